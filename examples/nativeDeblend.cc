@@ -0,0 +1,579 @@
+/*
+ * Run the baseline deblender on an exposure and its detections without
+ * python, e.g. for profiling the native code paths in isolation.
+ *
+ * Usage:
+ *     nativeDeblend [-j NTHREADS] [-c CONFIG] EXPOSURE SOURCES OUTPUT
+ *
+ * EXPOSURE is an ExposureF with a PSF, SOURCES a SourceCatalog with
+ * Footprints (as written by detection), and OUTPUT the deblended
+ * SourceCatalog, with the same deblend_* fields SourceDeblendTask adds.
+ * CONFIG is an optional SourceDeblendConfig written with Config.save();
+ * fields that do not apply to the native deblender are ignored, and
+ * weightTemplates or removeDegenerateTemplates, which it does not
+ * support, are an error.
+ * Parents are deblended on NTHREADS threads (default: all cores).
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "lsst/log/Log.h"
+#include "lsst/geom.h"
+#include "lsst/pex/exceptions.h"
+#include "lsst/afw/geom/SpanSet.h"
+#include "lsst/afw/image/Exposure.h"
+#include "lsst/afw/table/Source.h"
+#include "lsst/afw/table/aggregates.h"
+#include "lsst/meas/deblender/BaselineUtils.h"
+#include "lsst/meas/deblender/NativeDeblender.h"
+#include "lsst/meas/deblender/ParentScreen.h"
+#include "lsst/meas/deblender/PerfCounters.h"
+
+namespace image = lsst::afw::image;
+namespace det = lsst::afw::detection;
+namespace table = lsst::afw::table;
+namespace deblend = lsst::meas::deblender;
+namespace afwGeom = lsst::afw::geom;
+namespace geom = lsst::geom;
+
+typedef deblend::NativeDeblender<float> DeblenderT;
+
+namespace {
+
+LOG_LOGGER _log = LOG_GET("lsst.meas.deblender.nativeDeblend");
+
+std::string strip(std::string const& s) {
+    std::size_t const b = s.find_first_not_of(" \t\r\n");
+    if (b == std::string::npos) {
+        return "";
+    }
+    std::size_t const e = s.find_last_not_of(" \t\r\n");
+    return s.substr(b, e - b + 1);
+}
+
+std::string unquote(std::string const& s) {
+    std::string v = strip(s);
+    if (v.size() >= 2 && (v[0] == '\'' || v[0] == '"') && v[v.size() - 1] == v[0]) {
+        return v.substr(1, v.size() - 2);
+    }
+    if (v == "None") {
+        return "";
+    }
+    return v;
+}
+
+bool parseBool(std::string const& s) {
+    std::string const v = strip(s);
+    if (v == "True") {
+        return true;
+    }
+    if (v == "False") {
+        return false;
+    }
+    throw LSST_EXCEPT(lsst::pex::exceptions::InvalidParameterError, "Not a boolean: " + v);
+}
+
+// Split the items of a python list or dict literal at top-level commas.
+std::vector<std::string> splitItems(std::string const& s) {
+    std::string const v = strip(s);
+    std::vector<std::string> items;
+    if (v.size() < 2) {
+        return items;
+    }
+    std::string cur;
+    char quote = 0;
+    for (std::size_t i = 1; i + 1 < v.size(); ++i) {
+        char const c = v[i];
+        if (quote) {
+            if (c == quote) {
+                quote = 0;
+            }
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == ',') {
+            if (!strip(cur).empty()) {
+                items.push_back(strip(cur));
+            }
+            cur.clear();
+            continue;
+        }
+        cur += c;
+    }
+    if (!strip(cur).empty()) {
+        items.push_back(strip(cur));
+    }
+    return items;
+}
+
+/*
+ * Load the fields of a saved SourceDeblendConfig that the native
+ * deblender understands.  Config.save() writes one
+ * "config.<name>=<python literal>" assignment per field (lists and dicts
+ * on a single line), which is all we need to parse.
+ */
+void loadConfig(std::string const& filename, deblend::NativeDeblendControl & ctrl) {
+    typedef std::function<void(std::string const&)> Setter;
+    std::map<std::string, Setter> const setters = {
+        {"edgeHandling", [&](std::string const& v) { ctrl.edgeHandling = unquote(v); }},
+        {"strayFluxToPointSources", [&](std::string const& v) { ctrl.strayFluxToPointSources = unquote(v); }},
+        {"assignStrayFlux", [&](std::string const& v) { ctrl.assignStrayFlux = parseBool(v); }},
+        {"strayFluxRule", [&](std::string const& v) { ctrl.strayFluxRule = unquote(v); }},
+        {"clipStrayFluxFraction", [&](std::string const& v) { ctrl.clipStrayFluxFraction = std::stod(v); }},
+        {"psfChisq1", [&](std::string const& v) { ctrl.psfChisq1 = std::stod(v); }},
+        {"psfChisq2", [&](std::string const& v) { ctrl.psfChisq2 = std::stod(v); }},
+        {"psfChisq2b", [&](std::string const& v) { ctrl.psfChisq2b = std::stod(v); }},
+        {"maxNumberOfPeaks", [&](std::string const& v) { ctrl.maxNumberOfPeaks = std::stoi(v); }},
+        {"maxFootprintArea", [&](std::string const& v) { ctrl.maxFootprintArea = std::stoi(v); }},
+        {"maxFootprintSize", [&](std::string const& v) { ctrl.maxFootprintSize = std::stoi(v); }},
+        {"minFootprintAxisRatio", [&](std::string const& v) { ctrl.minFootprintAxisRatio = std::stod(v); }},
+        {"notDeblendedMask", [&](std::string const& v) { ctrl.notDeblendedMask = unquote(v); }},
+        {"tinyFootprintSize", [&](std::string const& v) { ctrl.tinyFootprintSize = std::stoi(v); }},
+        {"propagateAllPeaks", [&](std::string const& v) { ctrl.propagateAllPeaks = parseBool(v); }},
+        {"catchFailures", [&](std::string const& v) { ctrl.catchFailures = parseBool(v); }},
+        {"weightTemplates", [&](std::string const& v) { ctrl.weightTemplates = parseBool(v); }},
+        {"removeDegenerateTemplates",
+         [&](std::string const& v) { ctrl.removeDegenerateTemplates = parseBool(v); }},
+        {"medianSmoothTemplate", [&](std::string const& v) { ctrl.medianSmoothTemplate = parseBool(v); }},
+        {"medianFilterHalfsize", [&](std::string const& v) { ctrl.medianFilterHalfsize = std::stoi(v); }},
+        {"medianFilterMethod", [&](std::string const& v) { ctrl.medianFilterMethod = unquote(v); }},
+        {"tiledTemplateMinArea", [&](std::string const& v) { ctrl.tiledTemplateMinArea = std::stoi(v); }},
+        {"spanTemplateSum", [&](std::string const& v) { ctrl.spanTemplateSum = parseBool(v); }},
+        {"maskPlanes", [&](std::string const& v) {
+            ctrl.maskPlanes.clear();
+            for (std::string const& item : splitItems(v)) {
+                ctrl.maskPlanes.push_back(unquote(item));
+            }
+        }},
+        {"maskLimits", [&](std::string const& v) {
+            ctrl.maskLimits.clear();
+            for (std::string const& item : splitItems(v)) {
+                std::size_t const colon = item.rfind(':');
+                ctrl.maskLimits[unquote(item.substr(0, colon))] = std::stod(item.substr(colon + 1));
+            }
+        }},
+    };
+
+    std::ifstream in(filename);
+    if (!in) {
+        throw LSST_EXCEPT(lsst::pex::exceptions::IoError, "Cannot read config file " + filename);
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        line = strip(line);
+        if (line.compare(0, 7, "config.") != 0) {
+            continue;
+        }
+        std::size_t const eq = line.find('=');
+        if (eq == std::string::npos) {
+            continue;
+        }
+        std::string const name = strip(line.substr(7, eq - 7));
+        std::map<std::string, Setter>::const_iterator it = setters.find(name);
+        if (it == setters.end()) {
+            LOGL_DEBUG(_log, "Ignoring config field %s", name.c_str());
+            continue;
+        }
+        it->second(strip(line.substr(eq + 1)));
+    }
+}
+
+template <typename T>
+table::Key<T> getOrAddField(table::Schema & schema, std::string const& name, std::string const& doc,
+                            std::string const& units = "") {
+    if (schema.getNames().count(name)) {
+        return schema.find<T>(name).key;
+    }
+    return schema.addField<T>(name, doc, units);
+}
+
+template <typename T>
+table::PointKey<T> getOrAddPointKey(table::Schema & schema, std::string const& name, std::string const& doc,
+                                    std::string const& unit) {
+    if (schema.getNames().count(name + "_x")) {
+        return table::PointKey<T>(schema[name]);
+    }
+    return table::PointKey<T>::addFields(schema, name, doc, unit);
+}
+
+/*
+ * The fields SourceDeblendTask.addSchemaKeys adds to the source schema.
+ */
+struct DeblendKeys {
+    explicit DeblendKeys(table::Schema & schema, bool catchFailures) {
+        nChild = getOrAddField<int>(schema, "deblend_nChild",
+                                    "Number of children this object has (defaults to 0)");
+        psf = getOrAddField<table::Flag>(schema, "deblend_deblendedAsPsf",
+                                         "Deblender thought this source looked like a PSF");
+        psfCenter = getOrAddPointKey<double>(schema, "deblend_psfCenter",
+                                             "If deblended-as-psf, the PSF centroid", "pixel");
+        psfFlux = getOrAddField<double>(schema, "deblend_psf_instFlux",
+                                        "If deblended-as-psf, the instrumental PSF flux", "count");
+        tooManyPeaks = getOrAddField<table::Flag>(schema, "deblend_tooManyPeaks",
+                                                  "Source had too many peaks; "
+                                                  "only the brightest were included");
+        tooBig = getOrAddField<table::Flag>(schema, "deblend_parentTooBig",
+                                            "Parent footprint covered too many pixels");
+        masked = getOrAddField<table::Flag>(schema, "deblend_masked",
+                                            "Parent footprint was predominantly masked");
+        if (catchFailures) {
+            failed = getOrAddField<table::Flag>(schema, "deblend_failed", "Deblending failed on source");
+        }
+        skipped = getOrAddField<table::Flag>(schema, "deblend_skipped", "Deblender skipped this source");
+        ramped = getOrAddField<table::Flag>(schema, "deblend_rampedTemplate",
+                                            "This source was near an image edge and the deblender used "
+                                            "\"ramp\" edge-handling.");
+        patched = getOrAddField<table::Flag>(schema, "deblend_patchedTemplate",
+                                             "This source was near an image edge and the deblender used "
+                                             "\"patched\" edge-handling.");
+        hasStrayFlux = getOrAddField<table::Flag>(schema, "deblend_hasStrayFlux",
+                                                  "This source was assigned some stray flux");
+        peakCenter = getOrAddPointKey<int>(schema, "deblend_peak_center",
+                                           "Center used to apply constraints in scarlet", "pixel");
+        peakId = getOrAddField<int>(schema, "deblend_peakId",
+                                    "ID of the peak in the parent footprint. "
+                                    "This is not unique, but the combination of 'parent'"
+                                    "and 'peakId' should be for all child sources. "
+                                    "Top level blends with no parents have 'peakId=0'");
+        nPeaks = getOrAddField<int>(schema, "deblend_nPeaks",
+                                    "Number of initial peaks in the blend. "
+                                    "This includes peaks that may have been culled "
+                                    "during deblending or failed to deblend");
+        parentNPeaks = getOrAddField<int>(schema, "deblend_parentNPeaks",
+                                          "Same as deblend_n_peaks, but the number of peaks "
+                                          "in the parent footprint");
+        for (std::string const& name : schema.getNames(true)) {
+            if (name.compare(0, 15, "merge_footprint") == 0) {
+                toCopyFromParent.push_back(schema.find<table::Flag>(name).key);
+            }
+        }
+    }
+
+    table::Key<int> nChild;
+    table::Key<table::Flag> psf;
+    table::PointKey<double> psfCenter;
+    table::Key<double> psfFlux;
+    table::Key<table::Flag> tooManyPeaks;
+    table::Key<table::Flag> tooBig;
+    table::Key<table::Flag> masked;
+    table::Key<table::Flag> failed;
+    table::Key<table::Flag> skipped;
+    table::Key<table::Flag> ramped;
+    table::Key<table::Flag> patched;
+    table::Key<table::Flag> hasStrayFlux;
+    table::PointKey<int> peakCenter;
+    table::Key<int> peakId;
+    table::Key<int> nPeaks;
+    table::Key<int> parentNPeaks;
+    std::vector<table::Key<table::Flag>> toCopyFromParent;
+};
+
+// As SourceDeblendTask.skipParent; the spans to set in the
+// notDeblendedMask plane are added to *notDeblended*.
+void skipParent(table::SourceRecord & src, std::vector<afwGeom::Span> & notDeblended,
+                DeblendKeys const& keys) {
+    std::shared_ptr<det::Footprint> fp = src.getFootprint();
+    src.set(keys.skipped, true);
+    notDeblended.insert(notDeblended.end(), fp->getSpans()->begin(), fp->getSpans()->end());
+    geom::Box2I const bbox = fp->getBBox();
+    src.set(keys.peakCenter, geom::Point2I(static_cast<int>(bbox.getMinX() + bbox.getWidth()/2.),
+                                           static_cast<int>(bbox.getMinY() + bbox.getHeight()/2.)));
+    src.set(keys.nChild, 0);
+    src.set(keys.nPeaks, static_cast<int>(fp->getPeaks().size()));
+    src.set(keys.peakId, 0);
+    src.set(keys.parentNPeaks, 0);
+}
+
+void usage(char const* prog) {
+    std::cerr << "Usage: " << prog << " [-j NTHREADS] [-c CONFIG] [-p] EXPOSURE SOURCES OUTPUT" << std::endl;
+    std::cerr << "  -p  report the hardware performance counters of the deblending threads" << std::endl;
+}
+
+} // end anonymous namespace
+
+int main(int argc, char** argv) {
+    int nThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::string configFile;
+    bool perf = false;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        std::string const arg = argv[i];
+        if ((arg == "-j" || arg == "-c") && i + 1 < argc) {
+            if (arg == "-j") {
+                nThreads = std::max(1, std::atoi(argv[++i]));
+            } else {
+                configFile = argv[++i];
+            }
+        } else if (arg == "-p") {
+            perf = true;
+        } else if (arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return 0;
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if (args.size() != 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        deblend::NativeDeblendControl ctrl;
+        if (!configFile.empty()) {
+            loadConfig(configFile, ctrl);
+        }
+
+        image::ExposureF exposure(args[0]);
+        if (!exposure.getPsf()) {
+            throw LSST_EXCEPT(lsst::pex::exceptions::InvalidParameterError, "Exposure has no PSF");
+        }
+        table::SourceCatalog inCat = table::SourceCatalog::readFits(args[1]);
+
+        table::SchemaMapper mapper(inCat.getSchema());
+        mapper.addMinimalSchema(inCat.getSchema(), true);
+        DeblendKeys const keys(mapper.editOutputSchema(), ctrl.catchFailures);
+        // Children get IDs following the largest input ID, as the
+        // task's IdFactory would give them.
+        table::SourceCatalog srcs(table::SourceTable::make(mapper.getOutputSchema(),
+                                                           std::shared_ptr<table::IdFactory>()));
+        srcs.insert(mapper, srcs.end(), inCat.begin(), inCat.end());
+        table::RecordId maxId = 0;
+        for (table::SourceRecord const& src : srcs) {
+            maxId = std::max(maxId, src.getId());
+        }
+
+        image::MaskedImageF mi = exposure.getMaskedImage();
+        double const sigma1 = DeblenderT::estimateSigma1(mi, ctrl.maskPlanes);
+        DeblenderT const deblender(ctrl, mi, exposure.getPsf(), sigma1);
+        LOGL_INFO(_log, "Deblending %d sources on %d threads", static_cast<int>(srcs.size()), nThreads);
+
+        // Screen the catalog, so that only the parents to deblend are
+        // handed to the threads, the most expensive first...
+        std::size_t const n0 = srcs.size();
+        std::vector<DeblenderT::Result> results(n0);
+        deblend::ParentScreen const screen = deblend::screenParents(srcs, *mi.getMask(), nullptr, ctrl);
+        std::vector<std::size_t> order;
+        for (std::size_t i = 0; i < n0; ++i) {
+            switch (screen.reason[i]) {
+              case deblend::ParentScreen::NOT_BLENDED:
+                results[i].status = DeblenderT::Result::NOT_BLENDED;
+                break;
+              case deblend::ParentScreen::TOO_BIG:
+                results[i].status = DeblenderT::Result::TOO_BIG;
+                break;
+              case deblend::ParentScreen::MASKED:
+                results[i].status = DeblenderT::Result::MASKED;
+                break;
+              default:
+                order.push_back(i);
+            }
+        }
+        std::stable_sort(order.begin(), order.end(), [&screen](std::size_t a, std::size_t b) {
+            return screen.cost[a] > screen.cost[b];
+        });
+        LOGL_DEBUG(_log, "Prescreened %d sources: %d to deblend", static_cast<int>(n0),
+                   static_cast<int>(order.size()));
+
+        // ... deblend them in parallel...
+        // The first exception stops the threads and is rethrown once
+        // they have all finished, as in NativeDeblender::deblendMany.
+        std::atomic<std::size_t> next(0);
+        std::atomic<bool> stop(false);
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        std::mutex perfMutex;
+        deblend::PerfCounters::Counts perfTotals;
+        perfTotals.fill(0);
+        double perfPixels = 0;
+        bool perfAvailable = perf;
+        auto const t0 = std::chrono::steady_clock::now();
+        auto worker = [&]() {
+            // The counters count the events of the thread that opens them
+            std::unique_ptr<deblend::PerfCounters> counters;
+            deblend::PerfCounters::Counts start;
+            if (perf) {
+                counters.reset(new deblend::PerfCounters());
+                start = counters->read();
+            }
+            double pixels = 0;
+            for (std::size_t k = next++; !stop && k < order.size(); k = next++) {
+                std::size_t const i = order[k];
+                try {
+                    results[i] = deblender.deblend(*srcs[i].getFootprint());
+                    pixels += srcs[i].getFootprint()->getArea();
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                    stop = true;
+                }
+            }
+            if (counters) {
+                deblend::PerfCounters::Counts const end = counters->read();
+                std::lock_guard<std::mutex> lock(perfMutex);
+                perfAvailable = perfAvailable && counters->isAvailable();
+                for (int e = 0; e < deblend::PerfCounters::NEVENTS; ++e) {
+                    perfTotals[e] = (end[e] < 0 || start[e] < 0 || perfTotals[e] < 0) ? -1 :
+                                    perfTotals[e] + end[e] - start[e];
+                }
+                perfPixels += pixels;
+            }
+        };
+        std::vector<std::thread> threads;
+        for (int t = 1; t < nThreads; ++t) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (std::thread & t : threads) {
+            t.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        double const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (perf && !perfAvailable) {
+            LOGL_WARN(_log, "Performance counters are unavailable (see /proc/sys/kernel/perf_event_paranoid)");
+        } else if (perf) {
+            auto const perPixel = [&](deblend::PerfCounters::Event e) {
+                return (perfTotals[e] < 0 || perfPixels <= 0) ? -1.0 : perfTotals[e]/perfPixels;
+            };
+            double const ipc = (perfTotals[deblend::PerfCounters::CYCLES] > 0 &&
+                                perfTotals[deblend::PerfCounters::INSTRUCTIONS] >= 0) ?
+                static_cast<double>(perfTotals[deblend::PerfCounters::INSTRUCTIONS])/
+                perfTotals[deblend::PerfCounters::CYCLES] : -1.0;
+            LOGL_INFO(_log, "Performance counters over %.0f parent pixels: IPC %.2f, "
+                      "%.3g cache misses/pixel, %.3g branch misses/pixel (-1: unavailable)",
+                      perfPixels, ipc, perPixel(deblend::PerfCounters::CACHE_MISSES),
+                      perPixel(deblend::PerfCounters::BRANCH_MISSES));
+        }
+
+        // ... and assemble the catalog serially, in parent order.
+        int nparents = 0;
+        std::vector<afwGeom::Span> notDeblended;
+        for (std::size_t i = 0; i < n0; ++i) {
+            table::SourceRecord & src = srcs[i];
+            DeblenderT::Result const& res = results[i];
+            std::shared_ptr<det::Footprint> fp = src.getFootprint();
+            det::PeakCatalog const& pks = fp->getPeaks();
+            switch (res.status) {
+              case DeblenderT::Result::NOT_BLENDED:
+                continue;
+              case DeblenderT::Result::TOO_BIG:
+                src.set(keys.tooBig, true);
+                skipParent(src, notDeblended, keys);
+                continue;
+              case DeblenderT::Result::MASKED:
+                src.set(keys.masked, true);
+                skipParent(src, notDeblended, keys);
+                continue;
+              case DeblenderT::Result::BAD_PSF:
+                ++nparents;
+                LOGL_WARN(_log, "Unable to deblend source %lld: %s",
+                          static_cast<long long>(src.getId()), res.message.c_str());
+                src.set(keys.failed, true);
+                continue;
+              case DeblenderT::Result::FAILED:
+                ++nparents;
+                src.set(keys.tooManyPeaks, static_cast<int>(pks.size()) > ctrl.maxNumberOfPeaks);
+                LOGL_WARN(_log, "Unable to deblend source %lld: %s",
+                          static_cast<long long>(src.getId()), res.message.c_str());
+                src.set(keys.failed, true);
+                continue;
+              case DeblenderT::Result::DEBLENDED:
+                break;
+            }
+            ++nparents;
+            src.set(keys.tooManyPeaks, static_cast<int>(pks.size()) > ctrl.maxNumberOfPeaks);
+            if (ctrl.catchFailures) {
+                src.set(keys.failed, false);
+            }
+
+            std::vector<std::shared_ptr<table::SourceRecord>> kids;
+            for (std::size_t j = 0; j < res.peaks.size(); ++j) {
+                DeblenderT::Peak const& peak = res.peaks[j];
+                det::PeakRecord const& pk = pks[j];
+                DeblenderT::HeavyFootprintPtrT heavy = peak.heavy;
+                geom::Point2D psfCenter = peak.psfFitCenter;
+                if (!heavy || peak.skip) {
+                    src.set(keys.skipped, true);
+                    if (!ctrl.propagateAllPeaks) {
+                        continue;
+                    }
+                    if (!heavy) {
+                        // The parent's spans, holding only this peak
+                        heavy = deblend::BaselineUtils<float>::makePlaceholderFootprint(
+                                res.parentSpans, pks.get(j), fp->getRegion());
+                    }
+                    if (!peak.hasPsfFit) {
+                        psfCenter = geom::Point2D(pk.getIx(), pk.getIy());
+                    }
+                }
+
+                src.set(keys.skipped, false);
+                std::shared_ptr<table::SourceRecord> child = srcs.addNew();
+                child->setId(++maxId);
+                for (table::Key<table::Flag> const& key : keys.toCopyFromParent) {
+                    child->set(key, src.get(key));
+                }
+                child->setParent(src.getId());
+                child->setFootprint(heavy);
+                child->set(keys.psf, peak.deblendedAsPsf);
+                child->set(keys.hasStrayFlux, peak.hasStrayFlux);
+                if (peak.deblendedAsPsf) {
+                    child->set(keys.psfCenter, psfCenter);
+                    child->set(keys.psfFlux, peak.psfFitFlux);
+                }
+                child->set(keys.ramped, peak.rampedTemplate);
+                child->set(keys.patched, peak.patched);
+                child->set(keys.peakCenter, geom::Point2I(pk.getIx(), pk.getIy()));
+                child->set(keys.peakId, static_cast<int>(pk.getId()));
+                child->set(keys.nPeaks, 1);
+                child->set(keys.parentNPeaks, static_cast<int>(pks.size()));
+                kids.push_back(child);
+            }
+
+            // The parent footprint must contain the union of its
+            // children's footprints (see SourceDeblendTask.deblend).
+            std::shared_ptr<afwGeom::SpanSet> spans = res.parentSpans;
+            for (std::shared_ptr<table::SourceRecord> const& kid : kids) {
+                spans = spans->union_(*kid->getFootprint()->getSpans());
+            }
+            fp->setSpans(spans);
+            src.set(keys.nChild, static_cast<int>(kids.size()));
+        }
+        // Set the mask plane of all the skipped parents in one pass over
+        // their merged spans.
+        if (!ctrl.notDeblendedMask.empty() && !notDeblended.empty()) {
+            image::Mask<> & mask = *mi.getMask();
+            mask.addMaskPlane(ctrl.notDeblendedMask);
+            afwGeom::SpanSet(std::move(notDeblended)).setMask(mask,
+                                                              mask.getPlaneBitMask(ctrl.notDeblendedMask));
+        }
+
+        std::size_t const n1 = srcs.size();
+        LOGL_INFO(_log, "Deblended: of %d sources, %d were deblended, creating %d children, total %d sources "
+                  "(%.3f s)", static_cast<int>(n0), nparents, static_cast<int>(n1 - n0),
+                  static_cast<int>(n1), elapsed);
+
+        srcs.writeFits(args[2]);
+    } catch (std::exception const& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
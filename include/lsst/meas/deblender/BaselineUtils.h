@@ -3,6 +3,7 @@
 #define LSST_DEBLENDER_BASELINE_H
 //!
 
+#include <cstdint>
 #include <vector>
 #include <utility>
 
@@ -55,10 +56,41 @@ namespace lsst {
                              ImageT & outimg,
                              int halfsize);
 
+                static void
+                medianFilterTiled(ImageT const& img,
+                                  ImageT & outimg,
+                                  int halfsize);
+
+                static void
+                medianFilterSeparable(ImageT const& img,
+                                      ImageT & outimg,
+                                      int halfsize);
+
+                static void
+                medianFilterBatch(std::vector<ImagePtrT> const& imgs,
+                                  std::vector<ImagePtrT> const& outimgs,
+                                  int halfsize);
+
                 static void
                 makeMonotonic(ImageT & img,
                               lsst::afw::detection::PeakRecord const& pk);
 
+                static void
+                makeMonotonicTiled(ImageT & img,
+                                   lsst::afw::detection::PeakRecord const& pk);
+
+                static void
+                makeMonotonicBatch(std::vector<ImagePtrT> const& imgs,
+                                   std::vector<int> const& pkx,
+                                   std::vector<int> const& pky);
+
+                // medianFilterBatch and makeMonotonicBatch only interleave
+                // images of at most this many pixels on a side, and median
+                // windows of at most this halfsize; the rest are processed
+                // one at a time by medianFilter and makeMonotonic.
+                static const int LANE_BATCH_MAX_SIZE = 32;
+                static const int LANE_BATCH_MAX_HALFSIZE = 3;
+
                 static const int ASSIGN_STRAYFLUX                          = 0x1;
                 static const int STRAYFLUX_TO_POINT_SOURCES_WHEN_NECESSARY = 0x2;
                 static const int STRAYFLUX_TO_POINT_SOURCES_ALWAYS         = 0x4;
@@ -67,6 +99,11 @@ namespace lsst {
                 static const int STRAYFLUX_R_TO_FOOTPRINT                  = 0x8;
                 static const int STRAYFLUX_NEAREST_FOOTPRINT              = 0x10;
                 static const int STRAYFLUX_TRIM                           = 0x20;
+                // assign to the nearest peak, by distance within the footprint
+                static const int STRAYFLUX_NEAREST_PEAK                   = 0x40;
+                // sum the templates over their footprints only; requires
+                // template pixels outside the footprints to be <= 0
+                static const int TEMPLATE_SUM_BY_SPANS                    = 0x80;
 
                 // swig doesn't seem to understand std::vector<MaskedImagePtrT>...
                 static
@@ -97,12 +134,31 @@ namespace lsst {
                                          std::shared_ptr<lsst::afw::detection::Footprint>,
                                          ImagePixelT threshold);
 
+                static
+                HeavyFootprintPtrT
+                makeChildFootprint(lsst::afw::detection::Footprint const& foot,
+                                   MaskedImageT const& portion,
+                                   HeavyFootprintPtrT stray);
+
+                static
+                HeavyFootprintPtrT
+                makePlaceholderFootprint(std::shared_ptr<lsst::afw::geom::SpanSet> spans,
+                                         std::shared_ptr<lsst::afw::detection::PeakRecord> peak,
+                                         lsst::geom::Box2I const& region=lsst::geom::Box2I());
+
 
                 static
                 void
                 _sum_templates(std::vector<ImagePtrT> timgs,
                                ImagePtrT tsum);
 
+                static
+                void
+                _sum_templates_by_spans(std::vector<ImagePtrT> timgs,
+                                        std::vector<std::shared_ptr<lsst::afw::detection::Footprint> > tfoots,
+                                        ImagePtrT tsum,
+                                        std::shared_ptr<lsst::afw::image::Image<std::uint16_t> > coverage);
+
                 static
                 void
                 _find_stray_flux(lsst::afw::detection::Footprint const& foot,
@@ -114,7 +170,8 @@ namespace lsst {
                              std::vector<int>  const& pkx,
                              std::vector<int>  const& pky,
                              double clipStrayFluxFraction,
-                             std::vector<std::shared_ptr<typename lsst::afw::detection::HeavyFootprint<ImagePixelT,MaskPixelT,VariancePixelT> > > & strays);
+                             std::vector<std::shared_ptr<typename lsst::afw::detection::HeavyFootprint<ImagePixelT,MaskPixelT,VariancePixelT> > > & strays,
+                             std::shared_ptr<lsst::afw::image::Image<std::uint16_t> > coverage=nullptr);
 
             };
         }
@@ -0,0 +1,72 @@
+// -*- LSST-C++ -*-
+#if !defined(LSST_DEBLENDER_LANEIMAGE_H)
+#define LSST_DEBLENDER_LANEIMAGE_H
+//!
+
+#include <cstddef>
+#include <vector>
+
+#include "lsst/afw/image/Image.h"
+
+namespace lsst {
+    namespace meas {
+        namespace deblender {
+
+            /**
+             The pixels (x, y) of the LANES images of a LaneImage.
+             */
+            template <typename PixelT>
+            struct LanePixel {
+                static int const LANES = 8;
+                PixelT v[LANES];
+            };
+
+            /**
+             Up to LANES images of the same dimensions stored side by
+             side: the pixels (x, y) of all the images are contiguous,
+             in one LanePixel.  An algorithm written for one image whose
+             steps do not depend on the pixel values (the window of a
+             median filter, the rings of makeMonotonic around the same
+             peak offset) processes all of them at once, each step a
+             loop over the lanes that the compiler vectorizes.
+
+             Pixels are addressed as in Image::operator(), by their
+             position relative to the image origin.
+             */
+            template <typename PixelT>
+            class LaneImage {
+            public:
+                typedef LanePixel<PixelT> Pixel;
+                static int const LANES = Pixel::LANES;
+
+                LaneImage(int width, int height);
+
+                int getWidth() const { return _width; }
+                int getHeight() const { return _height; }
+
+                Pixel & operator()(int x, int y) { return _pixels[static_cast<std::size_t>(y)*_width + x]; }
+                Pixel const& operator()(int x, int y) const {
+                    return _pixels[static_cast<std::size_t>(y)*_width + x];
+                }
+
+                /// Copy the pixels of *other*, which must have the same dimensions.
+                void assign(LaneImage const& other) { _pixels = other._pixels; }
+
+                /// Copy *img*, which must have the same dimensions, into lane *lane*.
+                void load(lsst::afw::image::Image<PixelT> const& img, int lane);
+
+                /// Copy lane *lane* back to *img*, which must have the same dimensions.
+                void copyTo(lsst::afw::image::Image<PixelT> & img, int lane) const;
+
+            private:
+                void _checkDimensions(lsst::afw::image::Image<PixelT> const& img, int lane) const;
+
+                int _width;
+                int _height;
+                std::vector<Pixel> _pixels;
+            };
+        }
+    }
+}
+
+#endif
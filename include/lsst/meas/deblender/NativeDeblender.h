@@ -0,0 +1,226 @@
+// -*- LSST-C++ -*-
+#if !defined(LSST_DEBLENDER_NATIVEDEBLENDER_H)
+#define LSST_DEBLENDER_NATIVEDEBLENDER_H
+//!
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "lsst/pex/config.h"
+#include "lsst/geom.h"
+#include "lsst/afw/image/MaskedImage.h"
+#include "lsst/afw/detection/Footprint.h"
+#include "lsst/afw/detection/HeavyFootprint.h"
+#include "lsst/afw/detection/Psf.h"
+
+namespace lsst {
+    namespace meas {
+        namespace deblender {
+
+            /**
+             Configuration of the native baseline deblender.  The fields
+             and their defaults mirror the python SourceDeblendConfig, so
+             a saved SourceDeblendConfig can be loaded into it.
+             */
+            class NativeDeblendControl {
+            public:
+                LSST_CONTROL_FIELD(edgeHandling, std::string,
+                                   "What to do when a peak is close to the edge: 'clip', 'ramp' or 'noclip'");
+                LSST_CONTROL_FIELD(strayFluxToPointSources, std::string,
+                                   "When to attribute stray flux to point sources: "
+                                   "'necessary', 'always' or 'never'");
+                LSST_CONTROL_FIELD(assignStrayFlux, bool,
+                                   "Assign stray flux (not claimed by any child) to deblend children");
+                LSST_CONTROL_FIELD(strayFluxRule, std::string,
+                                   "How to split stray flux among peaks: 'r-to-peak', 'r-to-footprint', "
+                                   "'nearest-footprint', 'nearest-peak' or 'trim'");
+                LSST_CONTROL_FIELD(clipStrayFluxFraction, double,
+                                   "When splitting stray flux, clip fractions below this value to zero");
+                LSST_CONTROL_FIELD(psfChisq1, double,
+                                   "Chi-squared per DOF cut for deciding a source is a PSF (un-shifted model)");
+                LSST_CONTROL_FIELD(psfChisq2, double,
+                                   "Chi-squared per DOF cut for deciding a source is a PSF (shifted model)");
+                LSST_CONTROL_FIELD(psfChisq2b, double,
+                                   "Chi-squared per DOF cut for deciding a source is a PSF (shifted model #2)");
+                LSST_CONTROL_FIELD(maxNumberOfPeaks, int,
+                                   "Only deblend the brightest maxNumberOfPeaks peaks (<= 0: unlimited)");
+                LSST_CONTROL_FIELD(maxFootprintArea, int,
+                                   "Maximum area for footprints before they are ignored as large");
+                LSST_CONTROL_FIELD(maxFootprintSize, int,
+                                   "Maximum linear dimension for footprints before they are ignored as large");
+                LSST_CONTROL_FIELD(minFootprintAxisRatio, double,
+                                   "Minimum axis ratio for footprints before they are ignored as large");
+                LSST_CONTROL_FIELD(notDeblendedMask, std::string,
+                                   "Mask name for footprints not deblended, or empty for none");
+                LSST_CONTROL_FIELD(tinyFootprintSize, int,
+                                   "Footprints smaller in width or height than this value will be ignored");
+                LSST_CONTROL_FIELD(propagateAllPeaks, bool,
+                                   "Guarantee that all peaks produce a child source");
+                LSST_CONTROL_FIELD(catchFailures, bool,
+                                   "Catch exceptions thrown by the deblender and flag the parent");
+                LSST_CONTROL_FIELD(maskPlanes, std::vector<std::string>,
+                                   "Mask planes to ignore when performing statistics");
+                LSST_CONTROL_FIELD(weightTemplates, bool,
+                                   "Least-squares fit the templates to the image (not supported natively: "
+                                   "the deblender throws if set)");
+                LSST_CONTROL_FIELD(removeDegenerateTemplates, bool,
+                                   "Try to remove similar templates (not supported natively: the deblender "
+                                   "throws if set)");
+                LSST_CONTROL_FIELD(medianSmoothTemplate, bool,
+                                   "Apply a smoothing filter to all of the template images");
+                LSST_CONTROL_FIELD(medianFilterHalfsize, int,
+                                   "Half the box size of the template median filter");
+                LSST_CONTROL_FIELD(medianFilterMethod, std::string,
+                                   "How to median-filter the templates: 'exact' or 'separable'");
+                LSST_CONTROL_FIELD(tiledTemplateMinArea, int,
+                                   "Process templates of at least this many pixels in a tiled copy (0: never)");
+                LSST_CONTROL_FIELD(spanTemplateSum, bool,
+                                   "Sum the templates over their clipped footprints only");
+                LSST_CONTROL_FIELD(numaPlacement, bool,
+                                   "In deblendMany, bind the threads to NUMA nodes and deblend each "
+                                   "parent on the node holding its rows");
+
+                // Mask planes with the corresponding limit on the fraction
+                // of masked pixels (pex_config controls have no dict fields).
+                std::map<std::string, double> maskLimits;
+
+                NativeDeblendControl();
+            };
+
+            /**
+             Runs the baseline deblender chain (PSF classification,
+             symmetric templates, edge ramping, median smoothing,
+             monotonic templates, clipping and flux apportionment) on
+             parent Footprints entirely in C++.
+
+             A NativeDeblender holds the exposure-level inputs; deblend()
+             may be called concurrently from several threads.
+             */
+            template <typename ImagePixelT,
+                      typename MaskPixelT=lsst::afw::image::MaskPixel,
+                      typename VariancePixelT=lsst::afw::image::VariancePixel>
+            class NativeDeblender {
+
+            public:
+                typedef typename lsst::afw::image::MaskedImage<ImagePixelT, MaskPixelT, VariancePixelT> MaskedImageT;
+                typedef typename lsst::afw::image::Image<ImagePixelT> ImageT;
+                typedef typename std::shared_ptr<lsst::afw::image::Image<ImagePixelT>> ImagePtrT;
+                typedef typename lsst::afw::detection::HeavyFootprint<ImagePixelT, MaskPixelT, VariancePixelT> HeavyFootprintT;
+                typedef typename std::shared_ptr<HeavyFootprintT> HeavyFootprintPtrT;
+
+                /// Outcome for a single peak, mirroring the python DeblendedPeak.
+                struct Peak {
+                    // Flux portion plus stray flux, with the peak attached;
+                    // null when the peak could not be deblended.
+                    HeavyFootprintPtrT heavy;
+                    bool skip = false;
+                    bool deblendedAsPsf = false;
+                    bool hasPsfFit = false;
+                    double psfFitFlux = 0.0;
+                    lsst::geom::Point2D psfFitCenter;
+                    bool hasStrayFlux = false;
+                    bool rampedTemplate = false;
+                    bool patched = false;
+                };
+
+                /// Outcome for a parent Footprint.
+                struct Result {
+                    enum Status {
+                        NOT_BLENDED,    // fewer than two peaks
+                        TOO_BIG,        // isLargeFootprint
+                        MASKED,         // violates the mask limits
+                        BAD_PSF,        // PSF FWHM is not positive
+                        FAILED,         // an exception was caught
+                        DEBLENDED
+                    };
+                    Status status = NOT_BLENDED;
+                    std::string message;
+                    double psfFwhm = 0.0;
+                    // Parent spans after deblending ("trim" may shrink them).
+                    std::shared_ptr<lsst::afw::geom::SpanSet> parentSpans;
+                    std::vector<Peak> peaks;
+                };
+
+                NativeDeblender(NativeDeblendControl const& ctrl,
+                                MaskedImageT const& mimg,
+                                std::shared_ptr<lsst::afw::detection::Psf const> psf,
+                                double sigma1);
+
+                /// Deblend one parent; safe to call from several threads.
+                Result deblend(lsst::afw::detection::Footprint const& parent) const;
+
+                /// Deblend many parents on an internal pool of *nThreads*
+                /// threads (<= 0: one per core); results in input order,
+                /// bit-for-bit those of deblend() for any *nThreads*.
+                std::vector<Result>
+                deblendMany(std::vector<std::shared_ptr<lsst::afw::detection::Footprint>> const& parents,
+                            int nThreads=0) const;
+
+                /// Median sigma of the variance plane, ignoring *maskPlanes*.
+                static double estimateSigma1(MaskedImageT const& mimg,
+                                             std::vector<std::string> const& maskPlanes);
+
+                bool isLargeFootprint(lsst::afw::detection::Footprint const& foot) const;
+                bool isMasked(lsst::afw::detection::Footprint const& foot) const;
+
+                NativeDeblendControl const& getControl() const { return _ctrl; }
+                double getSigma1() const { return _sigma1; }
+
+            private:
+                typedef lsst::afw::detection::Psf::Image PsfImageT;
+                typedef std::map<std::pair<double, double>, std::shared_ptr<PsfImageT>> PsfCacheT;
+
+                struct PeakState;
+
+                std::shared_ptr<PsfImageT> _computePsfImage(lsst::geom::Point2D const& pos) const;
+                std::shared_ptr<PsfImageT> _cachedPsfImage(PsfCacheT & cache, double cx, double cy) const;
+                double _computePsfFwhm(lsst::geom::Point2D const& pos) const;
+
+                bool _fitPsf(lsst::afw::detection::Footprint const& fp,
+                             lsst::afw::image::Mask<MaskPixelT> const& fmask,
+                             int pki,
+                             std::vector<lsst::geom::Point2D> const& peakF,
+                             PeakState & pkres,
+                             PsfCacheT & psfCache,
+                             double psffwhm) const;
+
+                std::pair<ImagePtrT, std::shared_ptr<lsst::afw::detection::Footprint>>
+                _handleFluxAtEdge(double psffwhm,
+                                  ImagePtrT t1,
+                                  std::shared_ptr<lsst::afw::detection::Footprint> tfoot,
+                                  lsst::afw::detection::Footprint const& fp,
+                                  lsst::afw::detection::PeakRecord const& pk,
+                                  bool patchEdges,
+                                  bool* patched) const;
+
+                void _deblendPeaks(lsst::afw::detection::Footprint const& parent,
+                                   double psffwhm,
+                                   Result & result) const;
+
+                NativeDeblendControl _ctrl;
+                MaskedImageT _mimg;
+                std::shared_ptr<lsst::afw::detection::Psf const> _psf;
+                double _sigma1;
+                // afw Psf implementations cache their images internally,
+                // so access from worker threads is serialized.
+                mutable std::mutex _psfMutex;
+            };
+
+            /**
+             Clips the given Footprint *foot* to the region in *img*
+             containing non-zero values, as clipFootprintToNonzeroImpl
+             does in python: spans that are totally zero are dropped and
+             endpoints are moved to non-zero pixels, but spans are not
+             split at internal zeros.
+             */
+            template <typename ImagePixelT>
+            void clipFootprintToNonzero(lsst::afw::detection::Footprint & foot,
+                                        lsst::afw::image::Image<ImagePixelT> const& img);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,67 @@
+// -*- LSST-C++ -*-
+#if !defined(LSST_DEBLENDER_PARENTSCREEN_H)
+#define LSST_DEBLENDER_PARENTSCREEN_H
+//!
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "ndarray.h"
+#include "lsst/afw/image/Mask.h"
+#include "lsst/afw/detection/Psf.h"
+#include "lsst/afw/table/Source.h"
+#include "lsst/meas/deblender/NativeDeblender.h"
+
+namespace lsst {
+    namespace meas {
+        namespace deblender {
+
+            /**
+             The decisions SourceDeblendTask makes about each parent before
+             deblending it, computed for a whole catalog in one pass, one
+             element per record.
+             */
+            struct ParentScreen {
+                enum Reason {
+                    DEBLEND = 0,        // to be deblended
+                    NOT_BLENDED = 1,    // fewer than two peaks
+                    TOO_BIG = 2,        // isLargeFootprint
+                    MASKED = 3,         // violates the mask limits
+                    BAD_PSF = 4         // PSF FWHM is not positive
+                };
+
+                ndarray::Array<int,1,1> reason;
+                // Number of peaks times the footprint area: proportional
+                // to the cost of building and apportioning the templates.
+                ndarray::Array<double,1,1> cost;
+                // Footprint centroid and the PSF FWHM there; the FWHM is
+                // only computed for parents to be deblended, NaN otherwise.
+                ndarray::Array<double,1,1> centroidX;
+                ndarray::Array<double,1,1> centroidY;
+                ndarray::Array<double,1,1> psfFwhm;
+            };
+
+            /**
+             Screen the parents in *srcs*, applying the checks of
+             SourceDeblendTask.isLargeFootprint and isMasked to *mask*
+             and computing the PSF FWHM of each parent to be deblended
+             (*psf* may be null to skip it).
+             */
+            ParentScreen screenParents(lsst::afw::table::SourceCatalog const& srcs,
+                                       lsst::afw::image::Mask<lsst::afw::image::MaskPixel> const& mask,
+                                       std::shared_ptr<lsst::afw::detection::Psf const> psf,
+                                       int maxFootprintArea,
+                                       int maxFootprintSize,
+                                       double minFootprintAxisRatio,
+                                       std::map<std::string, double> const& maskLimits);
+
+            ParentScreen screenParents(lsst::afw::table::SourceCatalog const& srcs,
+                                       lsst::afw::image::Mask<lsst::afw::image::MaskPixel> const& mask,
+                                       std::shared_ptr<lsst::afw::detection::Psf const> psf,
+                                       NativeDeblendControl const& ctrl);
+        }
+    }
+}
+
+#endif
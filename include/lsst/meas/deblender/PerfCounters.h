@@ -0,0 +1,63 @@
+// -*- LSST-C++ -*-
+#if !defined(LSST_DEBLENDER_PERFCOUNTERS_H)
+#define LSST_DEBLENDER_PERFCOUNTERS_H
+//!
+
+#include <array>
+#include <cstdint>
+
+namespace lsst {
+    namespace meas {
+        namespace deblender {
+
+            /**
+             Hardware performance counters of the calling thread, read
+             through Linux perf_event_open.
+
+             The counters are opened as one group, so the kernel
+             schedules them together and read() takes them atomically:
+             their ratios are exact even when the PMU is shared with other
+             events.  If the group was only counting part of the time, the
+             counts are scaled up to the whole time it was enabled.
+
+             Counters that cannot be opened (no kernel support, a
+             restrictive perf_event_paranoid setting or seccomp policy,
+             as is common in containers, or a non-Linux platform) read
+             as -1, as do all of them if the group was never scheduled;
+             isAvailable() tells whether any counter could be opened.
+             */
+            class PerfCounters {
+            public:
+                enum Event {
+                    CYCLES = 0,
+                    INSTRUCTIONS,
+                    CACHE_MISSES,
+                    BRANCH_MISSES,
+                    NEVENTS
+                };
+                typedef std::array<std::int64_t, NEVENTS> Counts;
+
+                /// Open the counters, enabled and counting from zero.
+                PerfCounters();
+                ~PerfCounters();
+
+                PerfCounters(PerfCounters const&) = delete;
+                PerfCounters& operator=(PerfCounters const&) = delete;
+
+                bool isAvailable() const;
+                bool hasEvent(Event event) const { return _fds[event] >= 0; }
+
+                /// Cumulative counts since construction (-1 where unavailable).
+                Counts read() const;
+
+            private:
+                std::array<int, NEVENTS> _fds;
+                // Position of each event in the group read from _leader
+                std::array<int, NEVENTS> _index;
+                int _leader;
+            };
+        }
+    }
+}
+
+#endif
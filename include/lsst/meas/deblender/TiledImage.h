@@ -0,0 +1,60 @@
+// -*- LSST-C++ -*-
+#if !defined(LSST_DEBLENDER_TILEDIMAGE_H)
+#define LSST_DEBLENDER_TILEDIMAGE_H
+//!
+
+#include <cstddef>
+#include <vector>
+
+#include "lsst/afw/image/Image.h"
+
+namespace lsst {
+    namespace meas {
+        namespace deblender {
+
+            /**
+             A copy of an Image stored in square tiles of TILE x TILE
+             pixels, each tile contiguous, so that neighbourhoods that
+             span several rows (median windows, the rings of
+             makeMonotonic) touch a few cache lines rather than one per
+             row.
+
+             Pixels are addressed as in Image::operator(), by their
+             position relative to the image origin.
+             */
+            template <typename PixelT>
+            class TiledImage {
+            public:
+                static int const TILE_SHIFT = 4;
+                static int const TILE = 1 << TILE_SHIFT;
+
+                explicit TiledImage(lsst::afw::image::Image<PixelT> const& img);
+
+                int getWidth() const { return _width; }
+                int getHeight() const { return _height; }
+
+                PixelT & operator()(int x, int y) { return _pixels[_index(x, y)]; }
+                PixelT const& operator()(int x, int y) const { return _pixels[_index(x, y)]; }
+
+                /// Copy the pixels of *other*, which must have the same dimensions.
+                void assign(TiledImage const& other) { _pixels = other._pixels; }
+
+                /// Copy the pixels back to *img*, which must have the same dimensions.
+                void copyTo(lsst::afw::image::Image<PixelT> & img) const;
+
+            private:
+                std::size_t _index(int x, int y) const {
+                    std::size_t const tile = static_cast<std::size_t>(y >> TILE_SHIFT)*_ntx + (x >> TILE_SHIFT);
+                    return (tile << (2*TILE_SHIFT)) + ((y & (TILE - 1)) << TILE_SHIFT) + (x & (TILE - 1));
+                }
+
+                int _width;
+                int _height;
+                std::size_t _ntx;
+                std::vector<PixelT> _pixels;
+            };
+        }
+    }
+}
+
+#endif
@@ -24,6 +24,17 @@
 """
 from .version import *
 from .baselineUtils import *
+from .parentScreen import *
+from .perfCounters import *
+from .nativeDeblender import *
+from .nativeBatch import *
 from .baseline import *
 from .plugins import *
 from .sourceDeblendTask import *
+from .distributed import *
+from .profiling import *
+from .export import *
+from .compression import *
+from .parentIndex import *
+from .metrics import *
+from .worker import *
@@ -23,16 +23,17 @@ __all__ = ["DEFAULT_PLUGINS", "DeblenderResult", "DeblendedParent", "MultiColorP
            "DeblendedPeak", "deblend", "newDeblend", "CachingPsf"]
 
 from collections import OrderedDict
+from contextlib import contextmanager, ExitStack
 import numpy as np
 
 import lsst.pex.exceptions
 import lsst.afw.image as afwImage
-import lsst.afw.detection as afwDet
 import lsst.geom as geom
 import lsst.afw.math as afwMath
 import lsst.utils.logging
 
 from . import plugins
+from .baselineUtils import BaselineUtilsF as bUtils
 
 DEFAULT_PLUGINS = [
     plugins.DeblenderPlugin(plugins.fitPsfs),
@@ -316,9 +317,15 @@ class DeblendedPeak:
 
         self.failedSymmetricTemplate = False
 
-        # The actual template Image and Footprint
-        self.templateImage = None
-        self.templateFootprint = None
+        # The actual template Image and Footprint, or the PsfTemplate
+        # they are computed from when first read
+        self._templateImage = None
+        self._templateFootprint = None
+        self._lazyTemplate = None
+        # DEBUG: the PsfTemplate of a peak deblended as a PSF, and its
+        # pixels once computed
+        self._psfTemplate = None
+        self._psfTemplatePixels = None
 
         # The flux assigned to this template -- a MaskedImage
         self.fluxPortion = None
@@ -355,6 +362,40 @@ class DeblendedPeak:
         chisq, dof = self.psfFitBest
         return dof
 
+    @property
+    def templateImage(self):
+        self._makeLazyTemplate()
+        return self._templateImage
+
+    @templateImage.setter
+    def templateImage(self, image):
+        # The footprint of a lazy template is kept, so the template is
+        # computed; use setTemplate to replace both without computing it.
+        self._makeLazyTemplate()
+        self._templateImage = image
+
+    @property
+    def templateFootprint(self):
+        self._makeLazyTemplate()
+        return self._templateFootprint
+
+    @templateFootprint.setter
+    def templateFootprint(self, footprint):
+        # As for templateImage
+        self._makeLazyTemplate()
+        self._templateFootprint = footprint
+
+    def _makeLazyTemplate(self):
+        if self._lazyTemplate is not None:
+            self._templateImage, self._templateFootprint = self._lazyTemplate.makeTemplate()
+            self._lazyTemplate = None
+
+    @property
+    def hasLazyTemplate(self):
+        """Whether the template pixels have yet to be computed.
+        """
+        return self._lazyTemplate is not None
+
     def getFluxPortion(self, strayFlux=True):
         """
         Return a HeavyFootprint containing the flux apportioned to this peak.
@@ -363,12 +404,8 @@ class DeblendedPeak:
         """
         if self.templateFootprint is None or self.fluxPortion is None:
             return None
-        heavy = afwDet.makeHeavyFootprint(self.templateFootprint, self.fluxPortion)
-        if strayFlux:
-            if self.strayFlux is not None:
-                heavy = afwDet.mergeHeavyFootprints(heavy, self.strayFlux)
-
-        return heavy
+        stray = self.strayFlux if strayFlux else None
+        return bUtils.makeChildFootprint(self.templateFootprint, self.fluxPortion, stray)
 
     def setStrayFlux(self, stray):
         self.strayFlux = stray
@@ -394,9 +431,35 @@ class DeblendedPeak:
     def setMedianFilteredTemplate(self, t, tfoot):
         self.medianFilteredTemplate = t.Factory(t, True)
 
-    def setPsfTemplate(self, tim, tfoot):
-        self.psfFootprint = afwDet.Footprint(tfoot)
-        self.psfTemplate = tim.Factory(tim, True)
+    def setPsfTemplate(self, psfTemplate):
+        """Use the `~lsst.meas.deblender.plugins.PsfTemplate`
+        ``psfTemplate`` as the template; its pixels are computed when the
+        template is first read.
+        """
+        self._lazyTemplate = psfTemplate
+        self._templateImage = None
+        self._templateFootprint = None
+        self._psfTemplate = psfTemplate
+        self._psfTemplatePixels = None
+
+    # DEBUG: the PSF template as fit, whatever later steps do to the
+    # template; computed on first access.
+    def _makePsfTemplatePixels(self):
+        if self._psfTemplatePixels is None:
+            self._psfTemplatePixels = self._psfTemplate.makeTemplate()
+        return self._psfTemplatePixels
+
+    @property
+    def psfTemplate(self):
+        if self._psfTemplate is None:
+            return None
+        return self._makePsfTemplatePixels()[0]
+
+    @property
+    def psfFootprint(self):
+        if self._psfTemplate is None:
+            return None
+        return self._makePsfTemplatePixels()[1]
 
     def setOutOfBounds(self):
         self.outOfBounds = True
@@ -424,8 +487,12 @@ class DeblendedPeak:
         self.skip = True
 
     def setTemplate(self, image, footprint):
-        self.templateImage = image
-        self.templateFootprint = footprint
+        """Replace the template image and footprint, discarding a lazy
+        template without computing it.
+        """
+        self._templateImage = image
+        self._templateFootprint = footprint
+        self._lazyTemplate = None
 
 
 def deblend(footprint, maskedImage, psf, psffwhm,
@@ -436,8 +503,9 @@ def deblend(footprint, maskedImage, psf, psffwhm,
             assignStrayFlux=True, strayFluxToPointSources='necessary', strayFluxAssignment='r-to-peak',
             rampFluxAtEdge=False, patchEdges=False, tinyFootprintSize=2,
             getTemplateSum=False, clipStrayFluxFraction=0.001, clipFootprintToNonzero=True,
-            removeDegenerateTemplates=False, maxTempDotProd=0.5
-            ):
+            removeDegenerateTemplates=False, maxTempDotProd=0.5, psfCache=None,
+            monitors=None, medianFilterMethod='exact', medianValidation=None, tiledMinArea=0,
+            spanTemplateSum=False):
     r"""Deblend a parent ``Footprint`` in a ``MaskedImageF``.
 
     Deblending assumes that ``footprint`` has multiple peaks, as it will still create a
@@ -596,6 +664,8 @@ def deblend(footprint, maskedImage, psf, psffwhm,
           minimum distance from the stray flux to footprint
         * ``nearest-footprint``: Stray flux is assigned to the footprint with lowest L-1 (Manhattan)
           distance to the stray flux
+        * ``nearest-peak``: Stray flux is assigned to the nearest peak, measured along paths within
+          the parent footprint
 
     rampFluxAtEdge: `bool`, optional
         If True then extend footprints with excessive flux on the edges as described above.
@@ -628,6 +698,27 @@ def deblend(footprint, maskedImage, psf, psffwhm,
         All dot products between templates greater than ``maxTempDotProduct`` will result in one
         of the templates removed. This parameter is only used when ``removeDegenerateTempaltes==True``.
         The default is 0.5.
+    psfCache: `CachingPsf`, optional
+        PSF model cache wrapping ``psf``, shared between calls so that PSF images computed for
+        one parent can be reused by the next (and by later runs on the same exposure).
+        The default is ``None``, which creates a new cache for this parent only.
+    monitors: `list`, optional
+        Objects with a ``stage(name)`` context manager, which is entered around
+        each deblender plugin (see `newDeblend`).
+    medianFilterMethod: `str`, optional
+        ``exact`` (default) for the 2-D box median filter, or ``separable``
+        for a row-then-column approximation whose cost per pixel grows only
+        linearly with ``medianFilterHalfsize``.
+    medianValidation: `plugins.MedianFilterValidation`, optional
+        Accumulates the deviation of an approximate median filter from the
+        exact one on a sample of templates.
+    tiledMinArea: `int`, optional
+        If positive, the exact median filter and the monotonic step work on a
+        tiled copy of templates of at least this many pixels; the results are
+        unchanged.  The default is 0, which disables tiling.
+    spanTemplateSum: `bool`, optional
+        If True and ``clipFootprintToNonzero`` is set, sum the templates over
+        their footprints only when apportioning the flux.
 
     Returns
     -------
@@ -645,15 +736,20 @@ def deblend(footprint, maskedImage, psf, psffwhm,
                                                   psfChisqCut1=psfChisqCut1,
                                                   psfChisqCut2=psfChisqCut2,
                                                   psfChisqCut2b=psfChisqCut2b,
-                                                  tinyFootprintSize=tinyFootprintSize))
+                                                  tinyFootprintSize=tinyFootprintSize,
+                                                  psfCache=psfCache))
     debPlugins.append(plugins.DeblenderPlugin(plugins.buildSymmetricTemplates, patchEdges=patchEdges))
     if rampFluxAtEdge:
         debPlugins.append(plugins.DeblenderPlugin(plugins.rampFluxAtEdge, patchEdges=patchEdges))
     if medianSmoothTemplate:
         debPlugins.append(plugins.DeblenderPlugin(plugins.medianSmoothTemplates,
-                                                  medianFilterHalfsize=medianFilterHalfsize))
+                                                  medianFilterHalfsize=medianFilterHalfsize,
+                                                  medianFilterMethod=medianFilterMethod,
+                                                  medianValidation=medianValidation,
+                                                  tiledMinArea=tiledMinArea))
     if monotonicTemplate:
-        debPlugins.append(plugins.DeblenderPlugin(plugins.makeTemplatesMonotonic))
+        debPlugins.append(plugins.DeblenderPlugin(plugins.makeTemplatesMonotonic,
+                                                  tiledMinArea=tiledMinArea))
     if clipFootprintToNonzero:
         debPlugins.append(plugins.DeblenderPlugin(plugins.clipFootprintsToNonzero))
     if weightTemplates:
@@ -671,15 +767,17 @@ def deblend(footprint, maskedImage, psf, psffwhm,
                                               assignStrayFlux=assignStrayFlux,
                                               strayFluxAssignment=strayFluxAssignment,
                                               strayFluxToPointSources=strayFluxToPointSources,
-                                              getTemplateSum=getTemplateSum))
+                                              getTemplateSum=getTemplateSum,
+                                              spanTemplateSum=spanTemplateSum and clipFootprintToNonzero))
 
-    debResult = newDeblend(debPlugins, footprint, maskedImage, psf, psffwhm, log, verbose, avgNoise)
+    debResult = newDeblend(debPlugins, footprint, maskedImage, psf, psffwhm, log, verbose, avgNoise,
+                           monitors=monitors)
 
     return debResult
 
 
 def newDeblend(debPlugins, footprint, mMaskedImage, psfs, psfFwhms,
-               log=None, verbose=False, avgNoise=None, maxNumberOfPeaks=0):
+               log=None, verbose=False, avgNoise=None, maxNumberOfPeaks=0, monitors=None):
     r"""Deblend a parent ``Footprint`` in a ``MaskedImageF``.
 
     Deblending assumes that ``footprint`` has multiple peaks, as it will still create a
@@ -718,6 +816,10 @@ def newDeblend(debPlugins, footprint, mMaskedImage, psfs, psfFwhms,
         If nonzero, the maximum number of peaks to deblend.
         If the total number of peaks is greater than ``maxNumberOfPeaks``,
         then only the first ``maxNumberOfPeaks`` sources are deblended.
+    monitors: `list`, optional
+        Objects with a ``stage(name)`` context manager, which is entered around
+        each plugin with the name of the plugin function, e.g. to attribute
+        profiling samples to plugins.
 
     Returns
     -------
@@ -745,7 +847,8 @@ def newDeblend(debPlugins, footprint, mMaskedImage, psfs, psfFwhms,
         # the result is flagged as `failed`
         # and the remaining steps are skipped
         if not debResult.failed:
-            reset = debPlugins[step].run(debResult, log)
+            with _monitorStage(monitors, debPlugins[step].func.__name__):
+                reset = debPlugins[step].run(debResult, log)
         else:
             log.warning("Skipping steps %s", debPlugins[step:])
             return debResult
@@ -757,6 +860,16 @@ def newDeblend(debPlugins, footprint, mMaskedImage, psfs, psfFwhms,
     return debResult
 
 
+@contextmanager
+def _monitorStage(monitors, name):
+    """Enter the ``stage(name)`` context of each of ``monitors``.
+    """
+    with ExitStack() as stack:
+        for monitor in monitors or ():
+            stack.enter_context(monitor.stage(name))
+        yield
+
+
 class CachingPsf:
     """Cache the PSF models
 
@@ -764,19 +877,33 @@ class CachingPsf:
     the one being fit.  This was turning out to be quite expensive in
     some cases.  Here, we cache the PSF models to bring the cost down
     closer to O(N) rather than O(N^2).
+
+    When the cache is shared by every parent on an exposure it can grow
+    large, so ``maxSize`` optionally bounds the number of PSF images kept;
+    the least recently used image is dropped first.  A non-positive
+    ``maxSize`` means no limit.
     """
 
-    def __init__(self, psf):
-        self.cache = {}
+    def __init__(self, psf, maxSize=0):
+        self.cache = OrderedDict()
         self.psf = psf
+        self.maxSize = maxSize
+        self.hits = 0
+        self.misses = 0
 
     def computeImage(self, cx, cy):
         im = self.cache.get((cx, cy), None)
         if im is not None:
+            self.hits += 1
+            if self.maxSize > 0:
+                self.cache.move_to_end((cx, cy))
             return im
+        self.misses += 1
         try:
             im = self.psf.computeImage(geom.Point2D(cx, cy))
         except lsst.pex.exceptions.Exception:
             im = self.psf.computeImage(self.psf.getAveragePosition())
         self.cache[(cx, cy)] = im
+        if self.maxSize > 0 and len(self.cache) > self.maxSize:
+            self.cache.popitem(last=False)
         return im
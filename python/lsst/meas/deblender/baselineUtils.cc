@@ -63,7 +63,13 @@ void declareBaselineUtils(py::module& mod, const std::string& suffix) {
         return py::make_tuple(result.first, result.second, patchedEdges);
     });
     cls.def_static("medianFilter", &Class::medianFilter, "img"_a, "outimg"_a, "halfsize"_a);
+    cls.def_static("medianFilterTiled", &Class::medianFilterTiled, "img"_a, "outimg"_a, "halfsize"_a);
+    cls.def_static("medianFilterSeparable", &Class::medianFilterSeparable, "img"_a, "outimg"_a,
+                   "halfsize"_a);
+    cls.def_static("medianFilterBatch", &Class::medianFilterBatch, "imgs"_a, "outimgs"_a, "halfsize"_a);
     cls.def_static("makeMonotonic", &Class::makeMonotonic, "img"_a, "pk"_a);
+    cls.def_static("makeMonotonicTiled", &Class::makeMonotonicTiled, "img"_a, "pk"_a);
+    cls.def_static("makeMonotonicBatch", &Class::makeMonotonicBatch, "imgs"_a, "pkx"_a, "pky"_a);
     // apportionFlux expects an empty vector containing HeavyFootprint pointers that is modified
     // in the function. But when a list is passed to pybind11 in place of the vector,
     // the changes are not passed back to python. So instead we create the vector in this lambda and
@@ -91,8 +97,13 @@ void declareBaselineUtils(py::module& mod, const std::string& suffix) {
                    "thresh"_a);
     cls.def_static("getSignificantEdgePixels", &Class::getSignificantEdgePixels, "img"_a, "sfoot"_a,
                    "thresh"_a);
+    cls.def_static("makeChildFootprint", &Class::makeChildFootprint, "foot"_a, "portion"_a, "stray"_a);
+    cls.def_static("makePlaceholderFootprint", &Class::makePlaceholderFootprint, "spans"_a, "peak"_a,
+                   "region"_a = lsst::geom::Box2I());
     // There appears to be an issue binding to a static const member of a templated type, so for now
     // we just use the values constants
+    cls.attr("LANE_BATCH_MAX_SIZE") = py::cast(Class::LANE_BATCH_MAX_SIZE);
+    cls.attr("LANE_BATCH_MAX_HALFSIZE") = py::cast(Class::LANE_BATCH_MAX_HALFSIZE);
     cls.attr("ASSIGN_STRAYFLUX") = py::cast(Class::ASSIGN_STRAYFLUX);
     cls.attr("STRAYFLUX_TO_POINT_SOURCES_WHEN_NECESSARY") =
             py::cast(Class::STRAYFLUX_TO_POINT_SOURCES_WHEN_NECESSARY);
@@ -100,6 +111,8 @@ void declareBaselineUtils(py::module& mod, const std::string& suffix) {
     cls.attr("STRAYFLUX_R_TO_FOOTPRINT") = py::cast(Class::STRAYFLUX_R_TO_FOOTPRINT);
     cls.attr("STRAYFLUX_NEAREST_FOOTPRINT") = py::cast(Class::STRAYFLUX_NEAREST_FOOTPRINT);
     cls.attr("STRAYFLUX_TRIM") = py::cast(Class::STRAYFLUX_TRIM);
+    cls.attr("STRAYFLUX_NEAREST_PEAK") = py::cast(Class::STRAYFLUX_NEAREST_PEAK);
+    cls.attr("TEMPLATE_SUM_BY_SPANS") = py::cast(Class::TEMPLATE_SUM_BY_SPANS);
 };
 
 }  // <anonymous>
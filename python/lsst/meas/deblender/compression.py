@@ -0,0 +1,263 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+__all__ = ['shuffleCompress', 'shuffleDecompress', 'runLengthEncode', 'runLengthDecode',
+           'CompressedHeavyFootprint', 'CompressedFootprintStore']
+
+import zlib
+
+import numpy as np
+
+import lsst.afw.detection as afwDet
+
+
+def shuffleCompress(array, level=1):
+    """Compress a numeric array losslessly.
+
+    The bytes are shuffled so that the n-th byte of every element is
+    stored together before deflating: the high bytes of nearby pixels
+    are often equal, which the codec then compresses well.
+
+    Parameters
+    ----------
+    array : `numpy.ndarray`
+        One-dimensional array to compress.
+    level : `int`, optional
+        zlib compression level; 1 is the fastest.
+
+    Returns
+    -------
+    data : `bytes`
+        Compressed array.
+    """
+    array = np.ascontiguousarray(array)
+    shuffled = array.view(np.uint8).reshape(-1, array.dtype.itemsize).T
+    return zlib.compress(shuffled.tobytes(), level)
+
+
+def shuffleDecompress(data, dtype, size):
+    """Inverse of `shuffleCompress`.
+
+    Parameters
+    ----------
+    data : `bytes`
+        Compressed array.
+    dtype : `numpy.dtype`
+        Type of the elements.
+    size : `int`
+        Number of elements.
+
+    Returns
+    -------
+    array : `numpy.ndarray`
+        Decompressed array.
+    """
+    dtype = np.dtype(dtype)
+    shuffled = np.frombuffer(zlib.decompress(data), dtype=np.uint8).reshape(dtype.itemsize, size)
+    return np.ascontiguousarray(shuffled.T).view(dtype).reshape(size)
+
+
+def runLengthEncode(array):
+    """Run-length encode an integer array, such as a mask.
+
+    Returns
+    -------
+    values : `numpy.ndarray`
+        Value of each run.
+    lengths : `numpy.ndarray`
+        Length of each run.
+    """
+    array = np.asarray(array)
+    if len(array) == 0:
+        return array[:0].copy(), np.zeros(0, dtype=np.int32)
+    starts = np.concatenate(([0], np.flatnonzero(array[1:] != array[:-1]) + 1))
+    lengths = np.diff(np.concatenate((starts, [len(array)]))).astype(np.int32)
+    return array[starts].copy(), lengths
+
+
+def runLengthDecode(values, lengths):
+    """Inverse of `runLengthEncode`.
+    """
+    return np.repeat(values, lengths)
+
+
+class CompressedHeavyFootprint:
+    """The pixels of a HeavyFootprint, held compressed.
+
+    The image and variance are compressed with `shuffleCompress` and the
+    mask is run-length encoded; the spans and peaks are kept in a plain
+    `lsst.afw.detection.Footprint`.
+
+    Parameters
+    ----------
+    heavy : `lsst.afw.detection.HeavyFootprintF`
+        Footprint to compress.
+    level : `int`, optional
+        zlib compression level.
+    """
+
+    def __init__(self, heavy, level=1):
+        self.footprint = afwDet.Footprint(heavy)
+        image = heavy.getImageArray()
+        mask = heavy.getMaskArray()
+        variance = heavy.getVarianceArray()
+        self.size = len(image)
+        self.rawBytes = image.nbytes + mask.nbytes + variance.nbytes
+        self._image = (image.dtype, shuffleCompress(image, level))
+        self._mask = runLengthEncode(mask)
+        self._variance = (variance.dtype, shuffleCompress(variance, level))
+
+    @property
+    def nbytes(self):
+        """Number of bytes used by the compressed pixels.
+        """
+        return (len(self._image[1]) + len(self._variance[1])
+                + self._mask[0].nbytes + self._mask[1].nbytes)
+
+    def decompress(self):
+        """Return the original HeavyFootprint.
+
+        Returns
+        -------
+        heavy : `lsst.afw.detection.HeavyFootprintF`
+            Footprint with the pixels restored.
+        """
+        heavy = afwDet.HeavyFootprintF(self.footprint)
+        heavy.getImageArray()[:] = shuffleDecompress(self._image[1], self._image[0], self.size)
+        heavy.getMaskArray()[:] = runLengthDecode(*self._mask)
+        heavy.getVarianceArray()[:] = shuffleDecompress(self._variance[1], self._variance[0], self.size)
+        return heavy
+
+
+class CompressedFootprintStore:
+    """Compressed pixels of the deblended children of a catalog.
+
+    `compress` replaces the HeavyFootprint of each child by a plain
+    Footprint with the same spans and peaks and keeps the pixels here;
+    `getFootprint` puts the HeavyFootprint back the first time a child
+    is accessed, and `restoreAll` does so for a whole catalog.  Tasks
+    that read child pixels, such as the noise replacer of the
+    measurement task, must only see restored children; `checkRestored`
+    raises if a catalog still has compressed children.
+
+    Parameters
+    ----------
+    level : `int`, optional
+        zlib compression level.
+    flagKey : `lsst.afw.table.Key`, optional
+        Flag set on the children whose pixels are held here, and cleared
+        when they are restored.
+    """
+
+    def __init__(self, level=1, flagKey=None):
+        self.level = level
+        self.flagKey = flagKey
+        self._footprints = {}
+        self.rawBytes = 0
+        self.compressedBytes = 0
+
+    def __len__(self):
+        return len(self._footprints)
+
+    def __contains__(self, sourceId):
+        return sourceId in self._footprints
+
+    def compress(self, catalog):
+        """Compress the pixels of all children in ``catalog``.
+
+        Parameters
+        ----------
+        catalog : `lsst.afw.table.SourceCatalog`
+            Deblended catalog; modified in place.
+
+        Returns
+        -------
+        nCompressed : `int`
+            Number of children compressed.
+        """
+        nCompressed = 0
+        for src in catalog:
+            if src.getParent() == 0:
+                continue
+            heavy = src.getFootprint()
+            if heavy is None or not heavy.isHeavy():
+                continue
+            compressed = CompressedHeavyFootprint(heavy, self.level)
+            self._footprints[src.getId()] = compressed
+            self.rawBytes += compressed.rawBytes
+            self.compressedBytes += compressed.nbytes
+            src.setFootprint(compressed.footprint)
+            if self.flagKey is not None:
+                src.set(self.flagKey, True)
+            nCompressed += 1
+        return nCompressed
+
+    def discard(self, sourceId):
+        """Drop the pixels held for ``sourceId``, e.g. when the child is
+        removed from its catalog.
+        """
+        compressed = self._footprints.pop(sourceId, None)
+        if compressed is not None:
+            self.rawBytes -= compressed.rawBytes
+            self.compressedBytes -= compressed.nbytes
+
+    def rename(self, sourceId, newId):
+        """Hold the pixels of ``sourceId``, if any, under ``newId``, for a
+        child whose ID is changed.
+        """
+        compressed = self._footprints.pop(sourceId, None)
+        if compressed is not None:
+            self._footprints[newId] = compressed
+
+    def getFootprint(self, src):
+        """Return the footprint of ``src``, restoring its HeavyFootprint
+        first if it is held here.
+        """
+        compressed = self._footprints.pop(src.getId(), None)
+        if compressed is not None:
+            src.setFootprint(compressed.decompress())
+            if self.flagKey is not None:
+                src.set(self.flagKey, False)
+            self.rawBytes -= compressed.rawBytes
+            self.compressedBytes -= compressed.nbytes
+        return src.getFootprint()
+
+    def restoreAll(self, catalog):
+        """Restore the HeavyFootprints of all children of ``catalog``
+        held here.
+        """
+        for src in catalog:
+            if src.getId() in self._footprints:
+                self.getFootprint(src)
+
+    def checkRestored(self, catalog):
+        """Raise if any child of ``catalog`` still has its pixels held
+        here.
+
+        Raises
+        ------
+        RuntimeError
+            Raised if some children have not been restored.
+        """
+        nHeld = sum(1 for src in catalog if src.getId() in self._footprints)
+        if nHeld:
+            raise RuntimeError("%d children still have their pixels compressed; restore them with "
+                               "restoreAll first" % nHeld)
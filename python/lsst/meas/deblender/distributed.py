@@ -0,0 +1,492 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+__all__ = ['RegionPartition', 'Transport', 'SocketTransport',
+           'DistributedSourceDeblendConfig', 'DistributedSourceDeblendTask', 'runLocal']
+
+import math
+import multiprocessing
+import multiprocessing.connection
+import os
+import shutil
+import tempfile
+import time
+import traceback
+from collections import defaultdict
+
+import lsst.pex.config as pexConfig
+import lsst.geom as geom
+import lsst.afw.image as afwImage
+import lsst.afw.table as afwTable
+
+from .sourceDeblendTask import SourceDeblendConfig, SourceDeblendTask
+
+
+class RegionPartition:
+    """Split a bounding box into a grid of regions, one per rank.
+
+    The grid shape is chosen so that the regions are as close to square
+    as possible.  Each parent is owned by the region containing the
+    centre of its bounding box; centres outside the box belong to the
+    nearest region.
+
+    Parameters
+    ----------
+    bbox : `lsst.geom.Box2I`
+        Bounding box to partition, e.g. that of the exposure.
+    nRegions : `int`
+        Number of regions.
+    """
+
+    def __init__(self, bbox, nRegions):
+        if nRegions < 1:
+            raise ValueError("nRegions must be positive, not %d" % nRegions)
+        self.bbox = geom.Box2I(bbox)
+        W, H = bbox.getWidth(), bbox.getHeight()
+        best = None
+        for nx in range(1, nRegions + 1):
+            if nRegions % nx:
+                continue
+            ny = nRegions // nx
+            aspect = abs(math.log((W/nx) / (H/ny)))
+            if best is None or aspect < best[0]:
+                best = (aspect, nx, ny)
+        _, self.nx, self.ny = best
+        self.xEdges = [bbox.getMinX() + (W*i)//self.nx for i in range(self.nx + 1)]
+        self.yEdges = [bbox.getMinY() + (H*i)//self.ny for i in range(self.ny + 1)]
+
+    def __len__(self):
+        return self.nx*self.ny
+
+    def getRegion(self, index):
+        """Return the bounding box of region ``index``.
+        """
+        ix, iy = index % self.nx, index // self.nx
+        return geom.Box2I(geom.Point2I(self.xEdges[ix], self.yEdges[iy]),
+                          geom.Point2I(self.xEdges[ix + 1] - 1, self.yEdges[iy + 1] - 1))
+
+    def regionOf(self, point):
+        """Return the index of the region containing ``point``.
+        """
+        x0, y0 = self.bbox.getMinX(), self.bbox.getMinY()
+        ix = int((point.getX() - x0)*self.nx // self.bbox.getWidth())
+        iy = int((point.getY() - y0)*self.ny // self.bbox.getHeight())
+        ix = min(max(ix, 0), self.nx - 1)
+        iy = min(max(iy, 0), self.ny - 1)
+        return iy*self.nx + ix
+
+    def ownerOf(self, bbox):
+        """Return the index of the region owning a parent with bounding box
+        ``bbox``.
+        """
+        return self.regionOf(geom.Box2D(bbox).getCenter())
+
+
+class Transport:
+    """Message passing between the ranks of a distributed deblend.
+
+    Rank 0 is the coordinator, which holds the exposure and catalog;
+    the other ranks are workers and only talk to the coordinator.
+    Messages are arbitrary picklable objects.
+    """
+
+    rank = 0
+    size = 1
+
+    def send(self, rank, obj):
+        raise NotImplementedError()
+
+    def recv(self, rank):
+        raise NotImplementedError()
+
+    def close(self):
+        pass
+
+
+class SocketTransport(Transport):
+    """Transport over `multiprocessing.connection` sockets.
+
+    The address is either the path of a Unix socket or a
+    ``(host, port)`` tuple for TCP, so the same code serves local
+    processes and separate nodes.  Use `listen` on the coordinator and
+    `connect` on the workers.
+
+    Parameters
+    ----------
+    rank : `int`
+        Rank of this process.
+    size : `int`
+        Total number of ranks.
+    connections : `dict` [`int`, `multiprocessing.connection.Connection`]
+        Connection to each rank this rank talks to.
+    """
+
+    def __init__(self, rank, size, connections):
+        self.rank = rank
+        self.size = size
+        self._connections = connections
+
+    @classmethod
+    def listen(cls, address, size, authkey=None):
+        """Create the coordinator (rank 0) end, waiting for all of the
+        ``size - 1`` workers to connect.
+        """
+        connections = {}
+        with multiprocessing.connection.Listener(address, authkey=authkey) as listener:
+            while len(connections) < size - 1:
+                conn = listener.accept()
+                rank = conn.recv()
+                if rank in connections or not 0 < rank < size:
+                    conn.close()
+                    raise RuntimeError("Unexpected connection from rank %s" % (rank,))
+                connections[rank] = conn
+        return cls(0, size, connections)
+
+    @classmethod
+    def connect(cls, address, rank, size, authkey=None, timeout=60.0):
+        """Create the worker end for ``rank``, retrying until the
+        coordinator is listening or ``timeout`` seconds have passed.
+        """
+        deadline = time.monotonic() + timeout
+        while True:
+            try:
+                conn = multiprocessing.connection.Client(address, authkey=authkey)
+                break
+            except (FileNotFoundError, ConnectionRefusedError):
+                if time.monotonic() > deadline:
+                    raise
+                time.sleep(0.05)
+        conn.send(rank)
+        return cls(rank, size, {0: conn})
+
+    def send(self, rank, obj):
+        self._connections[rank].send(obj)
+
+    def recv(self, rank):
+        return self._connections[rank].recv()
+
+    def close(self):
+        for conn in self._connections.values():
+            conn.close()
+        self._connections = {}
+
+
+class DistributedSourceDeblendConfig(SourceDeblendConfig):
+    haloPixels = pexConfig.Field(
+        dtype=int, default=0,
+        doc=("Minimum margin, in pixels, around each parent footprint that is sent to the rank "
+             "deblending it; the margin needed by 'ramp' edge handling is always included."))
+
+
+class DistributedSourceDeblendTask(SourceDeblendTask):
+    """Deblend the parents of an exposure on several processes or nodes.
+
+    The exposure is split into one region per rank of the transport
+    (see `RegionPartition`) and each parent is deblended by the rank
+    owning the centre of its bounding box.  A rank is sent only the
+    pixels its parents touch: its own parents' footprints plus the
+    halo the deblender reads around them, so the results are those of
+    `SourceDeblendTask`.  Children are gathered in parent order and
+    given IDs as a serial run would.
+
+    With no transport, or a transport of size one, this is
+    `SourceDeblendTask`.  The single-parent hooks are not called for
+    parents deblended by other ranks.
+
+    Parameters
+    ----------
+    schema : `lsst.afw.table.Schema`
+        As for `SourceDeblendTask`.
+    peakSchema : `lsst.afw.table.Schema`, optional
+        As for `SourceDeblendTask`.
+    transport : `Transport`, optional
+        Connection to the workers; this task runs on rank 0.
+    **kwargs
+        Additional keyword arguments passed to `SourceDeblendTask`.
+    """
+    ConfigClass = DistributedSourceDeblendConfig
+    _DefaultName = "sourceDeblend"
+
+    def __init__(self, schema, peakSchema=None, transport=None, **kwargs):
+        SourceDeblendTask.__init__(self, schema, peakSchema=peakSchema, **kwargs)
+        self.transport = transport
+        self._initializedTransport = None
+        self._seq = 0
+
+    def deblend(self, exposure, srcs, psf, sigma1=None):
+        """Deblend, distributing the parents over the ranks of
+        ``self.transport``.
+
+        Parameters are as for `SourceDeblendTask.deblend`.
+        """
+        transport = self.transport
+        if transport is None or transport.size < 2 or self.config.useCiLimits:
+            return SourceDeblendTask.deblend(self, exposure, srcs, psf, sigma1=sigma1)
+        if self.config.doStreamChildren:
+            raise RuntimeError("doStreamChildren is not supported when deblending on several ranks")
+
+        t0 = time.time()
+        self.log.info("Deblending %d sources on %d ranks", len(srcs), transport.size)
+        self._initWorkers(transport)
+
+        cache = self.getExposureCache(exposure, psf)
+        if sigma1 is None:
+            sigma1 = cache.sigma1
+        expBBox = exposure.getBBox()
+        partition = RegionPartition(expBBox, transport.size)
+
+        owned = defaultdict(list)
+        for i, src in enumerate(srcs):
+            owned[partition.ownerOf(src.getFootprint().getBBox())].append(i)
+
+        seq = self._nextSeq()
+        sent = []
+        results = {}
+        try:
+            # Send each worker its parents and the pixels they need...
+            jobs = {}
+            for rank in range(transport.size):
+                if not owned[rank]:
+                    continue
+                region = self._getRankBBox(srcs, owned[rank], expBBox, cache, psf)
+                if region.isEmpty():
+                    region = partition.getRegion(rank)
+                sub = exposure.Factory(exposure, region, afwImage.PARENT, True)
+                sub.setPsf(psf)
+                subSrcs = afwTable.SourceCatalog(srcs.table)
+                for i in owned[rank]:
+                    subSrcs.append(srcs[i])
+                core = geom.Box2I(partition.getRegion(rank))
+                core.clip(region)
+                self.log.debug("Rank %d: %d sources, region %s (%d pixels, %d outside its core)",
+                               rank, len(subSrcs), region, region.getArea(),
+                               region.getArea() - core.getArea())
+                if rank == 0:
+                    jobs[rank] = (sub, subSrcs.copy(deep=True))
+                else:
+                    transport.send(rank, ("deblend", seq, sub, subSrcs, sigma1))
+                    sent.append(rank)
+
+            # ... deblend our own region meanwhile...
+            if 0 in jobs:
+                sub, subSrcs = jobs[0]
+                SourceDeblendTask.deblend(self, sub, subSrcs, psf, sigma1=sigma1)
+                results[0] = subSrcs
+        finally:
+            # ... and gather the results: every reply, even if we failed,
+            # so that none is left queued for the next call.
+            replies = {rank: self._recvReply(transport, rank, seq) for rank in sent}
+        errors = ["Deblending failed on rank %d:\n%s" % (rank, reply[2])
+                  for rank, reply in replies.items() if reply[0] == "error"]
+        if errors:
+            raise RuntimeError("\n".join(errors))
+        for rank, reply in replies.items():
+            results[rank] = reply[2]
+
+        n0 = len(srcs)
+        parents = {}
+        kids = defaultdict(list)
+        for rank, result in results.items():
+            nOwned = len(owned[rank])
+            for k, i in enumerate(owned[rank]):
+                parents[i] = result[k]
+            for k in range(nOwned, len(result)):
+                kids[result[k].getParent()].append(result[k])
+
+        mask = exposure.getMaskedImage().getMask()
+        maskUpdates = self._makeMaskUpdates(mask)
+        for i in range(n0):
+            src = srcs[i]
+            spans = src.getFootprint().getSpans()
+            src.assign(parents[i])
+            self._rememberParentSpans(src, spans)
+            for kid in kids[src.getId()]:
+                child = srcs.addNew()
+                childId = child.getId()
+                child.assign(kid)
+                child.setId(childId)
+            if src.get(self.tooBigKey) or src.get(self.maskedKey):
+                self.skipParent(src, mask, maskUpdates)
+        if maskUpdates is not None:
+            maskUpdates.apply()
+
+        n1 = len(srcs)
+        self.log.info('Deblended: of %i sources, created %i children, total %i sources (%.1f s)',
+                      n0, n1 - n0, n1, time.time() - t0)
+
+    def stopWorkers(self):
+        """Tell the workers to exit and close the transport.
+        """
+        transport = self.transport
+        if transport is None:
+            return
+        seq = self._nextSeq()
+        for rank in range(1, transport.size):
+            transport.send(rank, ("stop", seq))
+        transport.close()
+        self.transport = None
+        self._initializedTransport = None
+
+    def _initWorkers(self, transport):
+        if self._initializedTransport is transport:
+            return
+        schemaCat = afwTable.BaseCatalog(self._inputSchema)
+        peakCat = afwTable.BaseCatalog(self._peakSchema) if self._peakSchema is not None else None
+        seq = self._nextSeq()
+        for rank in range(1, transport.size):
+            transport.send(rank, ("init", seq, self.config, schemaCat, peakCat))
+        replies = {rank: self._recvReply(transport, rank, seq) for rank in range(1, transport.size)}
+        errors = ["Initializing rank %d failed:\n%s" % (rank, reply[2])
+                  for rank, reply in replies.items() if reply[0] == "error"]
+        if errors:
+            raise RuntimeError("\n".join(errors))
+        self._initializedTransport = transport
+
+    def _nextSeq(self):
+        """Return the sequence number of the next request to the workers.
+        """
+        self._seq += 1
+        return self._seq
+
+    def _recvReply(self, transport, rank, seq):
+        """Receive the reply of ``rank`` to request ``seq``.
+
+        Replies to earlier requests, which an interrupted call may have
+        left queued, are discarded.
+        """
+        while True:
+            reply = transport.recv(rank)
+            if reply[1] == seq:
+                return reply
+            if reply[1] > seq:
+                raise RuntimeError("Rank %d replied to request %d while waiting for %d" %
+                                   (rank, reply[1], seq))
+            self.log.warning("Discarding the reply of rank %d to earlier request %d", rank, reply[1])
+
+    def _getRankBBox(self, srcs, indices, expBBox, cache, psf):
+        """Return the bounding box of the pixels needed to deblend
+        ``srcs[indices]``.
+
+        The "ramp" edge handling reads pixels up to about 1.5 PSF FWHM
+        beyond a parent's footprint.
+        """
+        bbox = geom.Box2I()
+        for i in indices:
+            fp = srcs[i].getFootprint()
+            fbb = fp.getBBox()
+            margin = self.config.haloPixels
+            if len(fp.getPeaks()) >= 2 and self.config.edgeHandling == 'ramp':
+                psf_fwhm = self._getCachedPsfFwhm(cache, psf, fp.getCentroid())
+                if psf_fwhm > 0:
+                    margin = max(margin, int((psf_fwhm*1.5 + 0.5)/2)*2 + 1)
+            fbb.grow(margin)
+            bbox.include(fbb)
+        bbox.clip(expBBox)
+        return bbox
+
+    @staticmethod
+    def runWorker(transport):
+        """Serve deblend requests from rank 0 until told to stop.
+
+        Every request carries a sequence number, which is echoed in its
+        reply; "stop" has no reply.
+
+        Parameters
+        ----------
+        transport : `Transport`
+            Connection to the coordinator.
+        """
+        task = None
+        while True:
+            msg = transport.recv(0)
+            kind, seq = msg[:2]
+            if kind == "stop":
+                break
+            try:
+                if kind == "init":
+                    config, schemaCat, peakCat = msg[2:]
+                    task = SourceDeblendTask(schema=schemaCat.schema,
+                                             peakSchema=peakCat.schema if peakCat is not None else None,
+                                             config=config)
+                    transport.send(0, ("ok", seq))
+                elif kind == "deblend":
+                    exposure, srcs, sigma1 = msg[2:]
+                    task.deblend(exposure, srcs, exposure.getPsf(), sigma1=sigma1)
+                    transport.send(0, ("result", seq, srcs))
+                else:
+                    raise RuntimeError("Unknown message %r" % (kind,))
+            except Exception:
+                transport.send(0, ("error", seq, traceback.format_exc()))
+
+
+def _runLocalWorker(address, rank, size, authkey):
+    transport = SocketTransport.connect(address, rank, size, authkey=authkey)
+    try:
+        DistributedSourceDeblendTask.runWorker(transport)
+    finally:
+        transport.close()
+
+
+def runLocal(task, exposure, srcs, nProcesses, address=None):
+    """Deblend with ``nProcesses - 1`` local worker processes standing in
+    for nodes.
+
+    Parameters
+    ----------
+    task : `DistributedSourceDeblendTask`
+        Task to run; its transport is replaced for the duration.
+    exposure : `lsst.afw.image.Exposure`
+        Exposure to deblend, with a PSF.
+    srcs : `lsst.afw.table.SourceCatalog`
+        Sources to deblend; children are appended.
+    nProcesses : `int`
+        Total number of ranks, including this process.
+    address : `str` or `tuple`, optional
+        Unix socket path or ``(host, port)`` to use; by default a Unix
+        socket in a temporary directory.
+    """
+    if nProcesses < 2:
+        task.transport = None
+        task.deblend(exposure, srcs, exposure.getPsf())
+        return
+    tmpdir = None
+    if address is None:
+        tmpdir = tempfile.mkdtemp(prefix="deblend-")
+        address = os.path.join(tmpdir, "socket")
+    authkey = os.urandom(16)
+    ctx = multiprocessing.get_context("spawn")
+    procs = [ctx.Process(target=_runLocalWorker, args=(address, rank, nProcesses, authkey))
+             for rank in range(1, nProcesses)]
+    for proc in procs:
+        proc.start()
+    try:
+        task.transport = SocketTransport.listen(address, nProcesses, authkey=authkey)
+        try:
+            task.deblend(exposure, srcs, exposure.getPsf())
+        finally:
+            task.stopWorkers()
+    finally:
+        for proc in procs:
+            proc.join(timeout=60)
+            if proc.is_alive():
+                proc.terminate()
+        if tmpdir is not None:
+            shutil.rmtree(tmpdir, ignore_errors=True)
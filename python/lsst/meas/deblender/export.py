@@ -0,0 +1,459 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+__all__ = ['writeChildColumns', 'ChildColumnFile', 'ChildStreamWriter', 'ChildStreamFile']
+
+import json
+import os
+import queue
+import struct
+import threading
+
+import numpy as np
+
+# File layout: MAGIC, the length of the header as a little-endian uint64,
+# the JSON header, then one buffer per column, each starting on an
+# ALIGNMENT-byte boundary so that it can be viewed in place.  A child
+# stream is a sequence of such blocks, each a multiple of ALIGNMENT
+# bytes long.
+MAGIC = b"DEBCHLD1"
+ALIGNMENT = 64
+VERSION = 1
+
+# Buffers holding the footprints of all children; row i owns
+# spans[spanOffset[i]:spanOffset[i] + nSpans[i]] and likewise for pixels.
+SPANS = "spans"
+PIXELS = "pixels"
+OFFSETS = {"spanOffset": SPANS, "pixelOffset": PIXELS}
+
+
+def _pad(n):
+    return -n % ALIGNMENT
+
+
+def _footprintArrays(footprints):
+    """Return the bounding box, span and pixel columns of ``footprints``.
+    """
+    n = len(footprints)
+    spanOffset = np.zeros(n, dtype=np.int64)
+    nSpans = np.zeros(n, dtype=np.int32)
+    pixelOffset = np.zeros(n, dtype=np.int64)
+    nPixels = np.zeros(n, dtype=np.int32)
+    bbox = np.zeros((n, 4), dtype=np.int32)
+    spanList = []
+    pixelList = []
+    nSpanTotal = 0
+    nPixelTotal = 0
+    for i, fp in enumerate(footprints):
+        box = fp.getBBox()
+        bbox[i] = (box.getMinX(), box.getMinY(), box.getWidth(), box.getHeight())
+        spans = np.array([(s.getY(), s.getX0(), s.getX1()) for s in fp.getSpans()],
+                         dtype=np.int32).reshape(-1, 3)
+        spanOffset[i] = nSpanTotal
+        nSpans[i] = len(spans)
+        nSpanTotal += len(spans)
+        spanList.append(spans)
+        if fp.isHeavy():
+            values = np.asarray(fp.getImageArray(), dtype=np.float32)
+            pixelOffset[i] = nPixelTotal
+            nPixels[i] = len(values)
+            nPixelTotal += len(values)
+            pixelList.append(values)
+    arrays = dict(bbox=bbox, spanOffset=spanOffset, nSpans=nSpans,
+                  pixelOffset=pixelOffset, nPixels=nPixels)
+    arrays[SPANS] = (np.concatenate(spanList) if spanList else np.zeros((0, 3), dtype=np.int32))
+    arrays[PIXELS] = (np.concatenate(pixelList) if pixelList else np.zeros(0, dtype=np.float32))
+    return arrays
+
+
+def _concatenateArrays(parts):
+    """Concatenate the columns of consecutive groups of rows, rebasing the
+    span and pixel offsets of each group onto the concatenated buffers.
+    """
+    arrays = {name: np.concatenate([part[name] for part in parts]) for name in parts[0]}
+    for name, buffer in OFFSETS.items():
+        if name not in arrays:
+            continue
+        base = 0
+        offsets = []
+        for part in parts:
+            offsets.append(part[name] + base)
+            base += len(part[buffer])
+        arrays[name] = np.concatenate(offsets)
+    return arrays
+
+
+def _encodeColumns(arrays, nRows):
+    """Return the bytes of a block holding ``arrays``.
+    """
+    entries = []
+    offset = 0
+    for name, array in arrays.items():
+        array = np.ascontiguousarray(array, dtype=array.dtype.newbyteorder("<"))
+        arrays[name] = array
+        entries.append({"name": name, "dtype": array.dtype.str, "shape": list(array.shape),
+                        "offset": offset})
+        offset += array.nbytes + _pad(array.nbytes)
+    header = json.dumps({"version": VERSION, "nRows": int(nRows), "columns": entries}).encode()
+    start = len(MAGIC) + 8 + len(header)
+    header += b" "*_pad(start)
+
+    chunks = [MAGIC, struct.pack("<Q", len(header)), header]
+    for entry in entries:
+        array = arrays[entry["name"]]
+        chunks.append(array.tobytes())
+        chunks.append(b"\0"*_pad(array.nbytes))
+    return b"".join(chunks)
+
+
+def writeChildColumns(filename, catalog, columns, pixels=True):
+    """Write the children in ``catalog`` to a columnar file.
+
+    Each column is stored as a contiguous little-endian array, so that
+    `ChildColumnFile` can memory-map the file and read any subset of
+    the columns without deserializing the catalog.
+
+    Parameters
+    ----------
+    filename : `str`
+        Name of the file to write.
+    catalog : `lsst.afw.table.SourceCatalog`
+        Catalog holding the parents and their children; only the
+        records with a nonzero parent are written.
+    columns : `dict` [`str`, `lsst.afw.table.Key` or `str`]
+        Column name and key (or field name) of each summary column.
+        ``id`` and ``parent`` are always written.
+    pixels : `bool`, optional
+        Also write the spans, bounding boxes and pixel values of the
+        child footprints.
+
+    Returns
+    -------
+    nRows : `int`
+        Number of children written.
+    """
+    if not catalog.isContiguous():
+        catalog = catalog.copy(deep=True)
+    isChild = catalog["parent"] != 0
+    children = catalog[isChild]
+
+    arrays = {"id": np.asarray(children["id"], dtype=np.int64),
+              "parent": np.asarray(children["parent"], dtype=np.int64)}
+    for name, key in columns.items():
+        arrays[name] = np.asarray(children[key])
+
+    if pixels:
+        compressed = "deblend_pixelsCompressed"
+        if compressed in catalog.schema.getNames() and np.any(children[compressed]):
+            raise RuntimeError("Cannot write the pixels of children whose pixels are held compressed; "
+                               "restore them first")
+        arrays.update(_footprintArrays([child.getFootprint() for child in children]))
+
+    with open(filename, "wb") as f:
+        f.write(_encodeColumns(arrays, len(children)))
+    return len(children)
+
+
+class ChildColumnFile:
+    """Read-only, memory-mapped view of a file written by
+    `writeChildColumns`.
+
+    Columns are returned as views into the mapped file, so only the
+    pages of the columns that are actually used are read.
+
+    Parameters
+    ----------
+    filename : `str`
+        Name of the file to read.
+    """
+
+    def __init__(self, filename):
+        self._open(np.memmap(filename, dtype=np.uint8, mode="r"), 0, filename)
+
+    @classmethod
+    def _fromBlock(cls, data, offset, filename):
+        self = cls.__new__(cls)
+        self._open(data, offset, filename)
+        return self
+
+    def _open(self, data, offset, filename):
+        self._data = data
+        if bytes(data[offset:offset + len(MAGIC)]) != MAGIC:
+            raise ValueError("%s is not a deblender child column file" % (filename,))
+        start = offset + len(MAGIC) + 8
+        headerLength, = struct.unpack("<Q", bytes(data[start - 8:start]))
+        header = json.loads(bytes(data[start:start + headerLength]).decode())
+        if header["version"] != VERSION:
+            raise ValueError("Unsupported child column file version %d" % (header["version"],))
+        self._start = start + headerLength
+        self.nRows = header["nRows"]
+        self._columns = {entry["name"]: entry for entry in header["columns"]}
+        # Offset of the end of this block in ``data``
+        self.end = self._start + max((entry["offset"] + self._nbytes(entry) + _pad(self._nbytes(entry))
+                                      for entry in header["columns"]), default=0)
+
+    @staticmethod
+    def _nbytes(entry):
+        return np.dtype(entry["dtype"]).itemsize*int(np.prod(entry["shape"]))
+
+    def __len__(self):
+        return self.nRows
+
+    def __contains__(self, name):
+        return name in self._columns
+
+    def getColumnNames(self):
+        """Return the names of the summary columns, in file order.
+        """
+        return [name for name in self._columns if name not in (SPANS, PIXELS)]
+
+    def __getitem__(self, name):
+        entry = self._columns[name]
+        dtype = np.dtype(entry["dtype"])
+        shape = tuple(entry["shape"])
+        begin = self._start + entry["offset"]
+        end = begin + self._nbytes(entry)
+        return self._data[begin:end].view(dtype).reshape(shape)
+
+    def getSpans(self, i):
+        """Return the spans of child ``i`` as an (N, 3) array of
+        ``y, x0, x1`` (inclusive).
+        """
+        begin = self["spanOffset"][i]
+        return self[SPANS][begin:begin + self["nSpans"][i]]
+
+    def getPixels(self, i):
+        """Return the pixel values of child ``i``, in span order.
+        """
+        begin = self["pixelOffset"][i]
+        return self[PIXELS][begin:begin + self["nPixels"][i]]
+
+    def getImage(self, i):
+        """Return the pixels of child ``i`` as an array over its
+        bounding box, zero outside of its footprint.
+        """
+        x0, y0, width, height = self["bbox"][i]
+        image = np.zeros((height, width), dtype=np.float32)
+        pixels = self.getPixels(i)
+        if len(pixels) == 0:
+            return image
+        n = 0
+        for y, xa, xb in self.getSpans(i):
+            image[y - y0, xa - x0:xb - x0 + 1] = pixels[n:n + xb - xa + 1]
+            n += xb - xa + 1
+        return image
+
+
+class ChildStreamWriter:
+    """Append the children of each deblended parent to a child stream
+    file on a background thread.
+
+    `append` copies the columns and footprints of the children it is
+    given and queues them; the thread groups them into blocks of at
+    least ``blockRows`` rows, in the order they were appended, each block
+    laid out as a `writeChildColumns` file.  At most ``maxQueued`` groups
+    of children wait to be written: `append` blocks beyond that, so the
+    memory held does not grow with the catalog.  Read the file with
+    `ChildStreamFile`; the blocks written so far can be read while the
+    stream is still being written.
+
+    Parameters
+    ----------
+    filename : `str`
+        Name of the file to write.
+    columns : `dict` [`str`, `lsst.afw.table.Key` or `str`]
+        Column name and key (or field name) of each summary column.
+        ``id`` and ``parent`` are always written.
+    pixels : `bool`, optional
+        Also write the spans, bounding boxes and pixel values of the
+        child footprints.
+    maxQueued : `int`, optional
+        Maximum number of `append` calls waiting to be written.
+    blockRows : `int`, optional
+        Minimum number of rows per block, but for the last one.
+    """
+
+    def __init__(self, filename, columns, pixels=True, maxQueued=64, blockRows=4096):
+        self.filename = filename
+        self.columns = dict(columns)
+        self.pixels = pixels
+        self.blockRows = blockRows
+        # Updated by the writer thread
+        self.nRows = 0
+        self.nBlocks = 0
+        self._queue = queue.Queue(max(1, maxQueued))
+        self._error = None
+        self._file = open(filename, "wb")
+        self._thread = threading.Thread(target=self._run, name="ChildStreamWriter", daemon=True)
+        self._thread.start()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def append(self, children):
+        """Queue ``children`` to be written.
+
+        Parameters
+        ----------
+        children : `list` of `lsst.afw.table.SourceRecord`
+            Children to write, e.g. those of one parent.
+        """
+        self._raiseError()
+        if self._thread is None:
+            raise RuntimeError("%s is closed" % (self.filename,))
+        if len(children) == 0:
+            return
+        arrays = {"id": np.array([child.getId() for child in children], dtype=np.int64),
+                  "parent": np.array([child.getParent() for child in children], dtype=np.int64)}
+        for name, key in self.columns.items():
+            arrays[name] = np.array([child.get(key) for child in children])
+        if self.pixels:
+            arrays.update(_footprintArrays([child.getFootprint() for child in children]))
+        self._queue.put(arrays)
+
+    def close(self):
+        """Write the queued children and close the file.
+
+        Returns
+        -------
+        nRows : `int`
+            Number of children written.
+        """
+        if self._thread is not None:
+            self._queue.put(None)
+            self._thread.join()
+            self._thread = None
+            self._file.close()
+        self._raiseError()
+        return self.nRows
+
+    def _raiseError(self):
+        if self._error is not None:
+            error, self._error = self._error, None
+            raise RuntimeError("Failed to write %s" % (self.filename,)) from error
+
+    def _run(self):
+        parts = []
+        nRows = 0
+        try:
+            while True:
+                arrays = self._queue.get()
+                if arrays is None:
+                    break
+                parts.append(arrays)
+                nRows += len(arrays["id"])
+                if nRows >= self.blockRows:
+                    self._writeBlock(parts, nRows)
+                    parts = []
+                    nRows = 0
+            if parts:
+                self._writeBlock(parts, nRows)
+        except Exception as e:
+            self._error = e
+            # Keep taking the queued children so that append never blocks
+            while self._queue.get() is not None:
+                pass
+
+    def _writeBlock(self, parts, nRows):
+        self._file.write(_encodeColumns(_concatenateArrays(parts), nRows))
+        self._file.flush()
+        self.nRows += nRows
+        self.nBlocks += 1
+
+
+class ChildStreamFile:
+    """Read-only, memory-mapped view of a file written by
+    `ChildStreamWriter`.
+
+    A block truncated by an interrupted writer is ignored.
+
+    Parameters
+    ----------
+    filename : `str`
+        Name of the file to read.
+    """
+
+    def __init__(self, filename):
+        data = np.memmap(filename, dtype=np.uint8, mode="r") if os.path.getsize(filename) > 0 else None
+        self.blocks = []
+        offset = 0
+        while data is not None and offset + len(MAGIC) + 8 <= len(data):
+            try:
+                block = ChildColumnFile._fromBlock(data, offset, filename)
+            except (ValueError, UnicodeDecodeError):
+                if not self.blocks:
+                    raise
+                break
+            if block.end > len(data):
+                break
+            self.blocks.append(block)
+            offset = block.end
+        self._rowStart = np.cumsum([0] + [len(block) for block in self.blocks])
+        self.nRows = int(self._rowStart[-1])
+
+    def __len__(self):
+        return self.nRows
+
+    def __contains__(self, name):
+        return bool(self.blocks) and name in self.blocks[0]
+
+    def getColumnNames(self):
+        """Return the names of the summary columns, in file order.
+        """
+        return self.blocks[0].getColumnNames() if self.blocks else []
+
+    def __getitem__(self, name):
+        """Return a column of all the blocks, concatenated (a copy).
+        """
+        if not self.blocks:
+            raise KeyError(name)
+        if name in OFFSETS:
+            # Offsets into the concatenated buffers
+            bases = np.cumsum([0] + [len(block[OFFSETS[name]]) for block in self.blocks[:-1]])
+            return np.concatenate([block[name] + base for block, base in zip(self.blocks, bases)])
+        return np.concatenate([block[name] for block in self.blocks])
+
+    def _locate(self, i):
+        if not 0 <= i < self.nRows:
+            raise IndexError("Row %d out of range for %d rows" % (i, self.nRows))
+        k = int(np.searchsorted(self._rowStart, i, side="right")) - 1
+        return self.blocks[k], i - int(self._rowStart[k])
+
+    def getSpans(self, i):
+        """Return the spans of child ``i``, as `ChildColumnFile.getSpans`.
+        """
+        block, j = self._locate(i)
+        return block.getSpans(j)
+
+    def getPixels(self, i):
+        """Return the pixel values of child ``i``, in span order.
+        """
+        block, j = self._locate(i)
+        return block.getPixels(j)
+
+    def getImage(self, i):
+        """Return the pixels of child ``i``, as `ChildColumnFile.getImage`.
+        """
+        block, j = self._locate(i)
+        return block.getImage(j)
@@ -0,0 +1,212 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+__all__ = ['DeblendMetrics']
+
+import bisect
+import os
+import resource
+import sys
+import tempfile
+import time
+from collections import Counter
+from contextlib import contextmanager
+
+
+class DeblendMetrics:
+    """Throughput, latency and failure metrics of the deblender, written
+    to a file in the Prometheus text exposition format.
+
+    The counters accumulate over the lifetime of the object, so that a
+    task that deblends many exposures exports monotonic counters as a
+    scraper expects.  `stage` makes this usable as a monitor for
+    `lsst.meas.deblender.baseline.newDeblend`, recording the latency of
+    each plugin in a histogram.  `update` rewrites the file at most
+    every ``interval`` seconds; the file is replaced atomically, so a
+    scraper never reads a partial file.
+
+    Parameters
+    ----------
+    filename : `str`
+        File to write, usually in the directory read by the node
+        exporter's text-file collector.
+    interval : `float`, optional
+        Minimum number of seconds between two writes in `update`.
+    buckets : `list` of `float`, optional
+        Upper bounds of the latency histogram buckets, in seconds.
+    """
+
+    SKIP_REASONS = ("tooBig", "masked", "deblendFailed", "psfFwhmInvalid")
+    DEFAULT_BUCKETS = (0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0,
+                       10.0, 30.0)
+
+    def __init__(self, filename, interval=10.0, buckets=None):
+        self.filename = filename
+        self.interval = interval
+        self.buckets = sorted(buckets if buckets is not None else self.DEFAULT_BUCKETS)
+        self.nParents = 0
+        self.nChildren = 0
+        self.skipped = Counter({reason: 0 for reason in self.SKIP_REASONS})
+        self.caches = {}
+        # stage name -> [bucket counts (the last for +Inf), sum, count]
+        self.stages = {}
+        self._runStart = None
+        self._runParents = 0
+        self._runChildren = 0
+        self._lastWrite = None
+
+    def startRun(self):
+        """Start timing a call to `SourceDeblendTask.deblend`; the
+        parents and children per second are rates over the current run.
+        """
+        self._runStart = time.monotonic()
+        self._runParents = 0
+        self._runChildren = 0
+
+    @contextmanager
+    def stage(self, name):
+        """Record the duration of this context in the histogram of
+        stage ``name``.
+        """
+        t0 = time.perf_counter()
+        try:
+            yield
+        finally:
+            self.observe(name, time.perf_counter() - t0)
+
+    def observe(self, name, seconds):
+        """Add a duration of ``seconds`` to the histogram of stage ``name``.
+        """
+        entry = self.stages.get(name)
+        if entry is None:
+            entry = self.stages[name] = [[0]*(len(self.buckets) + 1), 0.0, 0]
+        entry[0][bisect.bisect_left(self.buckets, seconds)] += 1
+        entry[1] += seconds
+        entry[2] += 1
+
+    def parentDeblended(self, nChildren):
+        """Count a deblended parent and its ``nChildren`` children.
+        """
+        self.nParents += 1
+        self.nChildren += nChildren
+        self._runParents += 1
+        self._runChildren += nChildren
+
+    def parentSkipped(self, reason):
+        """Count a parent that was not deblended because of ``reason``,
+        one of `SKIP_REASONS`.
+        """
+        self.skipped[reason] += 1
+
+    def setCache(self, name, hits, misses):
+        """Set the current number of hits and misses of cache ``name``.
+        """
+        self.caches[name] = (hits, misses)
+
+    def update(self, force=False):
+        """Write the file if ``interval`` seconds have passed since the
+        last write, or if ``force``.
+
+        Returns
+        -------
+        written : `bool`
+            Whether the file was written.
+        """
+        now = time.monotonic()
+        if not force and self._lastWrite is not None and now - self._lastWrite < self.interval:
+            return False
+        self.write()
+        self._lastWrite = now
+        return True
+
+    def write(self):
+        """Write the metrics to ``filename``.
+        """
+        directory = os.path.dirname(os.path.abspath(self.filename))
+        fd, tmpName = tempfile.mkstemp(dir=directory, prefix=".deblendMetrics")
+        try:
+            with os.fdopen(fd, "w") as f:
+                f.write(self.format())
+            # Readable by a scraper running as another user
+            os.chmod(tmpName, 0o644)
+            os.replace(tmpName, self.filename)
+        except BaseException:
+            os.unlink(tmpName)
+            raise
+
+    def format(self):
+        """Return the metrics in the Prometheus text format.
+        """
+        lines = []
+
+        def metric(name, kind, doc, samples):
+            lines.append("# HELP %s %s" % (name, doc))
+            lines.append("# TYPE %s %s" % (name, kind))
+            for labels, value in samples:
+                lines.append("%s%s %s" % (name, labels, _formatValue(value)))
+
+        metric("deblend_parents_total", "counter", "Parents deblended.", [("", self.nParents)])
+        metric("deblend_children_total", "counter", "Children created.", [("", self.nChildren)])
+        elapsed = time.monotonic() - self._runStart if self._runStart is not None else 0.0
+        metric("deblend_parents_per_second", "gauge", "Parents deblended per second in the current run.",
+               [("", self._runParents/elapsed if elapsed > 0 else 0.0)])
+        metric("deblend_children_per_second", "gauge", "Children created per second in the current run.",
+               [("", self._runChildren/elapsed if elapsed > 0 else 0.0)])
+        metric("deblend_parents_skipped_total", "counter", "Parents not deblended, by reason.",
+               [('{reason="%s"}' % reason, count) for reason, count in sorted(self.skipped.items())])
+
+        lines.append("# HELP deblend_stage_duration_seconds Duration of each deblender plugin.")
+        lines.append("# TYPE deblend_stage_duration_seconds histogram")
+        for name, (counts, total, count) in sorted(self.stages.items()):
+            cumulative = 0
+            for bound, n in zip(self.buckets + [float("inf")], counts):
+                cumulative += n
+                lines.append('deblend_stage_duration_seconds_bucket{stage="%s",le="%s"} %d'
+                             % (name, _formatValue(bound), cumulative))
+            lines.append('deblend_stage_duration_seconds_sum{stage="%s"} %s' % (name, _formatValue(total)))
+            lines.append('deblend_stage_duration_seconds_count{stage="%s"} %d' % (name, count))
+
+        metric("deblend_cache_hit_ratio", "gauge", "Fraction of cache lookups that hit.",
+               [('{cache="%s"}' % name, hits/(hits + misses) if hits + misses > 0 else 0.0)
+                for name, (hits, misses) in sorted(self.caches.items())])
+        metric("deblend_cache_lookups", "gauge", "Cache lookups since the exposure caches were built.",
+               [('{cache="%s"}' % name, hits + misses)
+                for name, (hits, misses) in sorted(self.caches.items())])
+
+        metric("deblend_peak_memory_bytes", "gauge", "Peak resident memory of the process.",
+               [("", _peakMemory())])
+        metric("deblend_last_update_timestamp_seconds", "gauge", "Time the file was written.",
+               [("", time.time())])
+        return "\n".join(lines) + "\n"
+
+
+def _formatValue(value):
+    if value == float("inf"):
+        return "+Inf"
+    if isinstance(value, int):
+        return "%d" % value
+    return repr(float(value))
+
+
+def _peakMemory():
+    maxrss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    # kilobytes on Linux, bytes on macOS
+    return maxrss if sys.platform == "darwin" else maxrss*1024
@@ -0,0 +1,117 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+__all__ = ['makeNativeControl', 'deblendMany', 'NativeDeblendedPeak', 'NativeDeblendResult']
+
+from .nativeDeblender import NativeDeblendControl, NativeDeblenderF
+
+# SourceDeblendConfig fields with the same name and meaning in
+# NativeDeblendControl
+_CONTROL_FIELDS = (
+    "edgeHandling", "strayFluxToPointSources", "assignStrayFlux", "strayFluxRule",
+    "clipStrayFluxFraction", "psfChisq1", "psfChisq2", "psfChisq2b", "maxNumberOfPeaks",
+    "maxFootprintArea", "maxFootprintSize", "minFootprintAxisRatio", "tinyFootprintSize",
+    "propagateAllPeaks", "catchFailures", "weightTemplates",
+    "removeDegenerateTemplates", "medianSmoothTemplate", "medianFilterHalfsize", "medianFilterMethod",
+    "tiledTemplateMinArea", "spanTemplateSum", "numaPlacement",
+)
+
+
+def makeNativeControl(config):
+    """Make the `NativeDeblendControl` equivalent to a
+    `SourceDeblendConfig`.
+    """
+    ctrl = NativeDeblendControl()
+    for name in _CONTROL_FIELDS:
+        setattr(ctrl, name, getattr(config, name))
+    ctrl.notDeblendedMask = config.notDeblendedMask or ""
+    ctrl.maskPlanes = list(config.maskPlanes)
+    ctrl.maskLimits = dict(config.maskLimits)
+    return ctrl
+
+
+def deblendMany(config, maskedImage, psf, sigma1, footprints, nThreads=0):
+    """Deblend ``footprints`` with the native deblender, on ``nThreads``
+    threads (non-positive: one per core).
+
+    Returns
+    -------
+    results : `list` of `NativeDeblendResult`
+        The results, in the order of ``footprints``.
+    """
+    deblender = NativeDeblenderF(makeNativeControl(config), maskedImage, psf, sigma1)
+    results = deblender.deblendMany(list(footprints), nThreads)
+    return [NativeDeblendResult(result, fp) for result, fp in zip(results, footprints)]
+
+
+class NativeDeblendedPeak:
+    """The outcome of the native deblender for one peak, with the
+    attributes of `lsst.meas.deblender.baseline.DeblendedPeak` that
+    `SourceDeblendTask` reads.
+    """
+
+    def __init__(self, peak, record):
+        self.peak = record
+        self.skip = peak.skip
+        self.deblendedAsPsf = peak.deblendedAsPsf
+        if peak.hasPsfFit:
+            self.psfFitFlux = peak.psfFitFlux
+            self.psfFitCenter = (peak.psfFitCenter.getX(), peak.psfFitCenter.getY())
+        else:
+            self.psfFitFlux = None
+            self.psfFitCenter = None
+        # The stray flux is already part of the child footprint; only
+        # whether there was any is known.
+        self.strayFlux = True if peak.hasStrayFlux else None
+        self.hasRampedTemplate = peak.rampedTemplate
+        self.patched = peak.patched
+        self._heavy = peak.heavy
+
+    def getFluxPortion(self, strayFlux=True):
+        if not strayFlux:
+            raise ValueError("The native deblender only returns child footprints with their stray flux")
+        return self._heavy
+
+
+class NativeDeblendResult:
+    """The outcome of the native deblender for one parent, shaped like
+    the `lsst.meas.deblender.baseline.DeblenderResult` of a single
+    filter: ``deblendedParents[0].peaks`` holds a `NativeDeblendedPeak`
+    per peak of the parent footprint.
+    """
+
+    class _Parent:
+        def __init__(self, fp, peaks):
+            self.fp = fp
+            self.peaks = peaks
+
+    def __init__(self, result, footprint):
+        self.result = result
+        self.status = result.status
+        self.message = result.message
+        self.parentSpans = result.parentSpans
+        peaks = [NativeDeblendedPeak(peak, record)
+                 for peak, record in zip(result.peaks, footprint.getPeaks())]
+        self.deblendedParents = [self._Parent(footprint, peaks)]
+
+    @property
+    def deblended(self):
+        return self.status == NativeDeblenderF.Result.DEBLENDED
@@ -0,0 +1,132 @@
+/*
+ * This file is part of meas_deblender.
+ *
+ * Developed for the LSST Data Management System.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+
+#include "lsst/afw/image/MaskedImage.h"
+#include "lsst/afw/detection/Footprint.h"
+#include "lsst/afw/detection/Psf.h"
+
+#include "lsst/meas/deblender/NativeDeblender.h"
+
+namespace py = pybind11;
+using namespace pybind11::literals;
+
+namespace lsst {
+namespace meas {
+namespace deblender {
+
+namespace {
+
+void declareControl(py::module & mod) {
+    py::class_<NativeDeblendControl> cls(mod, "NativeDeblendControl");
+    cls.def(py::init<>());
+    cls.def_readwrite("edgeHandling", &NativeDeblendControl::edgeHandling);
+    cls.def_readwrite("strayFluxToPointSources", &NativeDeblendControl::strayFluxToPointSources);
+    cls.def_readwrite("assignStrayFlux", &NativeDeblendControl::assignStrayFlux);
+    cls.def_readwrite("strayFluxRule", &NativeDeblendControl::strayFluxRule);
+    cls.def_readwrite("clipStrayFluxFraction", &NativeDeblendControl::clipStrayFluxFraction);
+    cls.def_readwrite("psfChisq1", &NativeDeblendControl::psfChisq1);
+    cls.def_readwrite("psfChisq2", &NativeDeblendControl::psfChisq2);
+    cls.def_readwrite("psfChisq2b", &NativeDeblendControl::psfChisq2b);
+    cls.def_readwrite("maxNumberOfPeaks", &NativeDeblendControl::maxNumberOfPeaks);
+    cls.def_readwrite("maxFootprintArea", &NativeDeblendControl::maxFootprintArea);
+    cls.def_readwrite("maxFootprintSize", &NativeDeblendControl::maxFootprintSize);
+    cls.def_readwrite("minFootprintAxisRatio", &NativeDeblendControl::minFootprintAxisRatio);
+    cls.def_readwrite("notDeblendedMask", &NativeDeblendControl::notDeblendedMask);
+    cls.def_readwrite("tinyFootprintSize", &NativeDeblendControl::tinyFootprintSize);
+    cls.def_readwrite("propagateAllPeaks", &NativeDeblendControl::propagateAllPeaks);
+    cls.def_readwrite("catchFailures", &NativeDeblendControl::catchFailures);
+    cls.def_readwrite("maskPlanes", &NativeDeblendControl::maskPlanes);
+    cls.def_readwrite("weightTemplates", &NativeDeblendControl::weightTemplates);
+    cls.def_readwrite("removeDegenerateTemplates", &NativeDeblendControl::removeDegenerateTemplates);
+    cls.def_readwrite("medianSmoothTemplate", &NativeDeblendControl::medianSmoothTemplate);
+    cls.def_readwrite("medianFilterHalfsize", &NativeDeblendControl::medianFilterHalfsize);
+    cls.def_readwrite("medianFilterMethod", &NativeDeblendControl::medianFilterMethod);
+    cls.def_readwrite("tiledTemplateMinArea", &NativeDeblendControl::tiledTemplateMinArea);
+    cls.def_readwrite("spanTemplateSum", &NativeDeblendControl::spanTemplateSum);
+    cls.def_readwrite("numaPlacement", &NativeDeblendControl::numaPlacement);
+    cls.def_readwrite("maskLimits", &NativeDeblendControl::maskLimits);
+}
+
+template <typename ImagePixelT>
+void declareDeblender(py::module & mod, std::string const& suffix) {
+    typedef NativeDeblender<ImagePixelT> Class;
+    typedef typename Class::Peak Peak;
+    typedef typename Class::Result Result;
+
+    py::class_<Class> cls(mod, ("NativeDeblender" + suffix).c_str());
+
+    py::class_<Peak> peak(cls, "Peak");
+    peak.def_readonly("heavy", &Peak::heavy);
+    peak.def_readonly("skip", &Peak::skip);
+    peak.def_readonly("deblendedAsPsf", &Peak::deblendedAsPsf);
+    peak.def_readonly("hasPsfFit", &Peak::hasPsfFit);
+    peak.def_readonly("psfFitFlux", &Peak::psfFitFlux);
+    peak.def_readonly("psfFitCenter", &Peak::psfFitCenter);
+    peak.def_readonly("hasStrayFlux", &Peak::hasStrayFlux);
+    peak.def_readonly("rampedTemplate", &Peak::rampedTemplate);
+    peak.def_readonly("patched", &Peak::patched);
+
+    py::class_<Result> result(cls, "Result");
+    py::enum_<typename Result::Status>(result, "Status")
+            .value("NOT_BLENDED", Result::NOT_BLENDED)
+            .value("TOO_BIG", Result::TOO_BIG)
+            .value("MASKED", Result::MASKED)
+            .value("BAD_PSF", Result::BAD_PSF)
+            .value("FAILED", Result::FAILED)
+            .value("DEBLENDED", Result::DEBLENDED)
+            .export_values();
+    result.def_readonly("status", &Result::status);
+    result.def_readonly("message", &Result::message);
+    result.def_readonly("psfFwhm", &Result::psfFwhm);
+    result.def_readonly("parentSpans", &Result::parentSpans);
+    result.def_readonly("peaks", &Result::peaks);
+
+    cls.def(py::init<NativeDeblendControl const&, typename Class::MaskedImageT const&,
+                     std::shared_ptr<afw::detection::Psf const>, double>(),
+            "ctrl"_a, "mimg"_a, "psf"_a, "sigma1"_a);
+    cls.def("deblend", &Class::deblend, "parent"_a, py::call_guard<py::gil_scoped_release>());
+    cls.def("deblendMany", &Class::deblendMany, "parents"_a, "nThreads"_a=0,
+            py::call_guard<py::gil_scoped_release>());
+    cls.def_static("estimateSigma1", &Class::estimateSigma1, "mimg"_a, "maskPlanes"_a);
+    cls.def("isLargeFootprint", &Class::isLargeFootprint, "foot"_a);
+    cls.def("isMasked", &Class::isMasked, "foot"_a);
+    cls.def("getControl", &Class::getControl, py::return_value_policy::copy);
+    cls.def("getSigma1", &Class::getSigma1);
+}
+
+}  // namespace
+
+PYBIND11_MODULE(nativeDeblender, mod) {
+    py::module::import("lsst.afw.image");
+    py::module::import("lsst.afw.detection");
+    py::module::import("lsst.afw.geom");
+
+    declareControl(mod);
+    declareDeblender<float>(mod, "F");
+}
+
+}  // deblender
+}  // meas
+}  // lsst
@@ -0,0 +1,125 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+__all__ = ['ParentIndex']
+
+from collections import defaultdict
+
+
+class ParentIndex:
+    """Grid index over the footprint bounding boxes of the parents
+    (records with no parent) of a catalog.
+
+    Each parent is registered in every grid cell its bounding box
+    overlaps, so a query only tests the parents of the cells the query
+    box overlaps.  The index holds the records themselves, so it stays
+    valid when children are added to or removed from the catalog; a
+    parent whose footprint changes must be passed to `update`.
+
+    Parameters
+    ----------
+    catalog : `lsst.afw.table.SourceCatalog`
+        Catalog to index.
+    cellSize : `int`, optional
+        Size of the grid cells, in pixels.
+    """
+
+    def __init__(self, catalog, cellSize=256):
+        self.cellSize = cellSize
+        self._cells = defaultdict(list)
+        self._parents = []
+        self._byId = {}
+        for src in catalog:
+            if src.getParent() != 0:
+                continue
+            n = len(self._parents)
+            bbox = src.getFootprint().getBBox()
+            self._parents.append((src, bbox))
+            self._byId[src.getId()] = n
+            for cell in self._cellsOf(bbox):
+                self._cells[cell].append(n)
+
+    def __len__(self):
+        return len(self._parents)
+
+    def _cellsOf(self, bbox):
+        x0, x1 = bbox.getMinX()//self.cellSize, bbox.getMaxX()//self.cellSize
+        y0, y1 = bbox.getMinY()//self.cellSize, bbox.getMaxY()//self.cellSize
+        return [(x, y) for y in range(y0, y1 + 1) for x in range(x0, x1 + 1)]
+
+    def query(self, bbox):
+        """Return the parents whose footprint bounding box overlaps
+        ``bbox``, in catalog order.
+
+        Parameters
+        ----------
+        bbox : `lsst.geom.Box2I`
+            Region of interest.
+
+        Returns
+        -------
+        parents : `list` of `lsst.afw.table.SourceRecord`
+            Matching parents.
+        """
+        if bbox.isEmpty():
+            return []
+        found = set()
+        for cell in self._cellsOf(bbox):
+            for n in self._cells.get(cell, ()):
+                if n not in found and self._parents[n][1].overlaps(bbox):
+                    found.add(n)
+        return [self._parents[n][0] for n in sorted(found)]
+
+    def update(self, src):
+        """Re-register parent ``src`` with the bounding box of its
+        current footprint, e.g. after deblending has grown it.
+
+        Parameters
+        ----------
+        src : `lsst.afw.table.SourceRecord`
+            A parent already in the index.
+        """
+        n = self._byId[src.getId()]
+        oldBBox = self._parents[n][1]
+        bbox = src.getFootprint().getBBox()
+        if bbox == oldBBox:
+            return
+        for cell in self._cellsOf(oldBBox):
+            self._cells[cell].remove(n)
+        self._parents[n] = (src, bbox)
+        for cell in self._cellsOf(bbox):
+            self._cells[cell].append(n)
+
+    def get(self, ids):
+        """Return the parents with the given IDs, in catalog order.
+
+        Parameters
+        ----------
+        ids : iterable of `int`
+            Source IDs; IDs that are not parents are ignored.
+
+        Returns
+        -------
+        parents : `list` of `lsst.afw.table.SourceRecord`
+            Matching parents.
+        """
+        found = sorted(self._byId[i] for i in set(ids) if i in self._byId)
+        return [self._parents[n][0] for n in found]
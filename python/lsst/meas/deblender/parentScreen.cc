@@ -0,0 +1,65 @@
+/*
+ * This file is part of meas_deblender.
+ *
+ * Developed for the LSST Data Management System.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+#include "ndarray/pybind11.h"
+
+#include "lsst/meas/deblender/ParentScreen.h"
+
+namespace py = pybind11;
+using namespace pybind11::literals;
+
+namespace lsst {
+namespace meas {
+namespace deblender {
+
+PYBIND11_MODULE(parentScreen, mod) {
+    py::module::import("lsst.afw.image");
+    py::module::import("lsst.afw.detection");
+    py::module::import("lsst.afw.table");
+
+    py::class_<ParentScreen> cls(mod, "ParentScreen");
+    py::enum_<ParentScreen::Reason>(cls, "Reason")
+            .value("DEBLEND", ParentScreen::DEBLEND)
+            .value("NOT_BLENDED", ParentScreen::NOT_BLENDED)
+            .value("TOO_BIG", ParentScreen::TOO_BIG)
+            .value("MASKED", ParentScreen::MASKED)
+            .value("BAD_PSF", ParentScreen::BAD_PSF)
+            .export_values();
+    cls.def_readonly("reason", &ParentScreen::reason);
+    cls.def_readonly("cost", &ParentScreen::cost);
+    cls.def_readonly("centroidX", &ParentScreen::centroidX);
+    cls.def_readonly("centroidY", &ParentScreen::centroidY);
+    cls.def_readonly("psfFwhm", &ParentScreen::psfFwhm);
+
+    mod.def("screenParents",
+            py::overload_cast<afw::table::SourceCatalog const&, afw::image::Mask<afw::image::MaskPixel> const&,
+                              std::shared_ptr<afw::detection::Psf const>, int, int, double,
+                              std::map<std::string, double> const&>(&screenParents),
+            "srcs"_a, "mask"_a, "psf"_a, "maxFootprintArea"_a, "maxFootprintSize"_a,
+            "minFootprintAxisRatio"_a, "maskLimits"_a);
+}
+
+}  // deblender
+}  // meas
+}  // lsst
@@ -0,0 +1,52 @@
+/*
+ * This file is part of meas_deblender.
+ *
+ * Developed for the LSST Data Management System.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+
+#include "lsst/meas/deblender/PerfCounters.h"
+
+namespace py = pybind11;
+using namespace pybind11::literals;
+
+namespace lsst {
+namespace meas {
+namespace deblender {
+
+PYBIND11_MODULE(perfCounters, mod) {
+    py::class_<PerfCounters> cls(mod, "PerfCounters");
+    py::enum_<PerfCounters::Event>(cls, "Event")
+            .value("CYCLES", PerfCounters::CYCLES)
+            .value("INSTRUCTIONS", PerfCounters::INSTRUCTIONS)
+            .value("CACHE_MISSES", PerfCounters::CACHE_MISSES)
+            .value("BRANCH_MISSES", PerfCounters::BRANCH_MISSES)
+            .export_values();
+    cls.attr("NEVENTS") = static_cast<int>(PerfCounters::NEVENTS);
+    cls.def(py::init<>());
+    cls.def("isAvailable", &PerfCounters::isAvailable);
+    cls.def("hasEvent", &PerfCounters::hasEvent, "event"_a);
+    cls.def("read", &PerfCounters::read);
+}
+
+}  // deblender
+}  // meas
+}  // lsst
@@ -20,8 +20,9 @@
 # along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 __all__ = ["DeblenderPlugin", "fitPsfs", "buildSymmetricTemplates", "rampFluxAtEdge",
-           "medianSmoothTemplates", "makeTemplatesMonotonic", "clipFootprintsToNonzero",
-           "weightTemplates", "reconstructTemplates", "apportionFlux"]
+           "medianSmoothTemplates", "MedianFilterValidation", "makeTemplatesMonotonic",
+           "clipFootprintsToNonzero", "weightTemplates", "reconstructTemplates", "apportionFlux",
+           "PsfTemplate"]
 
 import numpy as np
 
@@ -65,6 +66,52 @@ def clipFootprintToNonzeroImpl(foot, image):
     foot.removeOrphanPeaks()
 
 
+class PsfTemplate:
+    """The template of a peak deblended as a PSF, held as the PSF model
+    it is made of rather than as pixels.
+
+    The pixels are only computed, straight from the (possibly cached and
+    shared) PSF image, when `makeTemplate` is called: `DeblendedPeak`
+    does so the first time its template is read, which for the default
+    plugins is in `apportionFlux`.
+
+    Parameters
+    ----------
+    psfImage: `afw.image.ImageD`
+        Unscaled PSF model at the fit position; not modified.
+    flux: `float`
+        Fit flux the PSF model is scaled by.
+    footprint: `afw.detection.Footprint`
+        Parent footprint clipped to the bounding box of ``psfImage``.
+    """
+    def __init__(self, psfImage, flux, footprint):
+        self.psfImage = psfImage
+        self.flux = flux
+        self.footprint = footprint
+
+    def getBBox(self):
+        return self.footprint.getBBox()
+
+    def makeTemplate(self):
+        """Compute the template pixels.
+
+        Returns
+        -------
+        image: `afw.image.ImageF`
+            The scaled PSF model within the footprint, zero outside.
+        footprint: `afw.detection.Footprint`
+            The footprint clipped to the non-zero pixels of ``image``.
+        """
+        bb = self.footprint.getBBox()
+        image = afwImage.ImageF(bb)
+        psfimg = self.psfImage.Factory(self.psfImage, bb, afwImage.PARENT)
+        np.multiply(psfimg.getArray(), self.flux, out=image.getArray(), casting='unsafe')
+        afwGeom.SpanSet(bb).intersectNot(self.footprint.spans).setImage(image, 0.0)
+        footprint = afwDet.Footprint(self.footprint)
+        clipFootprintToNonzeroImpl(footprint, image)
+        return image, footprint
+
+
 class DeblenderPlugin:
     """Class to define plugins for the deblender.
 
@@ -162,7 +209,8 @@ def _setPeakError(debResult, log, pk, cx, cy, filters, msg, flag):
         getattr(pkResult, flag)()
 
 
-def fitPsfs(debResult, log, psfChisqCut1=1.5, psfChisqCut2=1.5, psfChisqCut2b=1.5, tinyFootprintSize=2):
+def fitPsfs(debResult, log, psfChisqCut1=1.5, psfChisqCut2=1.5, psfChisqCut2b=1.5, tinyFootprintSize=2,
+            psfCache=None):
     """Fit a PSF + smooth background model (linear) to a small region
     around each peak.
 
@@ -204,6 +252,10 @@ def fitPsfs(debResult, log, psfChisqCut1=1.5, psfChisqCut2=1.5, psfChisqCut2b=1.
         footprint. If the bbox of the clipped PSF model for a peak is
         smaller than ``max(tinyFootprintSize,2)`` then ``tinyFootprint`` for
         the peak is set to ``True`` and the peak is not fit. The default is 2.
+    psfCache: `lsst.meas.deblender.baseline.CachingPsf`, optional
+        Existing PSF model cache to use instead of creating a new one.
+        Since a `CachingPsf` wraps a single PSF, this is only used when
+        deblending a single filter.
 
     Returns
     -------
@@ -217,7 +269,10 @@ def fitPsfs(debResult, log, psfChisqCut1=1.5, psfChisqCut2=1.5, psfChisqCut2b=1.
     for fidx in debResult.filters:
         dp = debResult.deblendedParents[fidx]
         peaks = dp.fp.getPeaks()
-        cpsf = CachingPsf(dp.psf)
+        if psfCache is not None and len(debResult.filters) == 1:
+            cpsf = psfCache
+        else:
+            cpsf = CachingPsf(dp.psf)
 
         # create mask image for pixels within the footprint
         fmask = afwImage.Mask(dp.bb)
@@ -680,27 +735,12 @@ def _fitPsf(fp, fmask, pk, pkF, pkres, fbb, peaks, peaksF, log, psf, psffwhm,
         # image.
         log.trace('Deblending as PSF; setting template to PSF model')
 
-        # Instantiate the PSF model and clip it to the footprint
+        # The PSF model clipped to the footprint; its pixels are only
+        # computed, from the image held by the PSF cache, when read.
         psfimg = psf.computeImage(cx, cy)
-        # Scale by fit flux.
-        psfimg *= Xpsf[I_psf]
-        psfimg = psfimg.convertF()
-
-        # Clip the Footprint to the PSF model image bbox.
         fpcopy = afwDet.Footprint(fp)
-        psfbb = psfimg.getBBox()
-        fpcopy.clipTo(psfbb)
-        bb = fpcopy.getBBox()
-
-        # Copy the part of the PSF model within the clipped footprint.
-        psfmod = afwImage.ImageF(bb)
-        fpcopy.spans.copyImage(psfimg, psfmod)
-        # Save it as our template.
-        clipFootprintToNonzeroImpl(fpcopy, psfmod)
-        pkres.setTemplate(psfmod, fpcopy)
-
-        # DEBUG
-        pkres.setPsfTemplate(psfmod, fpcopy)
+        fpcopy.clipTo(psfimg.getBBox())
+        pkres.setPsfTemplate(PsfTemplate(psfimg, Xpsf[I_psf], fpcopy))
 
     return ispsf
 
@@ -953,7 +993,63 @@ def _handle_flux_at_edge(log, psffwhm, t1, tfoot, fp, maskedImage,
     return t2, tfoot2, patched
 
 
-def medianSmoothTemplates(debResult, log, medianFilterHalfsize=2):
+class MedianFilterValidation:
+    """Compare an approximate median filter with the exact one on a
+    sample of templates.
+
+    Every ``interval``-th template smoothed with the approximate filter
+    is also smoothed exactly, and the differences, in units of the
+    parent's noise level, are accumulated.
+
+    Parameters
+    ----------
+    interval : `int`
+        Validate one template in every ``interval``.
+    """
+    def __init__(self, interval):
+        self.interval = interval
+        self.nSeen = 0
+        self.nSamples = 0
+        self.maxDeviation = 0.0
+        self._sumSq = 0.0
+        self._nPixels = 0
+
+    @property
+    def rmsDeviation(self):
+        return np.sqrt(self._sumSq/self._nPixels) if self._nPixels else 0.0
+
+    def add(self, inimg, approx, halfsize, sigma1):
+        """Validate ``approx``, the approximate median of ``inimg``, if it
+        is due.
+        """
+        self.nSeen += 1
+        if self.interval <= 0 or (self.nSeen - 1) % self.interval:
+            return
+        exact = inimg.Factory(inimg, True)
+        bUtils.medianFilter(inimg, exact, halfsize)
+        # The exact filter only covers the interior, less its last column.
+        h = halfsize
+        diff = (approx.getArray()[h:-h, h:-h-1].astype(float)
+                - exact.getArray()[h:-h, h:-h-1])/sigma1
+        if diff.size == 0:
+            return
+        self.nSamples += 1
+        self.maxDeviation = max(self.maxDeviation, float(np.max(np.abs(diff))))
+        self._sumSq += float(np.sum(diff**2))
+        self._nPixels += diff.size
+
+
+def _isLaneBatched(timg):
+    """Whether ``timg`` is small enough to be interleaved with other
+    templates by ``BaselineUtils::medianFilterBatch`` and
+    ``BaselineUtils::makeMonotonicBatch``.
+    """
+    return (timg.getWidth() <= bUtils.LANE_BATCH_MAX_SIZE
+            and timg.getHeight() <= bUtils.LANE_BATCH_MAX_SIZE)
+
+
+def medianSmoothTemplates(debResult, log, medianFilterHalfsize=2, medianFilterMethod='exact',
+                          medianValidation=None, tiledMinArea=0):
     """Applying median smoothing filter to the template images for every
     peak in every filter.
 
@@ -969,6 +1065,17 @@ def medianSmoothTemplates(debResult, log, medianFilterHalfsize=2):
         be the median of  the pixels in a 101 x 101-pixel box in the input
         image. This parameter is only used when
         ``medianSmoothTemplate==True``, otherwise it is ignored.
+    medianFilterMethod: `str`, optional
+        ``exact`` for the 2-D box median, or ``separable`` for the faster
+        row-then-column approximation (see
+        ``BaselineUtils::medianFilterSeparable``).
+    medianValidation: `MedianFilterValidation`, optional
+        If given, and the method is not ``exact``, accumulates the
+        deviation of the approximate filter from the exact one.
+    tiledMinArea: `int`, optional
+        If positive, the exact filter reads templates of at least this
+        many pixels from a tiled copy (``BaselineUtils::medianFilterTiled``),
+        which gives the same result with fewer cache misses.
 
     Returns
     -------
@@ -977,7 +1084,13 @@ def medianSmoothTemplates(debResult, log, medianFilterHalfsize=2):
         This will be ``True`` as long as there is at least one source that
         is not flagged as a PSF.
     """
+    if medianFilterMethod not in ('exact', 'separable'):
+        raise ValueError("Unknown medianFilterMethod: %s" % medianFilterMethod)
     modified = False
+    # The small templates of the exact filter are filtered together, by
+    # size (``BaselineUtils::medianFilterBatch``)
+    batch = []
+    batchHalfsize = medianFilterHalfsize <= bUtils.LANE_BATCH_MAX_HALFSIZE
     # Loop over all filters
     for fidx in debResult.filters:
         dp = debResult.deblendedParents[fidx]
@@ -992,17 +1105,33 @@ def medianSmoothTemplates(debResult, log, medianFilterHalfsize=2):
                 # We want the output to go in "t1", so copy it into
                 # "inimg" for input
                 inimg = timg.Factory(timg, True)
-                bUtils.medianFilter(inimg, timg, medianFilterHalfsize)
+                if medianFilterMethod == 'separable':
+                    bUtils.medianFilterSeparable(inimg, timg, medianFilterHalfsize)
+                    if medianValidation is not None:
+                        medianValidation.add(inimg, timg, medianFilterHalfsize, dp.avgNoise)
+                elif tiledMinArea > 0 and timg.getWidth()*timg.getHeight() >= tiledMinArea:
+                    bUtils.medianFilterTiled(inimg, timg, medianFilterHalfsize)
+                elif batchHalfsize and _isLaneBatched(timg):
+                    batch.append((pkres, inimg, timg, tfoot))
+                    continue
+                else:
+                    bUtils.medianFilter(inimg, timg, medianFilterHalfsize)
                 # possible save this median-filtered template
                 pkres.setMedianFilteredTemplate(timg, tfoot)
             else:
                 log.trace('Not median-filtering template %i: size %i x %i smaller than required %i x %i',
                           pkres.pki, timg.getWidth(), timg.getHeight(), filtsize, filtsize)
             pkres.setTemplate(timg, tfoot)
+    if batch:
+        bUtils.medianFilterBatch([inimg for _, inimg, _, _ in batch], [timg for _, _, timg, _ in batch],
+                                 medianFilterHalfsize)
+        for pkres, _, timg, tfoot in batch:
+            pkres.setMedianFilteredTemplate(timg, tfoot)
+            pkres.setTemplate(timg, tfoot)
     return modified
 
 
-def makeTemplatesMonotonic(debResult, log):
+def makeTemplatesMonotonic(debResult, log, tiledMinArea=0):
     """Make the templates monotonic.
 
     The pixels in the templates are modified such that pixels further
@@ -1014,6 +1143,10 @@ def makeTemplatesMonotonic(debResult, log):
         Container for the final deblender results.
     log: `lsst.log.Logger` or `lsst.utils.logging.LsstLogAdapter`
         LSST logger for logging purposes.
+    tiledMinArea: `int`, optional
+        If positive, templates of at least this many pixels are processed
+        in a tiled copy (``BaselineUtils::makeMonotonicTiled``), which gives
+        the same result with fewer cache misses.
 
     Returns
     -------
@@ -1023,6 +1156,9 @@ def makeTemplatesMonotonic(debResult, log):
         is not flagged as a PSF.
     """
     modified = False
+    # The small templates are processed together, by size and peak
+    # offset (``BaselineUtils::makeMonotonicBatch``)
+    batch = []
     # Loop over all filters
     for fidx in debResult.filters:
         dp = debResult.deblendedParents[fidx]
@@ -1033,7 +1169,19 @@ def makeTemplatesMonotonic(debResult, log):
             timg, tfoot = pkres.templateImage, pkres.templateFootprint
             pk = pkres.peak
             log.trace('Making template %i monotonic', pkres.pki)
-            bUtils.makeMonotonic(timg, pk)
+            if tiledMinArea > 0 and timg.getWidth()*timg.getHeight() >= tiledMinArea:
+                bUtils.makeMonotonicTiled(timg, pk)
+                pkres.setTemplate(timg, tfoot)
+            elif _isLaneBatched(timg):
+                batch.append((pkres, timg, tfoot))
+            else:
+                bUtils.makeMonotonic(timg, pk)
+                pkres.setTemplate(timg, tfoot)
+    if batch:
+        bUtils.makeMonotonicBatch([timg for _, timg, _ in batch],
+                                  [pkres.peak.getIx() for pkres, _, _ in batch],
+                                  [pkres.peak.getIy() for pkres, _, _ in batch])
+        for pkres, timg, tfoot in batch:
             pkres.setTemplate(timg, tfoot)
     return modified
 
@@ -1249,7 +1397,7 @@ def reconstructTemplates(debResult, log, maxTempDotProd=0.5):
 
 def apportionFlux(debResult, log, assignStrayFlux=True, strayFluxAssignment='r-to-peak',
                   strayFluxToPointSources='necessary', clipStrayFluxFraction=0.001,
-                  getTemplateSum=False):
+                  getTemplateSum=False, spanTemplateSum=False):
     """Apportion flux to all of the peak templates in each filter
 
     Divide the ``maskedImage`` flux amongst all of the templates based
@@ -1278,6 +1426,8 @@ def apportionFlux(debResult, log, assignStrayFlux=True, strayFluxAssignment='r-t
           to footprint
         * ``nearest-footprint``: Stray flux is assigned to the footprint
           with lowest L-1 (Manhattan) distance to the stray flux
+        * ``nearest-peak``: Stray flux is assigned to the nearest peak,
+          measured along paths within the parent footprint
 
     strayFluxToPointSources: `string`, optional
         Determines how stray flux is apportioned to point sources
@@ -1296,6 +1446,13 @@ def apportionFlux(debResult, log, assignStrayFlux=True, strayFluxAssignment='r-t
         As part of the flux calculation, the sum of the templates is
         calculated. If ``getTemplateSum==True`` then the sum of the
         templates is stored in the result (a `DeblendedFootprint`).
+    spanTemplateSum: `bool`, optional
+        Take each template to be zero outside its footprint, summing the
+        templates over their footprints only.  `clipFootprintsToNonzero`
+        only trims the ends of the spans, so a template may still be
+        positive outside its footprint, e.g. where the median filter spread
+        its flux; the image flux there then goes to the other templates or
+        to the stray flux, and the result differs from the default.
 
     Returns
     -------
@@ -1305,7 +1462,7 @@ def apportionFlux(debResult, log, assignStrayFlux=True, strayFluxAssignment='r-t
         it is unlikely that any deblender plugins will be re-run.
     """
     validStrayPtSrc = ['never', 'necessary', 'always']
-    validStrayAssign = ['r-to-peak', 'r-to-footprint', 'nearest-footprint', 'trim']
+    validStrayAssign = ['r-to-peak', 'r-to-footprint', 'nearest-footprint', 'nearest-peak', 'trim']
     if strayFluxToPointSources not in validStrayPtSrc:
         raise ValueError((('strayFluxToPointSources: value \"%s\" not in the set of allowed values: ') %
                           strayFluxToPointSources) + str(validStrayPtSrc))
@@ -1348,6 +1505,8 @@ def apportionFlux(debResult, log, assignStrayFlux=True, strayFluxAssignment='r-t
         # sumimg.setXY0(bb.getMinX(), bb.getMinY())
 
         strayopts = 0
+        if spanTemplateSum:
+            strayopts |= bUtils.TEMPLATE_SUM_BY_SPANS
         if strayFluxAssignment == 'trim':
             assignStrayFlux = False
             strayopts |= bUtils.STRAYFLUX_TRIM
@@ -1365,6 +1524,8 @@ def apportionFlux(debResult, log, assignStrayFlux=True, strayFluxAssignment='r-t
                 strayopts |= bUtils.STRAYFLUX_R_TO_FOOTPRINT
             elif strayFluxAssignment == 'nearest-footprint':
                 strayopts |= bUtils.STRAYFLUX_NEAREST_FOOTPRINT
+            elif strayFluxAssignment == 'nearest-peak':
+                strayopts |= bUtils.STRAYFLUX_NEAREST_PEAK
 
         portions, strayflux = bUtils.apportionFlux(dp.maskedImage, dp.fp, tmimgs, tfoots, sumimg, dpsf,
                                                    pkx, pky, strayopts, clipStrayFluxFraction)
@@ -0,0 +1,262 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+__all__ = ['SamplingProfiler', 'PerfCounterMonitor']
+
+import heapq
+import os
+import signal
+import threading
+import time
+from collections import Counter
+from contextlib import contextmanager
+
+from .perfCounters import PerfCounters
+
+
+class SamplingProfiler:
+    """Low-overhead statistical profiler for the deblender.
+
+    While running, the call stack of the main thread is sampled every
+    ``interval`` seconds of CPU time (``SIGPROF``) and each sample is
+    attributed to the current parent (see `setParent`) and deblender
+    plugin (see `stage`, which makes this usable as a monitor for
+    `lsst.meas.deblender.baseline.newDeblend`).  The samples are written
+    as collapsed stacks, one ``frame;frame;... count`` line per distinct
+    stack, which flamegraph tools read directly.  The samples of the
+    ``topN`` slowest parents are also kept separately.
+
+    Python only delivers signals between bytecodes, so time spent in a
+    native routine is sampled when it returns and charged to the line of
+    the Python frame that called it.
+
+    Parameters
+    ----------
+    interval : `float`
+        Sampling interval, in seconds of CPU time.
+    topN : `int`
+        Number of slowest parents whose samples are kept separately.
+    """
+
+    def __init__(self, interval=0.01, topN=10):
+        self.interval = interval
+        self.topN = topN
+        self.samples = Counter()
+        self.nSamples = 0
+        self._slowest = []
+        self._parent = None
+        self._parentStart = None
+        self._parentSamples = None
+        self._stage = None
+        self._previousHandler = None
+        self._running = False
+
+    @property
+    def running(self):
+        return self._running
+
+    def start(self):
+        """Start sampling.
+
+        Returns
+        -------
+        started : `bool`
+            Whether sampling started; signals can only be handled on
+            the main thread.
+        """
+        if self._running or threading.current_thread() is not threading.main_thread():
+            return False
+        self._previousHandler = signal.signal(signal.SIGPROF, self._sample)
+        signal.setitimer(signal.ITIMER_PROF, self.interval, self.interval)
+        self._running = True
+        return True
+
+    def stop(self):
+        """Stop sampling, finishing the current parent.
+        """
+        if not self._running:
+            return
+        signal.setitimer(signal.ITIMER_PROF, 0, 0)
+        signal.signal(signal.SIGPROF, self._previousHandler or signal.SIG_DFL)
+        self._running = False
+        self.setParent(None)
+
+    def setParent(self, parentId):
+        """Attribute the following samples to parent ``parentId``, and
+        finish timing the previous parent.
+
+        Parameters
+        ----------
+        parentId : `int` or `None`
+            ID of the parent being deblended, or `None` between parents.
+        """
+        now = time.perf_counter()
+        if self._parent is not None:
+            entry = (now - self._parentStart, self._parent, self._parentSamples)
+            if len(self._slowest) < self.topN:
+                heapq.heappush(self._slowest, entry)
+            elif self.topN > 0 and entry[0] > self._slowest[0][0]:
+                heapq.heapreplace(self._slowest, entry)
+        self._parent = parentId
+        self._parentStart = now
+        self._parentSamples = Counter() if parentId is not None else None
+
+    @contextmanager
+    def stage(self, name):
+        """Attribute the samples taken in this context to stage ``name``.
+        """
+        previous = self._stage
+        self._stage = name
+        try:
+            yield
+        finally:
+            self._stage = previous
+
+    def getSlowest(self):
+        """Return the slowest parents, slowest first.
+
+        Returns
+        -------
+        slowest : `list` of `tuple`
+            ``(parentId, seconds, nSamples)`` for each parent.
+        """
+        return [(parentId, duration, sum(samples.values()))
+                for duration, parentId, samples in sorted(self._slowest, key=lambda e: -e[0])]
+
+    def writeCollapsed(self, filename):
+        """Write all samples as collapsed stacks to ``filename``.
+        """
+        with open(filename, "w") as f:
+            for stack, count in sorted(self.samples.items()):
+                f.write("%s %d\n" % (stack, count))
+
+    def writeSlowest(self, filename):
+        """Write the samples of the slowest parents as collapsed stacks,
+        each rooted at a ``parent <id> (<seconds> s)`` frame.
+        """
+        with open(filename, "w") as f:
+            for duration, parentId, samples in sorted(self._slowest, key=lambda e: -e[0]):
+                root = "parent %d (%.3f s)" % (parentId, duration)
+                for stack, count in sorted(samples.items()):
+                    f.write("%s;%s %d\n" % (root, stack, count))
+
+    def _sample(self, signum, frame):
+        frames = []
+        while frame is not None:
+            code = frame.f_code
+            frames.append("%s (%s:%d)" % (code.co_name, os.path.basename(code.co_filename),
+                                          frame.f_lineno))
+            frame = frame.f_back
+        frames.append(self._stage or "(task)")
+        stack = ";".join(reversed(frames))
+        self.samples[stack] += 1
+        self.nSamples += 1
+        if self._parentSamples is not None:
+            self._parentSamples[stack] += 1
+
+
+class PerfCounterMonitor:
+    """Hardware performance counters per deblender plugin.
+
+    Used as a monitor for `lsst.meas.deblender.baseline.newDeblend`, it
+    reads the cycle, instruction, cache-miss and branch-miss counters of
+    the calling thread around each `stage` and accumulates the
+    differences per stage name, together with the number of parent
+    pixels the stage processed (the footprint area given to
+    `setParent`), from which `getSummary` derives the instructions per
+    cycle and the misses per pixel.
+
+    The counters come from the Linux ``perf_event_open`` interface,
+    which is often unavailable in containers or restricted by
+    ``/proc/sys/kernel/perf_event_paranoid``; `available` is then
+    `False` and the stages are not measured.  Counters the CPU does not
+    support are reported as `None`.
+    """
+
+    EVENTS = ("cycles", "instructions", "cacheMisses", "branchMisses")
+
+    def __init__(self):
+        self._counters = PerfCounters()
+        self.available = self._counters.isAvailable()
+        self.stages = {}
+        self._pixels = 0
+        self._depth = 0
+
+    def setParent(self, parentId, nPixels=0):
+        """Charge the pixels of the following stages to a parent of
+        ``nPixels`` pixels.
+        """
+        self._pixels = nPixels
+
+    @contextmanager
+    def stage(self, name):
+        """Accumulate the counts of this context to stage ``name``.
+
+        Nested stages are charged to the outermost one only, so that
+        the totals of all stages do not count any event twice.
+        """
+        if not self.available or self._depth > 0:
+            self._depth += 1
+            try:
+                yield
+            finally:
+                self._depth -= 1
+            return
+        self._depth += 1
+        before = self._counters.read()
+        try:
+            yield
+        finally:
+            after = self._counters.read()
+            self._depth -= 1
+            totals = self.stages.setdefault(name, [0, 0] + [0]*len(self.EVENTS))
+            totals[0] += 1
+            totals[1] += self._pixels
+            for i, (b, a) in enumerate(zip(before, after)):
+                if a < 0 or b < 0:
+                    totals[2 + i] = None
+                elif totals[2 + i] is not None:
+                    totals[2 + i] += a - b
+
+    def getSummary(self):
+        """Return the accumulated counts of each stage.
+
+        Returns
+        -------
+        summary : `dict` [`str`, `dict`]
+            For each stage, the number of calls (``calls``) and pixels
+            (``pixels``), the total of each counter, the instructions
+            per cycle (``ipc``) and the cache and branch misses per pixel
+            (``cacheMissesPerPixel``, ``branchMissesPerPixel``); values
+            that could not be measured are `None`.
+        """
+        summary = {}
+        for name, totals in self.stages.items():
+            entry = {"calls": totals[0], "pixels": totals[1]}
+            entry.update(zip(self.EVENTS, totals[2:]))
+            cycles, instructions = entry["cycles"], entry["instructions"]
+            entry["ipc"] = (instructions/cycles if cycles and instructions is not None else None)
+            for event in ("cacheMisses", "branchMisses"):
+                count = entry[event]
+                entry[event + "PerPixel"] = (count/totals[1] if count is not None and totals[1] > 0
+                                             else None)
+            summary[name] = entry
+        return summary
@@ -19,21 +19,34 @@
 # You should have received a copy of the GNU General Public License
 # along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
-__all__ = ['SourceDeblendConfig', 'SourceDeblendTask']
+__all__ = ['SourceDeblendConfig', 'SourceDeblendTask', 'DeblendExposureCache', 'MaskPlaneUpdates']
 
 import math
+import time
 import numpy as np
 
 import lsst.pex.config as pexConfig
 import lsst.pipe.base as pipeBase
 import lsst.afw.math as afwMath
 import lsst.geom as geom
+import lsst.afw.geom as afwGeom
 import lsst.afw.geom.ellipses as afwEll
-import lsst.afw.image as afwImage
 import lsst.afw.detection as afwDet
 import lsst.afw.table as afwTable
 from lsst.utils.timer import timeMethod
 
+from .baseline import CachingPsf
+from .baselineUtils import BaselineUtilsF as bUtils
+from .compression import CompressedFootprintStore
+from .export import writeChildColumns, ChildStreamWriter
+from .parentIndex import ParentIndex
+from .parentScreen import ParentScreen, screenParents
+from .plugins import MedianFilterValidation
+from .nativeBatch import deblendMany
+from .profiling import SamplingProfiler, PerfCounterMonitor
+from .metrics import DeblendMetrics
+from .worker import DeblendWorkerClient, exposureKey
+
 
 class SourceDeblendConfig(pexConfig.Config):
 
@@ -71,6 +84,8 @@ class SourceDeblendConfig(pexConfig.Config):
                                'CAUTION: this can be computationally expensive on large footprints!'),
             'nearest-footprint': ('Assign 100% to the nearest footprint (using L-1 norm aka '
                                   'Manhattan distance)'),
+            'nearest-peak': ('Assign 100% to the nearest peak, measured along paths within the parent '
+                             'footprint; the cost does not grow with the number of peaks'),
             'trim': ('Shrink the parent footprint to pixels that are not assigned to children')
         }
     )
@@ -110,6 +125,10 @@ class SourceDeblendConfig(pexConfig.Config):
 
     propagateAllPeaks = pexConfig.Field(dtype=bool, default=False,
                                         doc=('Guarantee that all peaks produce a child source.'))
+    prescreenParents = pexConfig.Field(
+        dtype=bool, default=True,
+        doc=("Decide which parents to skip (too few peaks, too large, masked) and compute their PSF FWHMs "
+             "for the whole catalog before deblending, rather than parent by parent."))
     catchFailures = pexConfig.Field(
         dtype=bool,
         default=True,
@@ -139,6 +158,132 @@ class SourceDeblendConfig(pexConfig.Config):
              "be removed."))
     medianSmoothTemplate = pexConfig.Field(dtype=bool, default=True,
                                            doc="Apply a smoothing filter to all of the template images")
+    medianFilterHalfsize = pexConfig.Field(dtype=int, default=2,
+                                           doc="Half the box size of the template median filter")
+    medianFilterMethod = pexConfig.ChoiceField(
+        dtype=str, default='exact',
+        doc="How to median-filter the templates",
+        allowed={
+            'exact': 'The exact median in a box of side 2*medianFilterHalfsize+1',
+            'separable': ('Median of row medians: approximate, but O(medianFilterHalfsize) '
+                          'rather than O(medianFilterHalfsize**2) per pixel'),
+        }
+    )
+    medianValidationInterval = pexConfig.Field(
+        dtype=int, default=100,
+        doc=("When medianFilterMethod is not 'exact', also compute the exact median for one in every "
+             "this many templates and record the deviation in the task metadata; 0 to disable."))
+    tiledTemplateMinArea = pexConfig.Field(
+        dtype=int, default=0,
+        doc=("Run the exact median filter and the monotonic step on a copy of the template stored "
+             "in 16x16-pixel tiles for templates of at least this many pixels, which reduces cache "
+             "misses on large templates without changing the result; 0 to disable."))
+    spanTemplateSum = pexConfig.Field(
+        dtype=bool, default=False,
+        doc=("Take each template to be zero outside its (clipped) footprint when apportioning the "
+             "flux: sum the templates over their footprints only, instead of over their whole bounding "
+             "boxes, and use the resulting coverage counts to find the stray flux.  Where a template is "
+             "positive only outside its footprint, e.g. where the median filter spread its flux, the "
+             "image flux goes to the other templates or to the stray flux, so the children differ "
+             "from those of the default."))
+    useNativeBatch = pexConfig.Field(
+        dtype=bool, default=False,
+        doc=("Deblend all the parents in one call to the native (C++) deblender, which runs them on "
+             "an internal thread pool, instead of running the python plugins parent by parent.  Only "
+             "used when the parents are prescreened and no per-parent python code is needed: "
+             "preSingleDeblendHook and postSingleDeblendHook are not overridden, there is no profiler, "
+             "performance counter or metrics monitor, the median filter is not validated and neither "
+             "weightTemplates nor removeDegenerateTemplates is set.  Switching it on changes the "
+             "children at the 1e-5 level: the native PSF fit solves its least-squares problems with an "
+             "Eigen SVD rather than numpy's lstsq, so its results are not bit-for-bit those of the "
+             "python path."))
+    nativeBatchThreads = pexConfig.Field(
+        dtype=int, default=1,
+        doc=("Number of threads used by useNativeBatch; non-positive for one per core.  The children "
+             "are bit-for-bit those of the native deblender on one thread, for any number of threads "
+             "(but see useNativeBatch for how they compare with the python path)."))
+    numaPlacement = pexConfig.Field(
+        dtype=bool, default=False,
+        doc=("With useNativeBatch on a machine with several NUMA nodes, bind the threads to the nodes, "
+             "move each node's band of image rows to its memory and deblend each parent on the node "
+             "holding its rows.  Does nothing on a single node; the children are unchanged."))
+    cacheExposureState = pexConfig.Field(
+        dtype=bool, default=False,
+        doc=("Keep the exposure-level state (noise estimate, PSF models and PSF FWHMs) between calls "
+             "to `deblend` on the same exposure, so that a long-lived task can rerun parents "
+             "without recomputing it.  The state is rebuilt if the pixels of the exposure have "
+             "changed since, which costs a digest of the exposure per call."))
+    psfCacheSize = pexConfig.Field(
+        dtype=int, default=4096,
+        doc=("Maximum number of PSF model images kept in the exposure-level PSF cache; "
+             "non-positive means no limit."))
+    workerAddress = pexConfig.Field(
+        dtype=str, default="",
+        doc=("If not empty, the Unix socket of a long-lived lsst.meas.deblender.DeblendWorker to deblend "
+             "on, which keeps the exposure-level state warm between tasks and pipeline invocations; "
+             "the children and mask are those of deblending here.  Not used with useCiLimits."))
+
+    profileSampleInterval = pexConfig.Field(
+        dtype=float, default=0.0,
+        doc=("If positive, sample the call stack every this many seconds of CPU time while deblending, "
+             "attributing the samples to parents and deblender plugins; see profileOutput."))
+    profileOutput = pexConfig.Field(
+        dtype=str, default="deblendProfile",
+        doc=("Prefix of the profile files written by each run: <prefix>-<run>.folded holds all samples "
+             "and <prefix>-<run>-slowest.folded those of the profileTopN slowest parents, "
+             "as collapsed stacks."))
+    profileTopN = pexConfig.Field(
+        dtype=int, default=10,
+        doc="Number of slowest parents whose profile samples are written separately")
+    perfCounters = pexConfig.Field(
+        dtype=bool, default=False,
+        doc=("Read the hardware performance counters (cycles, instructions, cache and branch misses) "
+             "around each deblender plugin and report the instructions per cycle and misses per pixel "
+             "of each; ignored, with a warning, where the counters are unavailable."))
+
+    metricsFile = pexConfig.Field(
+        dtype=str, default="",
+        doc=("If not empty, write throughput, latency, skip and cache metrics to this file in the "
+             "Prometheus text format while deblending, e.g. for the node exporter's text-file "
+             "collector; see lsst.meas.deblender.DeblendMetrics."))
+    metricsInterval = pexConfig.Field(
+        dtype=float, default=10.0,
+        doc="Minimum number of seconds between two writes of metricsFile")
+
+    doExportChildren = pexConfig.Field(
+        dtype=bool, default=False,
+        doc=("Write the children of each run to a memory-mappable columnar file, "
+             "<exportOutput>-<run>.children; see lsst.meas.deblender.ChildColumnFile."))
+    exportOutput = pexConfig.Field(
+        dtype=str, default="deblendChildren",
+        doc="Prefix of the child column files written when doExportChildren is set")
+    exportPixels = pexConfig.Field(
+        dtype=bool, default=True,
+        doc="Include the spans and pixel values of the child footprints in the exported file")
+
+    doStreamChildren = pexConfig.Field(
+        dtype=bool, default=False,
+        doc=("Append the children of each parent, as soon as it is deblended, to a child stream file, "
+             "<exportOutput>-<run>.childstream, written by a background thread; see "
+             "lsst.meas.deblender.ChildStreamFile.  Not supported by DistributedSourceDeblendTask."))
+    streamQueueSize = pexConfig.Field(
+        dtype=int, default=64,
+        doc=("Maximum number of parents whose children wait to be written when doStreamChildren is "
+             "set; deblending waits for the writer beyond that"))
+    streamDropPixels = pexConfig.Field(
+        dtype=bool, default=False,
+        doc=("Replace the HeavyFootprints of the streamed children by plain Footprints, so that their "
+             "pixels are only held in the stream file and not in the catalog"))
+
+    compressChildren = pexConfig.Field(
+        dtype=bool, default=False,
+        doc=("Hold the pixels of the children compressed in the task's compressedFootprints store, "
+             "replacing their HeavyFootprints by plain Footprints, and flagging them "
+             "deblend_pixelsCompressed, until they are restored with restoreChildren; "
+             "see lsst.meas.deblender.CompressedFootprintStore."))
+    compressionLevel = pexConfig.RangeField(
+        dtype=int, default=1, min=1, max=9,
+        doc="zlib compression level used when compressChildren is set")
 
     # Testing options
     # Some obs packages and ci packages run the full pipeline on a small
@@ -161,6 +306,102 @@ class SourceDeblendConfig(pexConfig.Config):
             "If `useCiLimits==False` then this parameter is ignored.")
 
 
+class DeblendExposureCache:
+    """State computed once per exposure and shared by all of its parents.
+
+    Parameters
+    ----------
+    exposure : `lsst.afw.image.Exposure`
+        Exposure being deblended.
+    psf : `lsst.afw.detection.Psf`
+        Point spread function used for deblending.
+    maskPlanes : `list` of `str`
+        Mask planes ignored when estimating the noise.
+    psfCacheSize : `int`, optional
+        Maximum number of PSF images kept by ``cachingPsf``;
+        non-positive means no limit.
+    pixelKey : `str`, optional
+        `exposureKey` of the pixels of ``exposure`` (without ``psf``),
+        checked by `matches` so that the cache is not reused once the
+        exposure has been modified in place.
+    """
+
+    def __init__(self, exposure, psf, maskPlanes, psfCacheSize=0, pixelKey=None):
+        self.exposure = exposure
+        self.psf = psf
+        self.maskPlanes = list(maskPlanes)
+        self.pixelKey = pixelKey
+
+        # find the median stdev in the image...
+        mi = exposure.getMaskedImage()
+        statsCtrl = afwMath.StatisticsControl()
+        statsCtrl.setAndMask(mi.getMask().getPlaneBitMask(self.maskPlanes))
+        stats = afwMath.makeStatistics(mi.getVariance(), mi.getMask(), afwMath.MEDIAN, statsCtrl)
+        self.sigma1 = math.sqrt(stats.getValue(afwMath.MEDIAN))
+
+        self.cachingPsf = CachingPsf(psf, maxSize=psfCacheSize)
+        self.psfFwhms = {}
+        self.psfFwhmHits = 0
+        self.psfFwhmMisses = 0
+
+    def matches(self, exposure, psf, maskPlanes, pixelKey=None):
+        """Return whether this cache was built for the given inputs and,
+        if ``pixelKey`` is given, for the same pixels.
+        """
+        return (exposure is self.exposure and psf is self.psf and list(maskPlanes) == self.maskPlanes
+                and (pixelKey is None or pixelKey == self.pixelKey))
+
+
+class MaskPlaneUpdates:
+    """Footprints whose pixels are to be set in a mask plane, collected
+    while deblending and applied in a single pass.
+
+    Setting the plane of each skipped parent as it is found writes the
+    exposure mask in the middle of the loop, while the parents that
+    follow read it; with the updates buffered the mask does not change
+    until `apply`, and the spans of all the footprints are merged so
+    that each mask row is written once.
+
+    Parameters
+    ----------
+    mask : `lsst.afw.image.Mask`
+        Mask to update.
+    planeName : `str`
+        Mask plane to set; added to ``mask`` by `apply` if needed.
+    """
+
+    def __init__(self, mask, planeName):
+        self.mask = mask
+        self.planeName = planeName
+        self._spans = []
+
+    def __len__(self):
+        return len(self._spans)
+
+    def add(self, spans):
+        """Set the plane in the pixels of ``spans`` (an
+        `lsst.afw.geom.SpanSet`) when `apply` is called.
+        """
+        self._spans.append(spans)
+
+    def apply(self):
+        """Set the plane in the pixels of all the spans added since the
+        last call.
+
+        Returns
+        -------
+        nPixels : `int`
+            Number of distinct pixels set.
+        """
+        if not self._spans:
+            return 0
+        merged = afwGeom.SpanSet([span for spans in self._spans for span in spans], normalize=True)
+        self._spans = []
+        self.mask.addMaskPlane(self.planeName)
+        merged.setMask(self.mask, self.mask.getPlaneBitMask(self.planeName))
+        return merged.getArea()
+
+
 class SourceDeblendTask(pipeBase.Task):
     """Split blended sources into individual sources.
 
@@ -185,6 +426,10 @@ class SourceDeblendTask(pipeBase.Task):
             Additional keyword arguments passed to ~lsst.pipe.base.task
         """
         pipeBase.Task.__init__(self, **kwargs)
+        # Workers build their own tasks from the schema as it was before
+        # this task added its fields.
+        self._inputSchema = afwTable.Schema(schema)
+        self._peakSchema = peakSchema
         self.schema = schema
         self.toCopyFromParent = [item.key for item in self.schema
                                  if item.field.getName().startswith("merge_footprint")]
@@ -205,6 +450,17 @@ class SourceDeblendTask(pipeBase.Task):
                     schema.addField(item.field)
             assert schema == self.peakSchemaMapper.getOutputSchema(), "Logic bug mapping schemas"
         self.addSchemaKeys(schema)
+        self._exposureCache = None
+        # Spans of the parents of one catalog before deblending, keyed by
+        # ID; see `_useParentSpansOf`.
+        self._parentSpansTable = None
+        self._parentSpans = {}
+        self._workerClient = None
+        self._profileRun = 0
+        self._exportRun = 0
+        self._streamRun = 0
+        self.metrics = None
+        self.compressedFootprints = CompressedFootprintStore(flagKey=self.pixelsCompressedKey)
 
     def addSchemaKeys(self, schema):
         self.nChildKey = schema.addField('deblend_nChild', type=np.int32,
@@ -262,6 +518,12 @@ class SourceDeblendTask(pipeBase.Task):
         self.parentNPeaksKey = schema.addField("deblend_parentNPeaks", type=np.int32,
                                                doc="Same as deblend_n_peaks, but the number of peaks "
                                                    "in the parent footprint")
+        self.pixelsCompressedKey = None
+        if self.config.compressChildren:
+            self.pixelsCompressedKey = schema.addField(
+                'deblend_pixelsCompressed', type='Flag',
+                doc=('The footprint of this child has no pixels: they are held compressed by the '
+                     'deblender until restored with SourceDeblendTask.restoreChildren'))
 
     @timeMethod
     def run(self, exposure, sources):
@@ -281,8 +543,53 @@ class SourceDeblendTask(pipeBase.Task):
     def _getPsfFwhm(self, psf, position):
         return psf.computeShape(position).getDeterminantRadius() * 2.35
 
+    def getExposureCache(self, exposure, psf):
+        """Return the exposure-level state used to deblend ``exposure``.
+
+        If ``cacheExposureState`` is set and the previous call was for the
+        same exposure and PSF, with the same pixels, the cached state is
+        reused; otherwise it is rebuilt.  The pixels are compared by a
+        digest of the image, variance and mask (less the
+        ``notDeblendedMask`` plane the task sets itself), so an exposure
+        modified in place between calls gets new state.
+
+        Parameters
+        ----------
+        exposure : `lsst.afw.image.Exposure`
+            Exposure to be processed
+        psf : `lsst.afw.detection.Psf`
+            Point source function
+
+        Returns
+        -------
+        cache : `DeblendExposureCache`
+            Noise estimate and PSF caches for ``exposure``.
+        """
+        pixelKey = None
+        if self.config.cacheExposureState:
+            pixelKey = exposureKey(exposure, None, ignoreMaskPlane=self.config.notDeblendedMask)
+        cache = self._exposureCache
+        if cache is None or not cache.matches(exposure, psf, self.config.maskPlanes, pixelKey):
+            cache = DeblendExposureCache(exposure, psf, self.config.maskPlanes,
+                                         psfCacheSize=self.config.psfCacheSize, pixelKey=pixelKey)
+        else:
+            self.log.debug("Reusing cached exposure state (%d PSF images)", len(cache.cachingPsf.cache))
+        self._exposureCache = cache if self.config.cacheExposureState else None
+        return cache
+
+    def _getCachedPsfFwhm(self, cache, psf, position):
+        key = (position.getX(), position.getY())
+        psf_fwhm = cache.psfFwhms.get(key)
+        if psf_fwhm is None:
+            cache.psfFwhmMisses += 1
+            psf_fwhm = self._getPsfFwhm(psf, position)
+            cache.psfFwhms[key] = psf_fwhm
+        else:
+            cache.psfFwhmHits += 1
+        return psf_fwhm
+
     @timeMethod
-    def deblend(self, exposure, srcs, psf):
+    def deblend(self, exposure, srcs, psf, sigma1=None):
         """Deblend.
 
         Parameters
@@ -293,11 +600,209 @@ class SourceDeblendTask(pipeBase.Task):
             SourceCatalog containing sources detected on this exposure
         psf : `lsst.afw.detection.Psf`
             Point source function
+        sigma1 : `float`, optional
+            Noise level to use instead of the median of the variance
+            plane, e.g. when ``exposure`` is a cutout of a larger image.
 
         Returns
         -------
         None
         """
+        self._useParentSpansOf(srcs)
+        if self.config.workerAddress and not self.config.useCiLimits:
+            self._deblendOnWorker(exposure, srcs, psf, sigma1)
+            return
+        profiler = self._startProfiler()
+        stream = self._startChildStream()
+        try:
+            self._deblend(exposure, srcs, psf, sigma1, profiler, stream)
+        finally:
+            if stream is not None:
+                self._finishChildStream(stream)
+            if profiler is not None:
+                self._stopProfiler(profiler)
+
+    def _deblendOnWorker(self, exposure, srcs, psf, sigma1):
+        """Deblend ``srcs`` on the worker at ``workerAddress`` and merge
+        its children into ``srcs``.
+
+        The children get IDs from ``srcs`` in parent order, as they would
+        here, and the parents that were not deblended are masked in
+        ``exposure``.  Children are exported and compressed here; the
+        profiler, performance counters, metrics and single-parent hooks
+        are not run.
+        """
+        if self.config.doStreamChildren:
+            raise RuntimeError("doStreamChildren is not supported when deblending on a worker")
+        t0 = time.time()
+        client = self._workerClient
+        if client is None or client.address != self.config.workerAddress:
+            if client is not None:
+                client.close()
+            client = DeblendWorkerClient(self.config.workerAddress)
+            self._workerClient = client
+            client.init(self.config, afwTable.BaseCatalog(self._inputSchema),
+                        afwTable.BaseCatalog(self._peakSchema) if self._peakSchema is not None else None)
+        key = exposureKey(exposure, psf, ignoreMaskPlane=self.config.notDeblendedMask)
+        result, info = client.deblend(key, exposure, psf, srcs, sigma1)
+
+        n0 = len(srcs)
+        mask = exposure.getMaskedImage().getMask()
+        maskUpdates = self._makeMaskUpdates(mask)
+        for i in range(n0):
+            spans = srcs[i].getFootprint().getSpans()
+            srcs[i].assign(result[i])
+            self._rememberParentSpans(srcs[i], spans)
+        for kid in result[n0:]:
+            child = srcs.addNew()
+            childId = child.getId()
+            child.assign(kid)
+            child.setId(childId)
+        for i in range(n0):
+            src = srcs[i]
+            if src.get(self.tooBigKey) or src.get(self.maskedKey):
+                self.skipParent(src, mask, maskUpdates)
+        if maskUpdates is not None:
+            maskUpdates.apply()
+
+        self.metadata["workerExposureCached"] = info["cached"]
+        self.metadata["workerSeconds"] = info["seconds"]
+        n1 = len(srcs)
+        self.log.info("Deblended %d sources on the worker at %s, creating %d children "
+                      "(%s exposure state; %.2f s, %.2f s on the worker)", n0, self.config.workerAddress,
+                      n1 - n0, "cached" if info["cached"] else "new", time.time() - t0, info["seconds"])
+
+        if self.config.doExportChildren:
+            self.exportChildren(srcs)
+        if self.config.compressChildren:
+            self.compressChildren(srcs)
+
+    def _useParentSpansOf(self, srcs):
+        """Keep the spans remembered by `_rememberParentSpans` for the
+        catalog ``srcs`` only, forgetting those of any other catalog.
+
+        Catalogs are told apart by their table (catalogs made from one
+        another, like the subsets of `deblendRegion`, share it), so the
+        parents of another catalog with the same IDs are not confused with
+        those of ``srcs``, and the spans of at most one catalog are kept.
+        """
+        table = srcs.getTable()
+        if table is not self._parentSpansTable:
+            self._parentSpansTable = table
+            self._parentSpans = {}
+
+    def _rememberParentSpans(self, src, spans):
+        """Keep ``spans``, the spans parent ``src`` had before it was
+        deblended, if deblending changed them, for `deblendRegion`.
+        """
+        if src.getId() not in self._parentSpans and src.getFootprint().getSpans() != spans:
+            self._parentSpans[src.getId()] = spans
+
+    def deblendRegion(self, exposure, srcs, bbox=None, ids=None, psf=None, sigma1=None, index=None):
+        """Deblend only the parents overlapping ``bbox`` or with IDs in
+        ``ids``, replacing any children they already have in ``srcs``.
+
+        The new children take the IDs of the children they replace (matched
+        by ``deblend_peakId``); other children get new IDs.  They are put
+        where the replaced children were, or at the end of the catalog.
+        Parents that this task deblended before, as part of this catalog
+        and with no other catalog deblended since, are deblended again from
+        the footprints they had then, not from the union with their
+        children's footprints that deblending leaves them with, so a rerun
+        gives the result of the first run.  The exposure-level state is
+        shared with `deblend` and reused between calls when
+        ``cacheExposureState`` is set.
+
+        Parameters
+        ----------
+        exposure : `lsst.afw.image.Exposure`
+            Exposure the sources were detected on.
+        srcs : `lsst.afw.table.SourceCatalog`
+            Catalog of parents, possibly with children; modified in place.
+        bbox : `lsst.geom.Box2I`, optional
+            Deblend the parents whose footprint bounding box overlaps it.
+        ids : iterable of `int`, optional
+            Deblend the parents with these IDs.
+        psf : `lsst.afw.detection.Psf`, optional
+            Point spread function; that of ``exposure`` by default.
+        sigma1 : `float`, optional
+            Noise level, as for `deblend`.
+        index : `ParentIndex`, optional
+            Index over the parents of ``srcs``, e.g. kept between calls;
+            built if not given.  The entries of the deblended parents are
+            updated to their new footprints.
+
+        Returns
+        -------
+        parents : `list` of `lsst.afw.table.SourceRecord`
+            The parents that were deblended.
+        """
+        if psf is None:
+            psf = exposure.getPsf()
+        if index is None:
+            index = ParentIndex(srcs)
+        self._useParentSpansOf(srcs)
+        parents = {}
+        if bbox is not None:
+            parents.update((src.getId(), src) for src in index.query(bbox))
+        if ids is not None:
+            parents.update((src.getId(), src) for src in index.get(ids))
+        if not parents:
+            return []
+
+        # Forget the results of any previous run on these parents
+        oldIds = {}
+        for src in srcs:
+            if src.getParent() in parents:
+                oldIds[(src.getParent(), src.get(self.peakIdKey))] = src.getId()
+                self.compressedFootprints.discard(src.getId())
+        resetKeys = [self.tooBigKey, self.maskedKey, self.deblendSkippedKey, self.tooManyPeaksKey]
+        if self.config.catchFailures:
+            resetKeys.append(self.deblendFailedKey)
+        for parent in parents.values():
+            parent.set(self.nChildKey, 0)
+            for key in resetKeys:
+                parent.set(key, False)
+            spans = self._parentSpans.get(parent.getId())
+            if spans is not None:
+                parent.getFootprint().setSpans(spans)
+
+        # New IDs must not collide with those of the whole catalog
+        srcs.getIdFactory().notify(max(src.getId() for src in srcs))
+        subset = afwTable.SourceCatalog(srcs.getTable())
+        for src in srcs:
+            if src.getId() in parents:
+                subset.append(src)
+        nParents = len(subset)
+        self.deblend(exposure, subset, psf, sigma1=sigma1)
+
+        children = {}
+        for child in subset[nParents:]:
+            oldId = oldIds.get((child.getParent(), child.get(self.peakIdKey)))
+            if oldId is not None:
+                self.compressedFootprints.rename(child.getId(), oldId)
+                child.setId(oldId)
+            children.setdefault(child.getParent(), []).append(child)
+
+        # Splice the new children in place of the old ones
+        spliced = afwTable.SourceCatalog(srcs.getTable())
+        for src in srcs:
+            parentId = src.getParent()
+            if parentId in parents:
+                spliced.extend(children.pop(parentId, []))
+            else:
+                spliced.append(src)
+        for parent in subset[:nParents]:
+            spliced.extend(children.pop(parent.getId(), []))
+        srcs.clear()
+        srcs.extend(spliced)
+        for parent in subset[:nParents]:
+            index.update(parent)
+        self.log.info("Deblended %d parents in region, creating %d children",
+                      nParents, len(subset) - nParents)
+        return list(subset[:nParents])
+
+    def _deblend(self, exposure, srcs, psf, sigma1, profiler, stream):
         # Cull footprints if required by ci
         if self.config.useCiLimits:
             self.log.info(f"Using CI catalog limits, "
@@ -329,20 +834,51 @@ class SourceDeblendTask(pipeBase.Task):
 
         from lsst.meas.deblender.baseline import deblend
 
-        # find the median stdev in the image...
         mi = exposure.getMaskedImage()
-        statsCtrl = afwMath.StatisticsControl()
-        statsCtrl.setAndMask(mi.getMask().getPlaneBitMask(self.config.maskPlanes))
-        stats = afwMath.makeStatistics(mi.getVariance(), mi.getMask(), afwMath.MEDIAN, statsCtrl)
-        sigma1 = math.sqrt(stats.getValue(afwMath.MEDIAN))
+        cache = self.getExposureCache(exposure, psf)
+        if sigma1 is None:
+            sigma1 = cache.sigma1
         self.log.trace('sigma1: %g', sigma1)
 
         n0 = len(srcs)
         nparents = 0
+        monitors = [profiler] if profiler is not None else []
+        counters = self._startPerfCounters()
+        if counters is not None:
+            monitors.append(counters)
+        metrics = self._startMetrics()
+        if metrics is not None:
+            monitors.append(metrics)
+        monitors = monitors or None
+        medianValidation = None
+        if self.config.medianFilterMethod != 'exact':
+            medianValidation = MedianFilterValidation(self.config.medianValidationInterval)
+        screen = None
+        if self.config.prescreenParents:
+            if self.config.notDeblendedMask in self.config.maskLimits:
+                # Skipped parents change the mask that later parents are checked against
+                self.log.debug("Not prescreening parents: notDeblendedMask is in maskLimits")
+            elif (type(self).isLargeFootprint is not SourceDeblendTask.isLargeFootprint
+                  or type(self).isMasked is not SourceDeblendTask.isMasked):
+                self.log.debug("Not prescreening parents: isLargeFootprint or isMasked is overridden")
+            else:
+                screen = self.screenParents(srcs, mi.getMask(), psf, cache)
+        maskUpdates = self._makeMaskUpdates(mi.getMask())
+        batch = None
+        if self.config.useNativeBatch:
+            batch = self._deblendNativeBatch(srcs, mi, psf, sigma1, screen, monitors, medianValidation)
         for i, src in enumerate(srcs):
             # t0 = time.clock()
+            if profiler is not None:
+                profiler.setParent(src.getId())
 
             fp = src.getFootprint()
+            parentSpans = fp.getSpans()
+            if counters is not None:
+                counters.setParent(src.getId(), fp.getArea())
+            if metrics is not None:
+                self._updateMetricCaches(metrics, cache)
+                metrics.update()
             pks = fp.getPeaks()
 
             # Since we use the first peak for the parent object, we should propagate its flags
@@ -352,24 +888,37 @@ class SourceDeblendTask(pipeBase.Task):
             if len(pks) < 2:
                 continue
 
-            if self.isLargeFootprint(fp):
+            if screen is not None:
+                reason = screen.reason[i]
+                isLarge = reason == int(ParentScreen.TOO_BIG)
+                isMasked = reason == int(ParentScreen.MASKED)
+            else:
+                isLarge = self.isLargeFootprint(fp)
+                isMasked = not isLarge and self.isMasked(fp, mi.getMask())
+            if isLarge:
+                if metrics is not None:
+                    metrics.parentSkipped("tooBig")
                 src.set(self.tooBigKey, True)
-                self.skipParent(src, mi.getMask())
+                self.skipParent(src, mi.getMask(), maskUpdates)
                 self.log.debug('Parent %i: skipping large footprint (area: %i)',
                                int(src.getId()), int(fp.getArea()))
                 continue
-            if self.isMasked(fp, exposure.getMaskedImage().getMask()):
+            if isMasked:
+                if metrics is not None:
+                    metrics.parentSkipped("masked")
                 src.set(self.maskedKey, True)
-                self.skipParent(src, mi.getMask())
+                self.skipParent(src, mi.getMask(), maskUpdates)
                 self.log.debug('Parent %i: skipping masked footprint (area: %i)',
                                int(src.getId()), int(fp.getArea()))
                 continue
 
             nparents += 1
             center = fp.getCentroid()
-            psf_fwhm = self._getPsfFwhm(psf, center)
+            psf_fwhm = self._getCachedPsfFwhm(cache, psf, center)
 
             if not (psf_fwhm > 0):
+                if metrics is not None:
+                    metrics.parentSkipped("psfFwhmInvalid")
                 if self.config.catchFailures:
                     self.log.warning("Unable to deblend source %d: because PSF FWHM=%f is invalid.",
                                      src.getId(), psf_fwhm)
@@ -387,27 +936,42 @@ class SourceDeblendTask(pipeBase.Task):
             src.set(self.tooManyPeaksKey, len(fp.getPeaks()) > self.config.maxNumberOfPeaks)
 
             try:
-                res = deblend(
-                    fp, mi, psf, psf_fwhm, sigma1=sigma1,
-                    psfChisqCut1=self.config.psfChisq1,
-                    psfChisqCut2=self.config.psfChisq2,
-                    psfChisqCut2b=self.config.psfChisq2b,
-                    maxNumberOfPeaks=self.config.maxNumberOfPeaks,
-                    strayFluxToPointSources=self.config.strayFluxToPointSources,
-                    assignStrayFlux=self.config.assignStrayFlux,
-                    strayFluxAssignment=self.config.strayFluxRule,
-                    rampFluxAtEdge=(self.config.edgeHandling == 'ramp'),
-                    patchEdges=(self.config.edgeHandling == 'noclip'),
-                    tinyFootprintSize=self.config.tinyFootprintSize,
-                    clipStrayFluxFraction=self.config.clipStrayFluxFraction,
-                    weightTemplates=self.config.weightTemplates,
-                    removeDegenerateTemplates=self.config.removeDegenerateTemplates,
-                    maxTempDotProd=self.config.maxTempDotProd,
-                    medianSmoothTemplate=self.config.medianSmoothTemplate
-                )
+                if batch is not None and i in batch:
+                    res = batch.pop(i)
+                    if not res.deblended:
+                        raise RuntimeError(res.message or str(res.status))
+                    src.getFootprint().setSpans(res.parentSpans)
+                else:
+                    res = deblend(
+                        fp, mi, psf, psf_fwhm, sigma1=sigma1,
+                        psfChisqCut1=self.config.psfChisq1,
+                        psfChisqCut2=self.config.psfChisq2,
+                        psfChisqCut2b=self.config.psfChisq2b,
+                        maxNumberOfPeaks=self.config.maxNumberOfPeaks,
+                        strayFluxToPointSources=self.config.strayFluxToPointSources,
+                        assignStrayFlux=self.config.assignStrayFlux,
+                        strayFluxAssignment=self.config.strayFluxRule,
+                        rampFluxAtEdge=(self.config.edgeHandling == 'ramp'),
+                        patchEdges=(self.config.edgeHandling == 'noclip'),
+                        tinyFootprintSize=self.config.tinyFootprintSize,
+                        clipStrayFluxFraction=self.config.clipStrayFluxFraction,
+                        weightTemplates=self.config.weightTemplates,
+                        removeDegenerateTemplates=self.config.removeDegenerateTemplates,
+                        maxTempDotProd=self.config.maxTempDotProd,
+                        medianSmoothTemplate=self.config.medianSmoothTemplate,
+                        medianFilterHalfsize=self.config.medianFilterHalfsize,
+                        medianFilterMethod=self.config.medianFilterMethod,
+                        medianValidation=medianValidation,
+                        tiledMinArea=self.config.tiledTemplateMinArea,
+                        spanTemplateSum=self.config.spanTemplateSum,
+                        psfCache=cache.cachingPsf,
+                        monitors=monitors,
+                    )
                 if self.config.catchFailures:
                     src.set(self.deblendFailedKey, False)
             except Exception as e:
+                if metrics is not None:
+                    metrics.parentSkipped("deblendFailed")
                 if self.config.catchFailures:
                     self.log.warning("Unable to deblend source %d: %s", src.getId(), e)
                     src.set(self.deblendFailedKey, True)
@@ -431,13 +995,10 @@ class SourceDeblendTask(pipeBase.Task):
                     self.log.trace("Peak at (%i,%i) failed.  Using minimal default info for child.",
                                    pks[j].getIx(), pks[j].getIy())
                     if heavy is None:
-                        # copy the full footprint and strip out extra peaks
-                        foot = afwDet.Footprint(src.getFootprint())
-                        peakList = foot.getPeaks()
-                        peakList.clear()
-                        peakList.append(peak.peak)
-                        zeroMimg = afwImage.MaskedImageF(foot.getBBox())
-                        heavy = afwDet.makeHeavyFootprint(foot, zeroMimg)
+                        # the parent's spans, holding only this peak, with zero pixels
+                        foot = src.getFootprint()
+                        heavy = bUtils.makePlaceholderFootprint(foot.getSpans(), peak.peak,
+                                                                foot.getRegion())
                     if peak.deblendedAsPsf:
                         if peak.psfFitFlux is None:
                             peak.psfFitFlux = 0.0
@@ -487,22 +1048,289 @@ class SourceDeblendTask(pipeBase.Task):
             for child in kids:
                 spans = spans.union(child.getFootprint().spans)
             src.getFootprint().setSpans(spans)
+            self._rememberParentSpans(src, parentSpans)
 
             src.set(self.nChildKey, nchild)
+            if metrics is not None:
+                metrics.parentDeblended(nchild)
 
             self.postSingleDeblendHook(exposure, srcs, i, npre, kids, fp, psf, psf_fwhm, sigma1, res)
+            if stream is not None:
+                stream.append(kids)
+                if self.config.streamDropPixels:
+                    for child in kids:
+                        child.setFootprint(afwDet.Footprint(child.getFootprint()))
             # print('Deblending parent id', src.getId(), 'took', time.clock() - t0)
 
+        if maskUpdates is not None:
+            nPixels = maskUpdates.apply()
+            self.log.debug("Set %s in %d pixels", self.config.notDeblendedMask, nPixels)
+
         n1 = len(srcs)
         self.log.info('Deblended: of %i sources, %i were deblended, creating %i children, total %i sources',
                       n0, nparents, n1-n0, n1)
 
+        self.metadata["medianFilterMethod"] = self.config.medianFilterMethod
+        if medianValidation is not None and medianValidation.nSamples > 0:
+            self.metadata["medianValidationSamples"] = medianValidation.nSamples
+            self.metadata["medianMaxDeviation"] = medianValidation.maxDeviation
+            self.metadata["medianRmsDeviation"] = medianValidation.rmsDeviation
+            self.log.info("Median filter '%s' deviation from exact, in units of sigma1, "
+                          "over %d templates: max %.3g, rms %.3g", self.config.medianFilterMethod,
+                          medianValidation.nSamples, medianValidation.maxDeviation,
+                          medianValidation.rmsDeviation)
+
+        if counters is not None:
+            self._reportPerfCounters(counters)
+        if metrics is not None:
+            self._updateMetricCaches(metrics, cache)
+            metrics.update(force=True)
+
+        if self.config.doExportChildren:
+            self.exportChildren(srcs)
+        if self.config.compressChildren:
+            self.compressChildren(srcs)
+
+    def _startProfiler(self):
+        """Start a `SamplingProfiler` if ``profileSampleInterval`` is set.
+        """
+        if not self.config.profileSampleInterval > 0:
+            return None
+        profiler = SamplingProfiler(self.config.profileSampleInterval, self.config.profileTopN)
+        if not profiler.start():
+            self.log.warning("Not profiling: sampling is only possible on the main thread")
+            return None
+        return profiler
+
+    def _stopProfiler(self, profiler):
+        """Stop ``profiler`` and write its samples.
+        """
+        profiler.stop()
+        self._profileRun += 1
+        prefix = "%s-%d" % (self.config.profileOutput, self._profileRun)
+        profiler.writeCollapsed(prefix + ".folded")
+        profiler.writeSlowest(prefix + "-slowest.folded")
+        slowest = profiler.getSlowest()
+        self.metadata["profileSamples"] = profiler.nSamples
+        self.metadata["profileSlowestParents"] = [int(parentId) for parentId, _, _ in slowest]
+        self.log.info("Wrote %d profile samples to %s.folded; slowest parents: %s", profiler.nSamples,
+                      prefix, ", ".join("%d (%.2f s)" % (parentId, duration)
+                                        for parentId, duration, _ in slowest))
+
+    def _deblendNativeBatch(self, srcs, mi, psf, sigma1, screen, monitors, medianValidation):
+        """Deblend all the parents to be deblended in one call to the
+        native deblender, unless per-parent python code is needed.
+
+        Returns
+        -------
+        batch : `dict` [`int`, `NativeDeblendResult`] or `None`
+            The result for the index in ``srcs`` of each parent, or `None`
+            if the parents must be deblended one at a time.
+        """
+        reason = None
+        if screen is None:
+            reason = "the parents are not prescreened"
+        elif (type(self).preSingleDeblendHook is not SourceDeblendTask.preSingleDeblendHook
+              or type(self).postSingleDeblendHook is not SourceDeblendTask.postSingleDeblendHook):
+            reason = "preSingleDeblendHook or postSingleDeblendHook is overridden"
+        elif monitors:
+            reason = "monitors need the python plugins"
+        elif medianValidation is not None:
+            reason = "the median filter is validated"
+        elif self.config.weightTemplates or self.config.removeDegenerateTemplates:
+            reason = "weightTemplates and removeDegenerateTemplates are not supported natively"
+        if reason is not None:
+            self.log.info("Not deblending in a native batch: %s", reason)
+            return None
+
+        indices = [i for i in range(len(srcs)) if screen.reason[i] == int(ParentScreen.DEBLEND)]
+        results = deblendMany(self.config, mi, psf, sigma1, [srcs[i].getFootprint() for i in indices],
+                              self.config.nativeBatchThreads)
+        self.log.info("Deblended %d parents in a native batch", len(indices))
+        return dict(zip(indices, results))
+
+    def _startPerfCounters(self):
+        """Open the hardware performance counters if ``perfCounters`` is
+        set and the platform provides them.
+        """
+        if not self.config.perfCounters:
+            return None
+        counters = PerfCounterMonitor()
+        if not counters.available:
+            self.log.warning("Not reading performance counters: perf_event_open is unavailable "
+                             "(see /proc/sys/kernel/perf_event_paranoid)")
+            return None
+        return counters
+
+    def _startMetrics(self):
+        """Return the task's `DeblendMetrics`, created on first use, if
+        ``metricsFile`` is set.
+        """
+        if not self.config.metricsFile:
+            return None
+        if self.metrics is None or self.metrics.filename != self.config.metricsFile:
+            self.metrics = DeblendMetrics(self.config.metricsFile, self.config.metricsInterval)
+        self.metrics.startRun()
+        return self.metrics
+
+    def _updateMetricCaches(self, metrics, cache):
+        """Copy the hit counts of the exposure caches to ``metrics``.
+        """
+        metrics.setCache("psfImage", cache.cachingPsf.hits, cache.cachingPsf.misses)
+        metrics.setCache("psfFwhm", cache.psfFwhmHits, cache.psfFwhmMisses)
+
+    def _reportPerfCounters(self, counters):
+        """Record the per-plugin counts of ``counters`` in the metadata
+        and the log.
+        """
+        def fmt(value, spec):
+            return "n/a" if value is None else spec % value
+
+        for name, entry in sorted(counters.getSummary().items()):
+            for key in ("calls", "pixels", "ipc", "cacheMissesPerPixel", "branchMissesPerPixel"):
+                if entry[key] is not None:
+                    self.metadata["perf_%s_%s" % (name, key)] = entry[key]
+            self.log.info("%s: %d calls, %d pixels, IPC %s, %s cache misses/pixel, "
+                          "%s branch misses/pixel", name, entry["calls"], entry["pixels"],
+                          fmt(entry["ipc"], "%.2f"), fmt(entry["cacheMissesPerPixel"], "%.3g"),
+                          fmt(entry["branchMissesPerPixel"], "%.3g"))
+
+    def getExportColumns(self):
+        """Return the summary columns written by `exportChildren`.
+
+        Returns
+        -------
+        columns : `dict` [`str`, `str`]
+            Column name and schema field name of each column.
+        """
+        return {
+            "peakId": "deblend_peakId",
+            "peakCenter_x": "deblend_peak_center_x",
+            "peakCenter_y": "deblend_peak_center_y",
+            "psfFlux": "deblend_psf_instFlux",
+            "psfCenter_x": "deblend_psfCenter_x",
+            "psfCenter_y": "deblend_psfCenter_y",
+            "deblendedAsPsf": "deblend_deblendedAsPsf",
+            "rampedTemplate": "deblend_rampedTemplate",
+            "patchedTemplate": "deblend_patchedTemplate",
+            "hasStrayFlux": "deblend_hasStrayFlux",
+            "parentNPeaks": "deblend_parentNPeaks",
+        }
+
+    def exportChildren(self, srcs):
+        """Write the children in ``srcs`` to the next child column file.
+
+        Parameters
+        ----------
+        srcs : `lsst.afw.table.SourceCatalog`
+            Deblended catalog.
+        """
+        self._exportRun += 1
+        filename = "%s-%d.children" % (self.config.exportOutput, self._exportRun)
+        nChildren = writeChildColumns(filename, srcs, self.getExportColumns(),
+                                      pixels=self.config.exportPixels)
+        self.metadata["exportFile"] = filename
+        self.log.info("Exported %d children to %s", nChildren, filename)
+
+    def _startChildStream(self):
+        """Open the next child stream file if ``doStreamChildren`` is set.
+        """
+        if not self.config.doStreamChildren:
+            return None
+        self._streamRun += 1
+        filename = "%s-%d.childstream" % (self.config.exportOutput, self._streamRun)
+        return ChildStreamWriter(filename, self.getExportColumns(), pixels=self.config.exportPixels,
+                                 maxQueued=self.config.streamQueueSize)
+
+    def _finishChildStream(self, stream):
+        """Wait for ``stream`` to write the queued children and close it.
+        """
+        nChildren = stream.close()
+        self.metadata["streamFile"] = stream.filename
+        self.metadata["streamedChildren"] = nChildren
+        self.log.info("Streamed %d children to %s in %d blocks", nChildren, stream.filename,
+                      stream.nBlocks)
+
+    def compressChildren(self, srcs):
+        """Move the pixels of the children in ``srcs`` to
+        ``self.compressedFootprints``.
+
+        Each compressed child is flagged ``deblend_pixelsCompressed``
+        and has a plain Footprint until restored, with `restoreChildren`,
+        which must be done before the children are measured.
+
+        Parameters
+        ----------
+        srcs : `lsst.afw.table.SourceCatalog`
+            Deblended catalog; modified in place.
+        """
+        store = self.compressedFootprints
+        store.level = self.config.compressionLevel
+        nCompressed = store.compress(srcs)
+        self.metadata["compressedChildren"] = nCompressed
+        self.metadata["compressedBytes"] = store.compressedBytes
+        self.metadata["uncompressedBytes"] = store.rawBytes
+        self.log.info("Compressed the pixels of %d children: %d bytes held for %d uncompressed",
+                      nCompressed, store.compressedBytes, store.rawBytes)
+
+    def restoreChildren(self, srcs):
+        """Put back the HeavyFootprints of the children of ``srcs`` held
+        compressed by `compressChildren`, clearing their
+        ``deblend_pixelsCompressed`` flags.
+
+        Parameters
+        ----------
+        srcs : `lsst.afw.table.SourceCatalog`
+            Deblended catalog; modified in place.
+        """
+        self.compressedFootprints.restoreAll(srcs)
+
     def preSingleDeblendHook(self, exposure, srcs, i, fp, psf, psf_fwhm, sigma1):
         pass
 
     def postSingleDeblendHook(self, exposure, srcs, i, npre, kids, fp, psf, psf_fwhm, sigma1, res):
         pass
 
+    def screenParents(self, srcs, mask, psf, cache=None):
+        """Decide which parents of ``srcs`` to deblend, as the deblending
+        loop does one parent at a time.
+
+        Parameters
+        ----------
+        srcs : `lsst.afw.table.SourceCatalog`
+            Catalog to deblend.
+        mask : `lsst.afw.image.Mask`
+            Mask checked against ``maskLimits``.
+        psf : `lsst.afw.detection.Psf`
+            PSF used to compute the FWHM of each parent to deblend.
+        cache : `DeblendExposureCache`, optional
+            Exposure cache to which the PSF FWHMs are added.
+
+        Returns
+        -------
+        screen : `lsst.meas.deblender.ParentScreen`
+            Arrays, with one element per record, of the reason for
+            skipping (``ParentScreen.DEBLEND`` for parents to deblend),
+            the estimated relative cost, the footprint centroid and the
+            PSF FWHM at the centroid.
+        """
+        screen = screenParents(srcs, mask, psf, self.config.maxFootprintArea, self.config.maxFootprintSize,
+                               self.config.minFootprintAxisRatio, dict(self.config.maskLimits))
+        reason = screen.reason
+        toDeblend = (reason == int(ParentScreen.DEBLEND)) | (reason == int(ParentScreen.BAD_PSF))
+        if cache is not None:
+            for x, y, fwhm in zip(screen.centroidX[toDeblend], screen.centroidY[toDeblend],
+                                  screen.psfFwhm[toDeblend]):
+                cache.psfFwhms[(x, y)] = fwhm
+        self.metadata["prescreenToDeblend"] = int(toDeblend.sum())
+        self.metadata["prescreenTooBig"] = int((reason == int(ParentScreen.TOO_BIG)).sum())
+        self.metadata["prescreenMasked"] = int((reason == int(ParentScreen.MASKED)).sum())
+        self.metadata["prescreenCost"] = float(screen.cost[toDeblend].sum())
+        self.log.debug("Prescreened %d sources: %d to deblend, %d too big, %d masked", len(srcs),
+                       self.metadata["prescreenToDeblend"], self.metadata["prescreenTooBig"],
+                       self.metadata["prescreenMasked"])
+        return screen
+
     def isLargeFootprint(self, footprint):
         """Returns whether a Footprint is large
 
@@ -536,7 +1364,19 @@ class SourceDeblendTask(pipeBase.Task):
                 return True
         return False
 
-    def skipParent(self, source, mask):
+    def _makeMaskUpdates(self, mask):
+        """Return the buffer the ``notDeblendedMask`` updates of skipped
+        parents go to, or `None` to apply them at once.
+
+        They are applied at once if the plane is in ``maskLimits``: the
+        plane of the parents skipped so far is then part of the check of
+        the next parents.
+        """
+        if not self.config.notDeblendedMask or self.config.notDeblendedMask in self.config.maskLimits:
+            return None
+        return MaskPlaneUpdates(mask, self.config.notDeblendedMask)
+
+    def skipParent(self, source, mask, maskUpdates=None):
         """Indicate that the parent source is not being deblended
 
         We set the appropriate flags and mask.
@@ -547,10 +1387,15 @@ class SourceDeblendTask(pipeBase.Task):
             The source to flag as skipped
         mask : `lsst.afw.image.Mask`
             The mask to update
+        maskUpdates : `MaskPlaneUpdates`, optional
+            If given, the mask update is added to it instead, to be
+            applied with those of the other skipped parents.
         """
         fp = source.getFootprint()
         source.set(self.deblendSkippedKey, True)
-        if self.config.notDeblendedMask:
+        if maskUpdates is not None:
+            maskUpdates.add(fp.spans)
+        elif self.config.notDeblendedMask:
             mask.addMaskPlane(self.config.notDeblendedMask)
             fp.spans.setMask(mask, mask.getPlaneBitMask(self.config.notDeblendedMask))
 
@@ -0,0 +1,307 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+"""A long-lived local process that deblends for short-lived tasks,
+keeping the exposure-level caches warm between them.
+"""
+
+__all__ = ['exposureKey', 'DeblendWorker', 'DeblendWorkerClient', 'startWorker']
+
+import argparse
+import hashlib
+import multiprocessing
+import multiprocessing.connection
+import os
+import pickle
+import time
+import traceback
+from collections import OrderedDict
+
+import numpy as np
+
+
+def exposureKey(exposure, psf, ignoreMaskPlane=None):
+    """Return a digest identifying the pixels of ``exposure`` and ``psf``.
+
+    Parameters
+    ----------
+    exposure : `lsst.afw.image.Exposure`
+        Exposure to identify.
+    psf : `lsst.afw.detection.Psf` or `None`
+        Point spread function used with ``exposure``; must be picklable.
+        If `None`, only the pixels are identified.
+    ignoreMaskPlane : `str`, optional
+        Mask plane left out of the digest, e.g. the one the deblender
+        itself sets, so that a rerun on the same exposure has the same key.
+
+    Returns
+    -------
+    key : `str`
+        Hexadecimal digest.
+    """
+    mi = exposure.getMaskedImage()
+    digest = hashlib.blake2b(digest_size=20)
+    bbox = exposure.getBBox()
+    digest.update(np.array([bbox.getMinX(), bbox.getMinY(), bbox.getWidth(), bbox.getHeight()],
+                           dtype=np.int64).tobytes())
+    digest.update(np.ascontiguousarray(mi.getImage().getArray()).tobytes())
+    digest.update(np.ascontiguousarray(mi.getVariance().getArray()).tobytes())
+    mask = mi.getMask()
+    maskArray = mask.getArray()
+    if ignoreMaskPlane and ignoreMaskPlane in mask.getMaskPlaneDict():
+        maskArray = maskArray & ~mask.getPlaneBitMask(ignoreMaskPlane)
+    digest.update(np.ascontiguousarray(maskArray).tobytes())
+    if psf is not None:
+        digest.update(pickle.dumps(psf))
+    return digest.hexdigest()
+
+
+class _ExposureEntry:
+    """An exposure held by `DeblendWorker` and its cached state.
+    """
+
+    def __init__(self, exposure, psf):
+        self.exposure = exposure
+        self.psf = psf
+        self.cache = None
+
+
+class DeblendWorker:
+    """Serve deblend requests from `DeblendWorkerClient` over a local
+    socket.
+
+    Each client connection sends its task configuration and schemas
+    once; the worker builds a `SourceDeblendTask` from them.  The
+    exposures sent with deblend requests are kept, by `exposureKey`,
+    together with their `DeblendExposureCache` (noise estimate, PSF
+    images and PSF FWHMs), so that later requests on the same pixels,
+    from the same client or from later ones, send only the parents and
+    reuse the warm caches.  The mask of a held exposure is restored
+    after each request, so the planes set while deblending do not
+    accumulate.
+
+    Connections are served one at a time; later clients wait in the
+    listen queue.
+
+    Parameters
+    ----------
+    address : `str` or `tuple`
+        Unix socket path, or ``(host, port)``, to listen on.
+    authkey : `bytes`, optional
+        Key the clients must present.
+    maxExposures : `int`, optional
+        Number of exposures held; the least recently used is dropped.
+    """
+
+    def __init__(self, address, authkey=None, maxExposures=4):
+        self.address = address
+        self.authkey = authkey
+        self.maxExposures = maxExposures
+        self._exposures = OrderedDict()
+
+    def serve(self):
+        """Serve connections until a client sends "stop".
+        """
+        with multiprocessing.connection.Listener(self.address, authkey=self.authkey) as listener:
+            if isinstance(self.address, str):
+                os.chmod(self.address, 0o600)
+            while True:
+                conn = listener.accept()
+                try:
+                    if not self._serveConnection(conn):
+                        return
+                finally:
+                    conn.close()
+
+    def _serveConnection(self, conn):
+        """Serve one client; return `False` if it asked the worker to stop.
+        """
+        task = None
+        while True:
+            try:
+                msg = conn.recv()
+            except EOFError:
+                return True
+            seq = msg[1]
+            try:
+                if msg[0] == "stop":
+                    conn.send(("ok", seq))
+                    return False
+                elif msg[0] == "init":
+                    task = self._makeTask(*msg[2:])
+                    conn.send(("ok", seq))
+                elif msg[0] == "deblend":
+                    key, exposurePsf, srcs, sigma1 = msg[2:]
+                    entry = self._exposures.get(key)
+                    if entry is None and exposurePsf is None:
+                        conn.send(("missing", seq))
+                        continue
+                    if entry is None:
+                        entry = _ExposureEntry(*exposurePsf)
+                        self._exposures[key] = entry
+                        while len(self._exposures) > self.maxExposures:
+                            self._exposures.popitem(last=False)
+                    self._exposures.move_to_end(key)
+                    info = self._deblend(task, entry, srcs, sigma1)
+                    conn.send(("result", seq, srcs, info))
+                else:
+                    raise RuntimeError("Unknown message %r" % (msg[0],))
+            except Exception:
+                conn.send(("error", seq, traceback.format_exc()))
+
+    def _makeTask(self, config, schemaCat, peakCat):
+        from .sourceDeblendTask import SourceDeblendTask
+
+        # Outputs written by the task itself stay with the client.
+        config.workerAddress = ""
+        config.cacheExposureState = True
+        config.doExportChildren = False
+        config.doStreamChildren = False
+        config.compressChildren = False
+        config.profileSampleInterval = 0.0
+        config.perfCounters = False
+        config.metricsFile = ""
+        return SourceDeblendTask(schema=schemaCat.schema,
+                                 peakSchema=peakCat.schema if peakCat is not None else None,
+                                 config=config)
+
+    def _deblend(self, task, entry, srcs, sigma1):
+        if task is None:
+            raise RuntimeError("Deblend request before init")
+        mask = entry.exposure.getMaskedImage().getMask()
+        savedMask = mask.getArray().copy()
+        cached = (entry.cache is not None
+                  and entry.cache.matches(entry.exposure, entry.psf, task.config.maskPlanes))
+        task._exposureCache = entry.cache
+        t0 = time.time()
+        try:
+            task.deblend(entry.exposure, srcs, entry.psf, sigma1=sigma1)
+        finally:
+            entry.cache = task._exposureCache
+            task._exposureCache = None
+            mask.getArray()[:, :] = savedMask
+        return {"cached": cached, "seconds": time.time() - t0}
+
+
+class DeblendWorkerClient:
+    """Connection from a `SourceDeblendTask` to a `DeblendWorker`.
+
+    Every request carries a sequence number that the reply must echo.
+
+    Parameters
+    ----------
+    address : `str` or `tuple`
+        Address the worker listens on.
+    authkey : `bytes`, optional
+        Key expected by the worker.
+    timeout : `float`, optional
+        Seconds to keep retrying while the worker is starting.
+    """
+
+    def __init__(self, address, authkey=None, timeout=10.0):
+        deadline = time.monotonic() + timeout
+        while True:
+            try:
+                self._conn = multiprocessing.connection.Client(address, authkey=authkey)
+                break
+            except (FileNotFoundError, ConnectionRefusedError):
+                if time.monotonic() > deadline:
+                    raise
+                time.sleep(0.05)
+        self.address = address
+        self._seq = 0
+
+    def call(self, kind, *args):
+        """Send a request and return the reply, raising if the worker
+        failed.
+        """
+        self._seq += 1
+        self._conn.send((kind, self._seq) + args)
+        reply = self._conn.recv()
+        if reply[1] != self._seq:
+            raise RuntimeError("Deblend worker replied to request %d, not %d" % (reply[1], self._seq))
+        if reply[0] == "error":
+            raise RuntimeError("Deblending failed on the worker at %s:\n%s" % (self.address, reply[2]))
+        return reply
+
+    def init(self, config, schemaCat, peakCat):
+        self.call("init", config, schemaCat, peakCat)
+
+    def deblend(self, key, exposure, psf, srcs, sigma1):
+        """Deblend ``srcs`` on the worker, sending ``exposure`` only if
+        the worker does not already hold it.
+
+        Returns
+        -------
+        srcs : `lsst.afw.table.SourceCatalog`
+            The parents followed by their children, as deblended by the
+            worker.
+        info : `dict`
+            ``cached``: whether the exposure-level caches were reused;
+            ``seconds``: time spent deblending on the worker.
+        """
+        reply = self.call("deblend", key, None, srcs, sigma1)
+        if reply[0] == "missing":
+            reply = self.call("deblend", key, (exposure, psf), srcs, sigma1)
+        return reply[2], reply[3]
+
+    def stop(self):
+        """Ask the worker to exit once this connection is closed.
+        """
+        self.call("stop")
+        self.close()
+
+    def close(self):
+        self._conn.close()
+
+
+def _runWorker(address, authkey, maxExposures):
+    DeblendWorker(address, authkey=authkey, maxExposures=maxExposures).serve()
+
+
+def startWorker(address, authkey=None, maxExposures=4):
+    """Start a `DeblendWorker` in a new local process.
+
+    The worker exits with this process; to keep one across pipeline
+    invocations run ``python -m lsst.meas.deblender.worker ADDRESS``.
+
+    Returns
+    -------
+    process : `multiprocessing.Process`
+        The worker; stop it with `DeblendWorkerClient.stop`.
+    """
+    ctx = multiprocessing.get_context("spawn")
+    process = ctx.Process(target=_runWorker, args=(address, authkey, maxExposures), daemon=True)
+    process.start()
+    return process
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Serve deblend requests on a local Unix socket.")
+    parser.add_argument("address", help="Path of the Unix socket to listen on")
+    parser.add_argument("--max-exposures", type=int, default=4,
+                        help="Number of exposures whose caches are kept")
+    args = parser.parse_args()
+    DeblendWorker(args.address, maxExposures=args.max_exposures).serve()
+
+
+if __name__ == "__main__":
+    main()
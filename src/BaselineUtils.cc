@@ -1,10 +1,17 @@
+#include <algorithm>
+#include <array>
 #include <list>
+#include <map>
+#include <utility>
+#include <vector>
 #include <cmath>
 #include <cstdint>
 
 #include "lsst/log/Log.h"
 #include "lsst/geom.h"
 #include "lsst/meas/deblender/BaselineUtils.h"
+#include "lsst/meas/deblender/LaneImage.h"
+#include "lsst/meas/deblender/TiledImage.h"
 #include "lsst/pex/exceptions.h"
 #include "lsst/afw/geom/Span.h"
 
@@ -35,6 +42,12 @@ const int deblend::BaselineUtils<ImagePixelT, MaskPixelT, VariancePixelT>::STRAY
 template <typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
 const int deblend::BaselineUtils<ImagePixelT, MaskPixelT, VariancePixelT>::STRAYFLUX_TRIM;
 
+template <typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+const int deblend::BaselineUtils<ImagePixelT, MaskPixelT, VariancePixelT>::STRAYFLUX_NEAREST_PEAK;
+
+template <typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+const int deblend::BaselineUtils<ImagePixelT, MaskPixelT, VariancePixelT>::TEMPLATE_SUM_BY_SPANS;
+
 static bool span_compare(afwGeom::Span const & sp1,
                          afwGeom::Span const & sp2) {
     return (sp1 < sp2);
@@ -127,6 +140,262 @@ namespace {
             }
         }
     }
+
+    /*
+     * Label each pixel of *spans* with the index of the nearest of the
+     * peaks at (*pkx*, *pky*) for which *use* is set, growing all the
+     * peaks at once, one 8-connected step at a time, within the spans:
+     * each pixel is visited once, whatever the number of peaks.  Pixels
+     * that no peak reaches are left as 0xffff.  The labels are 16 bits,
+     * with 0xfffe and 0xffff reserved, so with 0xfffe peaks or more
+     * nothing is labelled and a null pointer is returned.
+     */
+    std::shared_ptr<image::Image<std::uint16_t>>
+    nearestPeak(afwGeom::SpanSet const& spans,
+                std::vector<int> const& pkx,
+                std::vector<int> const& pky,
+                std::vector<bool> const& use)
+    {
+        typedef std::uint16_t itype;
+
+        const itype nil = 0xffff;
+        const itype outside = 0xfffe;
+
+        if (use.size() >= outside) {
+            return nullptr;
+        }
+
+        geom::Box2I const bbox = spans.getBBox();
+        auto label = std::make_shared<image::Image<itype>>(bbox);
+        *label = outside;
+        spans.setImage(*label, nil);
+
+        int const x0 = bbox.getMinX();
+        int const y0 = bbox.getMinY();
+        int const width = bbox.getWidth();
+        int const height = bbox.getHeight();
+
+        std::vector<std::pair<int, int>> queue;
+        queue.reserve(spans.getArea());
+        for (size_t i = 0; i < use.size(); ++i) {
+            if (!use[i] || !bbox.contains(geom::Point2I(pkx[i], pky[i]))) {
+                continue;
+            }
+            int const x = pkx[i] - x0;
+            int const y = pky[i] - y0;
+            if ((*label)(x, y) == nil) {
+                (*label)(x, y) = static_cast<itype>(i);
+                queue.emplace_back(x, y);
+            }
+        }
+        for (size_t head = 0; head < queue.size(); ++head) {
+            int const x = queue[head].first;
+            int const y = queue[head].second;
+            itype const i = (*label)(x, y);
+            for (int dy = -1; dy <= 1; ++dy) {
+                int const ny = y + dy;
+                if (ny < 0 || ny >= height) {
+                    continue;
+                }
+                for (int dx = -1; dx <= 1; ++dx) {
+                    int const nx = x + dx;
+                    if (nx < 0 || nx >= width || (*label)(nx, ny) != nil) {
+                        continue;
+                    }
+                    (*label)(nx, ny) = i;
+                    queue.emplace_back(nx, ny);
+                }
+            }
+        }
+        return label;
+    }
+} // end anonymous namespace
+
+namespace {
+
+/*
+ * Scratch buffers of the kernels, one per thread and call site (*Use*),
+ * grown to the largest size requested so far and reused by later calls:
+ * the window of a median filter or the per-peak weights of a stray pixel
+ * can be large, so they are neither runtime-sized stack arrays, which
+ * could overflow the smaller stacks of worker threads, nor allocated on
+ * the heap for every call.  A request larger than maxRetainedScratchBytes
+ * gets a buffer of its own, freed with the ScratchBuffer, so that one
+ * huge footprint does not leave that much memory held by every thread
+ * that saw it.  The contents are not initialized.
+ */
+enum ScratchUse {
+    MEDIAN_LOCATIONS,
+    MEDIAN_WINDOW,
+    MEDIAN_ROWS,
+    MEDIAN_LANES,
+    STRAY_CONTRIB
+};
+
+std::size_t const maxRetainedScratchBytes = 1 << 20;
+
+template <typename T, ScratchUse Use>
+class ScratchBuffer {
+public:
+    explicit ScratchBuffer(std::size_t n) {
+        if (n*sizeof(T) > maxRetainedScratchBytes) {
+            _own.resize(n);
+            _data = _own.data();
+            return;
+        }
+        thread_local std::vector<T> buffer;
+        if (buffer.size() < n) {
+            buffer.resize(n);
+        }
+        _data = buffer.data();
+    }
+
+    ScratchBuffer(ScratchBuffer const&) = delete;
+    ScratchBuffer& operator=(ScratchBuffer const&) = delete;
+
+    T* data() const { return _data; }
+
+private:
+    std::vector<T> _own;
+    T* _data;
+};
+
+/*
+ * Copy the margins that medianFilter does not filter from *img* to *out*.
+ */
+template <typename ImageT>
+void copyMedianMargins(ImageT const& img, ImageT & out, int halfsize) {
+    int W = img.getWidth();
+    int H = img.getHeight();
+    // grumble grumble margins
+    for (int y=0; y<2*halfsize; ++y) {
+        int iy = y;
+        if (y >= halfsize)
+            iy = H - 1 - (y-halfsize);
+        typename ImageT::x_iterator optr = out.row_begin(iy);
+        typename ImageT::x_iterator iptr = img.row_begin(iy), end=img.row_end(iy);
+        for (; iptr != end; ++iptr,++optr)
+            *optr = *iptr;
+    }
+    for (int y=halfsize; y<H-halfsize; ++y) {
+        typename ImageT::x_iterator optr = out.row_begin(y);
+        typename ImageT::x_iterator iptr = img.row_begin(y), end=img.row_begin(y)+halfsize;
+        for (; iptr != end; ++iptr,++optr)
+            *optr = *iptr;
+        iptr = img.row_begin(y) + ((W-1) - halfsize);
+        end  = img.row_begin(y) + (W-1);
+        optr = out.row_begin(y) + ((W-1) - halfsize);
+        for (; iptr != end; ++iptr,++optr)
+            *optr = *iptr;
+    }
+}
+
+/*
+ * Split the items [0, keys.size()) into batches of at most LANES items
+ * with the same key, in the order of their first items.  An item that
+ * is not *batchable* gets a batch of its own.
+ */
+template <typename KeyT, int LANES>
+std::vector<std::vector<int>> laneBatches(std::vector<KeyT> const& keys, std::vector<bool> const& batchable) {
+    std::map<KeyT, std::size_t> filling;
+    std::vector<std::vector<int>> batches;
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        if (!batchable[i]) {
+            batches.push_back(std::vector<int>(1, static_cast<int>(i)));
+            continue;
+        }
+        auto found = filling.find(keys[i]);
+        if (found == filling.end() || batches[found->second].size() == LANES) {
+            filling[keys[i]] = batches.size();
+            batches.emplace_back();
+        }
+        batches[filling[keys[i]]].push_back(i);
+    }
+    return batches;
+}
+
+/*
+ * Whether *img* is small enough to be processed in a LaneImage.
+ */
+template <typename PixelT>
+bool fitsLanes(image::Image<PixelT> const& img) {
+    int const maxSize = deblend::BaselineUtils<PixelT>::LANE_BATCH_MAX_SIZE;
+    return img.getWidth() <= maxSize && img.getHeight() <= maxSize;
+}
+
+/*
+ * Whether any pixel of *img* is NaN.
+ */
+template <typename PixelT>
+bool containsNaN(image::Image<PixelT> const& img) {
+    for (int y = 0; y < img.getHeight(); ++y) {
+        for (auto ptr = img.row_begin(y), end = img.row_end(y); ptr != end; ++ptr) {
+            if (std::isnan(*ptr)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/*
+ * Load *imgs*[batch[k]] into lane k of *lanes*; the lanes past the end
+ * of the batch repeat its last image.
+ */
+template <typename PixelT>
+void loadLanes(deblend::LaneImage<PixelT> & lanes,
+               std::vector<std::shared_ptr<image::Image<PixelT>>> const& imgs,
+               std::vector<int> const& batch) {
+    for (int k = 0; k < deblend::LaneImage<PixelT>::LANES; ++k) {
+        lanes.load(*imgs[batch[std::min<std::size_t>(k, batch.size() - 1)]], k);
+    }
+}
+
+/*
+ * The compare-exchanges of Batcher's merge-exchange sorting network for
+ * *n* values (Knuth, TAOCP 5.2.2, algorithm M) that the median, value
+ * n/2 of the sorted values, depends on.  Each pair (a, b) leaves the
+ * smaller value in a and the larger in b.
+ */
+std::vector<std::pair<int, int>> medianNetwork(int n) {
+    std::vector<std::pair<int, int>> network;
+    int t = 0;
+    while ((1 << t) < n) {
+        ++t;
+    }
+    for (int p = (t > 0) ? (1 << (t - 1)) : 0; p > 0; p >>= 1) {
+        int q = 1 << (t - 1);
+        int r = 0;
+        int d = p;
+        for (;;) {
+            for (int i = 0; i < n - d; ++i) {
+                if ((i & p) == r) {
+                    network.emplace_back(i, i + d);
+                }
+            }
+            if (q == p) {
+                break;
+            }
+            d = q - p;
+            q >>= 1;
+            r = p;
+        }
+    }
+    // Walk back from the median, keeping the exchanges it depends on
+    std::vector<bool> needed(n, false);
+    needed[n/2] = true;
+    std::vector<std::pair<int, int>> pruned;
+    for (auto it = network.rbegin(); it != network.rend(); ++it) {
+        if (needed[it->first] || needed[it->second]) {
+            needed[it->first] = true;
+            needed[it->second] = true;
+            pruned.push_back(*it);
+        }
+    }
+    std::reverse(pruned.begin(), pruned.end());
+    return pruned;
+}
+
 } // end anonymous namespace
 
 /**
@@ -151,16 +420,19 @@ medianFilter(ImageT const& img,
     int S = halfsize*2 + 1;
     int SS = S*S;
     typedef typename ImageT::xy_locator xy_loc;
+    typedef typename xy_loc::cached_location_t cached_loc;
     xy_loc pix = img.xy_at(halfsize,halfsize);
-    std::vector<typename xy_loc::cached_location_t> locs;
+    ScratchBuffer<cached_loc, MEDIAN_LOCATIONS> locBuffer(SS);
+    cached_loc* locs = locBuffer.data();
     for (int i=0; i<S; ++i) {
         for (int j=0; j<S; ++j) {
-            locs.push_back(pix.cache_location(j-halfsize, i-halfsize));
+            locs[i*S + j] = pix.cache_location(j-halfsize, i-halfsize);
         }
     }
     int W = img.getWidth();
     int H = img.getHeight();
-    ImagePixelT vals[S*S];
+    ScratchBuffer<ImagePixelT, MEDIAN_WINDOW> valBuffer(SS);
+    ImagePixelT* vals = valBuffer.data();
     for (int y=halfsize; y<H-halfsize; ++y) {
         xy_loc inpix = img.xy_at(halfsize, y), end = img.xy_at(W-halfsize, y);
         for (typename ImageT::x_iterator optr = out.row_begin(y) + halfsize;
@@ -172,72 +444,225 @@ medianFilter(ImageT const& img,
         }
     }
 
-    // grumble grumble margins
-    for (int y=0; y<2*halfsize; ++y) {
-        int iy = y;
-        if (y >= halfsize)
-            iy = H - 1 - (y-halfsize);
-        typename ImageT::x_iterator optr = out.row_begin(iy);
-        typename ImageT::x_iterator iptr = img.row_begin(iy), end=img.row_end(iy);
-        for (; iptr != end; ++iptr,++optr)
-            *optr = *iptr;
-    }
-    for (int y=halfsize; y<H-halfsize; ++y) {
-        typename ImageT::x_iterator optr = out.row_begin(y);
-        typename ImageT::x_iterator iptr = img.row_begin(y), end=img.row_begin(y)+halfsize;
-        for (; iptr != end; ++iptr,++optr)
-            *optr = *iptr;
-        iptr = img.row_begin(y) + ((W-1) - halfsize);
-        end  = img.row_begin(y) + (W-1);
-        optr = out.row_begin(y) + ((W-1) - halfsize);
-        for (; iptr != end; ++iptr,++optr)
-            *optr = *iptr;
+    copyMedianMargins(img, out, halfsize);
+}
+
+/**
+ medianFilter, reading the windows from a TiledImage copy of *img* and
+ visiting the output one tile at a time: each (2*halfsize+1)^2 window
+ spans several rows, which a tiled layout keeps within a few cache
+ lines.  The result, margins included, is identical.
+ */
+template<typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+void
+deblend::BaselineUtils<ImagePixelT,MaskPixelT,VariancePixelT>::
+medianFilterTiled(ImageT const& img,
+                  ImageT & out,
+                  int halfsize) {
+    int const S = halfsize*2 + 1;
+    int const SS = S*S;
+    int const W = img.getWidth();
+    int const H = img.getHeight();
+    int const T = TiledImage<ImagePixelT>::TILE;
+    TiledImage<ImagePixelT> const timg(img);
+    ScratchBuffer<ImagePixelT, MEDIAN_WINDOW> valBuffer(SS);
+    ImagePixelT* vals = valBuffer.data();
+    for (int ty=0; ty<H-halfsize; ty+=T) {
+        for (int tx=0; tx<W-halfsize; tx+=T) {
+            for (int y=std::max(ty, halfsize); y<std::min(ty+T, H-halfsize); ++y) {
+                for (int x=std::max(tx, halfsize); x<std::min(tx+T, W-halfsize); ++x) {
+                    int k = 0;
+                    for (int i=0; i<S; ++i) {
+                        for (int j=0; j<S; ++j) {
+                            vals[k++] = timg(x + j - halfsize, y + i - halfsize);
+                        }
+                    }
+                    std::nth_element(vals, vals + SS/2, vals + SS);
+                    out(x, y) = vals[SS/2];
+                }
+            }
+        }
     }
 
+    copyMedianMargins(img, out, halfsize);
 }
 
 /**
- Given an image *mimg* and Peak location *peak*, overwrite *mimg* so
- that pixels further from the peak have values smaller than those
- close to the peak; make the profile monotonic-decreasing.
-
- The exact algorithm is a little more complicated than that.  The
- basic idea is of "casting a shadow" from a pixel to pixels farther
- from the peak in the same direction.  Done naively, this results in
- very narrow "shadows" and ragged profiles.  A tweak is to make the
- shadows "fatter" -- make a pixel shadow a wedge of pixels -- but if
- one does this naively, the wedge gets wider and wider too quickly.
- The algorithm works out from the peak in square "rings" of pixels, so
- if a pixel shadows a wedge 30 degrees wide, in the next ring of
- pixels the shadowed pixel at largest angle from the shadowing pixel
- will shade a yet-larger wedge, expanding the shadowing angle.  To
- reduce this effect, we work in chunks of 5 pixels in radius, only
- copying the intermediate pixels to the "shadowing" image at the end
- of each chunk.
+ An approximate, separable version of medianFilter: the median of each
+ row segment of 2*halfsize+1 pixels, followed by the median of those
+ row medians down each column.  The cost is O(*halfsize*) per pixel,
+ rather than O(*halfsize*^2) for the exact box median.
+
+ The result is the exact median for profiles that are monotonic in x
+ and y separately; otherwise it typically differs by a small fraction
+ of the local pixel scatter.  The same pixels as in medianFilter (those
+ within *halfsize* of the edges) are copied from *img* to *out*.
+ */
+template<typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+void
+deblend::BaselineUtils<ImagePixelT,MaskPixelT,VariancePixelT>::
+medianFilterSeparable(ImageT const& img,
+                      ImageT & out,
+                      int halfsize) {
+    int const S = halfsize*2 + 1;
+    int const W = img.getWidth();
+    int const H = img.getHeight();
+
+    // Start from a copy of the input: this takes care of the margins.
+    out.assign(img);
+    if (W < S || H < S) {
+        return;
+    }
 
- Currently the mask and variance planes of the input are totally
- ignored.
+    // Row medians for the columns [halfsize, W-halfsize), in every row.
+    int const NX = W - 2*halfsize;
+    ScratchBuffer<ImagePixelT, MEDIAN_ROWS> rowBuffer(static_cast<std::size_t>(NX)*H);
+    ScratchBuffer<ImagePixelT, MEDIAN_WINDOW> valBuffer(S);
+    ImagePixelT* rowmed = rowBuffer.data();
+    ImagePixelT* vals = valBuffer.data();
+    for (int y=0; y<H; ++y) {
+        typename ImageT::const_x_iterator iptr = img.row_begin(y);
+        for (int x=0; x<NX; ++x) {
+            std::copy(iptr + x, iptr + x + S, vals);
+            std::nth_element(vals, vals + S/2, vals + S);
+            rowmed[y*NX + x] = vals[S/2];
+        }
+    }
+    // Column medians of the row medians.
+    for (int y=halfsize; y<H-halfsize; ++y) {
+        typename ImageT::x_iterator optr = out.row_begin(y) + halfsize;
+        for (int x=0; x<NX; ++x, ++optr) {
+            for (int i=0; i<S; ++i) {
+                vals[i] = rowmed[(y - halfsize + i)*NX + x];
+            }
+            std::nth_element(vals, vals + S/2, vals + S);
+            *optr = vals[S/2];
+        }
+    }
+}
 
- For illustration, run tests/monotonic.py and look at im*.png
+/**
+ medianFilter for many images at once: *outimgs*[i] is set as
+ medianFilter(*imgs*[i], *outimgs*[i], *halfsize*) would.
+
+ Images of the same dimensions are filtered together, LaneImage::LANES
+ at a time, each window sorted by a fixed network of compare-exchanges
+ applied to all the lanes: for small templates this replaces many short
+ nth_element calls by loops at full vector width.  The network grows
+ with the square of the window, so this is only done for *halfsize* up
+ to LANE_BATCH_MAX_HALFSIZE and images of at most LANE_BATCH_MAX_SIZE
+ pixels on a side.  Larger images, images containing NaN (which the
+ network does not order as nth_element does) and images with no other
+ of their dimensions are filtered alone by medianFilter, so the result
+ is always that of medianFilter.
  */
 template<typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
 void
 deblend::BaselineUtils<ImagePixelT,MaskPixelT,VariancePixelT>::
-makeMonotonic(
-    ImageT & img,
-    det::PeakRecord const& peak) {
+medianFilterBatch(std::vector<ImagePtrT> const& imgs,
+                  std::vector<ImagePtrT> const& outimgs,
+                  int halfsize) {
+    typedef LaneImage<ImagePixelT> LaneImageT;
+    typedef typename LaneImageT::Pixel LanePixelT;
+    int const LANES = LaneImageT::LANES;
+
+    if (imgs.size() != outimgs.size()) {
+        throw LSST_EXCEPT(lsst::pex::exceptions::LengthError,
+            (boost::format("Input and output images must be the same length (%d vs %d)")
+                % imgs.size() % outimgs.size()).str());
+    }
+    if (halfsize > LANE_BATCH_MAX_HALFSIZE) {
+        for (std::size_t i = 0; i < imgs.size(); ++i) {
+            medianFilter(*imgs[i], *outimgs[i], halfsize);
+        }
+        return;
+    }
+    int const S = halfsize*2 + 1;
+    int const SS = S*S;
+    std::vector<std::array<int, 2>> keys;
+    std::vector<bool> batchable;
+    for (ImagePtrT const& img : imgs) {
+        keys.push_back({{img->getWidth(), img->getHeight()}});
+        batchable.push_back(fitsLanes(*img) && !containsNaN(*img));
+    }
+    std::vector<std::pair<int, int>> const network = medianNetwork(SS);
+    ScratchBuffer<LanePixelT, MEDIAN_LANES> valBuffer(SS);
+    LanePixelT* vals = valBuffer.data();
 
-    int cx = peak.getIx();
-    int cy = peak.getIy();
-    int ix0 = img.getX0();
-    int iy0 = img.getY0();
+    for (std::vector<int> const& batch : laneBatches<std::array<int, 2>, LANES>(keys, batchable)) {
+        if (batch.size() == 1) {
+            medianFilter(*imgs[batch[0]], *outimgs[batch[0]], halfsize);
+            continue;
+        }
+        int const W = imgs[batch[0]]->getWidth();
+        int const H = imgs[batch[0]]->getHeight();
+        LaneImageT in(W, H);
+        loadLanes(in, imgs, batch);
+        LaneImageT out(W, H);
+        for (int y=halfsize; y<H-halfsize; ++y) {
+            for (int x=halfsize; x<W-halfsize; ++x) {
+                int n = 0;
+                for (int i=0; i<S; ++i) {
+                    for (int j=0; j<S; ++j) {
+                        vals[n++] = in(x + j - halfsize, y + i - halfsize);
+                    }
+                }
+                for (std::pair<int, int> const& ex : network) {
+                    LanePixelT & a = vals[ex.first];
+                    LanePixelT & b = vals[ex.second];
+                    for (int k = 0; k < LANES; ++k) {
+                        ImagePixelT const lo = std::min(a.v[k], b.v[k]);
+                        b.v[k] = std::max(a.v[k], b.v[k]);
+                        a.v[k] = lo;
+                    }
+                }
+                out(x, y) = vals[SS/2];
+            }
+        }
+        for (std::size_t k = 0; k < batch.size(); ++k) {
+            ImageT & outimg = *outimgs[batch[k]];
+            for (int y=halfsize; y<H-halfsize; ++y) {
+                typename ImageT::x_iterator optr = outimg.row_begin(y) + halfsize;
+                for (int x=halfsize; x<W-halfsize; ++x, ++optr) {
+                    *optr = out(x, y).v[k];
+                }
+            }
+            copyMedianMargins(*imgs[batch[k]], outimg, halfsize);
+        }
+    }
+}
+
+namespace {
+
+/*
+ * Lower *pixel* to *shadow* where it is brighter, in every lane of a
+ * LaneImage pixel.
+ */
+template <typename PixelT>
+inline void castShadow(PixelT & pixel, PixelT const& shadow) {
+    pixel = std::min(pixel, shadow);
+}
+
+template <typename PixelT>
+inline void castShadow(deblend::LanePixel<PixelT> & pixel, deblend::LanePixel<PixelT> const& shadow) {
+    for (int k = 0; k < deblend::LanePixel<PixelT>::LANES; ++k) {
+        pixel.v[k] = std::min(pixel.v[k], shadow.v[k]);
+    }
+}
+
+/*
+ * The body of makeMonotonic, for any image type *ImgT* whose pixels are
+ * addressed as img(x, y) relative to its origin (afw Image, TiledImage
+ * or LaneImage).  *shadowingImg* must start as a copy of *img*; (cx, cy)
+ * is the peak and (ix0, iy0) the origin of the images.
+ */
+template <typename PixelT, typename ImgT>
+void makeMonotonicImpl(ImgT & img, ImgT & shadowingImg, int cx, int cy, int ix0, int iy0) {
     int iW = img.getWidth();
     int iH = img.getHeight();
 
-    ImagePtrT shadowingImg = ImagePtrT(new ImageT(img, true));
-
-    int DW = std::max(cx - img.getX0(), img.getX0() + img.getWidth() - cx);
-    int DH = std::max(cy - img.getY0(), img.getY0() + img.getHeight() - cy);
+    int DW = std::max(cx - ix0, ix0 + iW - cx);
+    int DH = std::max(cy - iy0, iy0 + iH - cy);
 
     const int S = 5;
 
@@ -303,7 +728,7 @@ makeMonotonic(
                 if (px < 0 || px >= iW || py < 0 || py >= iH)
                     continue;
                 // The pixel casting the shadow
-                ImagePixelT pix = (*shadowingImg)(px,py);
+                PixelT pix = shadowingImg(px,py);
 
                 // Cast this pixel's shadow S pixels long in a cone.
                 // We compute the range of slopes (or inverse-slopes)
@@ -331,7 +756,7 @@ makeMonotonic(
                             psy = cy + y + xsign*shy - iy0;
                             if (psy < 0 || psy >= iH)
                                 continue;
-                            img(psx, psy) = std::min(img(psx, psy), pix);
+                            castShadow(img(psx, psy), pix);
                         }
                     }
 
@@ -351,13 +776,115 @@ makeMonotonic(
                             psx = cx + x + ysign*shx - ix0;
                             if (psx < 0 || psx >= iW)
                                 continue;
-                            img(psx, psy) = std::min(img(psx, psy), pix);
+                            castShadow(img(psx, psy), pix);
                         }
                     }
                 }
             }
         }
-        shadowingImg->assign(img);
+        shadowingImg.assign(img);
+    }
+}
+
+} // end anonymous namespace
+
+/**
+ Given an image *mimg* and Peak location *peak*, overwrite *mimg* so
+ that pixels further from the peak have values smaller than those
+ close to the peak; make the profile monotonic-decreasing.
+
+ The exact algorithm is a little more complicated than that.  The
+ basic idea is of "casting a shadow" from a pixel to pixels farther
+ from the peak in the same direction.  Done naively, this results in
+ very narrow "shadows" and ragged profiles.  A tweak is to make the
+ shadows "fatter" -- make a pixel shadow a wedge of pixels -- but if
+ one does this naively, the wedge gets wider and wider too quickly.
+ The algorithm works out from the peak in square "rings" of pixels, so
+ if a pixel shadows a wedge 30 degrees wide, in the next ring of
+ pixels the shadowed pixel at largest angle from the shadowing pixel
+ will shade a yet-larger wedge, expanding the shadowing angle.  To
+ reduce this effect, we work in chunks of 5 pixels in radius, only
+ copying the intermediate pixels to the "shadowing" image at the end
+ of each chunk.
+
+ Currently the mask and variance planes of the input are totally
+ ignored.
+
+ For illustration, run tests/monotonic.py and look at im*.png
+ */
+template<typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+void
+deblend::BaselineUtils<ImagePixelT,MaskPixelT,VariancePixelT>::
+makeMonotonic(
+    ImageT & img,
+    det::PeakRecord const& peak) {
+    ImageT shadowingImg(img, true);
+    makeMonotonicImpl<ImagePixelT>(img, shadowingImg, peak.getIx(), peak.getIy(), img.getX0(), img.getY0());
+}
+
+/**
+ makeMonotonic, working on a TiledImage copy of *img*: the rings and
+ shadows it walks cross many rows, which a tiled layout keeps within
+ a few cache lines.  The result is identical.
+ */
+template<typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+void
+deblend::BaselineUtils<ImagePixelT,MaskPixelT,VariancePixelT>::
+makeMonotonicTiled(
+    ImageT & img,
+    det::PeakRecord const& peak) {
+    TiledImage<ImagePixelT> timg(img);
+    TiledImage<ImagePixelT> shadowingImg(timg);
+    makeMonotonicImpl<ImagePixelT>(timg, shadowingImg, peak.getIx(), peak.getIy(), img.getX0(), img.getY0());
+    timg.copyTo(img);
+}
+
+/**
+ makeMonotonic for many images at once, each around the peak at
+ (*pkx*[i], *pky*[i]) in the parent coordinates of *imgs*[i].
+
+ The rings and shadows that makeMonotonic walks depend only on the
+ image dimensions and the position of the peak within the image, so
+ images that share them are processed together in a LaneImage, each
+ shadow cast on all the lanes at once.  Images of more than
+ LANE_BATCH_MAX_SIZE pixels on a side, and images with no such partner,
+ are processed alone by makeMonotonic.  The results are identical.
+ */
+template<typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+void
+deblend::BaselineUtils<ImagePixelT,MaskPixelT,VariancePixelT>::
+makeMonotonicBatch(std::vector<ImagePtrT> const& imgs,
+                   std::vector<int> const& pkx,
+                   std::vector<int> const& pky) {
+    typedef LaneImage<ImagePixelT> LaneImageT;
+
+    if ((pkx.size() != imgs.size()) || (pky.size() != imgs.size())) {
+        throw LSST_EXCEPT(lsst::pex::exceptions::LengthError,
+            (boost::format("'pkx' and 'pky' must be the same length as images (%d,%d vs %d)")
+                % pkx.size() % pky.size() % imgs.size()).str());
+    }
+    std::vector<std::array<int, 4>> keys;
+    std::vector<bool> batchable;
+    for (std::size_t i = 0; i < imgs.size(); ++i) {
+        ImageT const& img = *imgs[i];
+        keys.push_back({{img.getWidth(), img.getHeight(), pkx[i] - img.getX0(), pky[i] - img.getY0()}});
+        batchable.push_back(fitsLanes(img));
+    }
+    for (std::vector<int> const& batch : laneBatches<std::array<int, 4>, LaneImageT::LANES>(keys, batchable)) {
+        int const first = batch[0];
+        if (batch.size() == 1) {
+            ImageT & img = *imgs[first];
+            ImageT shadowingImg(img, true);
+            makeMonotonicImpl<ImagePixelT>(img, shadowingImg, pkx[first], pky[first], img.getX0(), img.getY0());
+            continue;
+        }
+        LaneImageT limg(keys[first][0], keys[first][1]);
+        loadLanes(limg, imgs, batch);
+        LaneImageT shadowingImg(limg);
+        makeMonotonicImpl<typename LaneImageT::Pixel>(limg, shadowingImg, keys[first][2], keys[first][3], 0, 0);
+        for (std::size_t k = 0; k < batch.size(); ++k) {
+            limg.copyTo(*imgs[batch[k]], k);
+        }
     }
 }
 
@@ -388,6 +915,201 @@ static double _get_contrib_r_to_footprint(int x, int y,
 }
 
 
+namespace {
+
+/*
+ * How _find_stray_flux weights the templates at a stray pixel, decoded
+ * once per call from the strayFluxOptions.
+ */
+struct StrayFluxWeighting {
+    enum Rule { R_TO_PEAK, R_TO_FOOTPRINT, NEAREST };
+    Rule rule;
+    bool toPointSourcesAlways;
+    bool toPointSourcesWhenNecessary;
+    double clipFraction;
+    std::vector<std::shared_ptr<det::Footprint>> const& tfoots;
+    std::vector<bool> const& ispsf;
+    std::vector<int> const& pkx;
+    std::vector<int> const& pky;
+};
+
+/*
+ * Set contrib[0..n) to the weights of the templates in the stray flux
+ * of pixel x,y and return their sum (zero: the pixel is given to no
+ * template).  *inear* is the template picked by the NEAREST rule, -1
+ * for none.
+ *
+ * Most blends have two to four templates, so the loops over templates
+ * are unrolled for N = 2, 3 and 4; N = 0 loops over *n* templates.  The
+ * operations and their order do not depend on N.
+ */
+template <int N>
+double strayFluxWeights(double* contrib, int n, int x, int y, int inear, StrayFluxWeighting const& w) {
+    if (N > 0) {
+        n = N;
+    }
+    bool const anyPsf = !w.ispsf.empty();
+    if (w.rule == StrayFluxWeighting::R_TO_FOOTPRINT) {
+        // we'll compute these just-in-time
+        for (int i = 0; i < n; ++i) {
+            contrib[i] = -1.0;
+        }
+    } else if (w.rule == StrayFluxWeighting::NEAREST) {
+        for (int i = 0; i < n; ++i) {
+            contrib[i] = 0.0;
+        }
+        if (inear >= 0) {
+            contrib[inear] = 1.0;
+        }
+    } else {
+        for (int i = 0; i < n; ++i) {
+            // Split the stray flux by 1/(1+r^2) to peaks
+            int const dx = w.pkx[i] - x;
+            int const dy = w.pky[i] - y;
+            contrib[i] = 1. / (1. + dx*dx + dy*dy);
+        }
+    }
+
+    // Round 1: skip point sources unless STRAYFLUX_TO_POINT_SOURCES_ALWAYS
+    // are we going to assign stray flux to ptsrcs?
+    bool ptsrcs = w.toPointSourcesAlways;
+    double csum = 0.;
+    for (int i = 0; i < n; ++i) {
+        // if we're skipping point sources and this is a point source...
+        if ((!ptsrcs) && anyPsf && w.ispsf[i]) {
+            continue;
+        }
+        if (contrib[i] == -1.0) {
+            contrib[i] = _get_contrib_r_to_footprint(x, y, w.tfoots[i]);
+        }
+        csum += contrib[i];
+    }
+    if ((csum == 0.) && w.toPointSourcesWhenNecessary) {
+        // No extended sources -- assign to pt sources
+        ptsrcs = true;
+        for (int i = 0; i < n; ++i) {
+            if (contrib[i] == -1.0) {
+                contrib[i] = _get_contrib_r_to_footprint(x, y, w.tfoots[i]);
+            }
+            csum += contrib[i];
+        }
+    }
+
+    // Drop small contributions...
+    double const strayclip = (w.clipFraction * csum);
+    csum = 0.;
+    for (int i = 0; i < n; ++i) {
+        // skip ptsrcs?
+        if ((!ptsrcs) && anyPsf && w.ispsf[i]) {
+            contrib[i] = 0.;
+            continue;
+        }
+        // skip small contributions
+        if (contrib[i] < strayclip) {
+            contrib[i] = 0.;
+            continue;
+        }
+        csum += contrib[i];
+    }
+    return csum;
+}
+
+/*
+ * The stray pixels given to each template by _find_stray_flux, in the
+ * order of the parent's spans.
+ */
+template <typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+struct StrayPixels {
+    explicit StrayPixels(std::size_t n) : spans(n), image(n), mask(n), variance(n) {}
+
+    std::vector<std::vector<afwGeom::Span>> spans;
+    std::vector<std::vector<ImagePixelT>> image;
+    std::vector<std::vector<MaskPixelT>> mask;
+    std::vector<std::vector<VariancePixelT>> variance;
+};
+
+/*
+ * The loop of _find_stray_flux over the pixels of *spans*, for N
+ * templates (N = 0: any number), dispatched on once per parent so that
+ * strayFluxWeights<N> is inlined and every loop over the templates is
+ * unrolled for the common blends of two to four templates.
+ *
+ * Under the NEAREST rule, *nearest* labels each pixel with its template;
+ * with *nearestPeaks*, pixels labelled 0xffff, or all of them if
+ * *nearest* is null, go to the nearest *eligible* peak in a straight line.
+ */
+template <int N, typename MaskedImageT, typename SumImageT, typename StrayPixelsT>
+void scanStrayFlux(afwGeom::SpanSet const& spans, SumImageT const& tsum, MaskedImageT const& img,
+                   image::Image<std::uint16_t> const* coverage, image::Image<std::uint16_t> const* nearest,
+                   bool nearestPeaks, std::vector<bool> const& eligible, StrayFluxWeighting const& w,
+                   double* contrib, StrayPixelsT & out) {
+    int const n = (N > 0) ? N : static_cast<int>(w.tfoots.size());
+    int const ix0 = img.getX0();
+    int const iy0 = img.getY0();
+    int const sumx0 = tsum.getX0();
+    int const sumy0 = tsum.getY0();
+
+    // Go through the (parent) Footprint looking for stray flux:
+    // pixels that are not claimed by any template, and positive.
+    for (afwGeom::Span const & s : spans) {
+        int y = s.getY();
+        int x0 = s.getX0();
+        int x1 = s.getX1();
+        auto tsum_it = tsum.row_begin(y - sumy0) + (x0 - sumx0);
+        auto in_it = img.row_begin(y - iy0) + (x0 - ix0);
+        std::uint16_t const* cov_it = nullptr;
+        if (coverage) {
+            cov_it = coverage->row_begin(y - sumy0) + (x0 - sumx0);
+        }
+
+        for (int x = x0; x <= x1; ++x, ++tsum_it, ++in_it) {
+            // Skip pixels that are covered by at least one
+            // template (*tsum_it > 0) or the input is not
+            // positive (*in_it <= 0).
+            bool const covered = cov_it ? (*cov_it++ > 0) : (*tsum_it > 0);
+            if (covered || (*in_it).image() <= 0) {
+                continue;
+            }
+
+            int inear = -1;
+            if (w.rule == StrayFluxWeighting::NEAREST) {
+                inear = nearest ? (*nearest)[geom::Point2I(x, y)] : 0xffff;
+                if (nearestPeaks && inear == 0xffff) {
+                    // not connected to any peak within the footprint, or
+                    // too many peaks to label: fall back to the nearest
+                    // peak in a straight line.
+                    inear = -1;
+                    int best = 0;
+                    for (int i = 0; i < n; ++i) {
+                        int const dx = w.pkx[i] - x;
+                        int const dy = w.pky[i] - y;
+                        if (eligible[i] && (inear < 0 || dx*dx + dy*dy < best)) {
+                            inear = i;
+                            best = dx*dx + dy*dy;
+                        }
+                    }
+                }
+            }
+            double const csum = strayFluxWeights<N>(contrib, n, x, y, inear, w);
+
+            for (int i = 0; i < n; ++i) {
+                if (contrib[i] == 0.) {
+                    continue;
+                }
+                // the stray flux to give to template i
+                double p = (contrib[i] / csum) * (*in_it).image();
+
+                out.spans[i].push_back(afwGeom::Span(y, x, x));
+                out.image[i].push_back(p);
+                out.mask[i].push_back((*in_it).mask());
+                out.variance[i].push_back((*in_it).variance());
+            }
+        }
+    }
+}
+
+} // end anonymous namespace
+
 template<typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
 void
 deblend::BaselineUtils<ImagePixelT,MaskPixelT,VariancePixelT>::
@@ -400,32 +1122,14 @@ _find_stray_flux(det::Footprint const& foot,
                  std::vector<int>  const& pkx,
                  std::vector<int>  const& pky,
                  double clipStrayFluxFraction,
-                 std::vector<std::shared_ptr<typename det::HeavyFootprint<ImagePixelT,MaskPixelT,VariancePixelT> > > & strays
+                 std::vector<std::shared_ptr<typename det::HeavyFootprint<ImagePixelT,MaskPixelT,VariancePixelT> > > & strays,
+                 std::shared_ptr<image::Image<std::uint16_t>> coverage
                  ) {
 
     typedef typename det::HeavyFootprint<ImagePixelT, MaskPixelT, VariancePixelT> HeavyFootprint;
     typedef typename std::shared_ptr< HeavyFootprint > HeavyFootprintPtrT;
 
-    // when doing stray flux: the footprints and pixels, which we'll
-    // combine into the return 'strays' HeavyFootprint at the end.
-    std::vector<std::shared_ptr<det::Footprint> > strayfoot;
-    std::vector<std::vector<afwGeom::Span>> straySpans(tfoots.size());
-    std::vector<std::vector<ImagePixelT> > straypix;
-    std::vector<std::vector<MaskPixelT> > straymask;
-    std::vector<std::vector<VariancePixelT> > strayvar;
-
-    int ix0 = img.getX0();
-    int iy0 = img.getY0();
     geom::Box2I sumbb = tsum->getBBox();
-    int sumx0 = sumbb.getMinX();
-    int sumy0 = sumbb.getMinY();
-
-    for (size_t i=0; i<tfoots.size(); ++i) {
-        strayfoot.push_back(std::shared_ptr<det::Footprint>());
-        straypix.push_back(std::vector<ImagePixelT>());
-        straymask.push_back(std::vector<MaskPixelT>());
-        strayvar.push_back(std::vector<VariancePixelT>());
-    }
 
     bool always = (strayFluxOptions & STRAYFLUX_TO_POINT_SOURCES_ALWAYS);
 
@@ -459,124 +1163,69 @@ _find_stray_flux(det::Footprint const& foot,
         nearestFootprint(*footlist, nearest, dist);
     }
 
-    // Go through the (parent) Footprint looking for stray flux:
-    // pixels that are not claimed by any template, and positive.
-    for (afwGeom::Span const & s : *foot.getSpans()) {
-        int y = s.getY();
-        int x0 = s.getX0();
-        int x1 = s.getX1();
-        typename ImageT::x_iterator tsum_it =
-            tsum->row_begin(y - sumy0) + (x0 - sumx0);
-        typename MaskedImageT::x_iterator in_it =
-            img.row_begin(y - iy0) + (x0 - ix0);
-        double contrib[tfoots.size()];
-
-        for (int x = x0; x <= x1; ++x, ++tsum_it, ++in_it) {
-            // Skip pixels that are covered by at least one
-            // template (*tsum_it > 0) or the input is not
-            // positive (*in_it <= 0).
-            if ((*tsum_it > 0) || (*in_it).image() <= 0) {
-                continue;
-            }
-
-            if (strayFluxOptions & STRAYFLUX_R_TO_FOOTPRINT) {
-                // we'll compute these just-in-time
-                for (size_t i=0; i<tfoots.size(); ++i) {
-                    contrib[i] = -1.0;
-                }
-            } else if (strayFluxOptions & STRAYFLUX_NEAREST_FOOTPRINT) {
-                for (size_t i=0; i<tfoots.size(); ++i) {
-                    contrib[i] = 0.0;
-                }
-                int i = (*nearest)[geom::Point2I(x, y)];
-                contrib[i] = 1.0;
-            } else {
-                // R_TO_PEAK
-                for (size_t i=0; i<tfoots.size(); ++i) {
-                    // Split the stray flux by 1/(1+r^2) to peaks
-                    int dx, dy;
-                    dx = pkx[i] - x;
-                    dy = pky[i] - y;
-                    contrib[i] = 1. / (1. + dx*dx + dy*dy);
-                }
-            }
-
-            // Round 1: skip point sources unless STRAYFLUX_TO_POINT_SOURCES_ALWAYS
-            // are we going to assign stray flux to ptsrcs?
-            bool ptsrcs = always;
-            double csum = 0.;
+    // The peaks that may receive stray flux under STRAYFLUX_NEAREST_PEAK:
+    // the extended sources, unless point sources always get stray flux
+    // or there are no extended sources and they get it when necessary.
+    std::vector<bool> eligible(tfoots.size(), true);
+    std::shared_ptr<image::Image<itype>> nearestPk;
+    if (strayFluxOptions & STRAYFLUX_NEAREST_PEAK) {
+        if (!always && ispsf.size()) {
+            bool anyExtended = false;
             for (size_t i=0; i<tfoots.size(); ++i) {
-                // if we're skipping point sources and this is a point source...
-                if ((!ptsrcs) && ispsf.size() && ispsf[i]) {
-                    continue;
-                }
-                if (contrib[i] == -1.0) {
-                    contrib[i] = _get_contrib_r_to_footprint(x, y, tfoots[i]);
-                }
-                csum += contrib[i];
+                eligible[i] = !ispsf[i];
+                anyExtended = anyExtended || eligible[i];
             }
-            if ((csum == 0.) &&
-                (strayFluxOptions &
-                 STRAYFLUX_TO_POINT_SOURCES_WHEN_NECESSARY)) {
-                // No extended sources -- assign to pt sources
-                //LOGL_DEBUG(_log, "necessary to assign stray flux to point sources");
-                ptsrcs = true;
-                for (size_t i=0; i<tfoots.size(); ++i) {
-                    if (contrib[i] == -1.0) {
-                        contrib[i] = _get_contrib_r_to_footprint(x, y, tfoots[i]);
-                    }
-                    csum += contrib[i];
-                }
+            if (!anyExtended && (strayFluxOptions & STRAYFLUX_TO_POINT_SOURCES_WHEN_NECESSARY)) {
+                eligible.assign(tfoots.size(), true);
             }
+        }
+        nearestPk = nearestPeak(*foot.getSpans(), pkx, pky, eligible);
+    }
 
-            // Drop small contributions...
-            double strayclip = (clipStrayFluxFraction * csum);
-            csum = 0.;
-            for (size_t i=0; i<tfoots.size(); ++i) {
-                // skip ptsrcs?
-                if ((!ptsrcs) && ispsf.size() && ispsf[i]) {
-                    contrib[i] = 0.;
-                    continue;
-                }
-                // skip small contributions
-                if (contrib[i] < strayclip) {
-                    contrib[i] = 0.;
-                    continue;
-                }
-                csum += contrib[i];
-            }
+    ScratchBuffer<double, STRAY_CONTRIB> contribBuffer(tfoots.size());
+    double* contrib = contribBuffer.data();
 
-            for (size_t i=0; i<tfoots.size(); ++i) {
-                if (contrib[i] == 0.) {
-                    continue;
-                }
-                // the stray flux to give to template i
-                double p = (contrib[i] / csum) * (*in_it).image();
-
-                if (!strayfoot[i]) {
-                    strayfoot[i] = std::make_shared<det::Footprint>();
-                    strayfoot[i]->setPeakSchema(foot.getPeaks().getSchema());
-                }
-                straySpans[i].push_back(afwGeom::Span(y, x, x));
-                straypix[i].push_back(p);
-                straymask[i].push_back((*in_it).mask());
-                strayvar[i].push_back((*in_it).variance());
-            }
-        }
+    StrayFluxWeighting::Rule rule = StrayFluxWeighting::R_TO_PEAK;
+    if (strayFluxOptions & STRAYFLUX_R_TO_FOOTPRINT) {
+        rule = StrayFluxWeighting::R_TO_FOOTPRINT;
+    } else if (strayFluxOptions & (STRAYFLUX_NEAREST_FOOTPRINT | STRAYFLUX_NEAREST_PEAK)) {
+        rule = StrayFluxWeighting::NEAREST;
+    }
+    StrayFluxWeighting const weighting = {
+        rule, always, bool(strayFluxOptions & STRAYFLUX_TO_POINT_SOURCES_WHEN_NECESSARY),
+        clipStrayFluxFraction, tfoots, ispsf, pkx, pky
+    };
+
+    // The stray pixels of each template, which we'll combine into the
+    // returned 'strays' HeavyFootprints at the end.
+    StrayPixels<ImagePixelT, MaskPixelT, VariancePixelT> stray(tfoots.size());
+    bool const nearestPeaks = !(strayFluxOptions & STRAYFLUX_NEAREST_FOOTPRINT);
+    image::Image<itype> const* nearestMap = nearestPeaks ? nearestPk.get() : nearest.get();
+    if (tfoots.size() == 2) {
+        scanStrayFlux<2>(*foot.getSpans(), *tsum, img, coverage.get(), nearestMap, nearestPeaks, eligible,
+                         weighting, contrib, stray);
+    } else if (tfoots.size() == 3) {
+        scanStrayFlux<3>(*foot.getSpans(), *tsum, img, coverage.get(), nearestMap, nearestPeaks, eligible,
+                         weighting, contrib, stray);
+    } else if (tfoots.size() == 4) {
+        scanStrayFlux<4>(*foot.getSpans(), *tsum, img, coverage.get(), nearestMap, nearestPeaks, eligible,
+                         weighting, contrib, stray);
+    } else {
+        scanStrayFlux<0>(*foot.getSpans(), *tsum, img, coverage.get(), nearestMap, nearestPeaks, eligible,
+                         weighting, contrib, stray);
     }
 
     // Store the stray flux in HeavyFootprints
     for (size_t i=0; i<tfoots.size(); ++i) {
-        if (strayfoot[i]) {
-            strayfoot[i]->setSpans(std::make_shared<afwGeom::SpanSet>(straySpans[i]));
-        }
-        if (!strayfoot[i]) {
+        if (stray.spans[i].empty()) {
             strays.push_back(HeavyFootprintPtrT());
         } else {
+            det::Footprint strayfoot(std::make_shared<afwGeom::SpanSet>(stray.spans[i]));
+            strayfoot.setPeakSchema(foot.getPeaks().getSchema());
             /// Hmm, this is a little bit dangerous: we're assuming that
             /// the HeavyFootprint stores its pixels in the same order that
             /// we iterate over them above (ie, lexicographic).
-            HeavyFootprintPtrT heavy(new HeavyFootprint(*strayfoot[i]));
+            HeavyFootprintPtrT heavy(new HeavyFootprint(strayfoot));
             ndarray::Array<ImagePixelT,1,1> himg = heavy->getImageArray();
             typename std::vector<ImagePixelT>::const_iterator spix;
             typename std::vector<MaskPixelT>::const_iterator smask;
@@ -585,15 +1234,15 @@ _find_stray_flux(det::Footprint const& foot,
             typename ndarray::Array<MaskPixelT,1,1>::Iterator mpix;
             typename ndarray::Array<VariancePixelT,1,1>::Iterator vpix;
 
-            assert((size_t)strayfoot[i]->getArea() == straypix[i].size());
+            assert((size_t)strayfoot.getArea() == stray.image[i].size());
 
-            for (spix = straypix[i].begin(),
-                     smask = straymask[i].begin(),
-                     svar  = strayvar [i].begin(),
+            for (spix = stray.image[i].begin(),
+                     smask = stray.mask[i].begin(),
+                     svar  = stray.variance[i].begin(),
                      hpix = himg.begin(),
                      mpix = heavy->getMaskArray().begin(),
                      vpix = heavy->getVarianceArray().begin();
-                 spix != straypix[i].end();
+                 spix != stray.image[i].end();
                  ++spix, ++smask, ++svar, ++hpix, ++mpix, ++vpix) {
                 *hpix = *spix;
                 *mpix = *smask;
@@ -639,6 +1288,55 @@ _sum_templates(std::vector<ImagePtrT> timgs,
 
 }
 
+/**
+ Sum the templates as _sum_templates does, but only over the pixels of
+ their footprints, as if each template were zero outside its footprint.
+ clipFootprintsToNonzero only trims the ends of the spans and drops the
+ spans that are all zero, so a template may still be positive outside
+ its footprint, e.g. where the median filter spread its flux; that flux
+ is left out.  Each span is a contiguous run in both images, added
+ without branches so that the compiler can vectorize it.  *coverage*,
+ over the bbox of *tsum*, counts the templates positive at each pixel.
+ */
+template<typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+void
+deblend::BaselineUtils<ImagePixelT,MaskPixelT,VariancePixelT>::
+_sum_templates_by_spans(std::vector<ImagePtrT> timgs,
+                        std::vector<std::shared_ptr<det::Footprint>> tfoots,
+                        ImagePtrT tsum,
+                        std::shared_ptr<image::Image<std::uint16_t>> coverage) {
+    geom::Box2I sumbb = tsum->getBBox();
+    int sumx0 = sumbb.getMinX();
+    int sumy0 = sumbb.getMinY();
+
+    for (size_t i=0; i<timgs.size(); ++i) {
+        ImagePtrT timg = timgs[i];
+        int tx0 = timg->getX0();
+        int ty0 = timg->getY0();
+        for (afwGeom::Span const & sp : *tfoots[i]->getSpans()) {
+            int const y = sp.getY();
+            // Ramped templates can extend outside the parent
+            if (y < sumbb.getMinY() || y > sumbb.getMaxY()) {
+                continue;
+            }
+            int const x0 = std::max(sp.getX0(), sumbb.getMinX());
+            int const x1 = std::min(sp.getX1(), sumbb.getMaxX());
+            int const n = x1 - x0 + 1;
+            if (n <= 0) {
+                continue;
+            }
+            ImagePixelT const* in = timg->row_begin(y - ty0) + (x0 - tx0);
+            ImagePixelT* out = tsum->row_begin(y - sumy0) + (x0 - sumx0);
+            std::uint16_t* cov = coverage->row_begin(y - sumy0) + (x0 - sumx0);
+            for (int k = 0; k < n; ++k) {
+                ImagePixelT const t = in[k];
+                out[k] += (t > 0) ? t : 0;
+                cov[k] += (t > 0);
+            }
+        }
+    }
+}
+
 /**
  Splits flux in a given image *img*, within a given footprint *foot*,
  among a number of templates *timgs*,*tfoots*.  This is where actual
@@ -662,6 +1360,12 @@ _sum_templates(std::vector<ImagePtrT> timgs,
  stray flux is assigned to the footprint with lowest L-1 (Manhattan)
  distance to the stray flux.
 
+ If *strayFluxOptions* includes *STRAYFLUX_NEAREST_PEAK*, the stray
+ flux is assigned to the nearest peak, measured along 8-connected
+ paths within the parent footprint; the peaks are grown into the
+ footprint in a single pass, so the cost does not depend on the number
+ of peaks.
+
  Otherwise, stray flux is assigned based on (1/(1+r^2) from the peaks.
 
  If *strayFluxOptions* includes *STRAYFLUX_TO_POINT_SOURCES_ALWAYS*,
@@ -683,6 +1387,15 @@ _sum_templates(std::vector<ImagePtrT> timgs,
 
  If *tsum* is given, is it set to the sum of max(0, template).
 
+ If *strayFluxOptions* includes *TEMPLATE_SUM_BY_SPANS*, each template
+ is taken to be zero outside its footprint: *tsum* is accumulated over
+ the template footprints only (see _sum_templates_by_spans), and the
+ flux is split among copies of the templates zeroed outside their
+ footprints.  The result is that of the default, applied to those
+ zeroed templates; it differs from the default wherever a template is
+ positive outside its footprint, whose image flux there goes to the
+ other templates or, if none covers the pixel, to the stray flux.
+
  The return value is a vector of MaskedImages containing the flux
  assigned to each template.
 
@@ -747,11 +1460,24 @@ apportionFlux(MaskedImageT const& img,
     int sumx0 = sumbb.getMinX();
     int sumy0 = sumbb.getMinY();
 
-    _sum_templates(timgs, tsum);
+    std::shared_ptr<image::Image<std::uint16_t>> coverage;
+    if (strayFluxOptions & TEMPLATE_SUM_BY_SPANS) {
+        coverage = std::make_shared<image::Image<std::uint16_t>>(sumbb);
+        *coverage = 0;
+        _sum_templates_by_spans(timgs, tfoots, tsum, coverage);
+    } else {
+        _sum_templates(timgs, tsum);
+    }
 
     // Compute flux portions
     for (size_t i=0; i<timgs.size(); ++i) {
         ImagePtrT timg = timgs[i];
+        if (strayFluxOptions & TEMPLATE_SUM_BY_SPANS) {
+            ImagePtrT inside(new ImageT(timg->getBBox()));
+            *inside = 0;
+            tfoots[i]->getSpans()->copyImage(*timg, *inside);
+            timg = inside;
+        }
         // Initialize return value:
         MaskedImagePtrT port(new MaskedImageT(timg->getDimensions()));
         port->setXY0(timg->getXY0());
@@ -801,7 +1527,7 @@ apportionFlux(MaskedImageT const& img,
                     % pkx.size() % pky.size() % timgs.size()).str());
         }
         _find_stray_flux(foot, tsum, img, strayFluxOptions, tfoots,
-                         ispsf, pkx, pky, clipStrayFluxFraction, strays);
+                         ispsf, pkx, pky, clipStrayFluxFraction, strays, coverage);
     }
     return portions;
 }
@@ -1452,6 +2178,111 @@ getSignificantEdgePixels(ImagePtrT img,
     return significant;
 }
 
+/**
+ Returns the HeavyFootprint of a child: the pixels of *portion* within
+ Footprint *foot* (whose peaks it takes), plus the pixels of *stray* if
+ it is not null, with the mask bits ORed.
+
+ This gives the same result as merging the HeavyFootprint of *portion*
+ with *stray* using mergeHeavyFootprints, but makes a single pixel
+ allocation, at the size of the child: children stay in the catalog
+ for the rest of the pipeline, and the intermediate HeavyFootprint and
+ bounding-box image that merging needs are not made.
+ */
+template<typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+typename deblend::BaselineUtils<ImagePixelT,MaskPixelT,VariancePixelT>::HeavyFootprintPtrT
+deblend::BaselineUtils<ImagePixelT,MaskPixelT,VariancePixelT>::
+makeChildFootprint(det::Footprint const& foot,
+                   MaskedImageT const& portion,
+                   HeavyFootprintPtrT stray) {
+    std::shared_ptr<afwGeom::SpanSet> spans = foot.getSpans();
+    if (stray) {
+        spans = spans->union_(*stray->getSpans());
+    }
+    det::Footprint childfoot(spans, foot.getPeaks().getSchema(), foot.getRegion());
+    childfoot.getPeaks().insert(childfoot.getPeaks().end(),
+                                foot.getPeaks().begin(), foot.getPeaks().end(), true);
+
+    auto heavy = std::make_shared<HeavyFootprintT>(childfoot);
+    ndarray::Array<ImagePixelT,1,1> himg = heavy->getImageArray();
+    ndarray::Array<MaskPixelT,1,1> hmask = heavy->getMaskArray();
+    ndarray::Array<VariancePixelT,1,1> hvar = heavy->getVarianceArray();
+
+    // The pixels of *foot* are copied in span order; the spans of the
+    // union are walked alongside to find where each one starts.
+    afwGeom::SpanSet::const_iterator usp = spans->begin();
+    std::size_t ustart = 0;
+    auto offsetOf = [&](afwGeom::Span const& sp) {
+        while (usp->getY() < sp.getY() || (usp->getY() == sp.getY() && usp->getX1() < sp.getX0())) {
+            ustart += usp->getWidth();
+            ++usp;
+        }
+        return ustart + (sp.getX0() - usp->getX0());
+    };
+
+    if (stray) {
+        // Pixels only covered by the stray flux start at zero
+        himg.deep() = 0;
+        hmask.deep() = 0;
+        hvar.deep() = 0;
+    }
+    int const x0 = portion.getX0(), y0 = portion.getY0();
+    for (afwGeom::Span const& sp : *foot.getSpans()) {
+        std::size_t k = offsetOf(sp);
+        typename ImageT::const_x_iterator ipix = portion.getImage()->x_at(sp.getX0() - x0, sp.getY() - y0);
+        typename MaskT::const_x_iterator mpix = portion.getMask()->x_at(sp.getX0() - x0, sp.getY() - y0);
+        typename lsst::afw::image::Image<VariancePixelT>::const_x_iterator vpix =
+            portion.getVariance()->x_at(sp.getX0() - x0, sp.getY() - y0);
+        for (int x = sp.getX0(); x <= sp.getX1(); ++x, ++k, ++ipix, ++mpix, ++vpix) {
+            himg[k] = *ipix;
+            hmask[k] = *mpix;
+            hvar[k] = *vpix;
+        }
+    }
+
+    if (stray) {
+        ndarray::Array<ImagePixelT const,1,1> simg = stray->getImageArray();
+        ndarray::Array<MaskPixelT const,1,1> smask = stray->getMaskArray();
+        ndarray::Array<VariancePixelT const,1,1> svar = stray->getVarianceArray();
+        usp = spans->begin();
+        ustart = 0;
+        std::size_t j = 0;
+        for (afwGeom::Span const& sp : *stray->getSpans()) {
+            std::size_t k = offsetOf(sp);
+            for (int x = sp.getX0(); x <= sp.getX1(); ++x, ++k, ++j) {
+                himg[k] += simg[j];
+                hmask[k] |= smask[j];
+                hvar[k] += svar[j];
+            }
+        }
+    }
+    return heavy;
+}
+
+/**
+ Returns a child HeavyFootprint with zero pixels, covering the spans
+ *spans* of its parent and holding only the peak *peak*; used for
+ peaks that failed to deblend when all peaks must produce a child.
+
+ The SpanSet is immutable, so it is shared with the parent rather
+ than copied, and the pixel arrays are allocated at the size of the
+ footprint: no image the size of the parent bounding box is made.
+ */
+template<typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+typename deblend::BaselineUtils<ImagePixelT,MaskPixelT,VariancePixelT>::HeavyFootprintPtrT
+deblend::BaselineUtils<ImagePixelT,MaskPixelT,VariancePixelT>::
+makePlaceholderFootprint(std::shared_ptr<afwGeom::SpanSet> spans,
+                         std::shared_ptr<det::PeakRecord> peak,
+                         geom::Box2I const& region) {
+    det::Footprint foot(spans, peak->getSchema(), region);
+    foot.getPeaks().push_back(peak);
+    auto heavy = std::make_shared<HeavyFootprintT>(foot);
+    heavy->getImageArray().deep() = 0;
+    heavy->getMaskArray().deep() = 0;
+    heavy->getVarianceArray().deep() = 0;
+    return heavy;
+}
+
 
 // Instantiate
 template class deblend::BaselineUtils<float>;
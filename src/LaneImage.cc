@@ -0,0 +1,49 @@
+#include "lsst/pex/exceptions.h"
+#include "lsst/meas/deblender/LaneImage.h"
+
+namespace image = lsst::afw::image;
+namespace deblend = lsst::meas::deblender;
+
+template <typename PixelT>
+deblend::LaneImage<PixelT>::LaneImage(int width, int height) :
+    _width(width),
+    _height(height),
+    _pixels(static_cast<std::size_t>(width)*height) {}
+
+template <typename PixelT>
+void
+deblend::LaneImage<PixelT>::_checkDimensions(image::Image<PixelT> const& img, int lane) const {
+    if (img.getWidth() != _width || img.getHeight() != _height) {
+        throw LSST_EXCEPT(lsst::pex::exceptions::LengthError,
+                          "Image dimensions do not match those of the LaneImage");
+    }
+    if (lane < 0 || lane >= LANES) {
+        throw LSST_EXCEPT(lsst::pex::exceptions::OutOfRangeError, "Lane out of range");
+    }
+}
+
+template <typename PixelT>
+void
+deblend::LaneImage<PixelT>::load(image::Image<PixelT> const& img, int lane) {
+    _checkDimensions(img, lane);
+    for (int y = 0; y < _height; ++y) {
+        typename image::Image<PixelT>::const_x_iterator iptr = img.row_begin(y);
+        for (int x = 0; x < _width; ++x, ++iptr) {
+            (*this)(x, y).v[lane] = *iptr;
+        }
+    }
+}
+
+template <typename PixelT>
+void
+deblend::LaneImage<PixelT>::copyTo(image::Image<PixelT> & img, int lane) const {
+    _checkDimensions(img, lane);
+    for (int y = 0; y < _height; ++y) {
+        typename image::Image<PixelT>::x_iterator optr = img.row_begin(y);
+        for (int x = 0; x < _width; ++x, ++optr) {
+            *optr = (*this)(x, y).v[lane];
+        }
+    }
+}
+
+template class deblend::LaneImage<float>;
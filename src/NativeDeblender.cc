@@ -0,0 +1,1311 @@
+#include <algorithm>
+#include <atomic>
+#include <cfenv>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "Eigen/Core"
+#include "Eigen/SVD"
+
+#include "lsst/log/Log.h"
+#include "lsst/geom.h"
+#include "lsst/pex/exceptions.h"
+#include "lsst/afw/geom/SpanSet.h"
+#include "lsst/afw/geom/ellipses/Axes.h"
+#include "lsst/afw/math/Statistics.h"
+#include "lsst/meas/deblender/BaselineUtils.h"
+#include "lsst/meas/deblender/NativeDeblender.h"
+
+namespace image = lsst::afw::image;
+namespace det = lsst::afw::detection;
+namespace deblend = lsst::meas::deblender;
+namespace afwGeom = lsst::afw::geom;
+namespace afwMath = lsst::afw::math;
+namespace geom = lsst::geom;
+
+deblend::NativeDeblendControl::NativeDeblendControl() :
+    edgeHandling("ramp"),
+    strayFluxToPointSources("necessary"),
+    assignStrayFlux(true),
+    strayFluxRule("trim"),
+    clipStrayFluxFraction(0.001),
+    psfChisq1(1.5),
+    psfChisq2(1.5),
+    psfChisq2b(1.5),
+    maxNumberOfPeaks(0),
+    maxFootprintArea(10000),
+    maxFootprintSize(0),
+    minFootprintAxisRatio(0.0),
+    notDeblendedMask("NOT_DEBLENDED"),
+    tinyFootprintSize(2),
+    propagateAllPeaks(false),
+    catchFailures(true),
+    maskPlanes({"SAT", "INTRP", "NO_DATA"}),
+    weightTemplates(false),
+    removeDegenerateTemplates(false),
+    medianSmoothTemplate(true),
+    medianFilterHalfsize(2),
+    medianFilterMethod("exact"),
+    tiledTemplateMinArea(0),
+    spanTemplateSum(false),
+    numaPlacement(false),
+    maskLimits({{"NO_DATA", 0.25}})
+{}
+
+namespace {
+    /*
+     * Linear least squares, matching numpy.linalg.lstsq(A, b, rcond=-1):
+     * the residual sum of squares is only available when A has full
+     * column rank and more rows than columns; otherwise *chisq* is set
+     * to 1e30, as the python PSF fit does.  Returns false if the inputs
+     * are not finite (numpy raises LinAlgError).
+     */
+    bool leastSquares(Eigen::MatrixXd const& A, Eigen::VectorXd const& b,
+                      Eigen::VectorXd & x, double & chisq) {
+        if (!A.allFinite() || !b.allFinite()) {
+            return false;
+        }
+        Eigen::JacobiSVD<Eigen::MatrixXd> svd(A, Eigen::ComputeThinU | Eigen::ComputeThinV);
+        svd.setThreshold(std::numeric_limits<double>::epsilon());
+        x = svd.solve(b);
+        if ((svd.rank() == A.cols()) && (A.rows() > A.cols())) {
+            chisq = (A*x - b).squaredNorm();
+        } else {
+            chisq = 1e30;
+        }
+        return true;
+    }
+} // end anonymous namespace
+
+template <typename ImagePixelT>
+void
+deblend::clipFootprintToNonzero(det::Footprint & foot,
+                                image::Image<ImagePixelT> const& img) {
+    int const x0 = img.getX0();
+    int const y0 = img.getY0();
+    int const x1 = x0 + img.getWidth() - 1;
+    int const y1 = y0 + img.getHeight() - 1;
+    std::vector<afwGeom::Span> newSpans;
+    for (afwGeom::Span const & sp : *foot.getSpans()) {
+        int const y = sp.getY();
+        if (y < y0 || y > y1) {
+            continue;
+        }
+        int const xmin = std::max(sp.getX0(), x0);
+        int const xmax = std::min(sp.getX1(), x1);
+        typename image::Image<ImagePixelT>::const_x_iterator row = img.row_begin(y - y0);
+        int lo = xmin;
+        while (lo <= xmax && row[lo - x0] == 0) {
+            ++lo;
+        }
+        if (lo > xmax) {
+            continue;
+        }
+        int hi = xmax;
+        while (row[hi - x0] == 0) {
+            --hi;
+        }
+        newSpans.push_back(afwGeom::Span(y, lo, hi));
+    }
+    foot.setSpans(std::make_shared<afwGeom::SpanSet>(std::move(newSpans), false));
+    foot.removeOrphanPeaks();
+}
+
+/*
+ * Working state for one peak while its parent is being deblended.
+ */
+template <typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+struct deblend::NativeDeblender<ImagePixelT, MaskPixelT, VariancePixelT>::PeakState : public Peak {
+    ImagePtrT timg;
+    std::shared_ptr<det::Footprint> tfoot;
+};
+
+template <typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+deblend::NativeDeblender<ImagePixelT, MaskPixelT, VariancePixelT>::
+NativeDeblender(NativeDeblendControl const& ctrl,
+                MaskedImageT const& mimg,
+                std::shared_ptr<det::Psf const> psf,
+                double sigma1) :
+    _ctrl(ctrl), _mimg(mimg), _psf(psf), _sigma1(sigma1)
+{
+    // The children would silently differ from those of SourceDeblendTask
+    if (_ctrl.weightTemplates || _ctrl.removeDegenerateTemplates) {
+        throw LSST_EXCEPT(lsst::pex::exceptions::InvalidParameterError,
+                          "weightTemplates and removeDegenerateTemplates are not supported "
+                          "by the native deblender");
+    }
+}
+
+/**
+ Returns the median sigma of the variance plane of *mimg*, ignoring
+ pixels with any of the *maskPlanes* set; this is the "sigma1" noise
+ estimate SourceDeblendTask uses for the whole exposure.
+ */
+template <typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+double
+deblend::NativeDeblender<ImagePixelT, MaskPixelT, VariancePixelT>::
+estimateSigma1(MaskedImageT const& mimg,
+               std::vector<std::string> const& maskPlanes) {
+    afwMath::StatisticsControl sctrl;
+    sctrl.setAndMask(mimg.getMask()->getPlaneBitMask(maskPlanes));
+    afwMath::Statistics stats = afwMath::makeStatistics(*mimg.getVariance(), *mimg.getMask(),
+                                                        afwMath::MEDIAN, sctrl);
+    return std::sqrt(stats.getValue(afwMath::MEDIAN));
+}
+
+/**
+ Returns whether Footprint *foot* is "large", by the area, size and
+ axis-ratio thresholds in the control (see
+ SourceDeblendTask.isLargeFootprint).
+ */
+template <typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+bool
+deblend::NativeDeblender<ImagePixelT, MaskPixelT, VariancePixelT>::
+isLargeFootprint(det::Footprint const& foot) const {
+    if ((_ctrl.maxFootprintArea > 0) &&
+        (foot.getArea() > static_cast<std::size_t>(_ctrl.maxFootprintArea))) {
+        return true;
+    }
+    if (_ctrl.maxFootprintSize > 0) {
+        geom::Box2I bbox = foot.getBBox();
+        if (std::max(bbox.getWidth(), bbox.getHeight()) > _ctrl.maxFootprintSize) {
+            return true;
+        }
+    }
+    if (_ctrl.minFootprintAxisRatio > 0) {
+        afwGeom::ellipses::Axes axes(foot.getShape());
+        if (axes.getB() < _ctrl.minFootprintAxisRatio*axes.getA()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ Returns whether Footprint *foot* violates the mask limits (see
+ SourceDeblendTask.isMasked).
+ */
+template <typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+bool
+deblend::NativeDeblender<ImagePixelT, MaskPixelT, VariancePixelT>::
+isMasked(det::Footprint const& foot) const {
+    double const size = foot.getArea();
+    image::Mask<MaskPixelT> const& mask = *_mimg.getMask();
+    for (auto const& limit : _ctrl.maskLimits) {
+        MaskPixelT const maskVal = mask.getPlaneBitMask(limit.first);
+        std::shared_ptr<afwGeom::SpanSet> unmasked = foot.getSpans()->intersectNot(mask, maskVal);
+        if ((size - unmasked->getArea())/size > limit.second) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+std::shared_ptr<det::Psf::Image>
+deblend::NativeDeblender<ImagePixelT, MaskPixelT, VariancePixelT>::
+_computePsfImage(geom::Point2D const& pos) const {
+    std::lock_guard<std::mutex> lock(_psfMutex);
+    return _psf->computeImage(pos);
+}
+
+/*
+ * PSF model images for one parent, cached by position as CachingPsf
+ * does in python.  Falls back to the PSF at its average position where
+ * it cannot be computed.
+ */
+template <typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+std::shared_ptr<det::Psf::Image>
+deblend::NativeDeblender<ImagePixelT, MaskPixelT, VariancePixelT>::
+_cachedPsfImage(PsfCacheT & cache, double cx, double cy) const {
+    std::pair<double, double> key(cx, cy);
+    typename PsfCacheT::const_iterator it = cache.find(key);
+    if (it != cache.end()) {
+        return it->second;
+    }
+    std::shared_ptr<PsfImageT> im;
+    try {
+        im = _computePsfImage(geom::Point2D(cx, cy));
+    } catch (lsst::pex::exceptions::Exception &) {
+        geom::Point2D avg;
+        {
+            std::lock_guard<std::mutex> lock(_psfMutex);
+            avg = _psf->getAveragePosition();
+        }
+        im = _computePsfImage(avg);
+    }
+    cache[key] = im;
+    return im;
+}
+
+template <typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+double
+deblend::NativeDeblender<ImagePixelT, MaskPixelT, VariancePixelT>::
+_computePsfFwhm(geom::Point2D const& pos) const {
+    std::lock_guard<std::mutex> lock(_psfMutex);
+    return _psf->computeShape(pos).getDeterminantRadius() * 2.35;
+}
+
+/*
+ * Fit a PSF + smooth background model (linear) to a small region
+ * around peak *pki*; this is a port of plugins._fitPsf, see there for
+ * the details.  Returns whether the peak looks like a point source, in
+ * which case the peak's template is set to the scaled PSF model.
+ */
+template <typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+bool
+deblend::NativeDeblender<ImagePixelT, MaskPixelT, VariancePixelT>::
+_fitPsf(det::Footprint const& fp,
+        image::Mask<MaskPixelT> const& fmask,
+        int pki,
+        std::vector<geom::Point2D> const& peakF,
+        PeakState & pkres,
+        PsfCacheT & psfCache,
+        double psffwhm) const {
+
+    LOG_LOGGER _log = LOG_GET("lsst.meas.deblender.NativeDeblender");
+
+    geom::Box2I const fbb = fp.getBBox();
+    ImageT const& img = *_mimg.getImage();
+    image::Image<VariancePixelT> const& varimg = *_mimg.getVariance();
+    int const ix0 = img.getX0();
+    int const iy0 = img.getY0();
+
+    // The small region is a disk out to R0, plus a ramp with
+    // decreasing weight down to R1.
+    int const R0 = static_cast<int>(std::ceil(psffwhm*1.));
+    int const R1 = static_cast<int>(std::ceil(psffwhm*1.5));
+    double cx = peakF[pki].getX();
+    double cy = peakF[pki].getY();
+    std::shared_ptr<PsfImageT> psfimg = _cachedPsfImage(psfCache, cx, cy);
+    // R2: distance to neighbouring peak in order to put it into the model
+    double const R2 = R1 + std::min(psfimg->getWidth(), psfimg->getHeight())/2.;
+
+    geom::Box2I pbb = psfimg->getBBox();
+    pbb.clip(fbb);
+
+    // Make sure we haven't been given a substitute PSF that's nowhere
+    // near where we want.
+    if (!pbb.contains(geom::Point2I(static_cast<int>(cx), static_cast<int>(cy)))) {
+        pkres.skip = true;
+        return false;
+    }
+
+    // The bounding-box of the local region we are going to fit ("stamp")
+    geom::Box2I stampbb(geom::Point2I(static_cast<int>(std::floor(cx - R1)),
+                                      static_cast<int>(std::floor(cy - R1))),
+                        geom::Point2I(static_cast<int>(std::ceil(cx + R1)),
+                                      static_cast<int>(std::ceil(cy + R1))));
+    stampbb.clip(fbb);
+    if (stampbb.isEmpty()) {
+        LOGL_DEBUG(_log, "Skipping peak %i: out of bounds", pki);
+        pkres.skip = true;
+        return false;
+    }
+    int const xlo = stampbb.getMinX();
+    int const xhi = stampbb.getMaxX();
+    int const ylo = stampbb.getMinY();
+    int const yhi = stampbb.getMaxY();
+
+    // drop tiny footprints too?  The minimum size limit of 2 comes from
+    // the "PSF dx" calculation below.
+    if (std::min(stampbb.getWidth(), stampbb.getHeight()) <= std::max(_ctrl.tinyFootprintSize, 2)) {
+        LOGL_DEBUG(_log, "Skipping peak %i: tiny footprint / close to edge", pki);
+        pkres.skip = true;
+        return false;
+    }
+
+    // find other peaks within range...
+    std::vector<std::shared_ptr<PsfImageT>> otherpeaks;
+    for (std::size_t j = 0; j < peakF.size(); ++j) {
+        if (static_cast<int>(j) == pki) {
+            continue;
+        }
+        if (peakF[pki].distanceSquared(peakF[j]) > R2*R2) {
+            continue;
+        }
+        std::shared_ptr<PsfImageT> opsfimg = _cachedPsfImage(psfCache, peakF[j].getX(), peakF[j].getY());
+        if (!opsfimg->getBBox().overlaps(stampbb)) {
+            continue;
+        }
+        otherpeaks.push_back(opsfimg);
+    }
+
+    // Number of terms -- PSF flux, constant sky, X, Y, + other PSF fluxes
+    int const NT1 = 4 + otherpeaks.size();
+    // + PSF dx, dy
+    int const NT2 = NT1 + 2;
+    // indices of columns in the "A" matrix.
+    int const I_psf = 0;
+    int const I_sky = 1;
+    int const I_sky_ramp_x = 2;
+    int const I_sky_ramp_y = 3;
+    int const I_opsf = 4;
+    int const I_dx = NT1 + 0;
+    int const I_dy = NT1 + 1;
+
+    // Compute the "valid" pixels within our region-of-interest
+    std::vector<geom::Point2I> pixels;
+    for (int y = ylo; y <= yhi; ++y) {
+        for (int x = xlo; x <= xhi; ++x) {
+            if (fmask(x - fbb.getMinX(), y - fbb.getMinY()) == 0) {
+                continue;
+            }
+            if ((x - cx)*(x - cx) + (y - cy)*(y - cy) > R1*R1) {
+                continue;
+            }
+            if (!(varimg(x - ix0, y - iy0) > 0)) {
+                continue;
+            }
+            pixels.push_back(geom::Point2I(x, y));
+        }
+    }
+    int const NP = pixels.size();
+    if (NP == 0) {
+        LOGL_WARN(_log, "Skipping peak at (%.1f, %.1f): no unmasked pixels nearby", cx, cy);
+        pkres.skip = true;
+        return false;
+    }
+
+    int const px0 = pbb.getMinX();
+    int const px1 = pbb.getMaxX();
+    int const py0 = pbb.getMinY();
+    int const py1 = pbb.getMaxY();
+    int const psfx0 = psfimg->getX0();
+    int const psfy0 = psfimg->getY0();
+
+    // Build the matrix "A", rhs "b" and weight "w".
+    Eigen::MatrixXd A = Eigen::MatrixXd::Zero(NP, NT2);
+    Eigen::VectorXd b(NP);
+    Eigen::VectorXd w(NP);
+    // the effective number of pixels
+    double sumr = 0.;
+    for (int k = 0; k < NP; ++k) {
+        int const x = pixels[k].getX();
+        int const y = pixels[k].getY();
+        A(k, I_sky) = 1.;
+        A(k, I_sky_ramp_x) = x - cx;
+        A(k, I_sky_ramp_y) = y - cy;
+        bool const inx = (x >= px0) && (x <= px1);
+        bool const iny = (y >= py0) && (y <= py1);
+        if (inx && iny) {
+            A(k, I_psf) = (*psfimg)(x - psfx0, y - psfy0);
+        }
+        // PSF dx, dy -- by taking the half-difference of shifted-by-one
+        // and shifted-by-minus-one.
+        if (iny && (x > px0) && (x < px1)) {
+            A(k, I_dx) = ((*psfimg)(x + 1 - psfx0, y - psfy0) - (*psfimg)(x - 1 - psfx0, y - psfy0))/2.;
+        }
+        if (inx && (y > py0) && (y < py1)) {
+            A(k, I_dy) = ((*psfimg)(x - psfx0, y + 1 - psfy0) - (*psfimg)(x - psfx0, y - 1 - psfy0))/2.;
+        }
+        // other PSFs...
+        for (std::size_t j = 0; j < otherpeaks.size(); ++j) {
+            PsfImageT const& opsf = *otherpeaks[j];
+            if (opsf.getBBox().contains(pixels[k])) {
+                A(k, I_opsf + j) = opsf(x - opsf.getX0(), y - opsf.getY0());
+            }
+        }
+        b(k) = img(x - ix0, y - iy0);
+
+        // Weights -- from ramp and image variance map.
+        // Ramp weights -- from 1 at R0 down to 0 at R1.
+        double const rr2 = (x - cx)*(x - cx) + (y - cy)*(y - cy);
+        double rw = 1.;
+        if (rr2 > R0*R0) {
+            rw = std::max(0., 1. - ((std::sqrt(rr2) - R0)/(R1 - R0)));
+        }
+        w(k) = std::sqrt(rw/varimg(x - ix0, y - iy0));
+        sumr += rw;
+    }
+
+    Eigen::VectorXd const bw = b.cwiseProduct(w);
+    Eigen::MatrixXd Aw = w.asDiagonal()*A;
+
+    // We do fits with and without the decenter (dx,dy) terms.
+    Eigen::VectorXd X1, X2;
+    double chisq1, chisq2;
+    if (!leastSquares(Aw.leftCols(NT1), bw, X1, chisq1) ||
+        !leastSquares(Aw, bw, X2, chisq2)) {
+        LOGL_WARN(_log, "Failed to fit PSF to child: non-finite pixels");
+        return false;
+    }
+    double const dof1 = sumr - NT1;
+    double const dof2 = sumr - NT2;
+
+    // This can happen if we're very close to the edge (?)
+    if (dof1 <= 0 || dof2 <= 0) {
+        LOGL_DEBUG(_log, "Skipping this peak: bad DOF %g, %g", dof1, dof2);
+        return false;
+    }
+
+    double const q1 = chisq1/dof1;
+    double q2 = chisq2/dof2;
+    bool const ispsf1 = (q1 < _ctrl.psfChisq1);
+    bool ispsf2 = (q2 < _ctrl.psfChisq2);
+
+    // check that the fit PSF spatial derivative terms aren't too big
+    double dx = 0.;
+    double dy = 0.;
+    if (ispsf2) {
+        double const f0 = X2[I_psf];
+        // as a fraction of the PSF flux
+        dx = X2[I_dx]/f0;
+        dy = X2[I_dy]/f0;
+        ispsf2 = (std::abs(dx) < 1. && std::abs(dy) < 1.);
+    }
+
+    // Looks like a shifted PSF: try actually shifting the PSF by that
+    // amount and re-evaluate the fit.
+    if (ispsf2) {
+        std::shared_ptr<PsfImageT> psfimg2 = _cachedPsfImage(psfCache, cx + dx, cy + dy);
+        geom::Box2I pbb2 = psfimg2->getBBox();
+        pbb2.clip(fbb);
+        if (!pbb2.contains(geom::Point2I(static_cast<int>(cx + dx), static_cast<int>(cy + dy)))) {
+            ispsf2 = false;
+        } else {
+            // Update the PSF terms in the least-squares fit matrix.  As in
+            // python, pixels outside the shifted PSF keep their old values.
+            for (int k = 0; k < NP; ++k) {
+                if (pbb2.contains(pixels[k])) {
+                    A(k, I_psf) = (*psfimg2)(pixels[k].getX() - psfimg2->getX0(),
+                                             pixels[k].getY() - psfimg2->getY0());
+                }
+            }
+            Eigen::MatrixXd const Awb = w.asDiagonal()*A.leftCols(NT1);
+            Eigen::VectorXd Xb;
+            double chisqb;
+            if (!leastSquares(Awb, bw, Xb, chisqb)) {
+                throw LSST_EXCEPT(lsst::pex::exceptions::RuntimeError,
+                                  "Failed to fit shifted PSF model: non-finite pixels");
+            }
+            double const dofb = sumr - Xb.size();
+            double const qb = chisqb/dofb;
+            ispsf2 = (qb < _ctrl.psfChisq2b);
+            q2 = qb;
+            X2 = Xb;
+        }
+    }
+
+    // Which one do we keep?
+    Eigen::VectorXd Xpsf;
+    if ((ispsf1 && ispsf2 && (q2 < q1)) || (ispsf2 && !ispsf1)) {
+        Xpsf = X2;
+        cx += dx;
+        cy += dy;
+    } else {
+        // (arbitrarily set to X1 when neither fits well)
+        Xpsf = X1;
+    }
+    bool const ispsf = (ispsf1 || ispsf2);
+
+    pkres.hasPsfFit = true;
+    pkres.psfFitCenter = geom::Point2D(cx, cy);
+    pkres.psfFitFlux = Xpsf[I_psf];
+
+    if (ispsf) {
+        pkres.deblendedAsPsf = true;
+        // The PSF model, scaled by the fit flux, within the footprint;
+        // read straight from the cached PSF image, without scaled copies.
+        std::shared_ptr<PsfImageT> psfimg = _cachedPsfImage(psfCache, cx, cy);
+        double const flux = Xpsf[I_psf];
+
+        auto fpcopy = std::make_shared<det::Footprint>(fp);
+        fpcopy->clipTo(psfimg->getBBox());
+        auto psfmod = std::make_shared<ImageT>(fpcopy->getBBox());
+        int const px0 = psfimg->getX0(), py0 = psfimg->getY0();
+        int const mx0 = psfmod->getX0(), my0 = psfmod->getY0();
+        for (afwGeom::Span const & span : *fpcopy->getSpans()) {
+            int const y = span.getY();
+            auto in = psfimg->row_begin(y - py0) + (span.getX0() - px0);
+            auto out = psfmod->row_begin(y - my0) + (span.getX0() - mx0);
+            for (int x = span.getX0(); x <= span.getX1(); ++x, ++in, ++out) {
+                *out = static_cast<ImagePixelT>(*in*flux);
+            }
+        }
+        clipFootprintToNonzero(*fpcopy, *psfmod);
+        pkres.timg = psfmod;
+        pkres.tfoot = fpcopy;
+    }
+    return ispsf;
+}
+
+/*
+ * Extend a template whose footprint touches the parent edge by the PSF
+ * to fill in the footprint; a port of plugins._handle_flux_at_edge.
+ */
+template <typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+std::pair<typename deblend::NativeDeblender<ImagePixelT, MaskPixelT, VariancePixelT>::ImagePtrT,
+          std::shared_ptr<det::Footprint>>
+deblend::NativeDeblender<ImagePixelT, MaskPixelT, VariancePixelT>::
+_handleFluxAtEdge(double psffwhm,
+                  ImagePtrT t1,
+                  std::shared_ptr<det::Footprint> tfoot,
+                  det::Footprint const& fp,
+                  det::PeakRecord const& pk,
+                  bool patchEdges,
+                  bool* patched) const {
+    typedef BaselineUtils<ImagePixelT, MaskPixelT, VariancePixelT> Utils;
+
+    // The size we'll grow by; make it an odd integer
+    int const S = static_cast<int>((psffwhm*1.5 + 0.5)/2)*2 + 1;
+
+    geom::Box2I tbb = tfoot->getBBox();
+    tbb.grow(S);
+
+    // (footprint+margin)-clipped image;
+    // we need the pixels OUTSIDE the footprint to be 0.
+    det::Footprint fpcopy(fp);
+    fpcopy.dilate(S);
+    fpcopy.setSpans(fpcopy.getSpans()->clippedTo(tbb));
+    fpcopy.removeOrphanPeaks();
+    MaskedImageT padim(tbb);
+    fpcopy.getSpans()->clippedTo(_mimg.getBBox())->copyMaskedImage(_mimg, padim);
+
+    // find pixels on the edge of the template
+    std::shared_ptr<det::Footprint> edgepix = Utils::getSignificantEdgePixels(t1, tfoot, -1e6);
+
+    // instantiate PSF image
+    geom::Box2I const fbb = fp.getBBox();
+    int const xc = (fbb.getMinX() + fbb.getMaxX())/2;
+    int const yc = (fbb.getMinY() + fbb.getMaxY())/2;
+    std::shared_ptr<PsfImageT> psfim = _computePsfImage(geom::Point2D(xc, yc));
+    // shift PSF image to be centered on zero
+    psfim->setXY0(psfim->getX0() - xc, psfim->getY0() - yc);
+    geom::Box2I pbb = psfim->getBBox();
+    // clip PSF to S, if necessary
+    geom::Box2I const Sbox(geom::Point2I(-S, -S), geom::Extent2I(2*S + 1, 2*S + 1));
+    if (!Sbox.contains(pbb)) {
+        psfim = std::make_shared<PsfImageT>(*psfim, Sbox, image::PARENT, true);
+        pbb = psfim->getBBox();
+    }
+    int const px0 = pbb.getMinX();
+    int const py0 = pbb.getMinY();
+    int const PW = pbb.getWidth();
+    int const PH = pbb.getHeight();
+
+    // The PSF, normalized to a peak of one.
+    double pmax = -std::numeric_limits<double>::infinity();
+    for (int y = 0; y < PH; ++y) {
+        for (int x = 0; x < PW; ++x) {
+            pmax = std::max(pmax, static_cast<double>((*psfim)(x, y)));
+        }
+    }
+    std::vector<double> P(PW*PH);
+    for (int y = 0; y < PH; ++y) {
+        for (int x = 0; x < PW; ++x) {
+            P[y*PW + x] = (*psfim)(x, y)/pmax;
+        }
+    }
+
+    // Compute the ramped-down edge pixels:
+    // for each edge pixel, ramped = max(ramped, edgepix * PSF)
+    ImageT ramped(tbb);
+    int const ox0 = ramped.getX0();
+    int const oy0 = ramped.getY0();
+    int const OW = ramped.getWidth();
+    int const OH = ramped.getHeight();
+    for (afwGeom::Span const & sp : *edgepix->getSpans()) {
+        int const y = sp.getY();
+        for (int x = sp.getX0(); x <= sp.getX1(); ++x) {
+            double const tin = (*t1)(x - t1->getX0(), y - t1->getY0());
+            for (int dy = 0; dy < PH; ++dy) {
+                int const oy = y + py0 + dy - oy0;
+                if (oy < 0 || oy >= OH) {
+                    continue;
+                }
+                for (int dx = 0; dx < PW; ++dx) {
+                    int const ox = x + px0 + dx - ox0;
+                    if (ox < 0 || ox >= OW) {
+                        continue;
+                    }
+                    double const v = tin*P[dy*PW + dx];
+                    if (v > ramped(ox, oy)) {
+                        ramped(ox, oy) = static_cast<ImagePixelT>(v);
+                    }
+                }
+            }
+        }
+    }
+
+    // Fill in the "padim" (which has the right variance and mask
+    // planes) with the ramped pixels, outside the footprint
+    ImageT & padimg = *padim.getImage();
+    for (int y = 0; y < OH; ++y) {
+        typename ImageT::x_iterator pptr = padimg.row_begin(y);
+        typename ImageT::x_iterator rptr = ramped.row_begin(y);
+        for (int x = 0; x < OW; ++x, ++pptr, ++rptr) {
+            if (*pptr == 0) {
+                *pptr = *rptr;
+            }
+        }
+    }
+
+    std::pair<ImagePtrT, std::shared_ptr<det::Footprint>> t2 =
+        Utils::buildSymmetricTemplate(padim, fpcopy, pk, _sigma1, true, patchEdges, patched);
+    if (!t2.first) {
+        throw LSST_EXCEPT(lsst::pex::exceptions::RuntimeError,
+                          "Failed to build symmetric template for ramped footprint");
+    }
+
+    // This template footprint may extend outside the parent
+    // footprint -- or the image.  Clip it.
+    // NOTE that this may make it asymmetric, unlike normal templates.
+    t2.second->clipTo(_mimg.getBBox());
+    t2.first = std::make_shared<ImageT>(*t2.first, t2.second->getBBox(), image::PARENT, true);
+    return t2;
+}
+
+/*
+ * The plugin chain of baseline.deblend with its SourceDeblendTask
+ * arguments: fitPsfs, buildSymmetricTemplates, rampFluxAtEdge,
+ * medianSmoothTemplates, makeTemplatesMonotonic,
+ * clipFootprintsToNonzero and apportionFlux.
+ */
+template <typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+void
+deblend::NativeDeblender<ImagePixelT, MaskPixelT, VariancePixelT>::
+_deblendPeaks(det::Footprint const& parent,
+              double psffwhm,
+              Result & result) const {
+    typedef BaselineUtils<ImagePixelT, MaskPixelT, VariancePixelT> Utils;
+
+    LOG_LOGGER _log = LOG_GET("lsst.meas.deblender.NativeDeblender");
+
+    // Work on a copy: "trim" replaces the spans, and the peaks are
+    // shared with the caller's catalog.
+    det::Footprint fp(parent);
+    det::PeakCatalog const& peaks = fp.getPeaks();
+    geom::Box2I const fbb = fp.getBBox();
+    if (!_mimg.getBBox(image::PARENT).contains(fbb)) {
+        throw LSST_EXCEPT(lsst::pex::exceptions::LengthError,
+                          "Footprint bounding-box extends outside image bounding-box");
+    }
+    // NOTE that, as in python, maxNumberOfPeaks is not applied here:
+    // baseline.deblend does not pass it on to newDeblend.
+    int const npeaks = peaks.size();
+    std::vector<PeakState> states(npeaks);
+
+    bool const patchEdges = (_ctrl.edgeHandling == "noclip");
+    bool const rampEdges = (_ctrl.edgeHandling == "ramp");
+
+    // Fit a PSF + background model to each peak.
+    {
+        PsfCacheT psfCache;
+        image::Mask<MaskPixelT> fmask(fbb);
+        fp.getSpans()->setMask(fmask, static_cast<MaskPixelT>(1));
+        std::vector<geom::Point2D> peakF;
+        peakF.reserve(npeaks);
+        for (det::PeakRecord const& pk : peaks) {
+            peakF.push_back(pk.getF());
+        }
+        for (int i = 0; i < npeaks; ++i) {
+            _fitPsf(fp, fmask, i, peakF, states[i], psfCache, psffwhm);
+        }
+    }
+
+    // Symmetric templates
+    geom::Box2I const imbb = _mimg.getBBox(image::PARENT);
+    for (int i = 0; i < npeaks; ++i) {
+        PeakState & st = states[i];
+        if (st.skip || st.deblendedAsPsf) {
+            continue;
+        }
+        det::PeakRecord const& pk = peaks[i];
+        if (!imbb.contains(geom::Point2I(pk.getIx(), pk.getIy()))) {
+            st.skip = true;
+            continue;
+        }
+        bool patched = false;
+        std::pair<ImagePtrT, std::shared_ptr<det::Footprint>> t =
+            Utils::buildSymmetricTemplate(_mimg, fp, pk, _sigma1, true, patchEdges, &patched);
+        if (!t.first) {
+            LOGL_DEBUG(_log, "Peak %i at (%i, %i): failed to build symmetric template",
+                       i, pk.getIx(), pk.getIy());
+            st.skip = true;
+            continue;
+        }
+        st.patched = st.patched || patched;
+        st.timg = t.first;
+        st.tfoot = t.second;
+    }
+
+    // Ramp flux at the edges
+    if (rampEdges) {
+        for (int i = 0; i < npeaks; ++i) {
+            PeakState & st = states[i];
+            if (st.skip || st.deblendedAsPsf) {
+                continue;
+            }
+            if (!Utils::hasSignificantFluxAtEdge(st.timg, st.tfoot, 3*_sigma1)) {
+                continue;
+            }
+            bool patched = false;
+            std::pair<ImagePtrT, std::shared_ptr<det::Footprint>> t;
+            try {
+                t = _handleFluxAtEdge(psffwhm, st.timg, st.tfoot, fp, peaks[i], patchEdges, &patched);
+            } catch (lsst::pex::exceptions::InvalidParameterError const& e) {
+                if (std::string(e.what()).find("CoaddPsf") != std::string::npos) {
+                    st.skip = true;
+                    continue;
+                }
+                throw;
+            }
+            st.rampedTemplate = true;
+            st.patched = st.patched || patched;
+            st.timg = t.first;
+            st.tfoot = t.second;
+        }
+    }
+
+    // Large templates are median-filtered and made monotonic in a tiled
+    // copy, small ones interleaved with others of the same size
+    auto isTiled = [this](ImageT const& timg) {
+        return (_ctrl.tiledTemplateMinArea > 0) &&
+            (static_cast<long>(timg.getWidth())*timg.getHeight() >= _ctrl.tiledTemplateMinArea);
+    };
+    auto isLaneBatched = [](ImageT const& timg) {
+        return (timg.getWidth() <= Utils::LANE_BATCH_MAX_SIZE) &&
+            (timg.getHeight() <= Utils::LANE_BATCH_MAX_SIZE);
+    };
+
+    // Median smoothing
+    if (_ctrl.medianSmoothTemplate) {
+        int const filtsize = _ctrl.medianFilterHalfsize*2 + 1;
+        bool const separable = (_ctrl.medianFilterMethod == "separable");
+        if (!separable && _ctrl.medianFilterMethod != "exact") {
+            throw LSST_EXCEPT(lsst::pex::exceptions::InvalidParameterError,
+                              "Unknown medianFilterMethod: " + _ctrl.medianFilterMethod);
+        }
+        // The small templates are filtered together, by size
+        std::vector<ImagePtrT> batchIn, batchOut;
+        for (PeakState & st : states) {
+            if (st.skip || st.deblendedAsPsf) {
+                continue;
+            }
+            if (st.timg->getWidth() >= filtsize && st.timg->getHeight() >= filtsize) {
+                auto inimg = std::make_shared<ImageT>(*st.timg, true);
+                if (separable) {
+                    Utils::medianFilterSeparable(*inimg, *st.timg, _ctrl.medianFilterHalfsize);
+                } else if (isTiled(*st.timg)) {
+                    Utils::medianFilterTiled(*inimg, *st.timg, _ctrl.medianFilterHalfsize);
+                } else if (isLaneBatched(*st.timg) &&
+                           _ctrl.medianFilterHalfsize <= Utils::LANE_BATCH_MAX_HALFSIZE) {
+                    batchIn.push_back(inimg);
+                    batchOut.push_back(st.timg);
+                } else {
+                    Utils::medianFilter(*inimg, *st.timg, _ctrl.medianFilterHalfsize);
+                }
+            }
+        }
+        Utils::medianFilterBatch(batchIn, batchOut, _ctrl.medianFilterHalfsize);
+    }
+
+    // Monotonic templates; the small ones together, by size and peak offset
+    {
+        std::vector<ImagePtrT> batch;
+        std::vector<int> batchX, batchY;
+        for (int i = 0; i < npeaks; ++i) {
+            PeakState & st = states[i];
+            if (st.skip || st.deblendedAsPsf) {
+                continue;
+            }
+            if (isTiled(*st.timg)) {
+                Utils::makeMonotonicTiled(*st.timg, peaks[i]);
+            } else if (isLaneBatched(*st.timg)) {
+                batch.push_back(st.timg);
+                batchX.push_back(peaks[i].getIx());
+                batchY.push_back(peaks[i].getIy());
+            } else {
+                Utils::makeMonotonic(*st.timg, peaks[i]);
+            }
+        }
+        Utils::makeMonotonicBatch(batch, batchX, batchY);
+    }
+
+    // Clip the template footprints to their non-zero pixels
+    for (PeakState & st : states) {
+        if (st.skip || st.deblendedAsPsf) {
+            continue;
+        }
+        clipFootprintToNonzero(*st.tfoot, *st.timg);
+        geom::Box2I const tbb = st.tfoot->getBBox();
+        if (!tbb.isEmpty() && tbb != st.timg->getBBox(image::PARENT)) {
+            st.timg = std::make_shared<ImageT>(*st.timg, tbb, image::PARENT, true);
+        }
+    }
+
+    // Apportion flux
+    std::vector<ImagePtrT> timgs;
+    std::vector<std::shared_ptr<det::Footprint>> tfoots;
+    std::vector<bool> ispsf;
+    std::vector<int> pkx, pky;
+    for (int i = 0; i < npeaks; ++i) {
+        PeakState const& st = states[i];
+        if (st.skip) {
+            continue;
+        }
+        timgs.push_back(st.timg);
+        tfoots.push_back(st.tfoot);
+        ispsf.push_back(st.deblendedAsPsf);
+        pkx.push_back(peaks[i].getIx());
+        pky.push_back(peaks[i].getIy());
+    }
+
+    int strayopts = 0;
+    if (_ctrl.spanTemplateSum) {
+        strayopts |= Utils::TEMPLATE_SUM_BY_SPANS;
+    }
+    bool assignStrayFlux = _ctrl.assignStrayFlux;
+    bool const trim = (_ctrl.strayFluxRule == "trim");
+    if (trim) {
+        assignStrayFlux = false;
+        strayopts |= Utils::STRAYFLUX_TRIM;
+    }
+    if (assignStrayFlux) {
+        strayopts |= Utils::ASSIGN_STRAYFLUX;
+        if (_ctrl.strayFluxToPointSources == "necessary") {
+            strayopts |= Utils::STRAYFLUX_TO_POINT_SOURCES_WHEN_NECESSARY;
+        } else if (_ctrl.strayFluxToPointSources == "always") {
+            strayopts |= Utils::STRAYFLUX_TO_POINT_SOURCES_ALWAYS;
+        } else if (_ctrl.strayFluxToPointSources != "never") {
+            throw LSST_EXCEPT(lsst::pex::exceptions::InvalidParameterError,
+                              "Unknown strayFluxToPointSources: " + _ctrl.strayFluxToPointSources);
+        }
+        if (_ctrl.strayFluxRule == "r-to-footprint") {
+            strayopts |= Utils::STRAYFLUX_R_TO_FOOTPRINT;
+        } else if (_ctrl.strayFluxRule == "nearest-footprint") {
+            strayopts |= Utils::STRAYFLUX_NEAREST_FOOTPRINT;
+        } else if (_ctrl.strayFluxRule == "nearest-peak") {
+            strayopts |= Utils::STRAYFLUX_NEAREST_PEAK;
+        } else if (_ctrl.strayFluxRule != "r-to-peak") {
+            throw LSST_EXCEPT(lsst::pex::exceptions::InvalidParameterError,
+                              "Unknown strayFluxRule: " + _ctrl.strayFluxRule);
+        }
+    }
+
+    ImagePtrT sumimg = std::make_shared<ImageT>(fbb);
+    std::vector<HeavyFootprintPtrT> strays;
+    std::vector<typename Utils::MaskedImagePtrT> portions =
+        Utils::apportionFlux(_mimg, fp, timgs, tfoots, sumimg, ispsf, pkx, pky, strays,
+                             strayopts, _ctrl.clipStrayFluxFraction);
+
+    // Shrink parent to union of children
+    if (trim) {
+        std::shared_ptr<afwGeom::SpanSet> finalSpans = std::make_shared<afwGeom::SpanSet>();
+        for (std::shared_ptr<det::Footprint> const& foot : tfoots) {
+            finalSpans = finalSpans->union_(*foot->getSpans());
+        }
+        result.parentSpans = finalSpans;
+    }
+
+    // Build the children: the flux portion within the template
+    // footprint, holding only its own peak, plus any stray flux.
+    result.peaks.resize(npeaks);
+    std::size_t ii = 0;
+    for (int i = 0; i < npeaks; ++i) {
+        PeakState & st = states[i];
+        result.peaks[i] = st;
+        if (st.skip) {
+            continue;
+        }
+        st.tfoot->getPeaks().clear();
+        st.tfoot->getPeaks().push_back(peaks.get(i));
+        HeavyFootprintPtrT stray = assignStrayFlux ? strays[ii] : HeavyFootprintPtrT();
+        result.peaks[i].heavy = Utils::makeChildFootprint(*st.tfoot, *portions[ii], stray);
+        result.peaks[i].hasStrayFlux = static_cast<bool>(stray);
+        ++ii;
+    }
+}
+
+/**
+ Deblend the parent Footprint *parent*, applying the same skip checks
+ as SourceDeblendTask.deblend (too few peaks, too large, masked,
+ invalid PSF FWHM).  When *catchFailures* is set, exceptions are
+ reported through the FAILED status.
+ */
+template <typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+typename deblend::NativeDeblender<ImagePixelT, MaskPixelT, VariancePixelT>::Result
+deblend::NativeDeblender<ImagePixelT, MaskPixelT, VariancePixelT>::
+deblend(det::Footprint const& parent) const {
+    Result result;
+    result.parentSpans = parent.getSpans();
+    if (parent.getPeaks().size() < 2) {
+        result.status = Result::NOT_BLENDED;
+        return result;
+    }
+    if (isLargeFootprint(parent)) {
+        result.status = Result::TOO_BIG;
+        return result;
+    }
+    if (isMasked(parent)) {
+        result.status = Result::MASKED;
+        return result;
+    }
+
+    geom::Point2D const center = parent.getCentroid();
+    result.psfFwhm = _computePsfFwhm(center);
+    if (!(result.psfFwhm > 0)) {
+        std::ostringstream os;
+        os << "PSF at (" << center.getX() << ", " << center.getY()
+           << ") has an invalid FWHM value of " << result.psfFwhm;
+        std::string const msg = os.str();
+        if (!_ctrl.catchFailures) {
+            throw LSST_EXCEPT(lsst::pex::exceptions::InvalidParameterError, msg);
+        }
+        result.status = Result::BAD_PSF;
+        result.message = msg;
+        return result;
+    }
+
+    try {
+        _deblendPeaks(parent, result.psfFwhm, result);
+        result.status = Result::DEBLENDED;
+    } catch (std::exception const& e) {
+        if (!_ctrl.catchFailures) {
+            throw;
+        }
+        result.status = Result::FAILED;
+        result.message = e.what();
+        result.parentSpans = parent.getSpans();
+        result.peaks.clear();
+    }
+    return result;
+}
+
+namespace {
+
+/*
+ * A NUMA node with CPUs: its kernel id and the CPUs it holds.
+ */
+struct NumaNode {
+    int id;
+    std::vector<int> cpus;
+};
+
+/*
+ * Parse a Linux CPU or node list such as "0-3,8,10-11".
+ */
+std::vector<int> parseIdList(std::string const& text) {
+    std::vector<int> ids;
+    std::istringstream in(text);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+        std::size_t const dash = range.find('-');
+        int const first = std::stoi(range.substr(0, dash));
+        int const last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+        for (int id = first; id <= last; ++id) {
+            ids.push_back(id);
+        }
+    }
+    return ids;
+}
+
+/*
+ * The NUMA nodes with CPUs, from sysfs; empty where the topology is not
+ * available (not Linux, or no sysfs).
+ */
+std::vector<NumaNode> numaNodes() {
+    std::vector<NumaNode> nodes;
+#ifdef __linux__
+    try {
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string line;
+        if (!std::getline(online, line)) {
+            return nodes;
+        }
+        for (int id : parseIdList(line)) {
+            std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+            std::string cpus;
+            if (std::getline(cpulist, cpus)) {
+                // Nodes with memory but no CPUs cannot run workers
+                NumaNode node{id, parseIdList(cpus)};
+                if (!node.cpus.empty()) {
+                    nodes.push_back(std::move(node));
+                }
+            }
+        }
+    } catch (std::exception const&) {
+        nodes.clear();
+    }
+#endif
+    return nodes;
+}
+
+/*
+ * Restrict the calling thread to *cpus* for the lifetime of the object,
+ * then restore its previous affinity.  A failure leaves the thread
+ * unbound.
+ */
+class CpuBinding {
+public:
+    explicit CpuBinding(std::vector<int> const& cpus) {
+#ifdef __linux__
+        _saved = (pthread_getaffinity_np(pthread_self(), sizeof(_previous), &_previous) == 0);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus) {
+            if (cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+    }
+
+    ~CpuBinding() {
+#ifdef __linux__
+        if (_saved) {
+            pthread_setaffinity_np(pthread_self(), sizeof(_previous), &_previous);
+        }
+#endif
+    }
+
+    CpuBinding(CpuBinding const&) = delete;
+    CpuBinding& operator=(CpuBinding const&) = delete;
+
+private:
+#ifdef __linux__
+    cpu_set_t _previous;
+    bool _saved = false;
+#endif
+};
+
+/*
+ * Move the pages holding rows [bandStart[k], bandStart[k + 1]) of *img*
+ * to NUMA node nodeIds[k], as if a thread on that node had touched them
+ * first.  A page shared by two bands goes with the later one, so each
+ * page is moved once.  Only the pages of this process are moved; a
+ * failure leaves them where they are.
+ */
+template <typename PixelT>
+void moveBandsToNodes(image::Image<PixelT> const& img, std::vector<int> const& bandStart,
+                      std::vector<int> const& nodeIds) {
+#if defined(__linux__) && defined(SYS_move_pages)
+    int const height = img.getHeight();
+    if (height == 0 || img.getWidth() == 0) {
+        return;
+    }
+    int const moveOwnPages = 1 << 1;    // MPOL_MF_MOVE
+    std::uintptr_t const pageSize = sysconf(_SC_PAGESIZE);
+    std::uintptr_t const end = reinterpret_cast<std::uintptr_t>(&*img.row_begin(height - 1) + img.getWidth());
+    std::vector<void*> pages;
+    std::vector<int> nodes;
+    for (std::size_t k = 0; k < nodeIds.size(); ++k) {
+        if (bandStart[k] >= bandStart[k + 1]) {
+            continue;
+        }
+        std::uintptr_t const begin = reinterpret_cast<std::uintptr_t>(&*img.row_begin(bandStart[k]));
+        std::uintptr_t page = begin - begin % pageSize;
+        if (!pages.empty() && reinterpret_cast<std::uintptr_t>(pages.back()) == page) {
+            nodes.back() = nodeIds[k];
+            page += pageSize;
+        }
+        std::uintptr_t const bandEnd = (bandStart[k + 1] < height) ?
+            reinterpret_cast<std::uintptr_t>(&*img.row_begin(bandStart[k + 1])) : end;
+        for (; page < bandEnd; page += pageSize) {
+            pages.push_back(reinterpret_cast<void*>(page));
+            nodes.push_back(nodeIds[k]);
+        }
+    }
+    std::vector<int> status(pages.size());
+    syscall(SYS_move_pages, 0, pages.size(), pages.data(), nodes.data(), status.data(), moveOwnPages);
+#endif
+}
+
+} // end anonymous namespace
+
+/**
+ Each thread, the calling one included, starts with its own queue of
+ parents, dealt out in order of decreasing cost (number of peaks times
+ area) so that the queues start balanced, and takes parents from its
+ front.  A thread whose queue is empty steals from the back of the
+ others, where the cheapest parents are.  If catchFailures is false,
+ the first exception stops the threads and is rethrown once they have
+ all finished.
+
+ With numaPlacement, on a machine with several NUMA nodes, the threads
+ are spread over the nodes and bound to their CPUs, and the rows of the
+ image are split into one band per node, whose pages are moved there
+ before the threads start.  Each parent is queued on a thread of the
+ node that holds the row of its centre, and a thread steals from the
+ other threads of its node before those of other nodes.  On a single
+ node, or without the topology, nothing changes.
+
+ Each parent is deblended by a single thread, with no state shared
+ with the others but the (serialized, deterministic) PSF, so every
+ floating-point reduction runs in the order of the serial deblender.
+ The threads also adopt the floating-point environment of the caller
+ (rounding mode, and on x86 the flush-to-zero and denormals-are-zero
+ flags, which new threads do not inherit), so the results are
+ bit-for-bit those of calling deblend() on each parent in turn,
+ whatever the number of threads and the order the parents are taken.
+ */
+template<typename ImagePixelT, typename MaskPixelT, typename VariancePixelT>
+std::vector<typename deblend::NativeDeblender<ImagePixelT, MaskPixelT, VariancePixelT>::Result>
+deblend::NativeDeblender<ImagePixelT, MaskPixelT, VariancePixelT>::
+deblendMany(std::vector<std::shared_ptr<det::Footprint>> const& parents, int nThreads) const {
+    std::size_t const n = parents.size();
+    std::vector<Result> results(n);
+    if (n == 0) {
+        return results;
+    }
+    if (nThreads <= 0) {
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    nThreads = static_cast<int>(std::min(static_cast<std::size_t>(nThreads), n));
+
+    std::vector<double> cost(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        cost[i] = static_cast<double>(parents[i]->getPeaks().size())*parents[i]->getArea();
+    }
+    std::vector<std::size_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&cost](std::size_t a, std::size_t b) {
+        return cost[a] > cost[b];
+    });
+
+    // Thread t runs on node t % nNodes, which holds the rows in
+    // [bandStart[node], bandStart[node + 1]).
+    std::vector<NumaNode> nodes;
+    if (_ctrl.numaPlacement && nThreads > 1) {
+        nodes = numaNodes();
+    }
+    int const nNodes = (nodes.size() > 1) ? std::min(static_cast<int>(nodes.size()), nThreads) : 1;
+    int const height = _mimg.getHeight();
+    std::vector<int> bandStart(nNodes + 1);
+    for (int node = 0; node <= nNodes; ++node) {
+        bandStart[node] = static_cast<int>(static_cast<long>(height)*node/nNodes);
+    }
+    auto nodeOfRow = [&bandStart, nNodes](int y) {
+        int node = 0;
+        while (node + 1 < nNodes && y >= bandStart[node + 1]) {
+            ++node;
+        }
+        return node;
+    };
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::size_t> items;
+    };
+    std::vector<WorkQueue> queues(nThreads);
+    std::vector<int> dealt(nNodes, 0);
+    for (std::size_t k = 0; k < n; ++k) {
+        int node = 0;
+        if (nNodes > 1) {
+            geom::Box2I const bbox = parents[order[k]]->getBBox();
+            node = nodeOfRow((bbox.getMinY() + bbox.getMaxY())/2 - _mimg.getY0());
+        }
+        int const threadsOnNode = (nThreads - node + nNodes - 1)/nNodes;
+        int const t = node + nNodes*(dealt[node]++ % threadsOnNode);
+        queues[t].items.push_back(order[k]);
+    }
+
+    // The queues each thread takes from, in order: its own, the others
+    // of its node, then those of the other nodes.
+    std::vector<std::vector<int>> victims(nThreads);
+    for (int t = 0; t < nThreads; ++t) {
+        for (int pass = 0; pass < 2; ++pass) {
+            for (int k = 0; k < nThreads; ++k) {
+                int const u = (t + k) % nThreads;
+                if ((u % nNodes == t % nNodes) == (pass == 0)) {
+                    victims[t].push_back(u);
+                }
+            }
+        }
+    }
+
+    // No parents are added once the threads start, so a thread that
+    // finds every queue empty is done.
+    auto next = [&queues, &victims, nThreads](int t, std::size_t & i) {
+        for (int k = 0; k < nThreads; ++k) {
+            WorkQueue & queue = queues[victims[t][k]];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.items.empty()) {
+                continue;
+            }
+            if (k == 0) {
+                i = queue.items.front();
+                queue.items.pop_front();
+            } else {
+                i = queue.items.back();
+                queue.items.pop_back();
+            }
+            return true;
+        }
+        return false;
+    };
+
+    // Place the bands while no thread reads the image
+    if (nNodes > 1) {
+        std::vector<int> nodeIds;
+        for (int node = 0; node < nNodes; ++node) {
+            nodeIds.push_back(nodes[node].id);
+        }
+        moveBandsToNodes(*_mimg.getImage(), bandStart, nodeIds);
+        moveBandsToNodes(*_mimg.getMask(), bandStart, nodeIds);
+        moveBandsToNodes(*_mimg.getVariance(), bandStart, nodeIds);
+    }
+
+    std::fenv_t fenv;
+    std::fegetenv(&fenv);
+    std::atomic<bool> stop(false);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto worker = [&](int t) {
+        if (t > 0) {
+            std::fesetenv(&fenv);
+        }
+        std::unique_ptr<CpuBinding> binding;
+        if (nNodes > 1) {
+            binding.reset(new CpuBinding(nodes[t % nNodes].cpus));
+        }
+        std::size_t i;
+        while (!stop && next(t, i)) {
+            try {
+                results[i] = deblend(*parents[i]);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                stop = true;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nThreads; ++t) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (std::thread & thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return results;
+}
+
+// Instantiate
+template class deblend::NativeDeblender<float>;
+template void deblend::clipFootprintToNonzero(det::Footprint &, image::Image<float> const&);
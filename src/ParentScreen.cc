@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include "lsst/geom.h"
+#include "lsst/afw/geom/SpanSet.h"
+#include "lsst/afw/geom/ellipses/Axes.h"
+#include "lsst/meas/deblender/ParentScreen.h"
+
+namespace image = lsst::afw::image;
+namespace det = lsst::afw::detection;
+namespace table = lsst::afw::table;
+namespace deblend = lsst::meas::deblender;
+namespace afwGeom = lsst::afw::geom;
+namespace geom = lsst::geom;
+
+namespace {
+
+bool isLargeFootprint(det::Footprint const& foot, int maxFootprintArea, int maxFootprintSize,
+                      double minFootprintAxisRatio) {
+    if ((maxFootprintArea > 0) && (foot.getArea() > static_cast<std::size_t>(maxFootprintArea))) {
+        return true;
+    }
+    if (maxFootprintSize > 0) {
+        geom::Box2I bbox = foot.getBBox();
+        if (std::max(bbox.getWidth(), bbox.getHeight()) > maxFootprintSize) {
+            return true;
+        }
+    }
+    if (minFootprintAxisRatio > 0) {
+        afwGeom::ellipses::Axes axes(foot.getShape());
+        if (axes.getB() < minFootprintAxisRatio*axes.getA()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // end anonymous namespace
+
+/**
+ The mask plane bits are looked up once and the PSF FWHM is computed
+ once per distinct centroid, as SourceDeblendTask caches it.
+ */
+deblend::ParentScreen
+deblend::screenParents(table::SourceCatalog const& srcs,
+                       image::Mask<image::MaskPixel> const& mask,
+                       std::shared_ptr<det::Psf const> psf,
+                       int maxFootprintArea,
+                       int maxFootprintSize,
+                       double minFootprintAxisRatio,
+                       std::map<std::string, double> const& maskLimits) {
+    std::size_t const n = srcs.size();
+    ParentScreen screen;
+    screen.reason = ndarray::allocate(n);
+    screen.cost = ndarray::allocate(n);
+    screen.centroidX = ndarray::allocate(n);
+    screen.centroidY = ndarray::allocate(n);
+    screen.psfFwhm = ndarray::allocate(n);
+
+    std::vector<std::pair<image::MaskPixel, double>> limits;
+    for (auto const& limit : maskLimits) {
+        limits.emplace_back(mask.getPlaneBitMask(limit.first), limit.second);
+    }
+    std::map<std::pair<double, double>, double> fwhms;
+    double const nan = std::numeric_limits<double>::quiet_NaN();
+
+    for (std::size_t i = 0; i < n; ++i) {
+        std::shared_ptr<det::Footprint> fp = srcs[i].getFootprint();
+        std::size_t const npeaks = fp->getPeaks().size();
+        double const area = fp->getArea();
+        geom::Point2D const center = fp->getCentroid();
+        screen.cost[i] = npeaks*area;
+        screen.centroidX[i] = center.getX();
+        screen.centroidY[i] = center.getY();
+        screen.psfFwhm[i] = nan;
+
+        if (npeaks < 2) {
+            screen.reason[i] = ParentScreen::NOT_BLENDED;
+            continue;
+        }
+        if (isLargeFootprint(*fp, maxFootprintArea, maxFootprintSize, minFootprintAxisRatio)) {
+            screen.reason[i] = ParentScreen::TOO_BIG;
+            continue;
+        }
+        bool masked = false;
+        for (auto const& limit : limits) {
+            std::shared_ptr<afwGeom::SpanSet> unmasked = fp->getSpans()->intersectNot(mask, limit.first);
+            if ((area - unmasked->getArea())/area > limit.second) {
+                masked = true;
+                break;
+            }
+        }
+        if (masked) {
+            screen.reason[i] = ParentScreen::MASKED;
+            continue;
+        }
+
+        screen.reason[i] = ParentScreen::DEBLEND;
+        if (!psf) {
+            continue;
+        }
+        std::pair<double, double> const key(center.getX(), center.getY());
+        auto found = fwhms.find(key);
+        if (found == fwhms.end()) {
+            double const fwhm = psf->computeShape(center).getDeterminantRadius()*2.35;
+            found = fwhms.emplace(key, fwhm).first;
+        }
+        screen.psfFwhm[i] = found->second;
+        if (!(found->second > 0)) {
+            screen.reason[i] = ParentScreen::BAD_PSF;
+        }
+    }
+    return screen;
+}
+
+deblend::ParentScreen
+deblend::screenParents(table::SourceCatalog const& srcs,
+                       image::Mask<image::MaskPixel> const& mask,
+                       std::shared_ptr<det::Psf const> psf,
+                       NativeDeblendControl const& ctrl) {
+    return screenParents(srcs, mask, psf, ctrl.maxFootprintArea, ctrl.maxFootprintSize,
+                         ctrl.minFootprintAxisRatio, ctrl.maskLimits);
+}
@@ -0,0 +1,123 @@
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "lsst/meas/deblender/PerfCounters.h"
+
+namespace deblend = lsst::meas::deblender;
+
+#if defined(__linux__)
+
+namespace {
+
+int openCounter(std::uint64_t config, int groupFd) {
+    struct perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // The leader starts disabled and enables the whole group once it is
+    // complete; it is read for all of them.
+    attr.disabled = (groupFd < 0) ? 1 : 0;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // This thread only, on any CPU
+    long const fd = syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+    return static_cast<int>(fd);
+}
+
+} // end anonymous namespace
+
+deblend::PerfCounters::PerfCounters() : _leader(-1) {
+    std::uint64_t const configs[NEVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+    int nOpen = 0;
+    for (int i = 0; i < NEVENTS; ++i) {
+        _fds[i] = openCounter(configs[i], _leader);
+        _index[i] = (_fds[i] >= 0) ? nOpen++ : -1;
+        if (_leader < 0) {
+            _leader = _fds[i];
+        }
+    }
+    if (_leader >= 0) {
+        ioctl(_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+deblend::PerfCounters::~PerfCounters() {
+    // The group members before the leader
+    for (int i = NEVENTS - 1; i >= 0; --i) {
+        if (_fds[i] >= 0) {
+            close(_fds[i]);
+        }
+    }
+}
+
+deblend::PerfCounters::Counts
+deblend::PerfCounters::read() const {
+    Counts counts;
+    counts.fill(-1);
+    if (_leader < 0) {
+        return counts;
+    }
+    // nr, time enabled, time running, then one value per member
+    std::uint64_t buffer[3 + NEVENTS];
+    ssize_t const size = ::read(_leader, buffer, sizeof(buffer));
+    if (size < static_cast<ssize_t>(3*sizeof(std::uint64_t)) ||
+        size < static_cast<ssize_t>((3 + buffer[0])*sizeof(std::uint64_t))) {
+        return counts;
+    }
+    std::uint64_t const enabled = buffer[1];
+    std::uint64_t const running = buffer[2];
+    if (running == 0) {
+        return counts;
+    }
+    double const scale = static_cast<double>(enabled)/running;
+    for (int i = 0; i < NEVENTS; ++i) {
+        if (_index[i] >= 0 && static_cast<std::uint64_t>(_index[i]) < buffer[0]) {
+            std::uint64_t const value = buffer[3 + _index[i]];
+            counts[i] = (running == enabled) ? static_cast<std::int64_t>(value) :
+                        static_cast<std::int64_t>(value*scale + 0.5);
+        }
+    }
+    return counts;
+}
+
+#else
+
+deblend::PerfCounters::PerfCounters() : _leader(-1) {
+    _fds.fill(-1);
+    _index.fill(-1);
+}
+
+deblend::PerfCounters::~PerfCounters() {}
+
+deblend::PerfCounters::Counts
+deblend::PerfCounters::read() const {
+    Counts counts;
+    counts.fill(-1);
+    return counts;
+}
+
+#endif
+
+bool
+deblend::PerfCounters::isAvailable() const {
+    for (int fd : _fds) {
+        if (fd >= 0) {
+            return true;
+        }
+    }
+    return false;
+}
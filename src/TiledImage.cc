@@ -0,0 +1,36 @@
+#include "lsst/pex/exceptions.h"
+#include "lsst/meas/deblender/TiledImage.h"
+
+namespace image = lsst::afw::image;
+namespace deblend = lsst::meas::deblender;
+
+template <typename PixelT>
+deblend::TiledImage<PixelT>::TiledImage(image::Image<PixelT> const& img) :
+    _width(img.getWidth()),
+    _height(img.getHeight()),
+    _ntx((img.getWidth() + TILE - 1) >> TILE_SHIFT),
+    _pixels(_ntx*((img.getHeight() + TILE - 1) >> TILE_SHIFT) << (2*TILE_SHIFT)) {
+    for (int y = 0; y < _height; ++y) {
+        typename image::Image<PixelT>::const_x_iterator iptr = img.row_begin(y);
+        for (int x = 0; x < _width; ++x, ++iptr) {
+            (*this)(x, y) = *iptr;
+        }
+    }
+}
+
+template <typename PixelT>
+void
+deblend::TiledImage<PixelT>::copyTo(image::Image<PixelT> & img) const {
+    if (img.getWidth() != _width || img.getHeight() != _height) {
+        throw LSST_EXCEPT(lsst::pex::exceptions::LengthError,
+                          "Image dimensions do not match those of the TiledImage");
+    }
+    for (int y = 0; y < _height; ++y) {
+        typename image::Image<PixelT>::x_iterator optr = img.row_begin(y);
+        for (int x = 0; x < _width; ++x, ++optr) {
+            *optr = (*this)(x, y);
+        }
+    }
+}
+
+template class deblend::TiledImage<float>;
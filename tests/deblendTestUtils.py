@@ -0,0 +1,104 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+"""Blended test images shared by the deblender tests.
+"""
+
+import numpy as np
+
+import lsst.afw.detection as afwDet
+import lsst.afw.image as afwImage
+import lsst.afw.table as afwTable
+import lsst.geom as geom
+import lsst.meas.algorithms as measAlg
+
+
+def makeBlendedExposure(W=240, H=160, seed=42, start=(10, 8), step=(37, 29), margin=0,
+                        offsets=((0., 0.), (4.5, 3.)), groupSize=None, fluxRange=None, background=0.):
+    """Make an exposure with groups of blended point sources on a grid,
+    some of them straddling the edges, and unit variance noise.
+
+    Parameters
+    ----------
+    W, H : `int`
+        Dimensions of the exposure.
+    seed : `int`
+        Seed of the positions, fluxes and noise.
+    start, step : `tuple` [`int`]
+        First grid point and grid spacing in x and y.
+    margin : `int`
+        No grid points are placed within this many pixels of the right
+        and top edges.
+    offsets : sequence of `tuple` [`float`]
+        Offsets of the sources of a group from its grid point, each
+        jittered by up to a pixel.
+    groupSize : callable, optional
+        Function of the column and row numbers of a grid point returning
+        how many of ``offsets`` its group uses; all of them by default.
+    fluxRange : `tuple` [`float`], optional
+        Range of the uniformly drawn source fluxes; 1000 by default.
+    background : `float`
+        Peak value of an extended Gaussian source (sigma 40 pixels) at the
+        centre of the exposure.
+
+    Returns
+    -------
+    exposure : `lsst.afw.image.ExposureF`
+        The exposure, with a double Gaussian PSF.
+    """
+    rng = np.random.RandomState(seed)
+    psf = measAlg.DoubleGaussianPsf(21, 21, 3.)
+    mi = afwImage.MaskedImageF(geom.Extent2I(W, H))
+    mi.getVariance().set(1.0)
+    img = mi.getImage()
+    if background:
+        yy, xx = np.mgrid[:H, :W]
+        img.getArray()[:, :] += background*np.exp(-((xx - W/2)**2 + (yy - H/2)**2)/(2*40.**2))
+    for n, x in enumerate(range(start[0], W - margin, step[0])):
+        for m, y in enumerate(range(start[1], H - margin, step[1])):
+            nSources = len(offsets) if groupSize is None else groupSize(n, m)
+            for dx, dy in offsets[:nSources]:
+                pos = geom.Point2D(x + dx + rng.uniform(-1, 1), y + dy + rng.uniform(-1, 1))
+                psfImg = psf.computeImage(pos)
+                bbox = psfImg.getBBox()
+                bbox.clip(img.getBBox())
+                psfImg = psfImg.Factory(psfImg, bbox, afwImage.PARENT)
+                flux = 1000. if fluxRange is None else rng.uniform(*fluxRange)
+                img.Factory(img, bbox, afwImage.PARENT).getArray()[:, :] += flux*psfImg.getArray()
+    img.getArray()[:, :] += rng.normal(size=(H, W)).astype(np.float32)
+    exposure = afwImage.makeExposure(mi)
+    exposure.setPsf(psf)
+    return exposure
+
+
+def makeSources(exposure, schema):
+    """Detect the sources of ``exposure`` above five sigma.
+
+    Returns
+    -------
+    srcs : `lsst.afw.table.SourceCatalog`
+        The parents, with ``schema``.
+    """
+    fpSet = afwDet.FootprintSet(exposure.getMaskedImage(), afwDet.Threshold(5.), "DETECTED")
+    srcs = afwTable.SourceCatalog(schema)
+    fpSet.makeSources(srcs)
+    return srcs
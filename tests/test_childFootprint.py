@@ -0,0 +1,83 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.detection as afwDet
+import lsst.afw.geom as afwGeom
+import lsst.afw.image as afwImage
+import lsst.geom as geom
+from lsst.meas.deblender import BaselineUtilsF as bUtils
+
+
+class ChildFootprintTestCase(lsst.utils.tests.TestCase):
+
+    def setUp(self):
+        rng = np.random.RandomState(7)
+        bbox = geom.Box2I(geom.Point2I(3, -4), geom.Extent2I(40, 30))
+        self.portion = afwImage.MaskedImageF(bbox)
+        self.portion.getImage().getArray()[:, :] = rng.normal(size=(30, 40))
+        self.portion.getVariance().getArray()[:, :] = rng.uniform(1, 2, size=(30, 40))
+        self.portion.getMask().getArray()[:, :] = rng.randint(0, 4, size=(30, 40))
+
+        self.foot = afwDet.Footprint(afwGeom.SpanSet.fromShape(6, afwGeom.Stencil.CIRCLE, (20, 8)))
+        self.foot.addPeak(20, 8, 1.)
+
+        # Stray flux partly overlapping the template footprint, partly outside
+        # the portion image.
+        strayFoot = afwDet.Footprint(afwGeom.SpanSet.fromShape(4, afwGeom.Stencil.BOX, (27, 14)))
+        strayImage = afwImage.MaskedImageF(strayFoot.getBBox())
+        strayImage.getImage().getArray()[:, :] = rng.uniform(size=strayImage.getImage().getArray().shape)
+        strayImage.getVariance().set(0.5)
+        strayImage.getMask().set(8)
+        self.stray = afwDet.makeHeavyFootprint(strayFoot, strayImage)
+
+    def assertHeavyEqual(self, heavy, ref):
+        self.assertEqual(heavy.getSpans(), ref.getSpans())
+        self.assertEqual(len(heavy.getPeaks()), len(ref.getPeaks()))
+        np.testing.assert_array_equal(heavy.getImageArray(), ref.getImageArray())
+        np.testing.assert_array_equal(heavy.getMaskArray(), ref.getMaskArray())
+        np.testing.assert_array_equal(heavy.getVarianceArray(), ref.getVarianceArray())
+
+    def testWithoutStray(self):
+        heavy = bUtils.makeChildFootprint(self.foot, self.portion, None)
+        self.assertHeavyEqual(heavy, afwDet.makeHeavyFootprint(self.foot, self.portion))
+
+    def testWithStray(self):
+        heavy = bUtils.makeChildFootprint(self.foot, self.portion, self.stray)
+        ref = afwDet.mergeHeavyFootprints(afwDet.makeHeavyFootprint(self.foot, self.portion), self.stray)
+        self.assertHeavyEqual(heavy, ref)
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
@@ -0,0 +1,135 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+import os
+import tempfile
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.image as afwImage
+import lsst.afw.table as afwTable
+from lsst.meas.deblender import (SourceDeblendTask, ChildColumnFile, ChildStreamWriter, ChildStreamFile,
+                                 writeChildColumns)
+
+from deblendTestUtils import makeBlendedExposure, makeSources
+
+
+class ChildStreamTestCase(lsst.utils.tests.TestCase):
+
+    def setUp(self):
+        self.exposure = makeBlendedExposure(W=120, H=90)
+        self.tempDir = tempfile.TemporaryDirectory()
+
+    def tearDown(self):
+        self.tempDir.cleanup()
+
+    def deblend(self, **kwargs):
+        schema = afwTable.SourceTable.makeMinimalSchema()
+        config = SourceDeblendTask.ConfigClass()
+        config.exportOutput = os.path.join(self.tempDir.name, "children")
+        for name, value in kwargs.items():
+            setattr(config, name, value)
+        task = SourceDeblendTask(schema, config=config)
+        srcs = makeSources(self.exposure, schema)
+        task.run(self.exposure.clone(), srcs)
+        return task, srcs
+
+    def assertSameChildren(self, stream, children):
+        self.assertEqual(len(stream), len(children))
+        for i, child in enumerate(children):
+            self.assertEqual(stream["id"][i], child.getId())
+            self.assertEqual(stream["parent"][i], child.getParent())
+            self.assertEqual(stream["peakId"][i], child.get("deblend_peakId"))
+            fp = child.getFootprint()
+            np.testing.assert_array_equal(stream.getPixels(i), fp.getImageArray())
+            image = afwImage.ImageF(fp.getBBox())
+            fp.insert(image)
+            np.testing.assert_array_equal(stream.getImage(i), image.getArray())
+
+    def testTask(self):
+        """The stream holds the children of the catalog, in order.
+        """
+        task, srcs = self.deblend(doStreamChildren=True)
+        filename = task.metadata["streamFile"]
+        self.assertEqual(filename, os.path.join(self.tempDir.name, "children-1.childstream"))
+        children = [src for src in srcs if src.getParent() != 0]
+        self.assertGreater(len(children), 0)
+        self.assertEqual(task.metadata["streamedChildren"], len(children))
+        stream = ChildStreamFile(filename)
+        for name in task.getExportColumns():
+            self.assertIn(name, stream.getColumnNames())
+        self.assertSameChildren(stream, children)
+
+    def testDropPixels(self):
+        _, ref = self.deblend()
+        task, srcs = self.deblend(doStreamChildren=True, streamDropPixels=True)
+        children = [src for src in srcs if src.getParent() != 0]
+        refChildren = [src for src in ref if src.getParent() != 0]
+        for child in children:
+            self.assertFalse(child.getFootprint().isHeavy())
+        self.assertSameChildren(ChildStreamFile(task.metadata["streamFile"]), refChildren)
+
+    def testBlocks(self):
+        """Several blocks read as one file written at once.
+        """
+        task, srcs = self.deblend()
+        columns = task.getExportColumns()
+        children = [src for src in srcs if src.getParent() != 0]
+        filename = os.path.join(self.tempDir.name, "blocks.childstream")
+        with ChildStreamWriter(filename, columns, maxQueued=1, blockRows=3) as writer:
+            for parent in srcs:
+                writer.append([child for child in children if child.getParent() == parent.getId()])
+        self.assertGreater(writer.nBlocks, 1)
+        self.assertEqual(writer.nRows, len(children))
+        stream = ChildStreamFile(filename)
+        self.assertEqual(len(stream.blocks), writer.nBlocks)
+        self.assertSameChildren(stream, children)
+
+        reference = os.path.join(self.tempDir.name, "reference.children")
+        writeChildColumns(reference, srcs, columns)
+        single = ChildColumnFile(reference)
+        for name in single.getColumnNames() + ["spans", "pixels"]:
+            np.testing.assert_array_equal(stream[name], single[name])
+
+        # A truncated last block is ignored
+        size = os.path.getsize(filename)
+        with open(filename, "r+b") as f:
+            f.truncate(size - 8)
+        truncated = ChildStreamFile(filename)
+        self.assertEqual(len(truncated.blocks), writer.nBlocks - 1)
+        self.assertSameChildren(truncated, children[:len(truncated)])
+        del stream, single, truncated
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
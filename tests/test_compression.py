@@ -0,0 +1,144 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+import os
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.detection as afwDet
+import lsst.afw.geom as afwGeom
+import lsst.afw.image as afwImage
+import lsst.afw.table as afwTable
+from lsst.meas.deblender import (shuffleCompress, shuffleDecompress, runLengthEncode, runLengthDecode,
+                                 CompressedFootprintStore, SourceDeblendTask, writeChildColumns)
+
+from deblendTestUtils import makeBlendedExposure, makeSources
+
+
+def makeHeavy(rng, x, y, radius):
+    foot = afwDet.Footprint(afwGeom.SpanSet.fromShape(radius, afwGeom.Stencil.CIRCLE, (x, y)))
+    foot.addPeak(x, y, 1.)
+    mi = afwImage.MaskedImageF(foot.getBBox())
+    mi.getImage().getArray()[:, :] = rng.normal(size=mi.getImage().getArray().shape)
+    mi.getVariance().set(2.5)
+    mi.getMask().getArray()[:, :2] = 3
+    return afwDet.makeHeavyFootprint(foot, mi)
+
+
+class CompressionTestCase(lsst.utils.tests.TestCase):
+
+    def testCodecs(self):
+        rng = np.random.RandomState(1)
+        for dtype in (np.float32, np.float64, np.int32):
+            array = (100*rng.normal(size=1001)).astype(dtype)
+            np.testing.assert_array_equal(shuffleDecompress(shuffleCompress(array), dtype, len(array)),
+                                          array)
+        mask = np.array([0, 0, 0, 4, 4, 0, 1, 1, 1, 1], dtype=np.int32)
+        values, lengths = runLengthEncode(mask)
+        np.testing.assert_array_equal(values, [0, 4, 0, 1])
+        np.testing.assert_array_equal(lengths, [3, 2, 1, 4])
+        np.testing.assert_array_equal(runLengthDecode(values, lengths), mask)
+        values, lengths = runLengthEncode(mask[:0])
+        self.assertEqual(len(runLengthDecode(values, lengths)), 0)
+
+    def testStore(self):
+        """Children are restored bit for bit, on first access or all at once.
+        """
+        rng = np.random.RandomState(2)
+        schema = afwTable.SourceTable.makeMinimalSchema()
+        catalog = afwTable.SourceCatalog(schema)
+        parent = catalog.addNew()
+        parent.setFootprint(makeHeavy(rng, 30, 30, 12))
+        refs = {}
+        for x, y in [(25, 28), (35, 31), (30, 36)]:
+            child = catalog.addNew()
+            child.setParent(parent.getId())
+            child.setFootprint(makeHeavy(rng, x, y, 5))
+            refs[child.getId()] = child.getFootprint()
+
+        store = CompressedFootprintStore()
+        self.assertEqual(store.compress(catalog), 3)
+        self.assertEqual(len(store), 3)
+        self.assertTrue(parent.getFootprint().isHeavy())
+        self.assertGreater(store.rawBytes, store.compressedBytes)
+
+        children = [src for src in catalog if src.getParent() != 0]
+        for src in children:
+            self.assertFalse(src.getFootprint().isHeavy())
+            self.assertEqual(src.getFootprint().getSpans(), refs[src.getId()].getSpans())
+            self.assertEqual(len(src.getFootprint().getPeaks()), 1)
+
+        heavy = store.getFootprint(children[0])
+        self.assertTrue(heavy.isHeavy())
+        self.assertNotIn(children[0].getId(), store)
+        store.restoreAll(catalog)
+        self.assertEqual(len(store), 0)
+        self.assertEqual(store.rawBytes, 0)
+        for src in children:
+            heavy, ref = src.getFootprint(), refs[src.getId()]
+            self.assertTrue(heavy.isHeavy())
+            np.testing.assert_array_equal(heavy.getImageArray(), ref.getImageArray())
+            np.testing.assert_array_equal(heavy.getMaskArray(), ref.getMaskArray())
+            np.testing.assert_array_equal(heavy.getVarianceArray(), ref.getVarianceArray())
+
+    def testTaskFlagsCompressedChildren(self):
+        """The task flags the children it compressed until they are
+        restored, and nothing reads their missing pixels silently.
+        """
+        exposure = makeBlendedExposure(W=120, H=90)
+        schema = afwTable.SourceTable.makeMinimalSchema()
+        config = SourceDeblendTask.ConfigClass()
+        config.compressChildren = True
+        task = SourceDeblendTask(schema, config=config)
+        srcs = makeSources(exposure, schema)
+        nParents = len(srcs)
+        task.run(exposure, srcs)
+        self.assertGreater(len(srcs), nParents)
+
+        children = [src for src in srcs if src.getParent() != 0]
+        for src in children:
+            self.assertTrue(src.get("deblend_pixelsCompressed"))
+            self.assertFalse(src.getFootprint().isHeavy())
+        with self.assertRaises(RuntimeError):
+            task.compressedFootprints.checkRestored(srcs)
+        with self.assertRaises(RuntimeError):
+            writeChildColumns(os.devnull, srcs, {})
+
+        task.restoreChildren(srcs)
+        task.compressedFootprints.checkRestored(srcs)
+        for src in children:
+            self.assertFalse(src.get("deblend_pixelsCompressed"))
+            self.assertTrue(src.getFootprint().isHeavy())
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
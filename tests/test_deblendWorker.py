@@ -0,0 +1,138 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+import os
+import shutil
+import tempfile
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.table as afwTable
+from lsst.meas.deblender import SourceDeblendTask, DeblendWorkerClient, exposureKey, startWorker
+
+from deblendTestUtils import makeBlendedExposure, makeSources
+
+
+class DeblendWorkerTestCase(lsst.utils.tests.TestCase):
+
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp(prefix="deblendWorker-")
+        self.address = os.path.join(self.tmpdir, "socket")
+        self.process = startWorker(self.address)
+
+    def tearDown(self):
+        DeblendWorkerClient(self.address).stop()
+        self.process.join(timeout=60)
+        shutil.rmtree(self.tmpdir, ignore_errors=True)
+
+    def assertSameChildren(self, srcs, ref):
+        self.assertEqual(len(srcs), len(ref))
+        for src, refSrc in zip(srcs, ref):
+            self.assertEqual(src.getId(), refSrc.getId())
+            self.assertEqual(src.getParent(), refSrc.getParent())
+            for name in ("deblend_nChild", "deblend_deblendedAsPsf", "deblend_peakId", "deblend_skipped"):
+                self.assertEqual(src.get(name), refSrc.get(name))
+            self.assertEqual(src.getFootprint().getSpans(), refSrc.getFootprint().getSpans())
+            if refSrc.getParent() != 0:
+                np.testing.assert_array_equal(src.getFootprint().getImageArray(),
+                                              refSrc.getFootprint().getImageArray())
+
+    def testMatchesLocal(self):
+        """Tasks deblending on the worker get the local result, and the
+        second task reuses the exposure state warmed by the first.
+        """
+        exposure = makeBlendedExposure()
+        schema = afwTable.SourceTable.makeMinimalSchema()
+        localTask = SourceDeblendTask(schema)
+        localSrcs = makeSources(exposure, schema)
+        nParents = len(localSrcs)
+        localExposure = exposure.clone()
+        localTask.run(localExposure, localSrcs)
+        self.assertGreater(len(localSrcs), nParents)
+
+        for run in range(2):
+            schema = afwTable.SourceTable.makeMinimalSchema()
+            config = SourceDeblendTask.ConfigClass()
+            config.workerAddress = self.address
+            task = SourceDeblendTask(schema, config=config)
+            srcs = makeSources(exposure, schema)
+            workerExposure = exposure.clone()
+            task.run(workerExposure, srcs)
+            self.assertEqual(task.metadata["workerExposureCached"], run > 0)
+            self.assertSameChildren(srcs, localSrcs)
+            np.testing.assert_array_equal(workerExposure.getMaskedImage().getMask().getArray(),
+                                          localExposure.getMaskedImage().getMask().getArray())
+
+    def testExposureKey(self):
+        """The key ignores the plane set by the deblender but not the
+        pixels.
+        """
+        exposure = makeBlendedExposure(W=60, H=40)
+        psf = exposure.getPsf()
+        key = exposureKey(exposure, psf, ignoreMaskPlane="NOT_DEBLENDED")
+        mask = exposure.getMaskedImage().getMask()
+        mask.addMaskPlane("NOT_DEBLENDED")
+        mask.getArray()[3, 4] |= mask.getPlaneBitMask("NOT_DEBLENDED")
+        self.assertEqual(exposureKey(exposure, psf, ignoreMaskPlane="NOT_DEBLENDED"), key)
+        exposure.getMaskedImage().getImage().getArray()[3, 4] += 1.0
+        self.assertNotEqual(exposureKey(exposure, psf, ignoreMaskPlane="NOT_DEBLENDED"), key)
+
+
+class ExposureCacheTestCase(lsst.utils.tests.TestCase):
+
+    def testModifiedInPlace(self):
+        """The cached exposure state is reused for the same pixels, also
+        once the task has set its own mask plane, but not after the
+        exposure has been modified in place.
+        """
+        exposure = makeBlendedExposure(W=80, H=60)
+        psf = exposure.getPsf()
+        schema = afwTable.SourceTable.makeMinimalSchema()
+        config = SourceDeblendTask.ConfigClass()
+        config.cacheExposureState = True
+        task = SourceDeblendTask(schema, config=config)
+        cache = task.getExposureCache(exposure, psf)
+        self.assertIs(task.getExposureCache(exposure, psf), cache)
+
+        mask = exposure.getMaskedImage().getMask()
+        mask.addMaskPlane(config.notDeblendedMask)
+        mask.getArray()[3, 4] |= mask.getPlaneBitMask(config.notDeblendedMask)
+        self.assertIs(task.getExposureCache(exposure, psf), cache)
+
+        exposure.getMaskedImage().getVariance().getArray()[:, :] *= 4.0
+        newCache = task.getExposureCache(exposure, psf)
+        self.assertIsNot(newCache, cache)
+        self.assertFloatsAlmostEqual(newCache.sigma1, 2.0*cache.sigma1, rtol=1e-6)
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
@@ -0,0 +1,169 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+import queue
+import threading
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.table as afwTable
+import lsst.geom as geom
+from lsst.meas.deblender import (SourceDeblendTask, DistributedSourceDeblendTask, RegionPartition,
+                                 Transport, runLocal)
+
+from deblendTestUtils import makeBlendedExposure, makeSources
+
+
+class QueueTransport(Transport):
+    """Transport between threads of this process.
+    """
+
+    def __init__(self, rank, size, queues):
+        self.rank = rank
+        self.size = size
+        self._queues = queues
+
+    @classmethod
+    def make(cls, size):
+        queues = {(a, b): queue.Queue() for a in range(size) for b in range(size) if a != b}
+        return [cls(rank, size, queues) for rank in range(size)]
+
+    def send(self, rank, obj):
+        self._queues[(self.rank, rank)].put(obj)
+
+    def recv(self, rank):
+        return self._queues[(rank, self.rank)].get(timeout=600)
+
+
+class FailOnceTask(DistributedSourceDeblendTask):
+    """Fail while deblending the first parent rank 0 is given.
+    """
+    failed = False
+
+    def preSingleDeblendHook(self, exposure, srcs, i, fp, psf, psf_fwhm, sigma1):
+        if not self.failed:
+            self.failed = True
+            raise RuntimeError("Failing on purpose")
+
+
+class RegionPartitionTestCase(lsst.utils.tests.TestCase):
+
+    def testTiling(self):
+        bbox = geom.Box2I(geom.Point2I(-5, 10), geom.Extent2I(301, 97))
+        for nRegions in (1, 2, 3, 4, 6, 7):
+            partition = RegionPartition(bbox, nRegions)
+            self.assertEqual(len(partition), nRegions)
+            area = 0
+            for i in range(nRegions):
+                region = partition.getRegion(i)
+                self.assertTrue(bbox.contains(region))
+                area += region.getArea()
+                self.assertEqual(partition.regionOf(geom.Point2D(region.getCenter())), i)
+            self.assertEqual(area, bbox.getArea())
+        partition = RegionPartition(bbox, 4)
+        # Owners are decided by the centre of the bounding box...
+        parent = geom.Box2I(geom.Point2I(140, 50), geom.Extent2I(20, 20))
+        self.assertEqual(partition.ownerOf(parent), partition.regionOf(geom.Point2D(149.5, 59.5)))
+        # ... even when it is outside the partitioned box.
+        self.assertEqual(partition.ownerOf(geom.Box2I(geom.Point2I(-50, -50), geom.Extent2I(3, 3))), 0)
+
+
+class DistributedDeblendTestCase(lsst.utils.tests.TestCase):
+
+    def testMatchesSerial(self):
+        """Deblending on local worker processes gives the serial result,
+        with the children in the same order and with the same IDs.
+        """
+        exposure = makeBlendedExposure()
+
+        schema = afwTable.SourceTable.makeMinimalSchema()
+        serialTask = SourceDeblendTask(schema)
+        serialSrcs = makeSources(exposure, schema)
+        nParents = len(serialSrcs)
+        serialExposure = exposure.clone()
+        serialTask.run(serialExposure, serialSrcs)
+
+        schema = afwTable.SourceTable.makeMinimalSchema()
+        task = DistributedSourceDeblendTask(schema)
+        srcs = makeSources(exposure, schema)
+        distExposure = exposure.clone()
+        runLocal(task, distExposure, srcs, 3)
+
+        self.assertGreater(len(serialSrcs), nParents)
+        self.assertEqual(len(srcs), len(serialSrcs))
+        for src, ref in zip(srcs, serialSrcs):
+            self.assertEqual(src.getId(), ref.getId())
+            self.assertEqual(src.getParent(), ref.getParent())
+            for name in ("deblend_nChild", "deblend_deblendedAsPsf", "deblend_peakId", "deblend_skipped"):
+                self.assertEqual(src.get(name), ref.get(name))
+            self.assertEqual(src.getFootprint().getSpans(), ref.getFootprint().getSpans())
+            if ref.getParent() != 0:
+                np.testing.assert_array_equal(src.getFootprint().getImageArray(),
+                                              ref.getFootprint().getImageArray())
+        np.testing.assert_array_equal(distExposure.getMaskedImage().getMask().getArray(),
+                                      serialExposure.getMaskedImage().getMask().getArray())
+
+    def testFailureLeavesNoReplies(self):
+        """A failure on rank 0 does not leave the workers' replies queued
+        for the next call.
+        """
+        exposure = makeBlendedExposure()
+        schema = afwTable.SourceTable.makeMinimalSchema()
+        serialTask = SourceDeblendTask(schema)
+        serialSrcs = makeSources(exposure, schema)
+        serialTask.run(exposure.clone(), serialSrcs)
+
+        transports = QueueTransport.make(3)
+        workers = [threading.Thread(target=DistributedSourceDeblendTask.runWorker, args=(transport,))
+                   for transport in transports[1:]]
+        for worker in workers:
+            worker.start()
+        schema = afwTable.SourceTable.makeMinimalSchema()
+        task = FailOnceTask(schema, transport=transports[0])
+        try:
+            with self.assertRaises(RuntimeError):
+                task.run(exposure.clone(), makeSources(exposure, schema))
+            srcs = makeSources(exposure, schema)
+            task.run(exposure.clone(), srcs)
+        finally:
+            task.stopWorkers()
+            for worker in workers:
+                worker.join()
+        self.assertEqual(len(srcs), len(serialSrcs))
+        for src, ref in zip(srcs, serialSrcs):
+            self.assertEqual(src.getId(), ref.getId())
+            self.assertEqual(src.getParent(), ref.getParent())
+            self.assertEqual(src.getFootprint().getSpans(), ref.getFootprint().getSpans())
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
@@ -0,0 +1,84 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+import os
+import tempfile
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.image as afwImage
+import lsst.afw.table as afwTable
+from lsst.meas.deblender import SourceDeblendTask, ChildColumnFile
+
+from deblendTestUtils import makeBlendedExposure, makeSources
+
+
+class ChildExportTestCase(lsst.utils.tests.TestCase):
+
+    def testRoundTrip(self):
+        """The exported columns and pixels match the deblended catalog.
+        """
+        exposure = makeBlendedExposure(W=120, H=90)
+        schema = afwTable.SourceTable.makeMinimalSchema()
+        config = SourceDeblendTask.ConfigClass()
+        config.doExportChildren = True
+        with tempfile.TemporaryDirectory() as tempDir:
+            config.exportOutput = os.path.join(tempDir, "children")
+            task = SourceDeblendTask(schema, config=config)
+            srcs = makeSources(exposure, schema)
+            task.run(exposure, srcs)
+            filename = task.metadata["exportFile"]
+            self.assertEqual(filename, config.exportOutput + "-1.children")
+
+            columns = ChildColumnFile(filename)
+            children = [src for src in srcs if src.getParent() != 0]
+            self.assertGreater(len(children), 0)
+            self.assertEqual(len(columns), len(children))
+            for name in task.getExportColumns():
+                self.assertIn(name, columns.getColumnNames())
+            for i, child in enumerate(children):
+                self.assertEqual(columns["id"][i], child.getId())
+                self.assertEqual(columns["parent"][i], child.getParent())
+                self.assertEqual(columns["peakId"][i], child.get("deblend_peakId"))
+                self.assertEqual(columns["peakCenter_x"][i], child.get("deblend_peak_center_x"))
+                self.assertEqual(columns["deblendedAsPsf"][i], child.get("deblend_deblendedAsPsf"))
+                self.assertEqual(columns["hasStrayFlux"][i], child.get("deblend_hasStrayFlux"))
+                np.testing.assert_array_equal(columns.getPixels(i), child.getFootprint().getImageArray())
+                fp = child.getFootprint()
+                image = afwImage.ImageF(fp.getBBox())
+                fp.insert(image)
+                np.testing.assert_array_equal(columns.getImage(i), image.getArray())
+            del columns
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
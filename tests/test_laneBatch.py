@@ -0,0 +1,116 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.detection as afwDet
+import lsst.afw.image as afwImage
+import lsst.geom as geom
+import lsst.pex.exceptions as pexExcept
+from lsst.meas.deblender import BaselineUtilsF as bUtils
+
+
+def makeTemplate(W, H, seed, x0=-7, y0=12):
+    rng = np.random.RandomState(seed)
+    yy, xx = np.mgrid[0:H, 0:W]
+    array = 100.*np.exp(-((xx - 0.4*W)**2 + (yy - 0.6*H)**2)/(0.1*W*H)) + rng.normal(size=(H, W))
+    img = afwImage.ImageF(array.astype(np.float32))
+    img.setXY0(geom.Point2I(x0, y0))
+    return img
+
+
+# Sizes with more templates than lanes, a few and a single one
+SIZES = [(15, 15)]*11 + [(21, 17)]*3 + [(31, 31)] + [(15, 15)]*2
+
+
+class LaneBatchTestCase(lsst.utils.tests.TestCase):
+    """The batch kernels give the same result as filtering each template
+    on its own.
+    """
+
+    def testMedianFilterBatch(self):
+        for h in (1, 2, 3):
+            imgs = [makeTemplate(W, H, seed) for seed, (W, H) in enumerate(SIZES)]
+            outs = [img.Factory(img, True) for img in imgs]
+            bUtils.medianFilterBatch(imgs, outs, h)
+            for img, out in zip(imgs, outs):
+                ref = img.Factory(img, True)
+                bUtils.medianFilter(img, ref, h)
+                np.testing.assert_array_equal(out.getArray(), ref.getArray())
+
+    def testMedianFilterBatchFallback(self):
+        # Templates with NaN, larger than LANE_BATCH_MAX_SIZE or filtered
+        # with a halfsize above LANE_BATCH_MAX_HALFSIZE are filtered by
+        # medianFilter, even with partners of the same size.
+        big = bUtils.LANE_BATCH_MAX_SIZE + 1
+        for h in (2, bUtils.LANE_BATCH_MAX_HALFSIZE + 1):
+            imgs = [makeTemplate(W, H, seed) for seed, (W, H) in enumerate([(15, 15)]*3 + [(big, 9)]*2)]
+            imgs[1].getArray()[7, 4:6] = np.nan
+            outs = [img.Factory(img, True) for img in imgs]
+            bUtils.medianFilterBatch(imgs, outs, h)
+            for img, out in zip(imgs, outs):
+                ref = img.Factory(img, True)
+                bUtils.medianFilter(img, ref, h)
+                np.testing.assert_array_equal(out.getArray(), ref.getArray())
+
+    def testMakeMonotonicBatch(self):
+        schema = afwDet.PeakTable.makeMinimalSchema()
+        table = afwDet.PeakTable.make(schema)
+        imgs = []
+        peaks = []
+        for seed, (W, H) in enumerate(SIZES):
+            # The same peak offset in templates at different positions
+            # is batched; a different one is not.
+            img = makeTemplate(W, H, seed, x0=3*seed, y0=-seed)
+            peak = table.makeRecord()
+            peak.setIx(img.getX0() + W//2 + (seed % 3 == 0))
+            peak.setIy(img.getY0() + H//2)
+            imgs.append(img)
+            peaks.append(peak)
+        refs = [img.Factory(img, True) for img in imgs]
+        bUtils.makeMonotonicBatch(imgs, [pk.getIx() for pk in peaks], [pk.getIy() for pk in peaks])
+        for img, ref, peak in zip(imgs, refs, peaks):
+            bUtils.makeMonotonic(ref, peak)
+            np.testing.assert_array_equal(img.getArray(), ref.getArray())
+
+    def testLengths(self):
+        img = makeTemplate(15, 15, 0)
+        with self.assertRaises(pexExcept.LengthError):
+            bUtils.medianFilterBatch([img, img], [img], 2)
+        with self.assertRaises(pexExcept.LengthError):
+            bUtils.makeMonotonicBatch([img], [0, 1], [0])
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
@@ -0,0 +1,126 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.geom as afwGeom
+import lsst.afw.image as afwImage
+import lsst.afw.table as afwTable
+import lsst.geom as geom
+from lsst.meas.deblender import SourceDeblendTask, MaskPlaneUpdates
+
+from deblendTestUtils import makeBlendedExposure, makeSources
+
+
+class MaskPlaneUpdatesTestCase(lsst.utils.tests.TestCase):
+
+    def testMerge(self):
+        mask = afwImage.Mask(geom.Box2I(geom.Point2I(0, 0), geom.Extent2I(30, 20)))
+        updates = MaskPlaneUpdates(mask, "NOT_DEBLENDED")
+        self.assertEqual(updates.apply(), 0)
+        self.assertNotIn("NOT_DEBLENDED", mask.getMaskPlaneDict())
+        a = afwGeom.SpanSet.fromShape(4, offset=(10, 10))
+        b = afwGeom.SpanSet.fromShape(3, offset=(13, 9))
+        updates.add(a)
+        updates.add(b)
+        self.assertEqual(len(updates), 2)
+        self.assertTrue(np.all(mask.getArray() == 0))
+        self.assertEqual(updates.apply(), a.union(b).getArea())
+        self.assertEqual(len(updates), 0)
+
+        expected = afwImage.Mask(mask.getBBox())
+        bit = mask.getPlaneBitMask("NOT_DEBLENDED")
+        a.setMask(expected, bit)
+        b.setMask(expected, bit)
+        np.testing.assert_array_equal(mask.getArray(), expected.getArray())
+
+
+class DeferredMaskTestCase(lsst.utils.tests.TestCase):
+
+    def setUp(self):
+        self.exposure = makeBlendedExposure(W=160, H=120)
+        mask = self.exposure.getMaskedImage().getMask()
+        mask.getArray()[40:70, 60:100] |= mask.getPlaneBitMask("SAT")
+
+    def makeConfig(self, deferred):
+        config = SourceDeblendTask.ConfigClass()
+        config.maxFootprintArea = 400
+        config.maskLimits = {"SAT": 0.1}
+        if not deferred:
+            # With the plane in maskLimits the mask is updated at once
+            config.maskLimits["NOT_DEBLENDED"] = 1.0
+        return config
+
+    def testSameMask(self):
+        masks = []
+        catalogs = []
+        for deferred in (True, False):
+            schema = afwTable.SourceTable.makeMinimalSchema()
+            task = SourceDeblendTask(schema, config=self.makeConfig(deferred))
+            srcs = makeSources(self.exposure, schema)
+            exposure = self.exposure.clone()
+            task.run(exposure, srcs)
+            masks.append(exposure.getMaskedImage().getMask())
+            catalogs.append(srcs)
+        self.assertGreater(sum(catalogs[0]["deblend_skipped"]), 0)
+        self.assertEqual(masks[0].getPlaneBitMask("NOT_DEBLENDED"), masks[1].getPlaneBitMask("NOT_DEBLENDED"))
+        np.testing.assert_array_equal(masks[0].getArray(), masks[1].getArray())
+        for src, ref in zip(*catalogs):
+            self.assertEqual(src.getId(), ref.getId())
+            self.assertEqual(src.get("deblend_nChild"), ref.get("deblend_nChild"))
+            self.assertEqual(src.get("deblend_skipped"), ref.get("deblend_skipped"))
+
+    def testMaskConstantWhileDeblending(self):
+        """The mask read by the parents is not changed by skipped ones.
+        """
+        initial = self.exposure.getMaskedImage().getMask().getArray().copy()
+        checked = []
+
+        class CheckingTask(SourceDeblendTask):
+            def preSingleDeblendHook(self, exposure, srcs, i, fp, psf, psf_fwhm, sigma1):
+                checked.append(np.array_equal(exposure.getMaskedImage().getMask().getArray(), initial))
+
+        schema = afwTable.SourceTable.makeMinimalSchema()
+        task = CheckingTask(schema, config=self.makeConfig(True))
+        srcs = makeSources(self.exposure, schema)
+        exposure = self.exposure.clone()
+        task.run(exposure, srcs)
+        self.assertGreater(len(checked), 0)
+        self.assertTrue(all(checked))
+        mask = exposure.getMaskedImage().getMask()
+        self.assertTrue(np.any(mask.getArray() & mask.getPlaneBitMask("NOT_DEBLENDED")))
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
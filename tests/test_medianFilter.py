@@ -0,0 +1,124 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+import threading
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.image as afwImage
+from lsst.meas.deblender import BaselineUtilsF as bUtils
+from lsst.meas.deblender.plugins import MedianFilterValidation
+
+
+class SeparableMedianTestCase(lsst.utils.tests.TestCase):
+
+    def testSeparableProfile(self):
+        """For a profile that is a product of monotonic functions of x and y,
+        the separable median is exact.
+        """
+        h = 3
+        yy, xx = np.mgrid[0:31, 0:40]
+        img = afwImage.ImageF((np.exp(-0.1*xx)*np.exp(-0.05*yy)).astype(np.float32))
+        exact = img.Factory(img, True)
+        approx = img.Factory(img, True)
+        bUtils.medianFilter(img, exact, h)
+        bUtils.medianFilterSeparable(img, approx, h)
+        np.testing.assert_array_equal(approx.getArray()[h:-h, h:-h-1], exact.getArray()[h:-h, h:-h-1])
+
+    def testNoise(self):
+        """On noise the approximation is close, and the margins are
+        copied from the input.
+        """
+        h = 5
+        rng = np.random.RandomState(12345)
+        img = afwImage.ImageF(rng.normal(size=(60, 50)).astype(np.float32))
+        approx = afwImage.ImageF(img.getBBox())
+        bUtils.medianFilterSeparable(img, approx, h)
+        arr, out = img.getArray(), approx.getArray()
+        np.testing.assert_array_equal(out[:h, :], arr[:h, :])
+        np.testing.assert_array_equal(out[-h:, :], arr[-h:, :])
+        np.testing.assert_array_equal(out[:, :h], arr[:, :h])
+        np.testing.assert_array_equal(out[:, -h:], arr[:, -h:])
+
+        validation = MedianFilterValidation(1)
+        validation.add(img, approx, h, 1.0)
+        self.assertEqual(validation.nSamples, 1)
+        # The median of 121 unit Gaussians has sigma ~0.11.
+        self.assertLess(validation.rmsDeviation, 0.2)
+        self.assertGreater(validation.maxDeviation, 0.0)
+
+    def testValidationInterval(self):
+        img = afwImage.ImageF(np.ones((20, 20), dtype=np.float32))
+        validation = MedianFilterValidation(3)
+        for i in range(7):
+            validation.add(img, img, 2, 1.0)
+        self.assertEqual(validation.nSeen, 7)
+        self.assertEqual(validation.nSamples, 3)
+        self.assertEqual(validation.maxDeviation, 0.0)
+
+
+class MedianScratchTestCase(lsst.utils.tests.TestCase):
+
+    def testLargeWindowOnSmallStack(self):
+        """A window much larger than a small thread stack is filtered, and
+        the reused scratch buffers give the same result on every call.
+        """
+        h = 120
+        rng = np.random.RandomState(3)
+        img = afwImage.ImageF(rng.normal(size=(2*h + 5, 2*h + 4)).astype(np.float32))
+        results = {}
+        repeatable = []
+
+        def run():
+            for name, func in [("exact", bUtils.medianFilter), ("separable", bUtils.medianFilterSeparable)]:
+                out = afwImage.ImageF(img.getBBox())
+                func(img, out, h)
+                results[name] = out.getArray().copy()
+                func(img, out, 2)
+                func(img, out, h)
+                repeatable.append(np.array_equal(out.getArray(), results[name]))
+
+        previous = threading.stack_size(256*1024)
+        try:
+            thread = threading.Thread(target=run)
+            thread.start()
+            thread.join()
+        finally:
+            threading.stack_size(previous)
+        self.assertEqual(set(results), {"exact", "separable"})
+        self.assertEqual(repeatable, [True, True])
+        arr = img.getArray()
+        self.assertEqual(results["exact"][h + 2, h + 1], np.median(arr[2:2*h + 3, 1:2*h + 2]))
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
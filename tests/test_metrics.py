@@ -0,0 +1,138 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+import os
+import tempfile
+import unittest
+
+import lsst.utils.tests
+import lsst.afw.detection as afwDet
+import lsst.afw.geom as afwGeom
+import lsst.afw.image as afwImage
+import lsst.afw.table as afwTable
+import lsst.geom as geom
+import lsst.meas.algorithms as measAlg
+from lsst.meas.deblender import DeblendMetrics, SourceDeblendConfig, SourceDeblendTask
+
+
+def readMetrics(filename):
+    """Parse a Prometheus text file into a dict of sample name (with
+    labels) to value.
+    """
+    values = {}
+    with open(filename) as f:
+        for line in f:
+            if line.startswith("#"):
+                continue
+            name, value = line.rsplit(" ", 1)
+            values[name] = float(value)
+    return values
+
+
+class DeblendMetricsTestCase(lsst.utils.tests.TestCase):
+
+    def testFormat(self):
+        with tempfile.TemporaryDirectory() as tmpdir:
+            filename = os.path.join(tmpdir, "deblend.prom")
+            metrics = DeblendMetrics(filename, interval=1000, buckets=[0.1, 1.0])
+            metrics.startRun()
+            metrics.observe("fitPsfs", 0.05)
+            metrics.observe("fitPsfs", 0.5)
+            metrics.observe("fitPsfs", 5.0)
+            with metrics.stage("apportionFlux"):
+                pass
+            metrics.parentDeblended(3)
+            metrics.parentDeblended(2)
+            metrics.parentSkipped("tooBig")
+            metrics.setCache("psfImage", 3, 1)
+            self.assertTrue(metrics.update())
+            # Not rewritten before the interval has passed...
+            metrics.parentDeblended(1)
+            self.assertFalse(metrics.update())
+            self.assertEqual(readMetrics(filename)["deblend_parents_total"], 2)
+            # ... unless forced
+            self.assertTrue(metrics.update(force=True))
+            values = readMetrics(filename)
+            self.assertEqual(os.listdir(tmpdir), ["deblend.prom"])
+
+        self.assertEqual(values["deblend_parents_total"], 3)
+        self.assertEqual(values["deblend_children_total"], 6)
+        self.assertGreater(values["deblend_parents_per_second"], 0)
+        self.assertEqual(values['deblend_parents_skipped_total{reason="tooBig"}'], 1)
+        self.assertEqual(values['deblend_parents_skipped_total{reason="masked"}'], 0)
+        self.assertEqual(values['deblend_stage_duration_seconds_bucket{stage="fitPsfs",le="0.1"}'], 1)
+        self.assertEqual(values['deblend_stage_duration_seconds_bucket{stage="fitPsfs",le="1.0"}'], 2)
+        self.assertEqual(values['deblend_stage_duration_seconds_bucket{stage="fitPsfs",le="+Inf"}'], 3)
+        self.assertAlmostEqual(values['deblend_stage_duration_seconds_sum{stage="fitPsfs"}'], 5.55)
+        self.assertEqual(values['deblend_stage_duration_seconds_count{stage="apportionFlux"}'], 1)
+        self.assertEqual(values['deblend_cache_hit_ratio{cache="psfImage"}'], 0.75)
+        self.assertGreater(values["deblend_peak_memory_bytes"], 0)
+
+    def testTask(self):
+        """The task writes the metrics file when metricsFile is set."""
+        mi = afwImage.MaskedImageF(geom.Extent2I(64, 64))
+        mi.getVariance().set(1.0)
+        exposure = afwImage.makeExposure(mi)
+        psf = measAlg.DoubleGaussianPsf(21, 21, 3.)
+        exposure.setPsf(psf)
+        for x, y in [(30, 30), (34, 33)]:
+            psfImg = psf.computeImage(geom.Point2D(x, y))
+            mi.getImage().Factory(mi.getImage(), psfImg.getBBox()).getArray()[:] += 100*psfImg.getArray()
+
+        schema = afwTable.SourceTable.makeMinimalSchema()
+        with tempfile.TemporaryDirectory() as tmpdir:
+            config = SourceDeblendConfig()
+            config.metricsFile = os.path.join(tmpdir, "deblend.prom")
+            config.maxFootprintArea = 1000
+            task = SourceDeblendTask(schema, config=config)
+            catalog = afwTable.SourceCatalog(schema)
+            src = catalog.addNew()
+            foot = afwDet.Footprint(afwGeom.SpanSet.fromShape(10, offset=(32, 32)))
+            foot.addPeak(30, 30, 100)
+            foot.addPeak(34, 33, 100)
+            src.setFootprint(foot)
+            big = catalog.addNew()
+            foot = afwDet.Footprint(afwGeom.SpanSet.fromShape(20, offset=(32, 32)))
+            foot.addPeak(30, 30, 100)
+            foot.addPeak(34, 33, 100)
+            big.setFootprint(foot)
+            task.run(exposure, catalog)
+            values = readMetrics(config.metricsFile)
+
+        self.assertEqual(values["deblend_parents_total"], 1)
+        self.assertEqual(values["deblend_children_total"], 2)
+        self.assertEqual(values['deblend_parents_skipped_total{reason="tooBig"}'], 1)
+        self.assertEqual(values['deblend_stage_duration_seconds_count{stage="fitPsfs"}'], 1)
+        self.assertIn('deblend_cache_hit_ratio{cache="psfImage"}', values)
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
@@ -0,0 +1,125 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.table as afwTable
+from lsst.meas.deblender import SourceDeblendTask, nativeBatch
+
+from deblendTestUtils import makeBlendedExposure, makeSources
+
+
+class NativeBatchTestCase(lsst.utils.tests.TestCase):
+
+    def setUp(self):
+        # Pairs and triples of blended point sources
+        self.exposure = makeBlendedExposure(W=200, H=140, seed=11, start=(15, 12), step=(40, 35), margin=10,
+                                            offsets=[(0., 0.), (4.5, 3.), (-3., 5.)],
+                                            groupSize=lambda n, m: 2 + n % 2)
+
+    def makeTask(self, useNativeBatch, nThreads=1):
+        schema = afwTable.SourceTable.makeMinimalSchema()
+        config = SourceDeblendTask.ConfigClass()
+        config.prescreenParents = True
+        config.useNativeBatch = useNativeBatch
+        config.nativeBatchThreads = nThreads
+        return SourceDeblendTask(schema, config=config), schema
+
+    def testInputOrder(self):
+        """The results come back in the order of the footprints whatever
+        the number of threads.
+        """
+        task, schema = self.makeTask(True)
+        srcs = makeSources(self.exposure, schema)
+        footprints = [src.getFootprint() for src in srcs if len(src.getFootprint().getPeaks()) > 1]
+        self.assertGreater(len(footprints), 4)
+        mi = self.exposure.getMaskedImage()
+        psf = self.exposure.getPsf()
+        ref = nativeBatch.deblendMany(task.config, mi, psf, 1.0, footprints, 1)
+        for nThreads in (3, 0):
+            results = nativeBatch.deblendMany(task.config, mi, psf, 1.0, footprints, nThreads)
+            self.assertEqual(len(results), len(footprints))
+            for fp, res, r0 in zip(footprints, results, ref):
+                self.assertEqual(res.status, r0.status)
+                self.assertEqual(len(res.deblendedParents[0].peaks), len(fp.getPeaks()))
+                for peak, p0 in zip(res.deblendedParents[0].peaks, r0.deblendedParents[0].peaks):
+                    self.assertEqual(peak.peak.getId(), p0.peak.getId())
+                    heavy, h0 = peak.getFluxPortion(), p0.getFluxPortion()
+                    self.assertEqual(heavy is None, h0 is None)
+                    if heavy is not None:
+                        self.assertEqual(heavy.getSpans(), h0.getSpans())
+                        np.testing.assert_array_equal(heavy.getImageArray(), h0.getImageArray())
+
+    def testSameChildren(self):
+        """The task makes the same children with and without the batch.
+        """
+        catalogs = []
+        for useNativeBatch, nThreads in ((False, 1), (True, 1), (True, 4)):
+            task, schema = self.makeTask(useNativeBatch, nThreads)
+            srcs = makeSources(self.exposure, schema)
+            task.run(self.exposure.clone(), srcs)
+            catalogs.append(srcs)
+        ref = catalogs[0]
+        for srcs in catalogs[1:]:
+            self.assertEqual(len(srcs), len(ref))
+            for src, r in zip(srcs, ref):
+                self.assertEqual(src.getParent(), r.getParent())
+                self.assertEqual(src.get("deblend_nChild"), r.get("deblend_nChild"))
+                self.assertEqual(src.get("deblend_deblendedAsPsf"), r.get("deblend_deblendedAsPsf"))
+                if src.getParent() != 0:
+                    self.assertEqual(src.getFootprint().getSpans(), r.getFootprint().getSpans())
+                    self.assertFloatsAlmostEqual(src.getFootprint().getImageArray(),
+                                                 r.getFootprint().getImageArray(), rtol=1e-5, atol=1e-5)
+
+    def testHookDisablesBatch(self):
+        """Overriding a per-parent hook falls back to the python path.
+        """
+        calls = []
+
+        class HookedTask(SourceDeblendTask):
+            def preSingleDeblendHook(self, *args):
+                calls.append(args[2])
+
+        schema = afwTable.SourceTable.makeMinimalSchema()
+        config = SourceDeblendTask.ConfigClass()
+        config.prescreenParents = True
+        config.useNativeBatch = True
+        task = HookedTask(schema, config=config)
+        srcs = makeSources(self.exposure, schema)
+        task.run(self.exposure.clone(), srcs)
+        self.assertGreater(len(calls), 0)
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
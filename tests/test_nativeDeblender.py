@@ -0,0 +1,161 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.table as afwTable
+import lsst.pex.exceptions as pexExcept
+from lsst.meas.deblender import SourceDeblendTask, nativeBatch
+from lsst.meas.deblender.baseline import deblend
+from lsst.meas.deblender.nativeDeblender import NativeDeblenderF
+
+from deblendTestUtils import makeBlendedExposure, makeSources
+
+
+def pythonDeblend(config, fp, mi, psf, psfFwhm, sigma1):
+    """Run the python baseline deblender on ``fp`` as `SourceDeblendTask`
+    does.
+    """
+    return deblend(fp, mi, psf, psfFwhm, sigma1=sigma1,
+                   psfChisqCut1=config.psfChisq1,
+                   psfChisqCut2=config.psfChisq2,
+                   psfChisqCut2b=config.psfChisq2b,
+                   maxNumberOfPeaks=config.maxNumberOfPeaks,
+                   strayFluxToPointSources=config.strayFluxToPointSources,
+                   assignStrayFlux=config.assignStrayFlux,
+                   strayFluxAssignment=config.strayFluxRule,
+                   rampFluxAtEdge=(config.edgeHandling == 'ramp'),
+                   patchEdges=(config.edgeHandling == 'noclip'),
+                   tinyFootprintSize=config.tinyFootprintSize,
+                   clipStrayFluxFraction=config.clipStrayFluxFraction,
+                   medianSmoothTemplate=config.medianSmoothTemplate,
+                   medianFilterHalfsize=config.medianFilterHalfsize,
+                   medianFilterMethod=config.medianFilterMethod,
+                   tiledMinArea=config.tiledTemplateMinArea,
+                   spanTemplateSum=config.spanTemplateSum)
+
+
+class NativeDeblenderTestCase(lsst.utils.tests.TestCase):
+    """NativeDeblender.deblend makes the children of the python baseline
+    deblender, parent by parent.
+    """
+
+    def setUp(self):
+        # Pairs and triples of blended point sources, some straddling the
+        # edges, on a faint extended source.
+        self.exposure = makeBlendedExposure(W=220, H=160, seed=3, start=(4, 3), step=(42, 38),
+                                            offsets=[(0., 0.), (4.5, 3.), (-3., 5.)],
+                                            groupSize=lambda n, m: 2 + (n + m) % 2, background=20.)
+        self.schema = afwTable.SourceTable.makeMinimalSchema()
+        self.srcs = makeSources(self.exposure, self.schema)
+        self.footprints = [src.getFootprint() for src in self.srcs if len(src.getFootprint().getPeaks()) > 1]
+        self.assertGreater(len(self.footprints), 4)
+        # A non-finite pixel next to a peak makes its PSF fit fail.
+        peak = self.footprints[len(self.footprints)//2].getPeaks()[0]
+        image = self.exposure.getMaskedImage().getImage()
+        image.getArray()[peak.getIy() - image.getY0(), peak.getIx() - image.getX0() + 1] = np.nan
+
+    def compare(self, **overrides):
+        """Deblend every blend with both deblenders and return the python
+        peaks, for the caller to check which paths were taken.
+        """
+        config = SourceDeblendTask.ConfigClass()
+        for name, value in overrides.items():
+            setattr(config, name, value)
+        mi = self.exposure.getMaskedImage()
+        psf = self.exposure.getPsf()
+        sigma1 = 1.0
+        deblender = NativeDeblenderF(nativeBatch.makeNativeControl(config), mi, psf, sigma1)
+        pyPeaks = []
+        for fp in self.footprints:
+            native = deblender.deblend(fp)
+            if native.status != NativeDeblenderF.Result.DEBLENDED:
+                continue
+            res = pythonDeblend(config, fp, mi, psf, native.psfFwhm, sigma1)
+            peaks = res.deblendedParents[0].peaks
+            self.assertEqual(len(native.peaks), len(peaks))
+            for npk, ppk in zip(native.peaks, peaks):
+                self.assertEqual(npk.skip, ppk.skip)
+                self.assertEqual(npk.deblendedAsPsf, ppk.deblendedAsPsf)
+                self.assertEqual(npk.hasPsfFit, ppk.psfFitFlux is not None)
+                if npk.hasPsfFit:
+                    self.assertFloatsAlmostEqual(npk.psfFitFlux, ppk.psfFitFlux, rtol=1e-5)
+                self.assertEqual(npk.rampedTemplate, ppk.hasRampedTemplate)
+                self.assertEqual(npk.patched, ppk.patched)
+                self.assertEqual(npk.hasStrayFlux, ppk.strayFlux is not None)
+                heavy = ppk.getFluxPortion()
+                self.assertEqual(npk.heavy is None, heavy is None)
+                if heavy is not None:
+                    self.assertEqual(npk.heavy.getSpans(), heavy.getSpans())
+                    np.testing.assert_allclose(npk.heavy.getImageArray(), heavy.getImageArray(),
+                                               rtol=1e-5, atol=1e-5)
+                pyPeaks.append(ppk)
+        self.assertGreater(len(pyPeaks), 0)
+        return pyPeaks
+
+    def testDefault(self):
+        peaks = self.compare()
+        self.assertTrue(any(pk.psfFitFailed for pk in peaks))
+        self.assertTrue(any(pk.deblendedAsPsf for pk in peaks))
+        self.assertTrue(any(pk.strayFlux is not None for pk in peaks))
+
+    def testRamp(self):
+        peaks = self.compare(edgeHandling='ramp')
+        self.assertTrue(any(pk.hasRampedTemplate for pk in peaks))
+
+    def testNoclip(self):
+        peaks = self.compare(edgeHandling='noclip')
+        self.assertTrue(any(pk.patched for pk in peaks))
+
+    def testStrayFluxRules(self):
+        for rule in ('r-to-peak', 'r-to-footprint', 'nearest-footprint'):
+            for toPointSources in ('necessary', 'always', 'never'):
+                peaks = self.compare(strayFluxRule=rule, strayFluxToPointSources=toPointSources)
+                if toPointSources != 'never':
+                    self.assertTrue(any(pk.strayFlux is not None for pk in peaks))
+
+    def testUnsupported(self):
+        """The options the native deblender does not support are an error,
+        not silently ignored.
+        """
+        mi = self.exposure.getMaskedImage()
+        for name in ('weightTemplates', 'removeDegenerateTemplates'):
+            config = SourceDeblendTask.ConfigClass()
+            setattr(config, name, True)
+            with self.assertRaises(pexExcept.InvalidParameterError):
+                NativeDeblenderF(nativeBatch.makeNativeControl(config), mi, self.exposure.getPsf(), 1.0)
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
@@ -0,0 +1,124 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.detection as afwDet
+import lsst.afw.geom as afwGeom
+import lsst.afw.image as afwImage
+import lsst.geom as geom
+from lsst.meas.deblender import BaselineUtilsF as bUtils
+
+
+class NearestPeakStrayFluxTestCase(lsst.utils.tests.TestCase):
+    """Stray flux under STRAYFLUX_NEAREST_PEAK goes to the nearest
+    eligible peak.
+    """
+
+    def setUp(self):
+        self.bbox = geom.Box2I(geom.Point2I(10, 20), geom.Extent2I(40, 30))
+        self.mi = afwImage.MaskedImageF(self.bbox)
+        self.mi.getImage().set(1.0)
+        self.mi.getVariance().set(1.0)
+        self.foot = afwDet.Footprint(afwGeom.SpanSet(self.bbox))
+        self.peaks = [(15, 25), (40, 30), (30, 45)]
+        for x, y in self.peaks:
+            self.foot.addPeak(x, y, 1.0)
+        # Small templates around each peak; everything else is stray
+        self.templates = []
+        self.tfoots = []
+        for x, y in self.peaks:
+            tbox = geom.Box2I(geom.Point2I(x - 1, y - 1), geom.Extent2I(3, 3))
+            templ = afwImage.ImageF(tbox)
+            templ.set(1.0)
+            self.templates.append(templ)
+            self.tfoots.append(afwDet.Footprint(afwGeom.SpanSet(tbox)))
+
+    def apportion(self, ispsf, options):
+        sumimg = afwImage.ImageF(self.bbox)
+        options |= bUtils.ASSIGN_STRAYFLUX | bUtils.STRAYFLUX_NEAREST_PEAK
+        portions, strays = bUtils.apportionFlux(
+            self.mi, self.foot, self.templates, self.tfoots, sumimg, ispsf,
+            [x for x, _ in self.peaks], [y for _, y in self.peaks], options, 0.0)
+        owner = np.full((self.bbox.getHeight(), self.bbox.getWidth()), -1)
+        for i, stray in enumerate(strays):
+            if stray is None:
+                continue
+            img = afwImage.ImageF(self.bbox)
+            stray.insert(img)
+            for span in stray.getSpans():
+                for x in range(span.getX0(), span.getX1() + 1):
+                    y = span.getY()
+                    self.assertEqual(owner[y - self.bbox.getMinY(), x - self.bbox.getMinX()], -1)
+                    owner[y - self.bbox.getMinY(), x - self.bbox.getMinX()] = i
+            self.assertFloatsAlmostEqual(img.getArray()[img.getArray() != 0], 1.0)
+        return owner
+
+    def testNearest(self):
+        owner = self.apportion([False, False, False], 0)
+        # In a rectangle, the 8-connected distance within the footprint
+        # is the chessboard distance.
+        ys, xs = np.mgrid[self.bbox.getMinY():self.bbox.getMaxY() + 1,
+                          self.bbox.getMinX():self.bbox.getMaxX() + 1]
+        dist = np.array([np.maximum(abs(xs - x), abs(ys - y)) for x, y in self.peaks])
+        nearest = np.argmin(dist, axis=0)
+        ordered = np.sort(dist, axis=0)
+        unambiguous = ordered[0] < ordered[1]
+        stray = np.ones(owner.shape, dtype=bool)
+        for x, y in self.peaks:
+            stray[y - 1 - self.bbox.getMinY():y + 2 - self.bbox.getMinY(),
+                  x - 1 - self.bbox.getMinX():x + 2 - self.bbox.getMinX()] = False
+        # Every stray pixel is assigned, to exactly one peak...
+        self.assertTrue(np.all(owner[stray] >= 0))
+        self.assertTrue(np.all(owner[~stray] == -1))
+        # ... the nearest one
+        np.testing.assert_array_equal(owner[stray & unambiguous], nearest[stray & unambiguous])
+
+    def testPointSources(self):
+        # Point sources only get stray flux when allowed to...
+        owner = self.apportion([False, True, False], bUtils.STRAYFLUX_TO_POINT_SOURCES_WHEN_NECESSARY)
+        self.assertNotIn(1, owner)
+        self.assertIn(0, owner)
+        self.assertIn(2, owner)
+        owner = self.apportion([False, True, False], bUtils.STRAYFLUX_TO_POINT_SOURCES_ALWAYS)
+        self.assertIn(1, owner)
+        # ... or necessary
+        owner = self.apportion([True, True, True], bUtils.STRAYFLUX_TO_POINT_SOURCES_WHEN_NECESSARY)
+        self.assertEqual(set(np.unique(owner)), {-1, 0, 1, 2})
+        owner = self.apportion([True, True, True], 0)
+        self.assertTrue(np.all(owner == -1))
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
@@ -0,0 +1,146 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.table as afwTable
+import lsst.geom as geom
+from lsst.meas.deblender import SourceDeblendTask, ParentIndex
+
+from deblendTestUtils import makeBlendedExposure, makeSources
+
+
+class ParentIndexTestCase(lsst.utils.tests.TestCase):
+
+    def setUp(self):
+        self.exposure = makeBlendedExposure(W=200, H=150)
+        self.schema = afwTable.SourceTable.makeMinimalSchema()
+        self.task = SourceDeblendTask(self.schema)
+
+    def testQuery(self):
+        srcs = makeSources(self.exposure, self.schema)
+        index = ParentIndex(srcs, cellSize=32)
+        self.assertEqual(len(index), len(srcs))
+        for box in [geom.Box2I(geom.Point2I(50, 40), geom.Extent2I(60, 30)),
+                    geom.Box2I(geom.Point2I(-10, -10), geom.Extent2I(15, 300)),
+                    geom.Box2I(geom.Point2I(500, 500), geom.Extent2I(5, 5))]:
+            expected = [src.getId() for src in srcs if src.getFootprint().getBBox().overlaps(box)]
+            self.assertEqual([src.getId() for src in index.query(box)], expected)
+        ids = [srcs[3].getId(), srcs[1].getId(), -1]
+        self.assertEqual([src.getId() for src in index.get(ids)], [srcs[1].getId(), srcs[3].getId()])
+
+    def testDeblendRegion(self):
+        """Deblending a region gives the children of a full run for the
+        parents in it, and rerunning it keeps their IDs.
+        """
+        full = makeSources(self.exposure, self.schema)
+        self.task.run(self.exposure.clone(), full)
+
+        box = geom.Box2I(geom.Point2I(40, 30), geom.Extent2I(80, 60))
+        srcs = makeSources(self.exposure, self.schema)
+        nParents = len(srcs)
+        parents = self.task.deblendRegion(self.exposure.clone(), srcs, bbox=box)
+        self.assertGreater(len(parents), 0)
+        self.assertLess(len(parents), nParents)
+        parentIds = {src.getId() for src in parents}
+        self.assertEqual(parentIds, {src.getId() for src in srcs[:nParents]
+                                     if src.getFootprint().getBBox().overlaps(box)})
+
+        ref = {(src.getParent(), src.get("deblend_peakId")): src for src in full
+               if src.getParent() in parentIds}
+        children = {(src.getParent(), src.get("deblend_peakId")): src for src in srcs
+                    if src.getParent() != 0}
+        self.assertEqual(set(children), set(ref))
+        for key, child in children.items():
+            np.testing.assert_array_equal(child.getFootprint().getImageArray(),
+                                          ref[key].getFootprint().getImageArray())
+
+        ids = [src.getId() for src in srcs]
+        self.assertEqual(len(set(ids)), len(ids))
+        spans = {src.getId(): src.getFootprint().getSpans() for src in parents}
+        self.task.deblendRegion(self.exposure.clone(), srcs, ids=list(parentIds))
+        self.assertEqual([src.getId() for src in srcs], ids)
+
+        # The rerun starts from the original parent footprints, so neither
+        # the parents nor the children change.
+        for src in srcs:
+            if src.getId() in spans:
+                self.assertEqual(src.getFootprint().getSpans(), spans[src.getId()])
+            elif src.getParent() != 0:
+                key = (src.getParent(), src.get("deblend_peakId"))
+                np.testing.assert_array_equal(src.getFootprint().getImageArray(),
+                                              ref[key].getFootprint().getImageArray())
+
+    def testTwoCatalogs(self):
+        """Rerunning the parents of a catalog restores its own parent
+        footprints, not those of another catalog with the same IDs that
+        the task deblended before, and the task keeps the footprints of
+        the last catalog only.
+        """
+        exposures = [self.exposure, makeBlendedExposure(W=200, H=150, seed=7, start=(20, 15))]
+        catalogs = [makeSources(exposure, self.schema) for exposure in exposures]
+        self.assertEqual(catalogs[0][0].getId(), catalogs[1][0].getId())
+        refs = []
+        for exposure, srcs in zip(exposures, catalogs):
+            self.task.run(exposure.clone(), srcs)
+            refs.append({(src.getParent(), src.get("deblend_peakId")): src for src in srcs
+                         if src.getParent() != 0})
+
+        srcs = catalogs[1]
+        parents = [src for src in srcs if src.getParent() == 0]
+        spans = {src.getId(): src.getFootprint().getSpans() for src in parents}
+        self.task.deblendRegion(exposures[1].clone(), srcs, ids=list(spans))
+        self.assertLessEqual(len(self.task._parentSpans), len(parents))
+        for src in srcs:
+            if src.getParent() == 0:
+                self.assertEqual(src.getFootprint().getSpans(), spans[src.getId()])
+            else:
+                key = (src.getParent(), src.get("deblend_peakId"))
+                np.testing.assert_array_equal(src.getFootprint().getImageArray(),
+                                              refs[1][key].getFootprint().getImageArray())
+
+    def testIndexUpdate(self):
+        """The index follows the parents whose footprints deblending grew.
+        """
+        srcs = makeSources(self.exposure, self.schema)
+        index = ParentIndex(srcs, cellSize=32)
+        box = geom.Box2I(geom.Point2I(40, 30), geom.Extent2I(80, 60))
+        self.task.deblendRegion(self.exposure.clone(), srcs, bbox=box, index=index)
+        parents = [src for src in srcs if src.getParent() == 0]
+        for query in [box, geom.Box2I(geom.Point2I(0, 0), geom.Extent2I(200, 150))]:
+            expected = [src.getId() for src in parents if src.getFootprint().getBBox().overlaps(query)]
+            self.assertEqual([src.getId() for src in index.query(query)], expected)
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
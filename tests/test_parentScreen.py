@@ -0,0 +1,99 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+import unittest
+
+
+import lsst.utils.tests
+import lsst.afw.table as afwTable
+from lsst.meas.deblender import SourceDeblendTask, ParentScreen
+
+from deblendTestUtils import makeBlendedExposure, makeSources
+
+
+class ParentScreenTestCase(lsst.utils.tests.TestCase):
+
+    def setUp(self):
+        self.exposure = makeBlendedExposure(W=160, H=120)
+        mask = self.exposure.getMaskedImage().getMask()
+        mask.getArray()[40:70, 60:100] |= mask.getPlaneBitMask("SAT")
+
+    def makeTask(self, prescreen):
+        schema = afwTable.SourceTable.makeMinimalSchema()
+        config = SourceDeblendTask.ConfigClass()
+        config.prescreenParents = prescreen
+        config.maxFootprintArea = 400
+        config.maskLimits = {"SAT": 0.1}
+        return SourceDeblendTask(schema, config=config), schema
+
+    def testMatchesTask(self):
+        """The screen makes the same decisions as the task's methods.
+        """
+        task, schema = self.makeTask(True)
+        srcs = makeSources(self.exposure, schema)
+        mask = self.exposure.getMaskedImage().getMask()
+        psf = self.exposure.getPsf()
+        screen = task.screenParents(srcs, mask, psf)
+        self.assertEqual(len(screen.reason), len(srcs))
+        reasons = set()
+        for i, src in enumerate(srcs):
+            fp = src.getFootprint()
+            reason = screen.reason[i]
+            reasons.add(reason)
+            self.assertEqual(screen.cost[i], len(fp.getPeaks())*fp.getArea())
+            if len(fp.getPeaks()) < 2:
+                self.assertEqual(reason, int(ParentScreen.NOT_BLENDED))
+            elif task.isLargeFootprint(fp):
+                self.assertEqual(reason, int(ParentScreen.TOO_BIG))
+            elif task.isMasked(fp, mask):
+                self.assertEqual(reason, int(ParentScreen.MASKED))
+            else:
+                self.assertEqual(reason, int(ParentScreen.DEBLEND))
+                self.assertAlmostEqual(screen.psfFwhm[i], task._getPsfFwhm(psf, fp.getCentroid()))
+        self.assertIn(int(ParentScreen.DEBLEND), reasons)
+        self.assertIn(int(ParentScreen.TOO_BIG), reasons)
+
+    def testSameResult(self):
+        catalogs = []
+        for prescreen in (True, False):
+            task, schema = self.makeTask(prescreen)
+            srcs = makeSources(self.exposure, schema)
+            exposure = self.exposure.clone()
+            task.run(exposure, srcs)
+            catalogs.append(srcs)
+        self.assertEqual(len(catalogs[0]), len(catalogs[1]))
+        for src, ref in zip(*catalogs):
+            self.assertEqual(src.getId(), ref.getId())
+            for name in ("deblend_nChild", "deblend_parentTooBig", "deblend_masked", "deblend_skipped"):
+                self.assertEqual(src.get(name), ref.get(name))
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
@@ -0,0 +1,122 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+import unittest
+
+import lsst.utils.tests
+import lsst.afw.detection as afwDet
+import lsst.afw.geom as afwGeom
+import lsst.afw.image as afwImage
+import lsst.afw.table as afwTable
+import lsst.geom as geom
+import lsst.meas.algorithms as measAlg
+from lsst.meas.deblender import PerfCounters, PerfCounterMonitor, SourceDeblendConfig, SourceDeblendTask
+
+
+def spin(n):
+    x = 0
+    for i in range(n):
+        x += i
+    return x
+
+
+class PerfCountersTestCase(lsst.utils.tests.TestCase):
+
+    def testCounters(self):
+        """The counters either all read -1, or count up."""
+        counters = PerfCounters()
+        before = counters.read()
+        self.assertEqual(len(before), PerfCounters.NEVENTS)
+        spin(100000)
+        after = counters.read()
+        if not counters.isAvailable():
+            self.assertEqual(list(after), [-1]*PerfCounters.NEVENTS)
+            return
+        for event in (PerfCounters.CYCLES, PerfCounters.INSTRUCTIONS):
+            if counters.hasEvent(event):
+                self.assertGreater(after[int(event)], before[int(event)])
+            else:
+                self.assertEqual(after[int(event)], -1)
+
+    def testMonitor(self):
+        monitor = PerfCounterMonitor()
+        for parentId, n in [(1, 10000), (2, 20000)]:
+            monitor.setParent(parentId, 100)
+            with monitor.stage("fitPsfs"):
+                spin(n)
+                with monitor.stage("nested"):
+                    spin(n)
+            with monitor.stage("apportionFlux"):
+                spin(n)
+        summary = monitor.getSummary()
+        if not monitor.available:
+            self.assertEqual(summary, {})
+            return
+        # Nested stages are charged to the outer one
+        self.assertEqual(set(summary), {"fitPsfs", "apportionFlux"})
+        self.assertEqual(summary["fitPsfs"]["calls"], 2)
+        self.assertEqual(summary["fitPsfs"]["pixels"], 200)
+        entry = summary["apportionFlux"]
+        if entry["cycles"] is not None and entry["instructions"] is not None:
+            self.assertGreater(entry["ipc"], 0)
+        if entry["cacheMisses"] is not None:
+            self.assertAlmostEqual(entry["cacheMissesPerPixel"], entry["cacheMisses"]/200)
+
+    def testTask(self):
+        """The task runs with perfCounters set, whether or not the counters
+        are available.
+        """
+        mi = afwImage.MaskedImageF(geom.Extent2I(64, 64))
+        mi.getVariance().set(1.0)
+        exposure = afwImage.makeExposure(mi)
+        psf = measAlg.DoubleGaussianPsf(21, 21, 3.)
+        exposure.setPsf(psf)
+        for x, y in [(30, 30), (34, 33)]:
+            psfImg = psf.computeImage(geom.Point2D(x, y))
+            mi.getImage().Factory(mi.getImage(), psfImg.getBBox()).getArray()[:] += 100*psfImg.getArray()
+
+        schema = afwTable.SourceTable.makeMinimalSchema()
+        config = SourceDeblendConfig()
+        config.perfCounters = True
+        task = SourceDeblendTask(schema, config=config)
+        catalog = afwTable.SourceCatalog(schema)
+        src = catalog.addNew()
+        foot = afwDet.Footprint(afwGeom.SpanSet.fromShape(10, offset=(32, 32)))
+        foot.addPeak(30, 30, 100)
+        foot.addPeak(34, 33, 100)
+        src.setFootprint(foot)
+        task.run(exposure, catalog)
+        self.assertEqual(src.get("deblend_nChild"), 2)
+        if PerfCounterMonitor().available:
+            self.assertGreaterEqual(task.metadata.getScalar("perf_fitPsfs_pixels"), foot.getArea())
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
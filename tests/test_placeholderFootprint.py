@@ -0,0 +1,78 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.detection as afwDet
+import lsst.afw.geom as afwGeom
+import lsst.afw.image as afwImage
+import lsst.geom as geom
+from lsst.meas.deblender import BaselineUtilsF as bUtils
+
+
+class PlaceholderFootprintTestCase(lsst.utils.tests.TestCase):
+
+    def testPlaceholder(self):
+        """A placeholder child covers the parent spans with zero pixels
+        and holds a single peak; it matches the HeavyFootprint made from
+        a zero image the size of the parent.
+        """
+        spans = afwGeom.SpanSet.fromShape(7, afwGeom.Stencil.CIRCLE, (20, 30))
+        region = geom.Box2I(geom.Point2I(0, 0), geom.Extent2I(100, 100))
+        parent = afwDet.Footprint(spans, region)
+        parent.addPeak(18, 29, 10.)
+        parent.addPeak(23, 31, 5.)
+        peak = parent.getPeaks()[1]
+
+        heavy = bUtils.makePlaceholderFootprint(parent.getSpans(), peak, parent.getRegion())
+        self.assertTrue(heavy.isHeavy())
+        self.assertEqual(heavy.getSpans(), parent.getSpans())
+        self.assertEqual(heavy.getRegion(), region)
+        self.assertEqual(len(heavy.getPeaks()), 1)
+        self.assertEqual(heavy.getPeaks()[0].getId(), peak.getId())
+        self.assertEqual((heavy.getPeaks()[0].getIx(), heavy.getPeaks()[0].getIy()), (23, 31))
+        # The parent keeps its peaks
+        self.assertEqual(len(parent.getPeaks()), 2)
+
+        foot = afwDet.Footprint(parent)
+        foot.getPeaks().clear()
+        foot.getPeaks().append(peak)
+        ref = afwDet.makeHeavyFootprint(foot, afwImage.MaskedImageF(foot.getBBox()))
+        np.testing.assert_array_equal(heavy.getImageArray(), ref.getImageArray())
+        np.testing.assert_array_equal(heavy.getMaskArray(), ref.getMaskArray())
+        np.testing.assert_array_equal(heavy.getVarianceArray(), ref.getVarianceArray())
+        self.assertEqual(len(heavy.getImageArray()), spans.getArea())
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
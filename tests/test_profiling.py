@@ -0,0 +1,116 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+import os
+import tempfile
+import time
+import unittest
+
+import lsst.utils.tests
+import lsst.afw.detection as afwDet
+import lsst.afw.geom as afwGeom
+import lsst.afw.image as afwImage
+import lsst.afw.table as afwTable
+import lsst.geom as geom
+import lsst.meas.algorithms as measAlg
+from lsst.meas.deblender import SamplingProfiler, SourceDeblendConfig, SourceDeblendTask
+
+
+def spin(seconds):
+    """Burn CPU time for ``seconds``."""
+    t0 = time.process_time()
+    x = 0
+    while time.process_time() - t0 < seconds:
+        x += 1
+    return x
+
+
+class SamplingProfilerTestCase(lsst.utils.tests.TestCase):
+
+    def testAttribution(self):
+        profiler = SamplingProfiler(interval=0.001, topN=2)
+        self.assertTrue(profiler.start())
+        try:
+            for parentId, seconds in [(1, 0.02), (2, 0.2), (3, 0.1), (4, 0.01)]:
+                profiler.setParent(parentId)
+                with profiler.stage("fitPsfs"):
+                    spin(seconds)
+        finally:
+            profiler.stop()
+        self.assertFalse(profiler.running)
+        self.assertGreater(profiler.nSamples, 0)
+        self.assertEqual(sum(profiler.samples.values()), profiler.nSamples)
+        self.assertTrue(any(stack.startswith("fitPsfs;") and "spin (" in stack
+                            for stack in profiler.samples))
+        slowest = profiler.getSlowest()
+        self.assertEqual([parentId for parentId, _, _ in slowest], [2, 3])
+
+        with tempfile.TemporaryDirectory() as tmpdir:
+            filename = os.path.join(tmpdir, "profile.folded")
+            profiler.writeCollapsed(filename)
+            with open(filename) as f:
+                lines = f.readlines()
+            self.assertEqual(sum(int(line.rsplit(" ", 1)[1]) for line in lines), profiler.nSamples)
+            filename = os.path.join(tmpdir, "slowest.folded")
+            profiler.writeSlowest(filename)
+            with open(filename) as f:
+                self.assertTrue(f.readline().startswith("parent 2 ("))
+
+    def testTask(self):
+        """The task writes profiles when profileSampleInterval is set."""
+        mi = afwImage.MaskedImageF(geom.Extent2I(64, 64))
+        mi.getVariance().set(1.0)
+        exposure = afwImage.makeExposure(mi)
+        psf = measAlg.DoubleGaussianPsf(21, 21, 3.)
+        exposure.setPsf(psf)
+        for x, y in [(30, 30), (34, 33)]:
+            psfImg = psf.computeImage(geom.Point2D(x, y))
+            mi.getImage().Factory(mi.getImage(), psfImg.getBBox()).getArray()[:] += 100*psfImg.getArray()
+
+        schema = afwTable.SourceTable.makeMinimalSchema()
+        with tempfile.TemporaryDirectory() as tmpdir:
+            config = SourceDeblendConfig()
+            config.profileSampleInterval = 0.0005
+            config.profileOutput = os.path.join(tmpdir, "deblend")
+            task = SourceDeblendTask(schema, config=config)
+            catalog = afwTable.SourceCatalog(schema)
+            src = catalog.addNew()
+            foot = afwDet.Footprint(afwGeom.SpanSet.fromShape(10, offset=(32, 32)))
+            foot.addPeak(30, 30, 100)
+            foot.addPeak(34, 33, 100)
+            src.setFootprint(foot)
+            task.run(exposure, catalog)
+            self.assertTrue(os.path.exists(config.profileOutput + "-1.folded"))
+            self.assertTrue(os.path.exists(config.profileOutput + "-1-slowest.folded"))
+            self.assertEqual(task.metadata.getArray("profileSlowestParents"), [src.getId()])
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
@@ -0,0 +1,147 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.detection as afwDet
+import lsst.afw.image as afwImage
+import lsst.geom as geom
+import lsst.meas.algorithms as measAlg
+from lsst.meas.deblender.baseline import deblend, newDeblend, CachingPsf
+from lsst.meas.deblender.plugins import DeblenderPlugin, fitPsfs, clipFootprintToNonzeroImpl
+
+
+def makeEagerTemplate(psf, fp, cx, cy, flux):
+    """The PSF template as _fitPsf used to build it.
+    """
+    psfimg = psf.computeImage(geom.Point2D(cx, cy))
+    psfimg = psfimg.Factory(psfimg, True)
+    psfimg *= flux
+    psfimg = psfimg.convertF()
+    fpcopy = afwDet.Footprint(fp)
+    fpcopy.clipTo(psfimg.getBBox())
+    psfmod = afwImage.ImageF(fpcopy.getBBox())
+    fpcopy.spans.copyImage(psfimg, psfmod)
+    clipFootprintToNonzeroImpl(fpcopy, psfmod)
+    return psfmod, fpcopy
+
+
+class PsfTemplateTestCase(lsst.utils.tests.TestCase):
+    """The templates of peaks deblended as PSFs are only computed when
+    read, and are those the PSF fit used to build eagerly.
+    """
+
+    def setUp(self):
+        rng = np.random.RandomState(7)
+        self.psf = measAlg.DoubleGaussianPsf(21, 21, 2.)
+        self.psffwhm = 2.*2.35
+        self.mi = afwImage.MaskedImageF(geom.Extent2I(80, 60))
+        self.mi.getVariance().set(1.0)
+        img = self.mi.getImage()
+        for x, y, flux in [(30.3, 28.6, 5000.), (38.8, 31.2, 3000.), (33.1, 37.9, 2000.)]:
+            psfImg = self.psf.computeImage(geom.Point2D(x, y))
+            bbox = psfImg.getBBox()
+            bbox.clip(img.getBBox())
+            psfImg = psfImg.Factory(psfImg, bbox, afwImage.PARENT)
+            img.Factory(img, bbox, afwImage.PARENT).getArray()[:, :] += flux*psfImg.getArray()
+        img.getArray()[:, :] += rng.normal(size=(60, 80)).astype(np.float32)
+        fpSet = afwDet.FootprintSet(self.mi, afwDet.Threshold(5.))
+        self.fp = max(fpSet.getFootprints(), key=lambda fp: len(fp.getPeaks()))
+        self.assertGreater(len(self.fp.getPeaks()), 1)
+
+    def assertEagerTemplate(self, pkres):
+        cx, cy = pkres.psfFitCenter
+        image, footprint = makeEagerTemplate(self.psf, self.fp, cx, cy, pkres.psfFitFlux)
+        self.assertEqual(pkres.templateImage.getBBox(), image.getBBox())
+        np.testing.assert_array_equal(pkres.templateImage.getArray(), image.getArray())
+        self.assertEqual(pkres.templateFootprint.spans, footprint.spans)
+
+    def testLazy(self):
+        psfCache = CachingPsf(self.psf)
+        plugin = DeblenderPlugin(fitPsfs, psfChisqCut1=1.5, psfChisqCut2=1.5, psfChisqCut2b=1.5,
+                                 psfCache=psfCache)
+        res = newDeblend([plugin], self.fp, self.mi, self.psf, self.psffwhm, avgNoise=1.0)
+        psfPeaks = [pkres for pkres in res.deblendedParents[0].peaks if pkres.deblendedAsPsf]
+        self.assertGreater(len(psfPeaks), 0)
+        nCached = len(psfCache.cache)
+        for pkres in psfPeaks:
+            self.assertTrue(pkres.hasLazyTemplate)
+            self.assertEagerTemplate(pkres)
+            self.assertFalse(pkres.hasLazyTemplate)
+            # The template is computed once, from the cached PSF image
+            self.assertIs(pkres.templateImage, pkres.templateImage)
+        self.assertEqual(len(psfCache.cache), nCached)
+
+    def testComputedOnce(self):
+        """Replacing the template does not compute the lazy one, and the
+        debug PSF template is computed once for both of its properties.
+        """
+        plugin = DeblenderPlugin(fitPsfs, psfChisqCut1=1.5, psfChisqCut2=1.5, psfChisqCut2b=1.5)
+        res = newDeblend([plugin], self.fp, self.mi, self.psf, self.psffwhm, avgNoise=1.0)
+        psfPeaks = [pkres for pkres in res.deblendedParents[0].peaks if pkres.deblendedAsPsf]
+        self.assertGreater(len(psfPeaks), 0)
+        for pkres in psfPeaks:
+            lazy = pkres._psfTemplate
+            calls = []
+            makeTemplate = lazy.makeTemplate
+
+            def countingMakeTemplate():
+                calls.append(1)
+                return makeTemplate()
+
+            lazy.makeTemplate = countingMakeTemplate
+            image, footprint = afwImage.ImageF(self.fp.getBBox()), afwDet.Footprint(self.fp)
+            pkres.setTemplate(image, footprint)
+            self.assertFalse(pkres.hasLazyTemplate)
+            self.assertIs(pkres.templateImage, image)
+            self.assertIs(pkres.templateFootprint, footprint)
+            self.assertEqual(len(calls), 0)
+            self.assertIs(pkres.psfTemplate, pkres.psfTemplate)
+            self.assertIsNotNone(pkres.psfFootprint)
+            self.assertEqual(len(calls), 1)
+
+    def testDeblend(self):
+        res = deblend(self.fp, self.mi, self.psf, self.psffwhm, sigma1=1.0)
+        psfPeaks = [pkres for pkres in res.deblendedParents[0].peaks if pkres.deblendedAsPsf]
+        self.assertGreater(len(psfPeaks), 0)
+        for pkres in psfPeaks:
+            self.assertFalse(pkres.hasLazyTemplate)
+            self.assertEagerTemplate(pkres)
+            psfTemplate = pkres.psfTemplate
+            np.testing.assert_array_equal(psfTemplate.getArray(), pkres.templateImage.getArray())
+            self.assertIsNotNone(pkres.getFluxPortion())
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
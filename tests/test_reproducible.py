@@ -0,0 +1,153 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.table as afwTable
+from lsst.meas.deblender import SourceDeblendTask, NativeDeblenderF, makeNativeControl
+
+from deblendTestUtils import makeBlendedExposure, makeSources
+
+
+class ReproducibleTestCase(lsst.utils.tests.TestCase):
+    """The parallel native deblender gives bit-for-bit the results of the
+    native deblender on one thread, whatever the number of threads.  It
+    matches the python path only to about 1e-5 (see
+    test_nativeBatch.testSameChildren).
+    """
+
+    def setUp(self):
+        # Groups of two to four blended point sources on a faint,
+        # extended background source
+        self.exposure = makeBlendedExposure(W=220, H=160, seed=3, start=(15, 12), step=(38, 33), margin=10,
+                                            offsets=[(0., 0.), (4.5, 3.), (-3., 5.), (6., -4.)],
+                                            groupSize=lambda n, m: 2 + (n + m) % 3,
+                                            fluxRange=(300., 3000.), background=3.)
+        self.schema = afwTable.SourceTable.makeMinimalSchema()
+        srcs = makeSources(self.exposure, self.schema)
+        self.footprints = [src.getFootprint() for src in srcs if len(src.getFootprint().getPeaks()) > 1]
+        self.assertGreater(len(self.footprints), 8)
+
+    def makeConfig(self, edgeHandling):
+        config = SourceDeblendTask.ConfigClass()
+        config.edgeHandling = edgeHandling
+        config.prescreenParents = True
+        return config
+
+    def assertSameResult(self, res, ref):
+        self.assertEqual(res.status, ref.status)
+        self.assertEqual(res.parentSpans, ref.parentSpans)
+        self.assertEqual(len(res.peaks), len(ref.peaks))
+        for peak, p0 in zip(res.peaks, ref.peaks):
+            self.assertEqual(peak.skip, p0.skip)
+            self.assertEqual(peak.deblendedAsPsf, p0.deblendedAsPsf)
+            self.assertEqual(peak.hasPsfFit, p0.hasPsfFit)
+            if peak.hasPsfFit:
+                # Exact comparisons: no tolerance is allowed
+                self.assertEqual(peak.psfFitFlux, p0.psfFitFlux)
+                self.assertEqual(peak.psfFitCenter, p0.psfFitCenter)
+            self.assertEqual(peak.heavy is None, p0.heavy is None)
+            if peak.heavy is not None:
+                self.assertEqual(peak.heavy.getSpans(), p0.heavy.getSpans())
+                np.testing.assert_array_equal(peak.heavy.getImageArray(), p0.heavy.getImageArray())
+                np.testing.assert_array_equal(peak.heavy.getMaskArray(), p0.heavy.getMaskArray())
+                np.testing.assert_array_equal(peak.heavy.getVarianceArray(),
+                                              p0.heavy.getVarianceArray())
+
+    def testDeblendMany(self):
+        mi = self.exposure.getMaskedImage()
+        psf = self.exposure.getPsf()
+        for edgeHandling in ("ramp", "noclip"):
+            config = self.makeConfig(edgeHandling)
+            deblender = NativeDeblenderF(makeNativeControl(config), mi, psf, 1.0)
+            serial = [deblender.deblend(fp) for fp in self.footprints]
+            for nThreads in (1, 2, 3, 8, 0):
+                results = deblender.deblendMany(self.footprints, nThreads)
+                for res, ref in zip(results, serial):
+                    self.assertSameResult(res, ref)
+            # The order the parents are given in does not matter either
+            order = np.random.RandomState(1).permutation(len(self.footprints))
+            results = deblender.deblendMany([self.footprints[k] for k in order], 4)
+            for k, res in zip(order, results):
+                self.assertSameResult(res, serial[k])
+
+    def testNumaPlacement(self):
+        """Binding the threads to NUMA nodes changes where the parents
+        are deblended, not the results; on a single node it does nothing.
+        """
+        mi = self.exposure.getMaskedImage()
+        psf = self.exposure.getPsf()
+        config = self.makeConfig("ramp")
+        serial = NativeDeblenderF(makeNativeControl(config), mi, psf, 1.0)
+        serial = [serial.deblend(fp) for fp in self.footprints]
+        config.numaPlacement = True
+        ctrl = makeNativeControl(config)
+        self.assertTrue(ctrl.numaPlacement)
+        deblender = NativeDeblenderF(ctrl, mi, psf, 1.0)
+        before = mi.getImage().getArray().copy()
+        for nThreads in (2, 5, 0):
+            results = deblender.deblendMany(self.footprints, nThreads)
+            for res, ref in zip(results, serial):
+                self.assertSameResult(res, ref)
+        # Moving the pages of the image leaves its pixels alone
+        np.testing.assert_array_equal(mi.getImage().getArray(), before)
+
+    def testTask(self):
+        catalogs = []
+        for nThreads in (1, 2, 5):
+            schema = afwTable.SourceTable.makeMinimalSchema()
+            config = self.makeConfig("ramp")
+            config.useNativeBatch = True
+            config.nativeBatchThreads = nThreads
+            task = SourceDeblendTask(schema, config=config)
+            srcs = makeSources(self.exposure, schema)
+            task.run(self.exposure.clone(), srcs)
+            catalogs.append(srcs)
+        ref = catalogs[0]
+        self.assertGreater(len(ref), len(self.footprints))
+        for srcs in catalogs[1:]:
+            self.assertEqual(len(srcs), len(ref))
+            for src, r in zip(srcs, ref):
+                self.assertEqual(src.getId(), r.getId())
+                self.assertEqual(src.getParent(), r.getParent())
+                for name in ("deblend_nChild", "deblend_deblendedAsPsf", "deblend_psf_instFlux"):
+                    a, b = src.get(name), r.get(name)
+                    self.assertTrue(a == b or (a != a and b != b), name)
+                if src.getParent() != 0:
+                    np.testing.assert_array_equal(src.getFootprint().getImageArray(),
+                                                  r.getFootprint().getImageArray())
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
@@ -0,0 +1,125 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.detection as afwDet
+import lsst.afw.geom as afwGeom
+import lsst.afw.image as afwImage
+import lsst.geom as geom
+from lsst.meas.deblender import BaselineUtilsF as bUtils
+
+
+class SmallBlendStrayFluxTestCase(lsst.utils.tests.TestCase):
+    """The stray flux of blends with two to four templates, which use
+    unrolled weighting loops, matches the 1/(1+r^2) rule computed here,
+    as for larger blends.
+    """
+
+    def setUp(self):
+        self.bbox = geom.Box2I(geom.Point2I(5, 8), geom.Extent2I(31, 23))
+        self.mi = afwImage.MaskedImageF(self.bbox)
+        rng = np.random.RandomState(7)
+        self.mi.getImage().getArray()[:, :] = rng.uniform(-0.2, 1.0, size=self.mi.getImage().getArray().shape)
+        self.mi.getVariance().set(1.0)
+        self.foot = afwDet.Footprint(afwGeom.SpanSet(self.bbox))
+        self.allPeaks = [(9, 12), (30, 27), (20, 10), (12, 26), (27, 17), (21, 20)]
+
+    def apportion(self, peaks, ispsf, options, clip):
+        templates = []
+        tfoots = []
+        for x, y in peaks:
+            tbox = geom.Box2I(geom.Point2I(x - 1, y - 1), geom.Extent2I(3, 3))
+            templ = afwImage.ImageF(tbox)
+            templ.set(1.0)
+            templates.append(templ)
+            tfoots.append(afwDet.Footprint(afwGeom.SpanSet(tbox)))
+        sumimg = afwImage.ImageF(self.bbox)
+        options |= bUtils.ASSIGN_STRAYFLUX
+        portions, strays = bUtils.apportionFlux(
+            self.mi, self.foot, templates, tfoots, sumimg, ispsf,
+            [x for x, _ in peaks], [y for _, y in peaks], options, clip)
+        images = []
+        for stray in strays:
+            img = afwImage.ImageF(self.bbox)
+            if stray is not None:
+                stray.insert(img)
+            images.append(img.getArray())
+        return np.array(images), sumimg.getArray()
+
+    def expected(self, peaks, ispsf, always, necessary, clip, tsum):
+        ys, xs = np.mgrid[self.bbox.getMinY():self.bbox.getMaxY() + 1,
+                          self.bbox.getMinX():self.bbox.getMaxX() + 1]
+        image = self.mi.getImage().getArray()
+        contrib = np.array([1.0/(1.0 + (x - xs)**2 + (y - ys)**2) for x, y in peaks])
+        ptsrc = np.array(ispsf, dtype=bool)
+        if not always and len(ispsf) > 0:
+            contrib[ptsrc] = 0.0
+            if necessary and np.all(ptsrc):
+                contrib = np.array([1.0/(1.0 + (x - xs)**2 + (y - ys)**2) for x, y in peaks])
+        contrib[contrib < clip*contrib.sum(axis=0)] = 0.0
+        csum = contrib.sum(axis=0)
+        stray = (tsum == 0) & (image > 0) & (csum > 0)
+        return np.where(stray, contrib/np.where(csum > 0, csum, 1.0)*image, 0.0)
+
+    def check(self, ispsfRule, options, clip):
+        always = bool(options & bUtils.STRAYFLUX_TO_POINT_SOURCES_ALWAYS)
+        necessary = bool(options & bUtils.STRAYFLUX_TO_POINT_SOURCES_WHEN_NECESSARY)
+        for n in range(2, len(self.allPeaks) + 1):
+            peaks = self.allPeaks[:n]
+            ispsf = ispsfRule(n)
+            with self.subTest(n=n, ispsf=ispsf, options=options, clip=clip):
+                strays, tsum = self.apportion(peaks, ispsf, options, clip)
+                expected = self.expected(peaks, ispsf, always, necessary, clip, tsum)
+                self.assertFloatsAlmostEqual(strays, expected, rtol=1e-5, atol=1e-6)
+
+    def testExtended(self):
+        self.check(lambda n: [False]*n, 0, 0.0)
+        self.check(lambda n: [], 0, 0.1)
+
+    def testPointSources(self):
+        def onePsf(n):
+            return [i == 1 for i in range(n)]
+
+        def allPsf(n):
+            return [True]*n
+
+        self.check(onePsf, 0, 0.05)
+        self.check(onePsf, bUtils.STRAYFLUX_TO_POINT_SOURCES_ALWAYS, 0.05)
+        self.check(allPsf, bUtils.STRAYFLUX_TO_POINT_SOURCES_WHEN_NECESSARY, 0.05)
+        self.check(allPsf, 0, 0.0)
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
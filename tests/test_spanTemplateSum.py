@@ -0,0 +1,150 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.detection as afwDet
+import lsst.afw.geom as afwGeom
+import lsst.afw.image as afwImage
+import lsst.geom as geom
+from lsst.meas.deblender import BaselineUtilsF as bUtils
+from lsst.meas.deblender.plugins import clipFootprintToNonzeroImpl
+
+
+class SpanTemplateSumTestCase(lsst.utils.tests.TestCase):
+    """Summing the templates over their footprints gives the apportioned
+    flux of summing them over their bounding boxes with the templates set
+    to zero outside their footprints.
+    """
+
+    def setUp(self):
+        rng = np.random.RandomState(5)
+        self.bbox = geom.Box2I(geom.Point2I(3, 7), geom.Extent2I(50, 40))
+        self.mi = afwImage.MaskedImageF(self.bbox)
+        self.mi.getImage().getArray()[:] = rng.uniform(-0.5, 10, size=(40, 50)).astype(np.float32)
+        self.mi.getVariance().set(1.0)
+        self.foot = afwDet.Footprint(afwGeom.SpanSet.fromShape(18, offset=(28, 27)).clippedTo(self.bbox))
+        self.templates = []
+        self.tfoots = []
+        self.pkx = []
+        self.pky = []
+        for x, y, r in [(20, 20, 8), (35, 30, 10), (28, 35, 6)]:
+            self.foot.addPeak(x, y, 1.0)
+            spans = afwGeom.SpanSet.fromShape(r, offset=(x, y)).clippedTo(self.bbox)
+            timg = afwImage.ImageF(spans.getBBox())
+            spans.setImage(timg, 1.0)
+            timg.getArray()[:] *= rng.uniform(0, 5, size=timg.getArray().shape).astype(np.float32)
+            self.templates.append(timg)
+            self.tfoots.append(afwDet.Footprint(spans))
+            self.pkx.append(x)
+            self.pky.append(y)
+
+    def apportion(self, options, templates=None):
+        sumimg = afwImage.ImageF(self.foot.getBBox())
+        options |= bUtils.ASSIGN_STRAYFLUX | bUtils.STRAYFLUX_TO_POINT_SOURCES_WHEN_NECESSARY
+        if templates is None:
+            templates = self.templates
+        portions, strays = bUtils.apportionFlux(self.mi, self.foot, templates, self.tfoots, sumimg,
+                                                [False]*len(templates), self.pkx, self.pky,
+                                                options, 0.001)
+        return sumimg, portions, strays
+
+    def assertSameResult(self, result0, result1):
+        sum0, portions0, strays0 = result0
+        sum1, portions1, strays1 = result1
+        np.testing.assert_array_equal(sum0.getArray(), sum1.getArray())
+        for p0, p1 in zip(portions0, portions1):
+            np.testing.assert_array_equal(p0.getImage().getArray(), p1.getImage().getArray())
+            np.testing.assert_array_equal(p0.getVariance().getArray(), p1.getVariance().getArray())
+        for s0, s1 in zip(strays0, strays1):
+            self.assertEqual(s0 is None, s1 is None)
+            if s0 is not None:
+                self.assertEqual(s0.getSpans(), s1.getSpans())
+                np.testing.assert_array_equal(s0.getImageArray(), s1.getImageArray())
+
+    def zeroedOutside(self):
+        """Return copies of the templates set to zero outside their
+        footprints.
+        """
+        zeroed = []
+        for timg, tfoot in zip(self.templates, self.tfoots):
+            inside = afwImage.ImageF(timg.getBBox())
+            tfoot.getSpans().copyImage(timg, inside)
+            zeroed.append(inside)
+        return zeroed
+
+    def testSameResult(self):
+        for rule in (0, bUtils.STRAYFLUX_NEAREST_FOOTPRINT, bUtils.STRAYFLUX_NEAREST_PEAK):
+            self.assertSameResult(self.apportion(rule), self.apportion(rule | bUtils.TEMPLATE_SUM_BY_SPANS))
+
+    def testMedianSmoothed(self):
+        """A median-smoothed template is positive outside its footprint
+        even after clipFootprintToNonzeroImpl: the result is then that of the
+        default with the templates zeroed outside their footprints, and
+        differs from that of the default with the templates as they are.
+        """
+        for timg, tfoot in zip(self.templates, self.tfoots):
+            smoothed = timg.Factory(timg, True)
+            bUtils.medianFilter(timg, smoothed, 2)
+            timg.getArray()[:] = smoothed.getArray()
+            clipFootprintToNonzeroImpl(tfoot, timg)
+        self.assertTrue(any((timg.getArray() > 0).sum() > tfoot.getArea()
+                            for timg, tfoot in zip(self.templates, self.tfoots)))
+        zeroed = self.zeroedOutside()
+        for rule in (0, bUtils.STRAYFLUX_NEAREST_FOOTPRINT, bUtils.STRAYFLUX_NEAREST_PEAK):
+            spans = self.apportion(rule | bUtils.TEMPLATE_SUM_BY_SPANS)
+            self.assertSameResult(self.apportion(rule, zeroed), spans)
+            default = self.apportion(rule)
+            self.assertFalse(np.array_equal(default[0].getArray(), spans[0].getArray()))
+
+    def testOutsideFootprint(self):
+        """Template flux outside the template footprint is not summed."""
+        timg = self.templates[0]
+        outside = np.ones(timg.getArray().shape, dtype=bool)
+        ys, xs = [], []
+        for span in self.tfoots[0].getSpans():
+            for x in range(span.getX0(), span.getX1() + 1):
+                ys.append(span.getY() - timg.getY0())
+                xs.append(x - timg.getX0())
+        outside[ys, xs] = False
+        self.assertTrue(outside.any())
+        timg.getArray()[outside] = 100.
+        sum1, _, _ = self.apportion(bUtils.TEMPLATE_SUM_BY_SPANS)
+        timg.getArray()[outside] = 0.
+        sum0, _, _ = self.apportion(0)
+        np.testing.assert_array_equal(sum0.getArray(), sum1.getArray())
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
@@ -0,0 +1,80 @@
+# This file is part of meas_deblender.
+#
+# Developed for the LSST Data Management System.
+# This product includes software developed by the LSST Project
+# (https://www.lsst.org).
+# See the COPYRIGHT file at the top-level directory of this distribution
+# for details of code ownership.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+import unittest
+
+import numpy as np
+
+import lsst.utils.tests
+import lsst.afw.detection as afwDet
+import lsst.afw.image as afwImage
+import lsst.geom as geom
+from lsst.meas.deblender import BaselineUtilsF as bUtils
+
+
+def makeTemplate(W, H, seed):
+    rng = np.random.RandomState(seed)
+    yy, xx = np.mgrid[0:H, 0:W]
+    array = 100.*np.exp(-((xx - 0.4*W)**2 + (yy - 0.6*H)**2)/(0.1*W*H)) + rng.normal(size=(H, W))
+    img = afwImage.ImageF(array.astype(np.float32))
+    img.setXY0(geom.Point2I(-7, 12))
+    return img
+
+
+class TiledTemplateTestCase(lsst.utils.tests.TestCase):
+    """The tiled kernels give the same result as the row-major ones,
+    for sizes that are and are not multiples of the tile size.
+    """
+
+    def testMedianFilter(self):
+        for W, H, h in [(37, 53, 2), (64, 32, 3), (5, 40, 2)]:
+            img = makeTemplate(W, H, 1)
+            ref = img.Factory(img, True)
+            out = img.Factory(img, True)
+            bUtils.medianFilter(img, ref, h)
+            bUtils.medianFilterTiled(img, out, h)
+            np.testing.assert_array_equal(out.getArray(), ref.getArray())
+
+    def testMakeMonotonic(self):
+        schema = afwDet.PeakTable.makeMinimalSchema()
+        table = afwDet.PeakTable.make(schema)
+        for W, H in [(37, 53), (64, 32), (17, 17)]:
+            img = makeTemplate(W, H, 2)
+            peak = table.makeRecord()
+            peak.setIx(img.getX0() + int(0.4*W))
+            peak.setIy(img.getY0() + int(0.6*H))
+            ref = img.Factory(img, True)
+            bUtils.makeMonotonic(ref, peak)
+            bUtils.makeMonotonicTiled(img, peak)
+            np.testing.assert_array_equal(img.getArray(), ref.getArray())
+
+
+class TestMemory(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()